@@ -0,0 +1,1025 @@
+#define _GNU_SOURCE
+#include "binproto.h"
+#include "commands.h"
+#include "kv.h"
+#include "linescan.h"
+#include "log.h"
+#include "metrics.h"
+#include "pubsub.h"
+#include "server_internal.h"
+#include "timecache.h"
+#include "timerwheel.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SCAN_MAX 256
+#define IOV_BATCH 64
+#define BENCH_MAX 128
+#define BENCH_REPEAT 5
+#define BENCH_OUT (1 << 17)
+#define TABLE_PROBES (1u << 16)
+
+struct bench_result {
+    char name[64];
+    double ns_per_op;
+    double ops_per_sec;
+    uint64_t ops;
+};
+
+typedef uint64_t (*bench_fn)(void *arg, uint64_t iters);
+
+static struct bench_result results[BENCH_MAX];
+static size_t results_count;
+static const char *filter;
+static double scale = 1.0;
+static FILE *report;
+static volatile uint64_t sink;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int bench_wanted(const char *name) {
+    return !filter || strstr(name, filter) != NULL;
+}
+
+static void bench_run(const char *name, bench_fn fn, void *arg, uint64_t iters) {
+    if (!bench_wanted(name) || results_count == BENCH_MAX) return;
+    iters = (uint64_t)((double)iters * scale);
+    if (iters == 0) iters = 1;
+    fn(arg, iters / 10 + 1);
+    double samples[BENCH_REPEAT];
+    uint64_t ops = 0;
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        double t0 = now_sec();
+        ops = fn(arg, iters);
+        samples[r] = (now_sec() - t0) * 1e9 / (double)ops;
+    }
+    qsort(samples, BENCH_REPEAT, sizeof(samples[0]), cmp_double);
+    struct bench_result *res = &results[results_count++];
+    snprintf(res->name, sizeof(res->name), "%s", name);
+    res->ns_per_op = samples[BENCH_REPEAT / 2];
+    res->ops_per_sec = 1e9 / res->ns_per_op;
+    res->ops = ops;
+    fprintf(report, "%-32s %10.2f ns/op %14.0f ops/s\n", res->name, res->ns_per_op, res->ops_per_sec);
+}
+
+static size_t build_input(char *buf, size_t cap, int line_len) {
+    size_t len = 0;
+    int i = 0;
+    while (len + (size_t)line_len + 1 <= cap) {
+        int n = snprintf(buf + len, cap - len, "%0*d", line_len, i++);
+        len += (size_t)n;
+        buf[len++] = '\n';
+    }
+    return len;
+}
+
+static size_t count_memchr(const char *data, size_t len) {
+    size_t lines = 0;
+    const char *p = data;
+    const char *end = data + len;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        if (!nl) break;
+        lines++;
+        p = nl + 1;
+    }
+    return lines;
+}
+
+static size_t count_scan(linescan_fn fn, const char *data, size_t len) {
+    uint32_t offs[SCAN_MAX];
+    size_t lines = 0;
+    size_t pos = 0;
+    while (pos < len) {
+        size_t n = fn(data + pos, len - pos, offs, SCAN_MAX);
+        if (n == 0) break;
+        lines += n;
+        pos += offs[n - 1] + 1;
+    }
+    return lines;
+}
+
+struct scan_arg {
+    linescan_fn fn;
+    const char *data;
+    size_t len;
+};
+
+static uint64_t bench_scan(void *arg, uint64_t iters) {
+    struct scan_arg *a = arg;
+    uint64_t lines = 0;
+    for (uint64_t i = 0; i < iters; i++) lines += a->fn ? count_scan(a->fn, a->data, a->len) : count_memchr(a->data, a->len);
+    return lines;
+}
+
+struct line_arg {
+    const char *line;
+    size_t len;
+};
+
+static uint64_t bench_process_line(void *arg, uint64_t iters) {
+    struct line_arg *a = arg;
+    static char out[BENCH_OUT];
+    struct server_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iters; i++) {
+        int shutdown_requested = 0;
+        total += (uint64_t)server_process_line(a->line, a->len, &stats, &shutdown_requested, out, sizeof(out));
+    }
+    sink += total;
+    return iters;
+}
+
+struct command_arg {
+    struct line_arg line;
+    struct server_command_ctx *ctx;
+};
+
+static uint64_t bench_command(void *arg, uint64_t iters) {
+    struct command_arg *a = arg;
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iters; i++) total += (uint64_t)commands_process(a->ctx, a->line.line, a->line.len);
+    sink += total;
+    return iters;
+}
+
+static const char *command_args(const char *name) {
+    static const struct {
+        const char *name;
+        const char *args;
+    } table[] = {
+        {"/set", " bench value"},
+        {"/setex", " bench 60000 value"},
+        {"/get", " bench"},
+        {"/del", " missing"},
+        {"/incr", " counter 1"},
+        {"/sub", " bench"},
+        {"/unsub", " other"},
+        {"/pub", " nobody hello"},
+    };
+    for (size_t i = 0; i < sizeof(table) / sizeof(table[0]); i++) {
+        if (strcmp(table[i].name, name) == 0) return table[i].args;
+    }
+    return "";
+}
+
+static uint64_t bench_trim(void *arg, uint64_t iters) {
+    struct line_arg *a = arg;
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iters; i++) {
+        __asm__ __volatile__("" : : : "memory");
+        const char *p = a->line;
+        size_t n = a->len;
+        trim_view(&p, &n);
+        total += n + (size_t)(p - a->line);
+    }
+    sink += total;
+    return iters;
+}
+
+static void *drain_thread(void *arg) {
+    int fd = *(int *)arg;
+    char buf[65536];
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) break;
+    }
+    return NULL;
+}
+
+static void send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("send");
+            exit(1);
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+static void per_line_send(int fd, const char *data, size_t len) {
+    const char *p = data;
+    const char *end = data + len;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        if (!nl) break;
+        send_all(fd, p, (size_t)(nl - p + 1));
+        p = nl + 1;
+    }
+}
+
+static void batched_send(int fd, const char *data, size_t len) {
+    uint32_t offs[SCAN_MAX];
+    struct iovec iov[IOV_BATCH];
+    size_t pos = 0;
+    while (pos < len) {
+        size_t n = linescan(data + pos, len - pos, offs, SCAN_MAX);
+        if (n == 0) break;
+        int cnt = 0;
+        size_t base = pos;
+        for (size_t i = 0; i < n; i++) {
+            size_t end = base + offs[i] + 1;
+            if (cnt > 0 && (char *)iov[cnt - 1].iov_base + iov[cnt - 1].iov_len == data + pos) {
+                iov[cnt - 1].iov_len += end - pos;
+            } else {
+                iov[cnt].iov_base = (void *)(data + pos);
+                iov[cnt].iov_len = end - pos;
+                cnt++;
+            }
+            pos = end;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t)cnt;
+        size_t want = pos - base;
+        ssize_t s = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (s == -1) {
+            perror("sendmsg");
+            exit(1);
+        }
+        if ((size_t)s < want) send_all(fd, data + base + s, want - (size_t)s);
+    }
+}
+
+struct send_arg {
+    void (*fn)(int, const char *, size_t);
+    int fd;
+    const char *data;
+    size_t len;
+    size_t lines;
+};
+
+static uint64_t bench_send(void *arg, uint64_t iters) {
+    struct send_arg *a = arg;
+    for (uint64_t i = 0; i < iters; i++) a->fn(a->fd, a->data, a->len);
+    return iters * a->lines;
+}
+
+static void run_send(const char *name, void (*fn)(int, const char *, size_t), const char *data, size_t len, uint64_t iters) {
+    if (!bench_wanted(name)) return;
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+        perror("socketpair");
+        exit(1);
+    }
+    pthread_t th;
+    pthread_create(&th, NULL, drain_thread, &sv[1]);
+    struct send_arg a = {fn, sv[0], data, len, count_memchr(data, len)};
+    bench_run(name, bench_send, &a, iters);
+    close(sv[0]);
+    pthread_join(th, NULL);
+    close(sv[1]);
+}
+
+struct time_arg {
+    size_t (*fn)(char *, size_t);
+};
+
+static uint64_t bench_time(void *arg, uint64_t iters) {
+    struct time_arg *a = arg;
+    char buf[32];
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iters; i++) total += a->fn(buf, sizeof(buf));
+    sink += total;
+    return iters;
+}
+
+struct frame_env {
+    struct server_shared sh;
+    struct server_state st;
+    struct client *c;
+    int sv[2];
+    pthread_t drain;
+};
+
+static int frame_env_open(struct frame_env *e) {
+    memset(e, 0, sizeof(*e));
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, e->sv) == -1) return -1;
+    e->sh.workers = &e->st;
+    e->sh.workers_count = 1;
+    e->st.shared = &e->sh;
+    e->st.epfd = e->st.wake_fd = e->st.tcp_listen_fd = e->st.udp_fd = -1;
+    e->st.client_buf_size = 4096;
+    e->st.max_line = 64 * 1024;
+    e->st.output_hwm = SIZE_MAX;
+    client_table_init(&e->st.clients);
+    bufpool_init(&e->st.bufs, e->st.client_buf_size, 16);
+    e->st.metrics = calloc(1, sizeof(*e->st.metrics));
+    if (pubsub_init(&e->sh, 0, SERVER_SLOW_DROP) == -1) return -1;
+    e->c = e->st.metrics ? add_client(&e->st, e->sv[0], 1) : NULL;
+    if (!e->c) return -1;
+    pthread_create(&e->drain, NULL, drain_thread, &e->sv[1]);
+    return 0;
+}
+
+static void frame_env_close(struct frame_env *e) {
+    close_client(&e->st, e->c);
+    pubsub_destroy(&e->sh);
+    pthread_join(e->drain, NULL);
+    close(e->sv[1]);
+    client_table_destroy(&e->st.clients);
+    bufpool_destroy(&e->st.bufs);
+    free(e->st.metrics);
+    free(e->st.reply);
+}
+
+struct frame_arg {
+    struct frame_env *env;
+    const char *data;
+    size_t len;
+    size_t chunk;
+    size_t lines;
+};
+
+static uint64_t bench_frame(void *arg, uint64_t iters) {
+    struct frame_arg *a = arg;
+    struct server_state *st = &a->env->st;
+    for (uint64_t i = 0; i < iters; i++) {
+        for (size_t off = 0; off < a->len; off += a->chunk) {
+            size_t n = a->len - off < a->chunk ? a->len - off : a->chunk;
+            if (client_input(st, a->env->c, a->data + off, n) == -1) {
+                fprintf(stderr, "client_input failed\n");
+                exit(1);
+            }
+        }
+    }
+    return iters * a->lines;
+}
+
+static void run_frame(struct frame_env *env, const char *name, const char *data, size_t len, size_t chunk, uint64_t iters) {
+    struct frame_arg a = {env, data, len, chunk, count_memchr(data, len)};
+    bench_run(name, bench_frame, &a, iters);
+}
+
+static size_t build_frames(char *out, size_t cap, const char *lines, size_t len, size_t *frames) {
+    size_t n = 0;
+    *frames = 0;
+    for (size_t pos = 0; pos < len;) {
+        const char *nl = memchr(lines + pos, '\n', len - pos);
+        size_t end = nl ? (size_t)(nl - lines) + 1 : len;
+        size_t plen = end - pos - 1;
+        uint16_t op = BIN_OP_ECHO;
+        if (plen == 6 && memcmp(lines + pos, "/stats", 6) == 0) op = BIN_OP_STATS;
+        if (plen == 5 && memcmp(lines + pos, "/time", 5) == 0) op = BIN_OP_TIME;
+        if (op != BIN_OP_ECHO) plen = 0;
+        if (n + BIN_HEADER_LEN + plen > cap) break;
+        struct bin_header h = {(uint32_t)plen, op, 0, (uint32_t)*frames};
+        bin_header_encode(out + n, &h);
+        memcpy(out + n + BIN_HEADER_LEN, lines + pos, plen);
+        n += BIN_HEADER_LEN + plen;
+        (*frames)++;
+        pos = end;
+    }
+    return n;
+}
+
+static void run_frame_binary(struct frame_env *env, const char *name, const char *lines, size_t len, uint64_t iters) {
+    static char frames[8192];
+    struct frame_arg a = {env, frames, 0, 0, 0};
+    a.len = build_frames(frames, sizeof(frames), lines, len, &a.lines);
+    a.chunk = a.len;
+    env->c->binary = 1;
+    bench_run(name, bench_frame, &a, iters);
+    env->c->binary = 0;
+}
+
+struct table_arg {
+    struct client_table t;
+    uint32_t probes[TABLE_PROBES];
+};
+
+static uint64_t bench_table(void *arg, uint64_t iters) {
+    struct table_arg *a = arg;
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iters; i++) {
+        struct client *c = client_table_get(&a->t, a->probes[i & (TABLE_PROBES - 1)]);
+        total += c->slot;
+    }
+    sink += total;
+    return iters;
+}
+
+static void run_table(uint32_t size, uint64_t iters) {
+    char name[64];
+    snprintf(name, sizeof(name), "client_table/get-%u", size);
+    if (!bench_wanted(name)) return;
+    struct table_arg *a = malloc(sizeof(*a));
+    if (!a) return;
+    client_table_init(&a->t);
+    for (uint32_t i = 0; i < size; i++) {
+        if (!client_table_alloc(&a->t)) {
+            fprintf(stderr, "client table alloc failed\n");
+            exit(1);
+        }
+    }
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    for (uint32_t i = 0; i < TABLE_PROBES; i++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        a->probes[i] = (uint32_t)(rng % size);
+    }
+    bench_run(name, bench_table, a, iters);
+    client_table_destroy(&a->t);
+    free(a);
+}
+
+struct wheel_arg {
+    struct timer_wheel w;
+    struct timer_node *nodes;
+    size_t count;
+    uint64_t now;
+};
+
+static void wheel_noop(struct timer_node *n, void *arg) {
+    (void)n;
+    (void)arg;
+}
+
+static uint64_t bench_wheel(void *arg, uint64_t iters) {
+    struct wheel_arg *a = arg;
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    for (uint64_t i = 0; i < iters; i++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        timer_arm(&a->w, &a->nodes[rng % a->count], a->now + 30000 + rng % 1000);
+        if ((i & 1023) == 0) timer_wheel_advance(&a->w, ++a->now, wheel_noop, NULL);
+    }
+    return iters;
+}
+
+struct kv_arg {
+    struct kv *kv;
+    char (*keys)[16];
+    uint8_t *lens;
+    uint32_t probes[TABLE_PROBES];
+    int op;
+};
+
+static uint64_t bench_kv(void *arg, uint64_t iters) {
+    struct kv_arg *a = arg;
+    char val[32];
+    size_t vlen;
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iters; i++) {
+        uint32_t k = a->probes[i & (TABLE_PROBES - 1)];
+        if (a->op == 0) {
+            if (kv_get(a->kv, a->keys[k], a->lens[k], 0, val, sizeof(val), &vlen) == KV_OK) total += vlen;
+        } else if (a->op == 1) {
+            total += (uint64_t)kv_set(a->kv, a->keys[k], a->lens[k], a->keys[k], a->lens[k], 0, 0);
+        } else {
+            int64_t v;
+            kv_incr(a->kv, a->keys[k], a->lens[k], 1, 0, &v);
+            total += (uint64_t)v;
+        }
+    }
+    sink += total;
+    return iters;
+}
+
+static void run_kv(uint32_t size, uint64_t iters) {
+    static const char *const ops[] = {"get", "set", "incr"};
+    char names[3][64];
+    int wanted = 0;
+    for (int op = 0; op < 3; op++) {
+        snprintf(names[op], sizeof(names[op]), "kv/%s-%u", ops[op], size);
+        wanted |= bench_wanted(names[op]);
+    }
+    if (!wanted) return;
+    struct kv_arg *a = malloc(sizeof(*a));
+    if (!a) return;
+    a->kv = kv_new();
+    a->keys = malloc((size_t)size * sizeof(*a->keys));
+    a->lens = malloc(size);
+    if (!a->kv || !a->keys || !a->lens) {
+        fprintf(stderr, "kv bench alloc failed\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        a->lens[i] = (uint8_t)snprintf(a->keys[i], sizeof(a->keys[i]), "key:%u", i);
+        if (kv_set(a->kv, a->keys[i], a->lens[i], "0", 1, 0, 0) != KV_OK) {
+            fprintf(stderr, "kv bench populate failed\n");
+            exit(1);
+        }
+    }
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    for (uint32_t i = 0; i < TABLE_PROBES; i++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        a->probes[i] = (uint32_t)(rng % size);
+    }
+    for (int op = 0; op < 3; op++) {
+        a->op = op;
+        bench_run(names[op], bench_kv, a, iters);
+    }
+    kv_free(a->kv);
+    free(a->keys);
+    free(a->lens);
+    free(a);
+}
+
+static void run_wheel(size_t count, uint64_t iters) {
+    char name[64];
+    snprintf(name, sizeof(name), "timer_wheel/rearm-%zu", count);
+    if (!bench_wanted(name)) return;
+    struct wheel_arg *a = calloc(1, sizeof(*a));
+    if (!a) return;
+    a->nodes = calloc(count, sizeof(*a->nodes));
+    if (!a->nodes) {
+        free(a);
+        return;
+    }
+    a->count = count;
+    timer_wheel_init(&a->w, 0);
+    for (size_t i = 0; i < count; i++) timer_arm(&a->w, &a->nodes[i], 30000 + i % 1000);
+    bench_run(name, bench_wheel, a, iters);
+    free(a->nodes);
+    free(a);
+}
+
+struct e2e_server {
+    struct server_config cfg;
+    pthread_t thread;
+    int rc;
+};
+
+struct e2e_arg {
+    int *fds;
+    int conns;
+    const char *req;
+    size_t req_len;
+    char *buf;
+    size_t lines;
+};
+
+static void *e2e_server_main(void *arg) {
+    struct e2e_server *s = arg;
+    s->rc = server_run(&s->cfg);
+    return NULL;
+}
+
+static int e2e_connect(int port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int attempt = 0; attempt < 200; attempt++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd == -1) return -1;
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) return fd;
+        close(fd);
+        struct timespec ts = {0, 10 * 1000 * 1000};
+        nanosleep(&ts, NULL);
+    }
+    return -1;
+}
+
+static void recv_exact(int fd, char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = recv(fd, buf, len, 0);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "e2e: connection lost\n");
+            exit(1);
+        }
+        len -= (size_t)n;
+    }
+}
+
+static uint64_t bench_e2e(void *arg, uint64_t iters) {
+    struct e2e_arg *a = arg;
+    for (uint64_t i = 0; i < iters; i++) {
+        for (int c = 0; c < a->conns; c++) send_all(a->fds[c], a->req, a->req_len);
+        for (int c = 0; c < a->conns; c++) recv_exact(a->fds[c], a->buf, a->req_len);
+    }
+    return iters * (uint64_t)a->conns * a->lines;
+}
+
+static void run_e2e(int backend, int conns, int pipeline, uint64_t iters) {
+    char name[64];
+    snprintf(name, sizeof(name), "e2e/%s-c%d-p%d", backend == SERVER_BACKEND_IO_URING ? "io_uring" : "epoll", conns, pipeline);
+    if (!bench_wanted(name) || !server_backend_available(backend)) return;
+    struct e2e_server s;
+    memset(&s, 0, sizeof(s));
+    s.cfg.port = 30000 + (int)(getpid() % 20000);
+    s.cfg.max_events = 64;
+    s.cfg.listen_backlog = 128;
+    s.cfg.max_clients = 1024;
+    s.cfg.client_buffer_size = 4096;
+    s.cfg.client_output_hwm = 256 * 1024;
+    s.cfg.max_line_length = 64 * 1024;
+    s.cfg.workers = 2;
+    s.cfg.backend = backend;
+    s.cfg.udp_batch = 32;
+    if (pthread_create(&s.thread, NULL, e2e_server_main, &s) != 0) return;
+    int fds[64];
+    struct e2e_arg a;
+    a.fds = fds;
+    a.conns = conns;
+    a.lines = (size_t)pipeline;
+    a.req_len = (size_t)pipeline * 16;
+    char *req = malloc(a.req_len);
+    a.buf = malloc(a.req_len);
+    if (!req || !a.buf) exit(1);
+    for (int i = 0; i < pipeline; i++) snprintf(req + (size_t)i * 16, 17, "%015d\n", i);
+    a.req = req;
+    for (int c = 0; c < conns; c++) {
+        fds[c] = e2e_connect(s.cfg.port);
+        if (fds[c] == -1) {
+            fprintf(stderr, "e2e: connect failed\n");
+            exit(1);
+        }
+    }
+    bench_run(name, bench_e2e, &a, iters);
+    send_all(fds[0], "/shutdown\n", 10);
+    recv_exact(fds[0], a.buf, 14);
+    for (int c = 0; c < conns; c++) close(fds[c]);
+    pthread_join(s.thread, NULL);
+    free(req);
+    free(a.buf);
+}
+
+static int rtt_socket(int family, int type, const char *path, int port) {
+    struct sockaddr_storage ss;
+    socklen_t len;
+    memset(&ss, 0, sizeof(ss));
+    if (family == AF_UNIX) {
+        struct sockaddr_un *un = (struct sockaddr_un *)&ss;
+        un->sun_family = AF_UNIX;
+        size_t n = strlen(path);
+        memcpy(un->sun_path, path, n);
+        if (path[0] == '@') un->sun_path[0] = '\0';
+        len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + n);
+    } else {
+        struct sockaddr_in *in = (struct sockaddr_in *)&ss;
+        in->sin_family = AF_INET;
+        in->sin_port = htons((uint16_t)port);
+        in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        len = sizeof(*in);
+    }
+    for (int attempt = 0; attempt < 200; attempt++) {
+        int fd = socket(family, type, 0);
+        if (fd == -1) return -1;
+        if (family == AF_UNIX && type == SOCK_DGRAM) {
+            sa_family_t af = AF_UNIX;
+            if (bind(fd, (struct sockaddr *)&af, sizeof(af)) == -1) {
+                close(fd);
+                return -1;
+            }
+        }
+        if (connect(fd, (struct sockaddr *)&ss, len) == 0) {
+            struct timeval tv = {5, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            return fd;
+        }
+        close(fd);
+        struct timespec ts = {0, 10 * 1000 * 1000};
+        nanosleep(&ts, NULL);
+    }
+    return -1;
+}
+
+static void run_rtt(int backend, uint64_t iters) {
+    const char *be = backend == SERVER_BACKEND_IO_URING ? "io_uring" : "epoll";
+    static const struct {
+        const char *name;
+        int family;
+        int type;
+    } transports[] = {
+        {"tcp", AF_INET, SOCK_STREAM},
+        {"unix", AF_UNIX, SOCK_STREAM},
+        {"udp", AF_INET, SOCK_DGRAM},
+        {"unix-dgram", AF_UNIX, SOCK_DGRAM},
+    };
+    size_t count = sizeof(transports) / sizeof(transports[0]);
+    char names[4][64];
+    int wanted = 0;
+    for (size_t i = 0; i < count; i++) {
+        snprintf(names[i], sizeof(names[i]), "rtt/%s-%s", be, transports[i].name);
+        wanted |= bench_wanted(names[i]);
+    }
+    if (!wanted || !server_backend_available(backend)) return;
+    char stream_path[64], dgram_path[64];
+    snprintf(stream_path, sizeof(stream_path), "@bench-%d-%d", (int)getpid(), backend);
+    snprintf(dgram_path, sizeof(dgram_path), "@bench-%d-%d-dgram", (int)getpid(), backend);
+    struct e2e_server s;
+    memset(&s, 0, sizeof(s));
+    s.cfg.port = 30000 + (int)(getpid() % 20000);
+    s.cfg.max_events = 64;
+    s.cfg.listen_backlog = 128;
+    s.cfg.max_clients = 1024;
+    s.cfg.client_buffer_size = 4096;
+    s.cfg.client_output_hwm = 256 * 1024;
+    s.cfg.max_line_length = 64 * 1024;
+    s.cfg.workers = 2;
+    s.cfg.backend = backend;
+    s.cfg.udp_batch = 32;
+    s.cfg.unix_path = stream_path;
+    s.cfg.unix_dgram_path = dgram_path;
+    if (pthread_create(&s.thread, NULL, e2e_server_main, &s) != 0) return;
+    char req[17], buf[16];
+    snprintf(req, sizeof(req), "%015d\n", 0);
+    int ctl = e2e_connect(s.cfg.port);
+    if (ctl == -1) {
+        fprintf(stderr, "rtt: connect failed\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!bench_wanted(names[i])) continue;
+        const char *path = transports[i].type == SOCK_STREAM ? stream_path : dgram_path;
+        int fd = rtt_socket(transports[i].family, transports[i].type, path, s.cfg.port);
+        if (fd == -1) {
+            fprintf(stderr, "rtt: %s connect failed\n", transports[i].name);
+            exit(1);
+        }
+        struct e2e_arg a = {&fd, 1, req, 16, buf, 1};
+        bench_run(names[i], bench_e2e, &a, iters);
+        close(fd);
+    }
+    send_all(ctl, "/shutdown\n", 10);
+    recv_exact(ctl, buf, 14);
+    close(ctl);
+    pthread_join(s.thread, NULL);
+}
+
+static void write_json(FILE *f, int line_len) {
+    fprintf(f, "{\n  \"impl\": \"%s\",\n  \"line_len\": %d,\n  \"repeat\": %d,\n  \"results\": [\n", linescan_impl_name(), line_len,
+            BENCH_REPEAT);
+    for (size_t i = 0; i < results_count; i++) {
+        const struct bench_result *r = &results[i];
+        fprintf(f, "    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"ops_per_sec\": %.1f, \"ops\": %llu}%s\n", r->name, r->ns_per_op,
+                r->ops_per_sec, (unsigned long long)r->ops, i + 1 < results_count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+static int compare_baseline(const char *path, double threshold) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "cannot read baseline %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    int regressions = 0;
+    char line[512];
+    fprintf(report, "\n%-32s %12s %12s %9s\n", "baseline comparison", "base ns/op", "ns/op", "change");
+    while (fgets(line, sizeof(line), f)) {
+        char name[64];
+        double base;
+        const char *p = strstr(line, "{\"name\": \"");
+        if (!p || sscanf(p, "{\"name\": \"%63[^\"]\", \"ns_per_op\": %lf", name, &base) != 2 || base <= 0) continue;
+        for (size_t i = 0; i < results_count; i++) {
+            if (strcmp(results[i].name, name) != 0) continue;
+            double change = (results[i].ns_per_op - base) / base * 100.0;
+            int slower = change > threshold;
+            regressions += slower;
+            fprintf(report, "%-32s %12.2f %12.2f %+8.1f%%%s\n", name, base, results[i].ns_per_op, change, slower ? "  REGRESSION" : "");
+        }
+    }
+    fclose(f);
+    return regressions;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--filter SUBSTR] [--json FILE|-] [--baseline FILE] [--threshold PCT]\n"
+                    "       [--scale F] [--line-len N]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    int line_len = 24;
+    const char *json = NULL;
+    const char *baseline = NULL;
+    double threshold = 10.0;
+    static const struct option opts[] = {
+        {"filter", required_argument, NULL, 'f'},
+        {"json", required_argument, NULL, 'j'},
+        {"baseline", required_argument, NULL, 'b'},
+        {"threshold", required_argument, NULL, 't'},
+        {"scale", required_argument, NULL, 's'},
+        {"line-len", required_argument, NULL, 'l'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "f:j:b:t:s:l:h", opts, NULL)) != -1) {
+        switch (opt) {
+        case 'f':
+            filter = optarg;
+            break;
+        case 'j':
+            json = optarg;
+            break;
+        case 'b':
+            baseline = optarg;
+            break;
+        case 't':
+            threshold = atof(optarg);
+            if (threshold < 0) {
+                fprintf(stderr, "invalid threshold: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 's':
+            scale = atof(optarg);
+            if (scale <= 0) {
+                fprintf(stderr, "invalid scale: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'l':
+            line_len = atoi(optarg);
+            if (line_len <= 0 || line_len > 4000) {
+                fprintf(stderr, "invalid line-len: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    report = json && strcmp(json, "-") == 0 ? stderr : stdout;
+    log_set_level(LOG_ERROR);
+    fprintf(report, "line_len=%d impl=%s\n", line_len, linescan_impl_name());
+
+    static char big[1 << 20];
+    size_t big_len = build_input(big, sizeof(big), line_len);
+    struct scan_arg scans[] = {
+        {NULL, big, big_len},
+        {linescan_scalar, big, big_len},
+        {linescan_sse2, big, big_len},
+        {linescan_avx2, big, big_len},
+    };
+    bench_run("scan/memchr", bench_scan, &scans[0], 200);
+    bench_run("scan/scalar", bench_scan, &scans[1], 200);
+    bench_run("scan/sse2", bench_scan, &scans[2], 200);
+    if (strcmp(linescan_impl_name(), "avx2") == 0) bench_run("scan/avx2", bench_scan, &scans[3], 200);
+
+    static char long_line[60 * 1024];
+    memset(long_line, 'x', sizeof(long_line) - 1);
+    long_line[sizeof(long_line) - 1] = '\n';
+    struct line_arg echo16 = {"0123456789abcdef\n", 17};
+    struct line_arg echo1k = {big, 1024};
+    struct line_arg echo_long = {long_line, sizeof(long_line)};
+    struct line_arg unknown = {"/nosuchcommand\n", 15};
+    bench_run("process_line/echo-16", bench_process_line, &echo16, 2000000);
+    bench_run("process_line/echo-1k", bench_process_line, &echo1k, 500000);
+    bench_run("process_line/echo-60k", bench_process_line, &echo_long, 20000);
+    bench_run("process_line/unknown", bench_process_line, &unknown, 2000000);
+
+    struct frame_env env;
+    if (frame_env_open(&env) == -1) {
+        fprintf(stderr, "failed to set up framing bench\n");
+        return 1;
+    }
+    static char cmd_out[BENCH_OUT];
+    struct server_stats cmd_stats;
+    memset(&cmd_stats, 0, sizeof(cmd_stats));
+    int cmd_shutdown = 0;
+    int cmd_binary = 0;
+    struct pubsub_peer cmd_peer = {&env.st, env.c, NULL, 0};
+    struct server_command_ctx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.stats = &cmd_stats;
+    ctx.shutdown_requested = &cmd_shutdown;
+    ctx.out = cmd_out;
+    ctx.out_cap = sizeof(cmd_out);
+    ctx.pubsub = pubsub_command;
+    ctx.pubsub_arg = &cmd_peer;
+    ctx.kv = kv_new();
+    ctx.binary = &cmd_binary;
+    ctx.admin = 1;
+    if (!ctx.kv) {
+        fprintf(stderr, "failed to set up command bench\n");
+        return 1;
+    }
+    for (int id = 0; id < COMMAND_MAX && command_name(id); id++) {
+        char name[64];
+        char cmd[64];
+        snprintf(name, sizeof(name), "process_line%s", command_name(id));
+        int n = snprintf(cmd, sizeof(cmd), "%s%s\n", command_name(id), command_args(command_name(id)));
+        struct command_arg a = {{cmd, (size_t)n}, &ctx};
+        bench_run(name, bench_command, &a, 500000);
+    }
+    kv_free(ctx.kv);
+
+    struct line_arg trim_clean = {"hello world", 11};
+    struct line_arg trim_padded = {"  \t hello world \t \r\n", 20};
+    bench_run("trim/clean", bench_trim, &trim_clean, 20000000);
+    bench_run("trim/padded", bench_trim, &trim_padded, 20000000);
+
+    static char rd[4096];
+    size_t rd_len = build_input(rd, sizeof(rd), line_len);
+    static char mixed[4096];
+    size_t mixed_len = 0;
+    for (int i = 0; mixed_len + 64 < sizeof(mixed); i++) {
+        mixed_len += (size_t)snprintf(mixed + mixed_len, sizeof(mixed) - mixed_len, "%s\n", i % 4 == 0 ? "/time" : "hello world");
+    }
+    static char longs[3 * 16385];
+    for (int i = 0; i < 3; i++) {
+        memset(longs + i * 16385, 'y', 16384);
+        longs[i * 16385 + 16384] = '\n';
+    }
+    run_frame(&env, "frame/echo", rd, rd_len, rd_len, 20000);
+    run_frame(&env, "frame/echo-split", rd, rd_len, 1000, 20000);
+    run_frame(&env, "frame/mixed", mixed, mixed_len, mixed_len, 20000);
+    run_frame(&env, "frame/long-16k", longs, sizeof(longs), 4096, 5000);
+    static char huge[60 * 1024];
+    memset(huge, 'z', sizeof(huge) - 1);
+    huge[sizeof(huge) - 1] = '\n';
+    run_frame(&env, "frame/long-60k-512", huge, sizeof(huge), 512, 500);
+    static char stats[4096];
+    size_t stats_len = 0;
+    while (stats_len + 7 <= 32 * 7) {
+        memcpy(stats + stats_len, "/stats\n", 7);
+        stats_len += 7;
+    }
+    run_frame(&env, "frame/stats", stats, stats_len, stats_len, 20000);
+    static char help[32 * 6];
+    for (int i = 0; i < 32; i++) memcpy(help + i * 6, "/help\n", 6);
+    run_frame(&env, "frame/help", help, sizeof(help), sizeof(help), 20000);
+    run_frame_binary(&env, "frame/binary-echo", rd, rd_len, 20000);
+    run_frame_binary(&env, "frame/binary-mixed", mixed, mixed_len, 20000);
+    run_frame_binary(&env, "frame/binary-stats", stats, stats_len, 20000);
+    frame_env_close(&env);
+
+    run_send("send/memchr+send", per_line_send, rd, rd_len, 2000);
+    run_send("send/scan+writev", batched_send, rd, rd_len, 20000);
+
+    run_table(1024, 20000000);
+    run_table(16384, 20000000);
+    run_table(262144, 20000000);
+
+    run_kv(16384, 10000000);
+    run_kv(1u << 20, 10000000);
+    run_kv(1u << 22, 10000000);
+
+    run_wheel(1000, 10000000);
+    run_wheel(100000, 10000000);
+
+    struct time_arg t_uncached = {timecache_format_uncached};
+    struct time_arg t_cached = {timecache_format};
+    bench_run("time/strftime", bench_time, &t_uncached, 200000);
+    bench_run("time/cached", bench_time, &t_cached, 20000000);
+
+    run_e2e(SERVER_BACKEND_EPOLL, 1, 1, 20000);
+    run_e2e(SERVER_BACKEND_EPOLL, 4, 32, 2000);
+    run_e2e(SERVER_BACKEND_IO_URING, 4, 32, 2000);
+
+    run_rtt(SERVER_BACKEND_EPOLL, 20000);
+    run_rtt(SERVER_BACKEND_IO_URING, 20000);
+
+    if (json) {
+        if (strcmp(json, "-") == 0) {
+            write_json(stdout, line_len);
+        } else {
+            FILE *f = fopen(json, "w");
+            if (!f) {
+                fprintf(stderr, "cannot write %s: %s\n", json, strerror(errno));
+                return 1;
+            }
+            write_json(f, line_len);
+            fclose(f);
+        }
+    }
+    if (baseline) {
+        int regressions = compare_baseline(baseline, threshold);
+        if (regressions < 0) return 1;
+        if (regressions > 0) {
+            fprintf(report, "%d benchmark(s) slower than baseline by more than %.1f%%\n", regressions, threshold);
+            return 3;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef BINPROTO_H
+#define BINPROTO_H
+
+#include <stdint.h>
+
+#define BIN_HEADER_LEN 12
+#define BIN_STATS_FIELDS 18
+
+enum bin_op {
+    BIN_OP_ECHO = 1,
+    BIN_OP_TIME = 2,
+    BIN_OP_STATS = 3,
+    BIN_OP_COMMAND = 4,
+    BIN_OP_MESSAGE = 5,
+};
+
+enum bin_status {
+    BIN_OK = 0,
+    BIN_EUNKNOWN = 1,
+    BIN_ETOOBIG = 2,
+    BIN_EFAIL = 3,
+};
+
+struct bin_header {
+    uint32_t len;
+    uint16_t op;
+    uint16_t status;
+    uint32_t id;
+};
+
+static inline void bin_put32(char *p, uint32_t v) {
+    unsigned char *u = (unsigned char *)p;
+    u[0] = (unsigned char)(v >> 24);
+    u[1] = (unsigned char)(v >> 16);
+    u[2] = (unsigned char)(v >> 8);
+    u[3] = (unsigned char)v;
+}
+
+static inline uint32_t bin_get32(const char *p) {
+    const unsigned char *u = (const unsigned char *)p;
+    return (uint32_t)u[0] << 24 | (uint32_t)u[1] << 16 | (uint32_t)u[2] << 8 | u[3];
+}
+
+static inline void bin_put64(char *p, uint64_t v) {
+    bin_put32(p, (uint32_t)(v >> 32));
+    bin_put32(p + 4, (uint32_t)v);
+}
+
+static inline uint64_t bin_get64(const char *p) {
+    return (uint64_t)bin_get32(p) << 32 | bin_get32(p + 4);
+}
+
+static inline void bin_header_encode(char *p, const struct bin_header *h) {
+    bin_put32(p, h->len);
+    bin_put32(p + 4, (uint32_t)h->op << 16 | h->status);
+    bin_put32(p + 8, h->id);
+}
+
+static inline void bin_header_decode(const char *p, struct bin_header *h) {
+    uint32_t w = bin_get32(p + 4);
+    h->len = bin_get32(p);
+    h->op = (uint16_t)(w >> 16);
+    h->status = (uint16_t)w;
+    h->id = bin_get32(p + 8);
+}
+
+#endif
@@ -0,0 +1,43 @@
+#include "bufpool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void bufpool_init(struct bufpool *p, size_t chunk_size, size_t max_free) {
+    memset(p, 0, sizeof(*p));
+    p->chunk_size = chunk_size < sizeof(void *) ? sizeof(void *) : chunk_size;
+    p->max_free = max_free;
+}
+
+void bufpool_destroy(struct bufpool *p) {
+    while (p->free_head) {
+        void *next;
+        memcpy(&next, p->free_head, sizeof(next));
+        free(p->free_head);
+        p->free_head = next;
+    }
+    p->free_count = 0;
+}
+
+char *bufpool_get(struct bufpool *p, int *hit) {
+    if (p->free_head) {
+        char *buf = p->free_head;
+        memcpy(&p->free_head, buf, sizeof(p->free_head));
+        p->free_count--;
+        *hit = 1;
+        return buf;
+    }
+    *hit = 0;
+    return malloc(p->chunk_size);
+}
+
+void bufpool_put(struct bufpool *p, char *buf, size_t cap) {
+    if (!buf) return;
+    if (cap != p->chunk_size || p->free_count >= p->max_free) {
+        free(buf);
+        return;
+    }
+    memcpy(buf, &p->free_head, sizeof(p->free_head));
+    p->free_head = buf;
+    p->free_count++;
+}
@@ -0,0 +1,18 @@
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stddef.h>
+
+struct bufpool {
+    size_t chunk_size;
+    size_t max_free;
+    size_t free_count;
+    void *free_head;
+};
+
+void bufpool_init(struct bufpool *p, size_t chunk_size, size_t max_free);
+void bufpool_destroy(struct bufpool *p);
+char *bufpool_get(struct bufpool *p, int *hit);
+void bufpool_put(struct bufpool *p, char *buf, size_t cap);
+
+#endif
@@ -0,0 +1,70 @@
+#include "client_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void client_table_init(struct client_table *t) {
+    memset(t, 0, sizeof(*t));
+    t->free_head = CLIENT_SLOT_NONE;
+    t->pending_head = CLIENT_SLOT_NONE;
+}
+
+void client_table_destroy(struct client_table *t) {
+    for (size_t i = 0; i < t->chunks_count; i++) free(t->chunks[i]);
+    free(t->chunks);
+    client_table_init(t);
+}
+
+static struct client *slot_ptr(const struct client_table *t, uint32_t slot) {
+    return &t->chunks[slot >> CLIENT_CHUNK_SHIFT][slot & (CLIENT_CHUNK_SIZE - 1)];
+}
+
+static int grow_chunk(struct client_table *t) {
+    if (t->slots > UINT32_MAX - CLIENT_CHUNK_SIZE) return -1;
+    if (t->chunks_count == t->chunks_cap) {
+        size_t new_cap = t->chunks_cap ? t->chunks_cap * 2 : 16;
+        struct client **nc = realloc(t->chunks, new_cap * sizeof(*nc));
+        if (!nc) return -1;
+        t->chunks = nc;
+        t->chunks_cap = new_cap;
+    }
+    struct client *chunk = calloc(CLIENT_CHUNK_SIZE, sizeof(struct client));
+    if (!chunk) return -1;
+    t->chunks[t->chunks_count++] = chunk;
+    return 0;
+}
+
+struct client *client_table_alloc(struct client_table *t) {
+    uint32_t slot;
+    if (t->free_head != CLIENT_SLOT_NONE) {
+        slot = t->free_head;
+        t->free_head = slot_ptr(t, slot)->next_free;
+    } else {
+        if ((t->slots & (CLIENT_CHUNK_SIZE - 1)) == 0 && grow_chunk(t) == -1) return NULL;
+        slot = t->slots++;
+    }
+    struct client *c = slot_ptr(t, slot);
+    memset(c, 0, sizeof(*c));
+    c->src.kind = EV_TCP_CLIENT;
+    c->src.fd = -1;
+    c->slot = slot;
+    c->next_free = CLIENT_SLOT_NONE;
+    t->live++;
+    return c;
+}
+
+void client_table_release(struct client_table *t, struct client *c) {
+    c->alive = 0;
+    c->next_free = t->pending_head;
+    t->pending_head = c->slot;
+    t->live--;
+}
+
+void client_table_reclaim(struct client_table *t) {
+    while (t->pending_head != CLIENT_SLOT_NONE) {
+        struct client *c = slot_ptr(t, t->pending_head);
+        t->pending_head = c->next_free;
+        c->next_free = t->free_head;
+        t->free_head = c->slot;
+    }
+}
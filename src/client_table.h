@@ -0,0 +1,95 @@
+#ifndef CLIENT_TABLE_H
+#define CLIENT_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "outq.h"
+#include "ratelimit.h"
+#include "timerwheel.h"
+
+#define CLIENT_CHUNK_SHIFT 10
+#define CLIENT_CHUNK_SIZE (1u << CLIENT_CHUNK_SHIFT)
+#define CLIENT_SLOT_NONE UINT32_MAX
+
+enum client_pause {
+    CLIENT_PAUSE_OUTPUT = 1,
+    CLIENT_PAUSE_RATE = 2,
+};
+
+enum ev_kind {
+    EV_WAKE,
+    EV_TCP_LISTEN,
+    EV_UDP,
+    EV_TCP_CLIENT,
+    EV_UNIX_LISTEN,
+    EV_UNIX_DGRAM,
+};
+
+struct ps_link;
+
+struct ev_source {
+    enum ev_kind kind;
+    int fd;
+};
+
+struct client {
+    struct ev_source src;
+    uint32_t slot;
+    uint32_t next_free;
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t scanned;
+    struct outq out;
+    struct timer_node timer;
+    uint64_t active_ms;
+    uint64_t line_since_ms;
+    uint64_t out_since_ms;
+    uint32_t events;
+    struct client *ready_next;
+    struct client **ready_pprev;
+    int paused;
+    int read_closed;
+    int discarding;
+    int binary;
+    size_t bin_skip;
+    int alive;
+    int local;
+    uint32_t uring_refs;
+    int recv_armed;
+    int recv_cancel;
+    int send_inflight;
+    int flush_queued;
+    struct client *flush_next;
+    struct ps_link *ps_links;
+    uint32_t ps_count;
+    uint32_t ps_cap;
+    struct rate_bucket rate_msgs;
+    struct rate_bucket rate_bytes;
+    uint64_t resume_ms;
+    uint8_t peer_key[RATE_IP_KEY];
+};
+
+struct client_table {
+    struct client **chunks;
+    size_t chunks_count;
+    size_t chunks_cap;
+    uint32_t slots;
+    uint32_t free_head;
+    uint32_t pending_head;
+    size_t live;
+};
+
+void client_table_init(struct client_table *t);
+void client_table_destroy(struct client_table *t);
+struct client *client_table_alloc(struct client_table *t);
+void client_table_release(struct client_table *t, struct client *c);
+void client_table_reclaim(struct client_table *t);
+
+static inline struct client *client_table_get(const struct client_table *t, uint32_t slot) {
+    if (slot >= t->slots) return NULL;
+    return &t->chunks[slot >> CLIENT_CHUNK_SHIFT][slot & (CLIENT_CHUNK_SIZE - 1)];
+}
+
+#endif
@@ -0,0 +1,497 @@
+#define _GNU_SOURCE
+#include "commands.h"
+#include "kv.h"
+#include "log.h"
+#include "timecache.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COMMAND_NAME_MAX 32
+#define COMMAND_SLOTS 128
+#define STATS_TEXT_MAX 1024
+
+struct command {
+    char name[COMMAND_NAME_MAX];
+    size_t name_len;
+    const char *help;
+    server_command_fn fn;
+};
+
+struct help_text {
+    size_t len;
+    char text[];
+};
+
+struct stats_cache {
+    uint64_t version;
+    int len;
+    int pinned;
+    char text[STATS_TEXT_MAX];
+};
+
+static struct command commands[COMMAND_MAX];
+static size_t commands_count;
+static int16_t slots[COMMAND_SLOTS];
+static pthread_once_t commands_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t commands_lock = PTHREAD_MUTEX_INITIALIZER;
+static int commands_running;
+static _Atomic(struct help_text *) help;
+static _Thread_local struct stats_cache stats_cache;
+
+static uint32_t name_hash(const char *name, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) h = (h ^ (uint8_t)name[i]) * 16777619u;
+    return h ^ (uint32_t)len;
+}
+
+static int reply_const(struct server_command_ctx *ctx, const char *s) {
+    ctx->reply = s;
+    return (int)strlen(s);
+}
+
+static int cmd_time(struct server_command_ctx *ctx) {
+    if (ctx->out_cap < 32) return -1;
+    size_t n = timecache_format(ctx->out, ctx->out_cap);
+    if (n == 0 || n + 2 > ctx->out_cap) return -1;
+    ctx->out[n] = '\n';
+    ctx->out[n + 1] = '\0';
+    return (int)(n + 1);
+}
+
+static int stats_render(const struct server_stats *s, char *out, size_t cap) {
+    int n = snprintf(out,
+                     cap,
+                     "total_tcp_clients=%" PRIu64 " current_tcp_clients=%" PRIu64 " total_udp_messages=%" PRIu64
+                     " client_pool_hits=%" PRIu64 " client_pool_misses=%" PRIu64 " buf_pool_hits=%" PRIu64
+                     " buf_pool_misses=%" PRIu64 " log_dropped=%" PRIu64 " client_timeouts=%" PRIu64
+                     " rejected_clients=%" PRIu64 " accept_pauses=%" PRIu64 " udp_drops=%" PRIu64
+                     " kv_keys=%" PRIu64 " kv_bytes=%" PRIu64 " total_unix_clients=%" PRIu64
+                     " current_unix_clients=%" PRIu64 " total_unix_messages=%" PRIu64 " udp_tx_drops=%" PRIu64 "\n",
+                     s->total_tcp_clients, s->current_tcp_clients, s->total_udp_messages, s->client_pool_hits,
+                     s->client_pool_misses, s->buf_pool_hits, s->buf_pool_misses, s->log_dropped,
+                     s->client_timeouts, s->rejected_clients, s->accept_pauses, s->udp_drops,
+                     s->kv_keys, s->kv_bytes, s->total_unix_clients, s->current_unix_clients,
+                     s->total_unix_messages, s->udp_tx_drops);
+    return n < 0 || (size_t)n >= cap ? -1 : n;
+}
+
+static int cmd_stats(struct server_command_ctx *ctx) {
+    struct server_stats fresh = *ctx->stats;
+    if (!ctx->stats_version) {
+        if (ctx->refresh) ctx->refresh(ctx->refresh_arg, &fresh);
+        return stats_render(&fresh, ctx->out, ctx->out_cap);
+    }
+    struct stats_cache *sc = &stats_cache;
+    uint64_t version = ctx->stats_version(ctx->refresh_arg);
+    if (sc->len == 0 || sc->version != version) {
+        if (ctx->refresh) ctx->refresh(ctx->refresh_arg, &fresh);
+        if (sc->pinned) return stats_render(&fresh, ctx->out, ctx->out_cap);
+        sc->len = stats_render(&fresh, sc->text, sizeof(sc->text));
+        if (sc->len < 0) {
+            sc->len = 0;
+            return -1;
+        }
+        sc->version = version;
+    }
+    sc->pinned = 1;
+    ctx->reply = sc->text;
+    return sc->len;
+}
+
+static int cmd_help(struct server_command_ctx *ctx) {
+    const struct help_text *h = atomic_load_explicit(&help, memory_order_acquire);
+    if (!h) return -1;
+    ctx->reply = h->text;
+    return (int)h->len;
+}
+
+static int cmd_shutdown(struct server_command_ctx *ctx) {
+    *ctx->shutdown_requested = 1;
+    return reply_const(ctx, "shutting down\n");
+}
+
+static int cmd_metrics(struct server_command_ctx *ctx) {
+    if (!ctx->metrics) return reply_const(ctx, "metrics unavailable\n");
+    int n = ctx->metrics(ctx->metrics_arg, ctx->out, ctx->out_cap);
+    if (n < 0) return reply_const(ctx, "metrics too large, use TCP or --metrics-port\n");
+    return n;
+}
+
+static int pubsub_call(struct server_command_ctx *ctx, int op) {
+    if (!ctx->pubsub) return reply_const(ctx, "pubsub unavailable\n");
+    const char *p = ctx->args.data;
+    size_t len = ctx->args.len;
+    size_t topic_len = 0;
+    while (topic_len < len && p[topic_len] != ' ' && p[topic_len] != '\t') topic_len++;
+    size_t msg = topic_len;
+    while (msg < len && (p[msg] == ' ' || p[msg] == '\t')) msg++;
+    if (op != SERVER_PUBSUB_PUB && msg < len) return reply_const(ctx, "invalid topic\n");
+    struct server_view topic = {p, topic_len};
+    struct server_view body = {p + msg, len - msg};
+    return ctx->pubsub(ctx->pubsub_arg, op, topic, body, ctx->out, ctx->out_cap);
+}
+
+static int cmd_sub(struct server_command_ctx *ctx) {
+    return pubsub_call(ctx, SERVER_PUBSUB_SUB);
+}
+
+static int cmd_unsub(struct server_command_ctx *ctx) {
+    return pubsub_call(ctx, SERVER_PUBSUB_UNSUB);
+}
+
+static int cmd_pub(struct server_command_ctx *ctx) {
+    return pubsub_call(ctx, SERVER_PUBSUB_PUB);
+}
+
+static size_t split_args(struct server_view args, struct server_view *tok, size_t max) {
+    const char *p = args.data;
+    size_t len = args.len, i = 0, n = 0;
+    while (i < len) {
+        while (i < len && (p[i] == ' ' || p[i] == '\t')) i++;
+        if (i == len) break;
+        size_t start = i;
+        while (i < len && p[i] != ' ' && p[i] != '\t') i++;
+        if (n == max) return max + 1;
+        tok[n].data = p + start;
+        tok[n].len = i - start;
+        n++;
+    }
+    return n;
+}
+
+static int parse_u64(struct server_view v, uint64_t *out) {
+    if (v.len == 0 || v.len > 19) return -1;
+    uint64_t r = 0;
+    for (size_t i = 0; i < v.len; i++) {
+        if (v.data[i] < '0' || v.data[i] > '9') return -1;
+        r = r * 10 + (uint64_t)(v.data[i] - '0');
+    }
+    *out = r;
+    return 0;
+}
+
+static int kv_reply(struct server_command_ctx *ctx, int rc) {
+    switch (rc) {
+    case KV_NOT_FOUND:
+        return reply_const(ctx, "not found\n");
+    case KV_NOT_INTEGER:
+        return reply_const(ctx, "not an integer\n");
+    case KV_OVERFLOW:
+        return reply_const(ctx, "overflow\n");
+    case KV_TOO_BIG:
+        return reply_const(ctx, "value too large\n");
+    default:
+        return reply_const(ctx, "out of memory\n");
+    }
+}
+
+static int kv_args(struct server_command_ctx *ctx, struct server_view *tok, size_t min, size_t max, size_t *count) {
+    if (!ctx->kv) return reply_const(ctx, "kv unavailable\n");
+    *count = split_args(ctx->args, tok, max);
+    if (*count < min || *count > max) return reply_const(ctx, "invalid arguments\n");
+    if (tok[0].len > KV_KEY_MAX) return reply_const(ctx, "invalid key\n");
+    return 0;
+}
+
+static struct server_view take_token(struct server_view *rest) {
+    const char *p = rest->data;
+    size_t len = rest->len, i = 0;
+    while (i < len && p[i] != ' ' && p[i] != '\t') i++;
+    struct server_view tok = {p, i};
+    while (i < len && (p[i] == ' ' || p[i] == '\t')) i++;
+    rest->data = p + i;
+    rest->len = len - i;
+    return tok;
+}
+
+static int kv_value_args(struct server_command_ctx *ctx, struct server_view *tok, size_t lead) {
+    if (!ctx->kv) return reply_const(ctx, "kv unavailable\n");
+    struct server_view rest = ctx->args;
+    for (size_t i = 0; i < lead; i++) {
+        tok[i] = take_token(&rest);
+        if (tok[i].len == 0 || rest.len == 0) return reply_const(ctx, "invalid arguments\n");
+    }
+    tok[lead] = rest;
+    if (tok[0].len > KV_KEY_MAX) return reply_const(ctx, "invalid key\n");
+    return 0;
+}
+
+static int kv_store(struct server_command_ctx *ctx, struct server_view key, struct server_view value, uint64_t ttl) {
+    int rc = kv_set(ctx->kv, key.data, key.len, value.data, value.len, ttl, ctx->now_ms);
+    if (rc != KV_OK) return kv_reply(ctx, rc);
+    return reply_const(ctx, "stored\n");
+}
+
+static int cmd_set(struct server_command_ctx *ctx) {
+    struct server_view tok[2];
+    int n = kv_value_args(ctx, tok, 1);
+    if (n != 0) return n;
+    return kv_store(ctx, tok[0], tok[1], 0);
+}
+
+static int cmd_setex(struct server_command_ctx *ctx) {
+    struct server_view tok[3];
+    int n = kv_value_args(ctx, tok, 2);
+    if (n != 0) return n;
+    uint64_t ttl;
+    if (parse_u64(tok[1], &ttl) == -1 || ttl == 0) return reply_const(ctx, "invalid ttl\n");
+    return kv_store(ctx, tok[0], tok[2], ttl);
+}
+
+static int cmd_get(struct server_command_ctx *ctx) {
+    struct server_view tok[1];
+    size_t count;
+    int n = kv_args(ctx, tok, 1, 1, &count);
+    if (n != 0) return n;
+    if (ctx->out_cap < 2) return -1;
+    size_t vlen;
+    int rc = kv_get(ctx->kv, tok[0].data, tok[0].len, ctx->now_ms, ctx->out, ctx->out_cap - 2, &vlen);
+    if (rc != KV_OK) return kv_reply(ctx, rc);
+    ctx->out[vlen] = '\n';
+    ctx->out[vlen + 1] = '\0';
+    return (int)(vlen + 1);
+}
+
+static int cmd_del(struct server_command_ctx *ctx) {
+    struct server_view tok[1];
+    size_t count;
+    int n = kv_args(ctx, tok, 1, 1, &count);
+    if (n != 0) return n;
+    int rc = kv_del(ctx->kv, tok[0].data, tok[0].len, ctx->now_ms);
+    if (rc != KV_OK) return kv_reply(ctx, rc);
+    return reply_const(ctx, "deleted\n");
+}
+
+static int cmd_incr(struct server_command_ctx *ctx) {
+    struct server_view tok[2];
+    size_t count;
+    int n = kv_args(ctx, tok, 1, 2, &count);
+    if (n != 0) return n;
+    int64_t delta = 1;
+    if (count == 2) {
+        struct server_view d = tok[1];
+        int neg = d.len > 0 && d.data[0] == '-';
+        uint64_t mag;
+        if (neg) {
+            d.data++;
+            d.len--;
+        }
+        if (parse_u64(d, &mag) == -1 || mag > (uint64_t)INT64_MAX) return reply_const(ctx, "not an integer\n");
+        delta = neg ? -(int64_t)mag : (int64_t)mag;
+    }
+    int64_t v;
+    int rc = kv_incr(ctx->kv, tok[0].data, tok[0].len, delta, ctx->now_ms, &v);
+    if (rc != KV_OK) return kv_reply(ctx, rc);
+    n = snprintf(ctx->out, ctx->out_cap, "%" PRId64 "\n", v);
+    if (n < 0 || (size_t)n >= ctx->out_cap) return -1;
+    return n;
+}
+
+static int cmd_binary(struct server_command_ctx *ctx) {
+    if (!ctx->binary) return reply_const(ctx, "binary unavailable\n");
+    if (ctx->args.len > 0) return reply_const(ctx, "invalid arguments\n");
+    *ctx->binary = 1;
+    return reply_const(ctx, "binary\n");
+}
+
+static int cmd_loglevel(struct server_command_ctx *ctx) {
+    if (ctx->args.len > 0) {
+        char name[16];
+        int l;
+        if (!ctx->admin) return reply_const(ctx, "not permitted\n");
+        if (ctx->args.len >= sizeof(name)) return reply_const(ctx, "invalid log level\n");
+        memcpy(name, ctx->args.data, ctx->args.len);
+        name[ctx->args.len] = '\0';
+        if (log_level_parse(name, &l) == -1) return reply_const(ctx, "invalid log level\n");
+        log_set_level(l);
+    }
+    int n = snprintf(ctx->out, ctx->out_cap, "loglevel=%s\n", log_level_name(log_get_level()));
+    if (n < 0 || (size_t)n >= ctx->out_cap) return -1;
+    return n;
+}
+
+static void help_build(void) {
+    static const char title[] = "Available commands:\n";
+    size_t cap = sizeof(title);
+    for (size_t i = 0; i < commands_count; i++) {
+        cap += commands[i].name_len + 1;
+        if (commands[i].help) cap += strlen(commands[i].help) + 3;
+    }
+    struct help_text *h = malloc(sizeof(*h) + cap);
+    if (!h) return;
+    memcpy(h->text, title, sizeof(title));
+    size_t len = sizeof(title) - 1;
+    for (size_t i = 0; i < commands_count; i++) {
+        const struct command *c = &commands[i];
+        if (c->help) {
+            len += (size_t)snprintf(h->text + len, cap - len, "%s - %s\n", c->name, c->help);
+        } else {
+            len += (size_t)snprintf(h->text + len, cap - len, "%s\n", c->name);
+        }
+    }
+    h->len = len;
+    free(atomic_exchange_explicit(&help, h, memory_order_acq_rel));
+}
+
+static int add_command(const char *name, const char *help, server_command_fn fn) {
+    size_t len = name ? strlen(name) : 0;
+    if (len < 2 || len >= COMMAND_NAME_MAX || name[0] != '/' || !fn) return -1;
+    if (strpbrk(name, " \t\r\n")) return -1;
+    if (commands_count == COMMAND_MAX) return -1;
+    uint32_t h = name_hash(name, len);
+    for (uint32_t i = 0; i < COMMAND_SLOTS; i++) {
+        int16_t *slot = &slots[(h + i) & (COMMAND_SLOTS - 1)];
+        if (*slot >= 0) {
+            const struct command *c = &commands[*slot];
+            if (c->name_len == len && memcmp(c->name, name, len) == 0) return -1;
+            continue;
+        }
+        struct command *c = &commands[commands_count];
+        memcpy(c->name, name, len + 1);
+        c->name_len = len;
+        c->help = help;
+        c->fn = fn;
+        *slot = (int16_t)commands_count++;
+        return 0;
+    }
+    return -1;
+}
+
+static void commands_init(void) {
+    memset(slots, 0xff, sizeof(slots));
+    add_command("/time", "current server time", cmd_time);
+    add_command("/stats", "server counters", cmd_stats);
+    add_command("/shutdown", "stop the server", cmd_shutdown);
+    add_command("/metrics", "latency histograms and counters (Prometheus text)", cmd_metrics);
+    add_command("/loglevel", "show or set log level (debug|info|error)", cmd_loglevel);
+    add_command("/sub", "subscribe to a topic", cmd_sub);
+    add_command("/unsub", "unsubscribe from a topic", cmd_unsub);
+    add_command("/pub", "publish a message to a topic", cmd_pub);
+    add_command("/set", "store a value: /set key value", cmd_set);
+    add_command("/setex", "store a value with a ttl: /setex key ttl_ms value", cmd_setex);
+    add_command("/get", "read a value", cmd_get);
+    add_command("/del", "delete a key", cmd_del);
+    add_command("/incr", "add to an integer value: /incr key [delta]", cmd_incr);
+    add_command("/binary", "switch this connection to the binary protocol", cmd_binary);
+    add_command("/help", "this list", cmd_help);
+    help_build();
+}
+
+int server_register_command(const char *name, const char *help, server_command_fn fn) {
+    pthread_once(&commands_once, commands_init);
+    pthread_mutex_lock(&commands_lock);
+    int rc = commands_running ? -1 : add_command(name, help, fn);
+    if (rc == 0) help_build();
+    pthread_mutex_unlock(&commands_lock);
+    return rc;
+}
+
+void commands_hold(void) {
+    pthread_once(&commands_once, commands_init);
+    pthread_mutex_lock(&commands_lock);
+    commands_running++;
+    pthread_mutex_unlock(&commands_lock);
+}
+
+void commands_flushed(void) {
+    stats_cache.pinned = 0;
+}
+
+void commands_release(void) {
+    pthread_mutex_lock(&commands_lock);
+    commands_running--;
+    pthread_mutex_unlock(&commands_lock);
+}
+
+static const struct command *find_command(const char *name, size_t len) {
+    uint32_t h = name_hash(name, len);
+    for (uint32_t i = 0; i < COMMAND_SLOTS; i++) {
+        int16_t idx = slots[(h + i) & (COMMAND_SLOTS - 1)];
+        if (idx < 0) return NULL;
+        const struct command *c = &commands[idx];
+        if (c->name_len == len && memcmp(c->name, name, len) == 0) return c;
+    }
+    return NULL;
+}
+
+const char *command_name(int id) {
+    if (id == COMMAND_ID_ECHO) return "echo";
+    if (id == COMMAND_ID_UNKNOWN) return "unknown";
+    if (id < 0 || (size_t)id >= commands_count) return NULL;
+    return commands[id].name;
+}
+
+int command_lookup(const char *name, size_t len) {
+    pthread_once(&commands_once, commands_init);
+    const struct command *c = find_command(name, len);
+    return c ? (int)(c - commands) : COMMAND_ID_UNKNOWN;
+}
+
+int commands_dispatch(const char *line, size_t len, struct server_command_ctx *ctx, int *cmd_id) {
+    *cmd_id = COMMAND_ID_NONE;
+    ctx->reply = ctx->out;
+    char *out = ctx->out;
+    size_t out_cap = ctx->out_cap;
+    if (!line || !ctx->stats || !ctx->shutdown_requested || !out || out_cap == 0) return -1;
+    if (len == 0) return 0;
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' ' || line[len - 1] == '\t')) len--;
+    size_t start = 0;
+    while (start < len && (line[start] == ' ' || line[start] == '\t')) start++;
+    if (start >= len) return 0;
+    const char *p = line + start;
+    size_t plen = len - start;
+    if (p[0] != '/') {
+        *cmd_id = COMMAND_ID_ECHO;
+        if (plen + 2 > out_cap) return -1;
+        memcpy(out, p, plen);
+        out[plen] = '\n';
+        out[plen + 1] = '\0';
+        return (int)(plen + 1);
+    }
+    size_t name_len = 0;
+    while (name_len < plen && p[name_len] != ' ' && p[name_len] != '\t') name_len++;
+    pthread_once(&commands_once, commands_init);
+    const struct command *c = find_command(p, name_len);
+    if (!c) {
+        *cmd_id = COMMAND_ID_UNKNOWN;
+        ctx->reply = "unknown command\n";
+        return (int)strlen(ctx->reply);
+    }
+    *cmd_id = (int)(c - commands);
+    size_t arg = name_len;
+    while (arg < plen && (p[arg] == ' ' || p[arg] == '\t')) arg++;
+    ctx->args.data = p + arg;
+    ctx->args.len = plen - arg;
+    return c->fn(ctx);
+}
+
+int commands_process(struct server_command_ctx *ctx, const char *line, size_t len) {
+    int cmd_id;
+    int n = commands_dispatch(line, len, ctx, &cmd_id);
+    if (n <= 0 || ctx->reply == ctx->out) return n;
+    if ((size_t)n + 1 > ctx->out_cap) return -1;
+    memcpy(ctx->out, ctx->reply, (size_t)n);
+    ctx->out[n] = '\0';
+    return n;
+}
+
+int server_process_line(const char *line,
+                        size_t len,
+                        const struct server_stats *stats,
+                        int *shutdown_requested,
+                        char *out,
+                        size_t out_cap) {
+    struct server_command_ctx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.stats = stats;
+    ctx.shutdown_requested = shutdown_requested;
+    ctx.out = out;
+    ctx.out_cap = out_cap;
+    ctx.admin = 1;
+    return commands_process(&ctx, line, len);
+}
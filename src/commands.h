@@ -0,0 +1,25 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <stddef.h>
+
+#include "server.h"
+
+#define COMMAND_MAX 64
+
+enum {
+    COMMAND_ID_ECHO = COMMAND_MAX,
+    COMMAND_ID_UNKNOWN,
+    COMMAND_ID_NONE,
+    COMMAND_ID_COUNT = COMMAND_ID_NONE,
+};
+
+int commands_dispatch(const char *line, size_t len, struct server_command_ctx *ctx, int *cmd_id);
+int commands_process(struct server_command_ctx *ctx, const char *line, size_t len);
+const char *command_name(int id);
+int command_lookup(const char *name, size_t len);
+void commands_hold(void);
+void commands_release(void);
+void commands_flushed(void);
+
+#endif
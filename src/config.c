@@ -0,0 +1,428 @@
+#define _GNU_SOURCE
+#include "config.h"
+#include "log.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    OPT_RCVBUF = 256,
+    OPT_SNDBUF,
+    OPT_UDP_RCVBUF,
+    OPT_UDP_SNDBUF,
+    OPT_NODELAY,
+    OPT_QUICKACK,
+    OPT_BUSY_POLL,
+    OPT_INCOMING_CPU,
+    OPT_TOS,
+    OPT_UPGRADE_SOCKET,
+    OPT_DRAIN_TIMEOUT,
+    OPT_FANOUT_SLICE,
+    OPT_SLOW_SUBSCRIBER,
+    OPT_RATE_MSGS,
+    OPT_RATE_BYTES,
+    OPT_RATE_IP_MSGS,
+    OPT_RATE_IP_BYTES,
+    OPT_RATE_IP_TABLE,
+    OPT_UNIX,
+    OPT_UNIX_DGRAM,
+    OPT_ADMIN_COMMANDS,
+    OPT_METRICS_BIND,
+};
+
+static const char short_opts[] = "w:po:l:b:u:gL:m:I:R:W:eB:c:a:D:F:P:C:h";
+
+static const struct option opts[] = {
+    {"port", required_argument, NULL, 'P'},
+    {"workers", required_argument, NULL, 'w'},
+    {"pin-cpus", no_argument, NULL, 'p'},
+    {"output-hwm", required_argument, NULL, 'o'},
+    {"max-line", required_argument, NULL, 'l'},
+    {"backend", required_argument, NULL, 'b'},
+    {"udp-batch", required_argument, NULL, 'u'},
+    {"udp-gso", no_argument, NULL, 'g'},
+    {"log-level", required_argument, NULL, 'L'},
+    {"metrics-port", required_argument, NULL, 'm'},
+    {"metrics-bind", required_argument, NULL, OPT_METRICS_BIND},
+    {"idle-timeout", required_argument, NULL, 'I'},
+    {"read-timeout", required_argument, NULL, 'R'},
+    {"write-timeout", required_argument, NULL, 'W'},
+    {"edge-triggered", no_argument, NULL, 'e'},
+    {"read-budget", required_argument, NULL, 'B'},
+    {"max-clients", required_argument, NULL, 'c'},
+    {"accept-batch", required_argument, NULL, 'a'},
+    {"defer-accept", required_argument, NULL, 'D'},
+    {"fastopen", required_argument, NULL, 'F'},
+    {"rcvbuf", required_argument, NULL, OPT_RCVBUF},
+    {"sndbuf", required_argument, NULL, OPT_SNDBUF},
+    {"udp-rcvbuf", required_argument, NULL, OPT_UDP_RCVBUF},
+    {"udp-sndbuf", required_argument, NULL, OPT_UDP_SNDBUF},
+    {"nodelay", no_argument, NULL, OPT_NODELAY},
+    {"quickack", no_argument, NULL, OPT_QUICKACK},
+    {"busy-poll", required_argument, NULL, OPT_BUSY_POLL},
+    {"incoming-cpu", no_argument, NULL, OPT_INCOMING_CPU},
+    {"tos", required_argument, NULL, OPT_TOS},
+    {"upgrade-socket", required_argument, NULL, OPT_UPGRADE_SOCKET},
+    {"drain-timeout", required_argument, NULL, OPT_DRAIN_TIMEOUT},
+    {"fanout-slice", required_argument, NULL, OPT_FANOUT_SLICE},
+    {"slow-subscriber", required_argument, NULL, OPT_SLOW_SUBSCRIBER},
+    {"rate-msgs", required_argument, NULL, OPT_RATE_MSGS},
+    {"rate-bytes", required_argument, NULL, OPT_RATE_BYTES},
+    {"rate-ip-msgs", required_argument, NULL, OPT_RATE_IP_MSGS},
+    {"rate-ip-bytes", required_argument, NULL, OPT_RATE_IP_BYTES},
+    {"rate-ip-table", required_argument, NULL, OPT_RATE_IP_TABLE},
+    {"unix", required_argument, NULL, OPT_UNIX},
+    {"unix-dgram", required_argument, NULL, OPT_UNIX_DGRAM},
+    {"admin-commands", no_argument, NULL, OPT_ADMIN_COMMANDS},
+    {"config", required_argument, NULL, 'C'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0},
+};
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--config FILE] [--workers N] [--pin-cpus] [--output-hwm BYTES] [--max-line BYTES]\n"
+                    "       [--backend epoll|io_uring] [--udp-batch N] [--udp-gso]\n"
+                    "       [--log-level debug|info|error] [--metrics-port PORT] [--metrics-bind ADDR]\n"
+                    "       [--idle-timeout MS] [--read-timeout MS] [--write-timeout MS]\n"
+                    "       [--edge-triggered] [--read-budget BYTES] [--max-clients N]\n"
+                    "       [--accept-batch N] [--defer-accept SEC] [--fastopen QLEN]\n"
+                    "       [--rcvbuf BYTES] [--sndbuf BYTES] [--udp-rcvbuf BYTES] [--udp-sndbuf BYTES]\n"
+                    "       [--nodelay] [--quickack] [--busy-poll USEC] [--incoming-cpu] [--tos N]\n"
+                    "       [--upgrade-socket PATH] [--drain-timeout MS]\n"
+                    "       [--fanout-slice N] [--slow-subscriber drop|disconnect]\n"
+                    "       [--rate-msgs N] [--rate-bytes N] [--rate-ip-msgs N] [--rate-ip-bytes N] [--rate-ip-table N]\n"
+                    "       [--unix PATH] [--unix-dgram PATH] [--admin-commands]\n"
+                    "       [--port PORT] [port]\n", prog);
+}
+
+static int parse_num(const char *name, const char *s, long min, long max, long *out) {
+    char *end;
+    errno = 0;
+    long v = strtol(s, &end, 0);
+    if (errno != 0 || end == s || *end != '\0' || v < min || v > max) {
+        fprintf(stderr, "invalid %s: %s\n", name, s);
+        return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+int config_parse_args(int argc, char **argv, struct server_config *cfg) {
+    int opt;
+    long v;
+    optind = 0;
+    while ((opt = getopt_long(argc, argv, short_opts, opts, NULL)) != -1) {
+        switch (opt) {
+        case 'P':
+            if (parse_num("port", optarg, 1, 65535, &v) == -1) return -1;
+            cfg->port = (int)v;
+            break;
+        case 'w':
+            if (parse_num("workers", optarg, 1, 1024, &v) == -1) return -1;
+            cfg->workers = (int)v;
+            break;
+        case 'p':
+            cfg->pin_cpus = 1;
+            break;
+        case 'o':
+            if (parse_num("output-hwm", optarg, 1, 1L << 40, &v) == -1) return -1;
+            cfg->client_output_hwm = (size_t)v;
+            break;
+        case 'l':
+            if (parse_num("max-line", optarg, 1, 1L << 30, &v) == -1) return -1;
+            cfg->max_line_length = (size_t)v;
+            break;
+        case 'b':
+            if (strcmp(optarg, "epoll") == 0) {
+                cfg->backend = SERVER_BACKEND_EPOLL;
+            } else if (strcmp(optarg, "io_uring") == 0) {
+                cfg->backend = SERVER_BACKEND_IO_URING;
+            } else {
+                fprintf(stderr, "invalid backend: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'u':
+            if (parse_num("udp-batch", optarg, 1, 1024, &v) == -1) return -1;
+            cfg->udp_batch = (int)v;
+            break;
+        case 'g':
+            cfg->udp_gso = 1;
+            break;
+        case 'L': {
+            int level;
+            if (log_level_parse(optarg, &level) == -1) {
+                fprintf(stderr, "invalid log-level: %s\n", optarg);
+                return -1;
+            }
+            log_set_level(level);
+            break;
+        }
+        case 'm':
+            if (parse_num("metrics-port", optarg, 1, 65535, &v) == -1) return -1;
+            cfg->metrics_port = (int)v;
+            break;
+        case 'I':
+            if (parse_num("idle-timeout", optarg, 0, 86400000, &v) == -1) return -1;
+            cfg->idle_timeout_ms = (unsigned)v;
+            break;
+        case 'R':
+            if (parse_num("read-timeout", optarg, 0, 86400000, &v) == -1) return -1;
+            cfg->read_timeout_ms = (unsigned)v;
+            break;
+        case 'W':
+            if (parse_num("write-timeout", optarg, 0, 86400000, &v) == -1) return -1;
+            cfg->write_timeout_ms = (unsigned)v;
+            break;
+        case 'e':
+            cfg->edge_triggered = 1;
+            break;
+        case 'B':
+            if (parse_num("read-budget", optarg, 0, 1L << 30, &v) == -1) return -1;
+            cfg->read_budget = (size_t)v;
+            break;
+        case 'c':
+            if (parse_num("max-clients", optarg, 0, 1 << 24, &v) == -1) return -1;
+            cfg->max_clients = (int)v;
+            break;
+        case 'a':
+            if (parse_num("accept-batch", optarg, 0, 1 << 20, &v) == -1) return -1;
+            cfg->accept_batch = (int)v;
+            break;
+        case 'D':
+            if (parse_num("defer-accept", optarg, 0, 3600, &v) == -1) return -1;
+            cfg->defer_accept_s = (int)v;
+            break;
+        case 'F':
+            if (parse_num("fastopen", optarg, 0, 65535, &v) == -1) return -1;
+            cfg->fastopen_qlen = (int)v;
+            break;
+        case OPT_RCVBUF:
+            if (parse_num("rcvbuf", optarg, 0, 1 << 30, &v) == -1) return -1;
+            cfg->sock.rcvbuf = (int)v;
+            break;
+        case OPT_SNDBUF:
+            if (parse_num("sndbuf", optarg, 0, 1 << 30, &v) == -1) return -1;
+            cfg->sock.sndbuf = (int)v;
+            break;
+        case OPT_UDP_RCVBUF:
+            if (parse_num("udp-rcvbuf", optarg, 0, 1 << 30, &v) == -1) return -1;
+            cfg->sock.udp_rcvbuf = (int)v;
+            break;
+        case OPT_UDP_SNDBUF:
+            if (parse_num("udp-sndbuf", optarg, 0, 1 << 30, &v) == -1) return -1;
+            cfg->sock.udp_sndbuf = (int)v;
+            break;
+        case OPT_NODELAY:
+            cfg->sock.nodelay = 1;
+            break;
+        case OPT_QUICKACK:
+            cfg->sock.quickack = 1;
+            break;
+        case OPT_BUSY_POLL:
+            if (parse_num("busy-poll", optarg, 0, 1000000, &v) == -1) return -1;
+            cfg->sock.busy_poll_us = (int)v;
+            break;
+        case OPT_INCOMING_CPU:
+            cfg->sock.incoming_cpu = 1;
+            break;
+        case OPT_TOS:
+            if (parse_num("tos", optarg, 0, 255, &v) == -1) return -1;
+            cfg->sock.tos = (int)v;
+            break;
+        case OPT_UPGRADE_SOCKET:
+            cfg->upgrade_socket = strdup(optarg);
+            if (!cfg->upgrade_socket) return -1;
+            break;
+        case OPT_UNIX:
+            cfg->unix_path = strdup(optarg);
+            if (!cfg->unix_path) return -1;
+            break;
+        case OPT_UNIX_DGRAM:
+            cfg->unix_dgram_path = strdup(optarg);
+            if (!cfg->unix_dgram_path) return -1;
+            break;
+        case OPT_ADMIN_COMMANDS:
+            cfg->admin_commands = 1;
+            break;
+        case OPT_METRICS_BIND:
+            cfg->metrics_bind = strdup(optarg);
+            if (!cfg->metrics_bind) return -1;
+            break;
+        case OPT_DRAIN_TIMEOUT:
+            if (parse_num("drain-timeout", optarg, 0, 86400000, &v) == -1) return -1;
+            cfg->drain_timeout_ms = (unsigned)v;
+            break;
+        case OPT_FANOUT_SLICE:
+            if (parse_num("fanout-slice", optarg, 1, 1 << 20, &v) == -1) return -1;
+            cfg->fanout_slice = (int)v;
+            break;
+        case OPT_SLOW_SUBSCRIBER:
+            if (strcmp(optarg, "drop") == 0) {
+                cfg->slow_subscriber = SERVER_SLOW_DROP;
+            } else if (strcmp(optarg, "disconnect") == 0) {
+                cfg->slow_subscriber = SERVER_SLOW_DISCONNECT;
+            } else {
+                fprintf(stderr, "invalid slow-subscriber: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_RATE_MSGS:
+            if (parse_num("rate-msgs", optarg, 0, 1L << 40, &v) == -1) return -1;
+            cfg->rate.conn_msgs = (uint64_t)v;
+            break;
+        case OPT_RATE_BYTES:
+            if (parse_num("rate-bytes", optarg, 0, 1L << 40, &v) == -1) return -1;
+            cfg->rate.conn_bytes = (uint64_t)v;
+            break;
+        case OPT_RATE_IP_MSGS:
+            if (parse_num("rate-ip-msgs", optarg, 0, 1L << 40, &v) == -1) return -1;
+            cfg->rate.ip_msgs = (uint64_t)v;
+            break;
+        case OPT_RATE_IP_BYTES:
+            if (parse_num("rate-ip-bytes", optarg, 0, 1L << 40, &v) == -1) return -1;
+            cfg->rate.ip_bytes = (uint64_t)v;
+            break;
+        case OPT_RATE_IP_TABLE:
+            if (parse_num("rate-ip-table", optarg, 1, 1L << 24, &v) == -1) return -1;
+            cfg->rate.ip_table = (size_t)v;
+            break;
+        case 'C':
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 1;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (optind < argc) {
+        if (parse_num("port", argv[optind], 1, 65535, &v) == -1) return -1;
+        cfg->port = (int)v;
+    }
+    return 0;
+}
+
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    size_t n = strlen(s);
+    while (n > 0 && isspace((unsigned char)s[n - 1])) s[--n] = '\0';
+    return s;
+}
+
+static const struct option *find_option(const char *name) {
+    for (const struct option *o = opts; o->name; o++) {
+        if (strcmp(o->name, name) == 0) return o;
+    }
+    return NULL;
+}
+
+static int parse_bool(const char *s, int *out) {
+    if (strcmp(s, "true") == 0 || strcmp(s, "yes") == 0 || strcmp(s, "on") == 0 || strcmp(s, "1") == 0) {
+        *out = 1;
+    } else if (strcmp(s, "false") == 0 || strcmp(s, "no") == 0 || strcmp(s, "off") == 0 || strcmp(s, "0") == 0) {
+        *out = 0;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int config_load(const char *path, struct server_config *cfg) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    char line[512];
+    int lineno = 0;
+    int rc = 0;
+    while (rc == 0 && fgets(line, sizeof(line), f)) {
+        lineno++;
+        if (!strchr(line, '\n') && !feof(f)) {
+            fprintf(stderr, "%s:%d: line too long\n", path, lineno);
+            rc = -1;
+            break;
+        }
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char *key = trim(line);
+        if (*key == '\0') continue;
+        char *value = "";
+        char *eq = strchr(key, '=');
+        if (eq) {
+            *eq = '\0';
+            value = trim(eq + 1);
+            key = trim(key);
+        }
+        const struct option *o = find_option(key);
+        if (!o || o->val == 'C' || o->val == 'h') {
+            fprintf(stderr, "%s:%d: unknown option '%s'\n", path, lineno, key);
+            rc = -1;
+            break;
+        }
+        char flag[64];
+        snprintf(flag, sizeof(flag), "--%s", key);
+        char *args[] = {"config", flag, value, NULL};
+        int nargs = 3;
+        if (o->has_arg == no_argument) {
+            int on = 1;
+            if (*value != '\0' && parse_bool(value, &on) == -1) {
+                fprintf(stderr, "%s:%d: '%s' expects true or false\n", path, lineno, key);
+                rc = -1;
+                break;
+            }
+            if (!on) continue;
+            args[2] = NULL;
+            nargs = 2;
+        } else if (*value == '\0') {
+            fprintf(stderr, "%s:%d: '%s' needs a value\n", path, lineno, key);
+            rc = -1;
+            break;
+        }
+        if (config_parse_args(nargs, args, cfg) != 0) {
+            fprintf(stderr, "%s:%d: bad value for '%s'\n", path, lineno, key);
+            rc = -1;
+        }
+    }
+    fclose(f);
+    return rc;
+}
+
+const char *config_path(int argc, char **argv) {
+    const char *path = NULL;
+    int opt;
+    int err = opterr;
+    opterr = 0;
+    optind = 0;
+    while ((opt = getopt_long(argc, argv, short_opts, opts, NULL)) != -1) {
+        if (opt == 'C') path = optarg;
+    }
+    opterr = err;
+    return path;
+}
+
+void config_defaults(struct server_config *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->port = 12345;
+    cfg->max_events = 64;
+    cfg->listen_backlog = 128;
+    cfg->max_clients = 1024;
+    cfg->client_buffer_size = 4096;
+    cfg->client_output_hwm = 256 * 1024;
+    cfg->max_line_length = 64 * 1024;
+    cfg->workers = 1;
+    cfg->backend = SERVER_BACKEND_EPOLL;
+    cfg->udp_batch = 32;
+    cfg->read_budget = 64 * 1024;
+    cfg->accept_batch = 64;
+    cfg->sock.udp_rcvbuf = 4 * 1024 * 1024;
+    cfg->drain_timeout_ms = 30000;
+    cfg->fanout_slice = 1024;
+    cfg->rate.ip_table = 65536;
+}
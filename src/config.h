@@ -0,0 +1,11 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "server.h"
+
+void config_defaults(struct server_config *cfg);
+const char *config_path(int argc, char **argv);
+int config_load(const char *path, struct server_config *cfg);
+int config_parse_args(int argc, char **argv, struct server_config *cfg);
+
+#endif
@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+#include "handoff.h"
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define HANDOFF_MAGIC "EPHO"
+#define HANDOFF_READY 'R'
+#define HANDOFF_READY_MS 10000
+#define SD_LISTEN_FDS_START 3
+
+struct handoff_hello {
+    char magic[4];
+    uint32_t count;
+};
+
+static int unix_addr(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    size_t len = strlen(path);
+    if (len == 0 || len >= sizeof(addr->sun_path)) {
+        log_error("upgrade socket path is empty or too long: %s", path);
+        return -1;
+    }
+    memcpy(addr->sun_path, path, len);
+    return 0;
+}
+
+int handoff_inherited(int *fds, int max) {
+    const char *pid = getenv("LISTEN_PID");
+    const char *n = getenv("LISTEN_FDS");
+    if (!pid || !n) return 0;
+    char *end;
+    long p = strtol(pid, &end, 10);
+    if (*end != '\0' || p != (long)getpid()) return 0;
+    long count = strtol(n, &end, 10);
+    if (*end != '\0' || count <= 0) return 0;
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+    if (count > max) {
+        log_error("too many sockets from systemd: %ld", count);
+        return -1;
+    }
+    for (int i = 0; i < (int)count; i++) {
+        fds[i] = SD_LISTEN_FDS_START + i;
+        if (fcntl(fds[i], F_SETFD, FD_CLOEXEC) == -1) perror("fcntl FD_CLOEXEC");
+    }
+    return (int)count;
+}
+
+int handoff_receive(const char *path, int *fds, int max, int *peer) {
+    *peer = -1;
+    struct sockaddr_un addr;
+    if (unix_addr(path, &addr) == -1) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket upgrade");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        int err = errno;
+        close(fd);
+        if (err == ENOENT || err == ECONNREFUSED) return 0;
+        errno = err;
+        perror("connect upgrade");
+        return -1;
+    }
+    struct timeval tv = {HANDOFF_READY_MS / 1000, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    struct handoff_hello hello;
+    struct iovec iov = {&hello, sizeof(hello)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } ctrl;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    ssize_t n;
+    do {
+        n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (n == -1 && errno == EINTR);
+    if (n == -1) perror("recvmsg upgrade");
+    int got = 0;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); n > 0 && cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+        int k = (int)((cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        for (int i = 0; i < k; i++) {
+            int rfd;
+            memcpy(&rfd, CMSG_DATA(cm) + (size_t)i * sizeof(int), sizeof(int));
+            if (got < max) {
+                fds[got++] = rfd;
+            } else {
+                close(rfd);
+            }
+        }
+    }
+    if (n != (ssize_t)sizeof(hello) || memcmp(hello.magic, HANDOFF_MAGIC, 4) != 0 || hello.count != (uint32_t)got ||
+        got == 0 || (msg.msg_flags & MSG_CTRUNC)) {
+        log_error("bad handoff from %s", path);
+        for (int i = 0; i < got; i++) close(fds[i]);
+        close(fd);
+        return -1;
+    }
+    *peer = fd;
+    return got;
+}
+
+int handoff_confirm(int peer) {
+    char c = HANDOFF_READY;
+    ssize_t n;
+    do {
+        n = send(peer, &c, 1, MSG_NOSIGNAL);
+    } while (n == -1 && errno == EINTR);
+    if (n != 1) perror("send upgrade ready");
+    close(peer);
+    return n == 1 ? 0 : -1;
+}
+
+void handoff_notify_ready(void) {
+    const char *path = getenv("NOTIFY_SOCKET");
+    if (!path || (path[0] != '/' && path[0] != '@')) return;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    size_t len = strlen(path);
+    if (len >= sizeof(addr.sun_path)) return;
+    memcpy(addr.sun_path, path, len);
+    if (addr.sun_path[0] == '@') addr.sun_path[0] = '\0';
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return;
+    char msg[64];
+    int n = snprintf(msg, sizeof(msg), "READY=1\nMAINPID=%d", (int)getpid());
+    if (sendto(fd, msg, (size_t)n, MSG_NOSIGNAL, (struct sockaddr *)&addr, (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len)) == -1) {
+        perror("sendto NOTIFY_SOCKET");
+    }
+    close(fd);
+}
+
+static int send_fds(struct handoff *h, int fd) {
+    struct handoff_hello hello;
+    memcpy(hello.magic, HANDOFF_MAGIC, 4);
+    hello.count = (uint32_t)h->count;
+    struct iovec iov = {&hello, sizeof(hello)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } ctrl;
+    memset(&ctrl, 0, sizeof(ctrl));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * (size_t)h->count);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int) * (size_t)h->count);
+    memcpy(CMSG_DATA(cm), h->fds, sizeof(int) * (size_t)h->count);
+    ssize_t n;
+    do {
+        n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (n == -1 && errno == EINTR);
+    if (n != (ssize_t)sizeof(hello)) {
+        perror("sendmsg upgrade");
+        return -1;
+    }
+    return 0;
+}
+
+static int wait_ready(struct handoff *h, int fd) {
+    for (int waited = 0; waited < HANDOFF_READY_MS && !atomic_load(&h->stop); waited += 200) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0) continue;
+        char c;
+        ssize_t n = recv(fd, &c, 1, 0);
+        if (n == -1 && errno == EINTR) continue;
+        return n == 1 && c == HANDOFF_READY ? 0 : -1;
+    }
+    return -1;
+}
+
+static void *handoff_thread(void *arg) {
+    struct handoff *h = arg;
+    while (!atomic_load(&h->stop)) {
+        struct pollfd pfd = {h->fd, POLLIN, 0};
+        int r = poll(&pfd, 1, 200);
+        if (r <= 0) continue;
+        int cfd = accept4(h->fd, NULL, NULL, SOCK_CLOEXEC);
+        if (cfd == -1) continue;
+        log_info("upgrade requested, passing %d sockets", h->count);
+        if (send_fds(h, cfd) == 0 && wait_ready(h, cfd) == 0) {
+            close(cfd);
+            h->handed_off = 1;
+            log_info("new process took over the listeners, draining");
+            h->done(h->arg);
+            break;
+        }
+        close(cfd);
+        log_error("upgrade aborted, keeping the listeners");
+    }
+    return NULL;
+}
+
+int handoff_start(struct handoff *h, const char *path, const int *fds, int count, void (*done)(void *arg), void *arg) {
+    memset(h, 0, sizeof(*h));
+    h->fd = -1;
+    atomic_init(&h->stop, 0);
+    if (count <= 0 || count > HANDOFF_MAX_FDS) {
+        log_error("cannot hand off %d sockets", count);
+        return -1;
+    }
+    struct sockaddr_un addr;
+    if (unix_addr(path, &addr) == -1) return -1;
+    memcpy(h->path, addr.sun_path, sizeof(h->path));
+    memcpy(h->fds, fds, sizeof(int) * (size_t)count);
+    h->count = count;
+    h->done = done;
+    h->arg = arg;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        perror("socket upgrade");
+        return -1;
+    }
+    unlink(path);
+    mode_t mask = umask(0077);
+    int rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (rc == -1 || chmod(path, 0600) == -1 || listen(fd, 4) == -1) {
+        perror("bind upgrade");
+        close(fd);
+        return -1;
+    }
+    h->fd = fd;
+    int err = pthread_create(&h->thread, NULL, handoff_thread, h);
+    if (err != 0) {
+        log_error("failed to start upgrade thread: %s", strerror(err));
+        close(fd);
+        unlink(path);
+        h->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void handoff_stop(struct handoff *h) {
+    if (h->fd == -1) return;
+    atomic_store(&h->stop, 1);
+    pthread_join(h->thread, NULL);
+    close(h->fd);
+    if (!h->handed_off) unlink(h->path);
+    h->fd = -1;
+}
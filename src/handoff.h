@@ -0,0 +1,30 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/un.h>
+
+#define HANDOFF_MAX_FDS 253
+
+struct handoff {
+    int fd;
+    pthread_t thread;
+    atomic_int stop;
+    int handed_off;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    int fds[HANDOFF_MAX_FDS];
+    int count;
+    void (*done)(void *arg);
+    void *arg;
+};
+
+int handoff_inherited(int *fds, int max);
+int handoff_receive(const char *path, int *fds, int max, int *peer);
+int handoff_confirm(int peer);
+void handoff_notify_ready(void);
+
+int handoff_start(struct handoff *h, const char *path, const int *fds, int count, void (*done)(void *arg), void *arg);
+void handoff_stop(struct handoff *h);
+
+#endif
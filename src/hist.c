@@ -0,0 +1,45 @@
+#include "hist.h"
+
+unsigned hist_index(uint64_t v) {
+    if (v < HIST_SUB) return (unsigned)v;
+    unsigned e = 63u - (unsigned)__builtin_clzll(v);
+    if (e > HIST_MAX_EXP) return HIST_BUCKETS - 1;
+    unsigned sub = (unsigned)(v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1);
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB + sub;
+}
+
+uint64_t hist_value(unsigned idx) {
+    if (idx < HIST_SUB) return idx;
+    unsigned e = idx / HIST_SUB - 1 + HIST_SUB_BITS;
+    uint64_t sub = idx % HIST_SUB;
+    uint64_t width = (uint64_t)1 << (e - HIST_SUB_BITS);
+    return (HIST_SUB + sub) * width + width / 2;
+}
+
+void hist_record(struct hist *h, uint64_t v) {
+    metric_add(&h->buckets[hist_index(v)], 1);
+    metric_add(&h->count, 1);
+    metric_add(&h->sum, v);
+}
+
+void hist_snapshot_add(struct hist_snapshot *dst, struct hist *src) {
+    uint64_t count = atomic_load_explicit(&src->count, memory_order_relaxed);
+    if (count == 0) return;
+    dst->count += count;
+    dst->sum += atomic_load_explicit(&src->sum, memory_order_relaxed);
+    for (unsigned i = 0; i < HIST_BUCKETS; i++) dst->buckets[i] += atomic_load_explicit(&src->buckets[i], memory_order_relaxed);
+}
+
+uint64_t hist_quantile(const struct hist_snapshot *s, double q) {
+    uint64_t total = 0;
+    for (unsigned i = 0; i < HIST_BUCKETS; i++) total += s->buckets[i];
+    if (total == 0) return 0;
+    uint64_t rank = (uint64_t)(q * (double)total + 0.5);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+        seen += s->buckets[i];
+        if (seen >= rank) return hist_value(i);
+    }
+    return hist_value(HIST_BUCKETS - 1);
+}
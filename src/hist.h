@@ -0,0 +1,34 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1u << HIST_SUB_BITS)
+#define HIST_MAX_EXP 40
+#define HIST_BUCKETS ((HIST_MAX_EXP - HIST_SUB_BITS + 2) * HIST_SUB)
+
+struct hist {
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t buckets[HIST_BUCKETS];
+};
+
+struct hist_snapshot {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+static inline void metric_add(_Atomic uint64_t *c, uint64_t v) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+unsigned hist_index(uint64_t v);
+uint64_t hist_value(unsigned idx);
+void hist_record(struct hist *h, uint64_t v);
+void hist_snapshot_add(struct hist_snapshot *dst, struct hist *src);
+uint64_t hist_quantile(const struct hist_snapshot *s, double q);
+
+#endif
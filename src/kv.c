@@ -0,0 +1,465 @@
+#include "kv.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define KV_SHARD_BITS 6
+#define KV_SHARDS (1u << KV_SHARD_BITS)
+#define KV_GROUP 16
+#define KV_TABLE_MIN 16
+#define KV_EMPTY ((int8_t)-128)
+#define KV_DELETED ((int8_t)-2)
+#define KV_PAGE (64 * 1024)
+#define KV_CLASSES 18
+
+static const uint32_t class_size[KV_CLASSES] = {
+    32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096, 6144, 8192, 12288,
+};
+
+struct kv_entry {
+    uint64_t hash;
+    uint64_t expires;
+    uint32_t vlen;
+    uint16_t klen;
+    uint8_t cls;
+    char data[];
+};
+
+struct kv_class {
+    void *free;
+    char *cur;
+    uint32_t left;
+};
+
+struct kv_shard {
+    _Alignas(64) pthread_mutex_t lock;
+    _Atomic uint64_t *expiring_total;
+    int8_t *ctrl;
+    struct kv_entry **slots;
+    uint32_t mask;
+    uint32_t count;
+    uint32_t tombstones;
+    uint32_t expiring;
+    uint32_t sweep;
+    struct kv_class classes[KV_CLASSES];
+    void **pages;
+    size_t pages_count;
+    size_t pages_cap;
+    _Atomic uint64_t keys;
+    _Atomic uint64_t bytes;
+    _Atomic uint64_t version;
+};
+
+struct kv {
+    struct kv_shard shards[KV_SHARDS];
+    _Alignas(64) _Atomic uint64_t expiring;
+    atomic_uint sweep_next;
+};
+
+static uint64_t kv_hash(const char *k, size_t len) {
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ (uint64_t)len;
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, k, 8);
+        h = (h ^ v) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+        k += 8;
+        len -= 8;
+    }
+    uint64_t v = 0;
+    memcpy(&v, k, len);
+    h = (h ^ v) * 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 29;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 32;
+    return h;
+}
+
+#if defined(__SSE2__)
+
+static inline uint32_t group_match(const int8_t *g, int8_t h2) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(const void *)g);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(h2)));
+}
+
+static inline uint32_t group_empty(const int8_t *g) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(const void *)g);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(KV_EMPTY)));
+}
+
+static inline uint32_t group_free(const int8_t *g) {
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(const void *)g));
+}
+
+#else
+
+static inline uint32_t group_match(const int8_t *g, int8_t h2) {
+    uint32_t m = 0;
+    for (int i = 0; i < KV_GROUP; i++) m |= (uint32_t)(g[i] == h2) << i;
+    return m;
+}
+
+static inline uint32_t group_empty(const int8_t *g) {
+    return group_match(g, KV_EMPTY);
+}
+
+static inline uint32_t group_free(const int8_t *g) {
+    uint32_t m = 0;
+    for (int i = 0; i < KV_GROUP; i++) m |= (uint32_t)(g[i] < 0) << i;
+    return m;
+}
+
+#endif
+
+static inline void set_ctrl(struct kv_shard *s, uint32_t i, int8_t v) {
+    s->ctrl[i] = v;
+    s->ctrl[((i - (KV_GROUP - 1)) & s->mask) + (KV_GROUP - 1)] = v;
+}
+
+static size_t table_bytes(uint32_t cap) {
+    return cap ? (size_t)cap * sizeof(struct kv_entry *) + cap + KV_GROUP - 1 : 0;
+}
+
+static int class_for(size_t need) {
+    for (int c = 0; c < KV_CLASSES; c++) {
+        if (need <= class_size[c]) return c;
+    }
+    return -1;
+}
+
+static void usage_add(struct kv_shard *s, _Atomic uint64_t *c, int64_t d) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + (uint64_t)d, memory_order_relaxed);
+    atomic_store_explicit(&s->version, atomic_load_explicit(&s->version, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+static struct kv_entry *slab_alloc(struct kv_shard *s, size_t need) {
+    int c = class_for(need);
+    if (c < 0) return NULL;
+    struct kv_class *k = &s->classes[c];
+    void *p = k->free;
+    if (p) {
+        memcpy(&k->free, p, sizeof(void *));
+    } else {
+        if (k->left < class_size[c]) {
+            if (s->pages_count == s->pages_cap) {
+                size_t cap = s->pages_cap ? s->pages_cap * 2 : 16;
+                void **pages = realloc(s->pages, cap * sizeof(*pages));
+                if (!pages) return NULL;
+                s->pages = pages;
+                s->pages_cap = cap;
+            }
+            char *page = malloc(KV_PAGE);
+            if (!page) return NULL;
+            s->pages[s->pages_count++] = page;
+            usage_add(s, &s->bytes, KV_PAGE);
+            k->cur = page;
+            k->left = KV_PAGE;
+        }
+        p = k->cur;
+        k->cur += class_size[c];
+        k->left -= class_size[c];
+    }
+    struct kv_entry *e = p;
+    e->cls = (uint8_t)c;
+    return e;
+}
+
+static void slab_free(struct kv_shard *s, struct kv_entry *e) {
+    struct kv_class *k = &s->classes[e->cls];
+    void *p = e;
+    memcpy(p, &k->free, sizeof(void *));
+    k->free = p;
+}
+
+
+static long find(const struct kv_shard *s, uint64_t h, const char *key, size_t klen) {
+    if (!s->slots) return -1;
+    int8_t h2 = (int8_t)(h & 0x7f);
+    uint32_t pos = (uint32_t)(h >> 7) & s->mask;
+    uint32_t stride = 0;
+    for (;;) {
+        const int8_t *g = s->ctrl + pos;
+        uint32_t m = group_match(g, h2);
+        while (m) {
+            uint32_t i = (pos + (uint32_t)__builtin_ctz(m)) & s->mask;
+            const struct kv_entry *e = s->slots[i];
+            if (e->hash == h && e->klen == klen && memcmp(e->data, key, klen) == 0) return (long)i;
+            m &= m - 1;
+        }
+        if (group_empty(g)) return -1;
+        stride += KV_GROUP;
+        pos = (pos + stride) & s->mask;
+    }
+}
+
+static uint32_t free_slot(const struct kv_shard *s, uint64_t h) {
+    uint32_t pos = (uint32_t)(h >> 7) & s->mask;
+    uint32_t stride = 0;
+    for (;;) {
+        uint32_t m = group_free(s->ctrl + pos);
+        if (m) return (pos + (uint32_t)__builtin_ctz(m)) & s->mask;
+        stride += KV_GROUP;
+        pos = (pos + stride) & s->mask;
+    }
+}
+
+static int rehash(struct kv_shard *s, uint32_t cap) {
+    int8_t *ctrl = malloc((size_t)cap + KV_GROUP - 1);
+    struct kv_entry **slots = malloc((size_t)cap * sizeof(*slots));
+    if (!ctrl || !slots) {
+        free(ctrl);
+        free(slots);
+        return -1;
+    }
+    memset(ctrl, KV_EMPTY, (size_t)cap + KV_GROUP - 1);
+    int8_t *old_ctrl = s->ctrl;
+    struct kv_entry **old_slots = s->slots;
+    uint32_t old_cap = old_slots ? s->mask + 1 : 0;
+    s->ctrl = ctrl;
+    s->slots = slots;
+    s->mask = cap - 1;
+    s->tombstones = 0;
+    for (uint32_t i = 0; i < old_cap; i++) {
+        if (old_ctrl[i] < 0) continue;
+        struct kv_entry *e = old_slots[i];
+        uint32_t j = free_slot(s, e->hash);
+        set_ctrl(s, j, (int8_t)(e->hash & 0x7f));
+        slots[j] = e;
+    }
+    free(old_ctrl);
+    free(old_slots);
+    if (cap != old_cap) usage_add(s, &s->bytes, (int64_t)table_bytes(cap) - (int64_t)table_bytes(old_cap));
+    return 0;
+}
+
+static int reserve(struct kv_shard *s) {
+    uint32_t cap = s->slots ? s->mask + 1 : 0;
+    if (cap && (uint64_t)(s->count + s->tombstones + 1) * 8 <= (uint64_t)cap * 7) return 0;
+    if (!cap) return rehash(s, KV_TABLE_MIN);
+    return rehash(s, (uint64_t)(s->count + 1) * 16 > (uint64_t)cap * 7 ? cap * 2 : cap);
+}
+
+static void expiring_add(struct kv_shard *s, int d) {
+    if (d == 0) return;
+    s->expiring += (uint32_t)d;
+    atomic_fetch_add_explicit(s->expiring_total, (uint64_t)(int64_t)d, memory_order_relaxed);
+}
+
+static void entry_ttl(struct kv_shard *s, struct kv_entry *e, uint64_t expires) {
+    expiring_add(s, (expires != 0) - (e->expires != 0));
+    e->expires = expires;
+}
+
+static void remove_at(struct kv_shard *s, uint32_t i) {
+    struct kv_entry *e = s->slots[i];
+    if (e->expires) expiring_add(s, -1);
+    set_ctrl(s, i, KV_DELETED);
+    s->tombstones++;
+    s->count--;
+    usage_add(s, &s->keys, -1);
+    slab_free(s, e);
+}
+
+static int expired(const struct kv_entry *e, uint64_t now_ms) {
+    return e->expires && e->expires <= now_ms;
+}
+
+static long lookup(struct kv_shard *s, uint64_t h, const char *key, size_t klen, uint64_t now_ms) {
+    long i = find(s, h, key, klen);
+    if (i >= 0 && expired(s->slots[i], now_ms)) {
+        remove_at(s, (uint32_t)i);
+        return -1;
+    }
+    return i;
+}
+
+static struct kv_shard *shard_of(struct kv *kv, uint64_t h) {
+    return &kv->shards[h >> (64 - KV_SHARD_BITS)];
+}
+
+static int store(struct kv_shard *s, long i, uint64_t h, const char *key, size_t klen, const char *val, size_t vlen, uint64_t expires) {
+    size_t need = offsetof(struct kv_entry, data) + klen + vlen;
+    struct kv_entry *e = i >= 0 ? s->slots[i] : NULL;
+    if (e && need <= class_size[e->cls]) {
+        memcpy(e->data + klen, val, vlen);
+        e->vlen = (uint32_t)vlen;
+        entry_ttl(s, e, expires);
+        return KV_OK;
+    }
+    if (i < 0 && reserve(s) == -1) return KV_NOMEM;
+    struct kv_entry *n = slab_alloc(s, need);
+    if (!n) return KV_NOMEM;
+    n->hash = h;
+    n->klen = (uint16_t)klen;
+    n->vlen = (uint32_t)vlen;
+    n->expires = 0;
+    memcpy(n->data, key, klen);
+    memcpy(n->data + klen, val, vlen);
+    entry_ttl(s, n, expires);
+    if (e) {
+        entry_ttl(s, e, 0);
+        slab_free(s, e);
+        s->slots[i] = n;
+        return KV_OK;
+    }
+    uint32_t j = free_slot(s, h);
+    if (s->ctrl[j] == KV_DELETED) s->tombstones--;
+    set_ctrl(s, j, (int8_t)(h & 0x7f));
+    s->slots[j] = n;
+    s->count++;
+    usage_add(s, &s->keys, 1);
+    return KV_OK;
+}
+
+int kv_set(struct kv *kv, const char *key, size_t klen, const char *val, size_t vlen, uint64_t ttl_ms, uint64_t now_ms) {
+    if (klen == 0 || klen > KV_KEY_MAX || vlen > KV_VALUE_MAX) return KV_TOO_BIG;
+    uint64_t expires = 0;
+    if (ttl_ms && __builtin_add_overflow(now_ms, ttl_ms, &expires)) return KV_OVERFLOW;
+    uint64_t h = kv_hash(key, klen);
+    struct kv_shard *s = shard_of(kv, h);
+    pthread_mutex_lock(&s->lock);
+    long i = find(s, h, key, klen);
+    int rc = store(s, i, h, key, klen, val, vlen, expires);
+    pthread_mutex_unlock(&s->lock);
+    return rc;
+}
+
+int kv_get(struct kv *kv, const char *key, size_t klen, uint64_t now_ms, char *out, size_t cap, size_t *vlen) {
+    uint64_t h = kv_hash(key, klen);
+    struct kv_shard *s = shard_of(kv, h);
+    pthread_mutex_lock(&s->lock);
+    long i = lookup(s, h, key, klen, now_ms);
+    int rc = KV_NOT_FOUND;
+    if (i >= 0) {
+        const struct kv_entry *e = s->slots[i];
+        *vlen = e->vlen;
+        rc = KV_TOO_BIG;
+        if (e->vlen <= cap) {
+            memcpy(out, e->data + e->klen, e->vlen);
+            rc = KV_OK;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return rc;
+}
+
+int kv_del(struct kv *kv, const char *key, size_t klen, uint64_t now_ms) {
+    uint64_t h = kv_hash(key, klen);
+    struct kv_shard *s = shard_of(kv, h);
+    pthread_mutex_lock(&s->lock);
+    long i = lookup(s, h, key, klen, now_ms);
+    if (i >= 0) remove_at(s, (uint32_t)i);
+    pthread_mutex_unlock(&s->lock);
+    return i >= 0 ? KV_OK : KV_NOT_FOUND;
+}
+
+static int parse_i64(const char *p, size_t len, int64_t *out) {
+    size_t i = 0;
+    int neg = 0;
+    if (len > 0 && (p[0] == '-' || p[0] == '+')) {
+        neg = p[0] == '-';
+        i = 1;
+    }
+    if (i == len || len - i > 19) return -1;
+    uint64_t v = 0;
+    for (; i < len; i++) {
+        if (p[i] < '0' || p[i] > '9') return -1;
+        v = v * 10 + (uint64_t)(p[i] - '0');
+    }
+    if (v > (uint64_t)INT64_MAX + (uint64_t)neg) return -1;
+    *out = neg ? (int64_t)(0 - v) : (int64_t)v;
+    return 0;
+}
+
+int kv_incr(struct kv *kv, const char *key, size_t klen, int64_t delta, uint64_t now_ms, int64_t *result) {
+    if (klen == 0 || klen > KV_KEY_MAX) return KV_TOO_BIG;
+    uint64_t h = kv_hash(key, klen);
+    struct kv_shard *s = shard_of(kv, h);
+    pthread_mutex_lock(&s->lock);
+    long i = lookup(s, h, key, klen, now_ms);
+    int64_t v = 0;
+    uint64_t expires = 0;
+    int rc = KV_OK;
+    if (i >= 0) {
+        const struct kv_entry *e = s->slots[i];
+        expires = e->expires;
+        if (parse_i64(e->data + e->klen, e->vlen, &v) == -1) rc = KV_NOT_INTEGER;
+    }
+    if (rc == KV_OK && __builtin_add_overflow(v, delta, &v)) rc = KV_OVERFLOW;
+    if (rc == KV_OK) {
+        char buf[24];
+        int n = snprintf(buf, sizeof(buf), "%lld", (long long)v);
+        rc = store(s, i, h, key, klen, buf, (size_t)n, expires);
+        *result = v;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return rc;
+}
+
+void kv_sweep(struct kv *kv, uint64_t now_ms, unsigned slots) {
+    unsigned idx = atomic_fetch_add_explicit(&kv->sweep_next, 1, memory_order_relaxed) % KV_SHARDS;
+    struct kv_shard *s = &kv->shards[idx];
+    if (pthread_mutex_trylock(&s->lock) != 0) return;
+    for (unsigned n = 0; s->expiring > 0 && n < slots && n <= s->mask; n++) {
+        uint32_t i = s->sweep;
+        s->sweep = (i + 1) & s->mask;
+        if (s->ctrl[i] >= 0 && expired(s->slots[i], now_ms)) remove_at(s, i);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+int kv_expiring(struct kv *kv) {
+    return atomic_load_explicit(&kv->expiring, memory_order_relaxed) != 0;
+}
+
+void kv_usage(struct kv *kv, uint64_t *keys, uint64_t *bytes) {
+    uint64_t k = 0, b = sizeof(*kv);
+    for (unsigned i = 0; i < KV_SHARDS; i++) {
+        k += atomic_load_explicit(&kv->shards[i].keys, memory_order_relaxed);
+        b += atomic_load_explicit(&kv->shards[i].bytes, memory_order_relaxed);
+    }
+    *keys = k;
+    *bytes = b;
+}
+
+uint64_t kv_version(struct kv *kv) {
+    uint64_t v = 0;
+    for (unsigned i = 0; i < KV_SHARDS; i++) v += atomic_load_explicit(&kv->shards[i].version, memory_order_relaxed);
+    return v;
+}
+
+struct kv *kv_new(void) {
+    struct kv *kv = aligned_alloc(64, sizeof(struct kv));
+    if (!kv) return NULL;
+    memset(kv, 0, sizeof(*kv));
+    for (unsigned i = 0; i < KV_SHARDS; i++) {
+        pthread_mutex_init(&kv->shards[i].lock, NULL);
+        kv->shards[i].expiring_total = &kv->expiring;
+        atomic_init(&kv->shards[i].keys, 0);
+        atomic_init(&kv->shards[i].bytes, 0);
+        atomic_init(&kv->shards[i].version, 0);
+    }
+    atomic_init(&kv->expiring, 0);
+    atomic_init(&kv->sweep_next, 0);
+    return kv;
+}
+
+void kv_free(struct kv *kv) {
+    if (!kv) return;
+    for (unsigned i = 0; i < KV_SHARDS; i++) {
+        struct kv_shard *s = &kv->shards[i];
+        for (size_t p = 0; p < s->pages_count; p++) free(s->pages[p]);
+        free(s->pages);
+        free(s->ctrl);
+        free(s->slots);
+        pthread_mutex_destroy(&s->lock);
+    }
+    free(kv);
+}
@@ -0,0 +1,36 @@
+#ifndef KV_H
+#define KV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define KV_KEY_MAX 250
+#define KV_VALUE_MAX 8192
+#define KV_SWEEP_INTERVAL_MS 100
+#define KV_SWEEP_SLOTS 512
+
+enum kv_status {
+    KV_OK,
+    KV_NOT_FOUND,
+    KV_NOT_INTEGER,
+    KV_OVERFLOW,
+    KV_TOO_BIG,
+    KV_NOMEM,
+};
+
+struct kv;
+
+struct kv *kv_new(void);
+void kv_free(struct kv *kv);
+
+int kv_set(struct kv *kv, const char *key, size_t klen, const char *val, size_t vlen, uint64_t ttl_ms, uint64_t now_ms);
+int kv_get(struct kv *kv, const char *key, size_t klen, uint64_t now_ms, char *out, size_t cap, size_t *vlen);
+int kv_del(struct kv *kv, const char *key, size_t klen, uint64_t now_ms);
+int kv_incr(struct kv *kv, const char *key, size_t klen, int64_t delta, uint64_t now_ms, int64_t *result);
+
+void kv_sweep(struct kv *kv, uint64_t now_ms, unsigned slots);
+int kv_expiring(struct kv *kv);
+void kv_usage(struct kv *kv, uint64_t *keys, uint64_t *bytes);
+uint64_t kv_version(struct kv *kv);
+
+#endif
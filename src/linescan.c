@@ -0,0 +1,91 @@
+#include "linescan.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LINESCAN_X86 1
+#endif
+
+size_t linescan_scalar(const char *data, size_t len, uint32_t *offs, size_t max) {
+    size_t n = 0;
+    size_t pos = 0;
+    while (n < max && pos < len) {
+        const char *nl = memchr(data + pos, '\n', len - pos);
+        if (!nl) break;
+        pos = (size_t)(nl - data);
+        offs[n++] = (uint32_t)pos;
+        pos++;
+    }
+    return n;
+}
+
+#ifdef LINESCAN_X86
+
+static size_t scan_tail(const char *data, size_t i, size_t len, uint32_t *offs, size_t n, size_t max) {
+    for (; i < len && n < max; i++) {
+        if (data[i] == '\n') offs[n++] = (uint32_t)i;
+    }
+    return n;
+}
+
+__attribute__((target("sse2"))) size_t linescan_sse2(const char *data, size_t len, uint32_t *offs, size_t max) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t n = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(data + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        while (mask) {
+            if (n == max) return n;
+            offs[n++] = (uint32_t)(i + (size_t)__builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    return scan_tail(data, i, len, offs, n, max);
+}
+
+__attribute__((target("avx2"))) size_t linescan_avx2(const char *data, size_t len, uint32_t *offs, size_t max) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t n = 0;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)(data + i));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        while (mask) {
+            if (n == max) return n;
+            offs[n++] = (uint32_t)(i + (size_t)__builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    return scan_tail(data, i, len, offs, n, max);
+}
+
+size_t linescan(const char *data, size_t len, uint32_t *offs, size_t max) {
+    if (__builtin_cpu_supports("avx2")) return linescan_avx2(data, len, offs, max);
+    return linescan_sse2(data, len, offs, max);
+}
+
+const char *linescan_impl_name(void) {
+    return __builtin_cpu_supports("avx2") ? "avx2" : "sse2";
+}
+
+#else
+
+size_t linescan_sse2(const char *data, size_t len, uint32_t *offs, size_t max) {
+    return linescan_scalar(data, len, offs, max);
+}
+
+size_t linescan_avx2(const char *data, size_t len, uint32_t *offs, size_t max) {
+    return linescan_scalar(data, len, offs, max);
+}
+
+size_t linescan(const char *data, size_t len, uint32_t *offs, size_t max) {
+    return linescan_scalar(data, len, offs, max);
+}
+
+const char *linescan_impl_name(void) {
+    return "scalar";
+}
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef LINESCAN_H
+#define LINESCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef size_t (*linescan_fn)(const char *data, size_t len, uint32_t *offs, size_t max);
+
+size_t linescan_scalar(const char *data, size_t len, uint32_t *offs, size_t max);
+size_t linescan_sse2(const char *data, size_t len, uint32_t *offs, size_t max);
+size_t linescan_avx2(const char *data, size_t len, uint32_t *offs, size_t max);
+size_t linescan(const char *data, size_t len, uint32_t *offs, size_t max);
+const char *linescan_impl_name(void);
+
+#endif
@@ -0,0 +1,291 @@
+#define _GNU_SOURCE
+#include "log.h"
+#include "timecache.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define LOG_RING 4096
+#define LOG_MSG_MAX 240
+#define LOG_BATCH 256
+#define LOG_IDLE_NS 100000000L
+
+struct log_record {
+    time_t sec;
+    int level;
+    uint16_t len;
+    char msg[LOG_MSG_MAX];
+};
+
+struct log_cell {
+    atomic_size_t seq;
+    struct log_record rec;
+};
+
+static struct log_cell ring[LOG_RING];
+static _Alignas(64) atomic_size_t enq_pos;
+static _Alignas(64) size_t deq_pos;
+static atomic_int level = LOG_INFO;
+static atomic_uint_fast64_t dropped;
+static atomic_int running;
+static atomic_int sleeping;
+static atomic_int stopping;
+static int users;
+static pthread_t thread;
+static pthread_mutex_t life_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+static const char *const level_names[] = {"DEBUG", "INFO", "ERROR"};
+
+void log_set_level(int l) {
+    if (l < LOG_DEBUG) l = LOG_DEBUG;
+    if (l > LOG_ERROR) l = LOG_ERROR;
+    atomic_store_explicit(&level, l, memory_order_relaxed);
+}
+
+int log_get_level(void) {
+    return atomic_load_explicit(&level, memory_order_relaxed);
+}
+
+int log_enabled(int l) {
+    return l >= atomic_load_explicit(&level, memory_order_relaxed);
+}
+
+int log_level_parse(const char *name, int *out) {
+    for (int i = LOG_DEBUG; i <= LOG_ERROR; i++) {
+        if (strcasecmp(name, level_names[i]) == 0) {
+            *out = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *log_level_name(int l) {
+    if (l < LOG_DEBUG || l > LOG_ERROR) return "?";
+    return level_names[l];
+}
+
+uint64_t log_dropped(void) {
+    return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
+
+static FILE *level_stream(int l) {
+    return l >= LOG_ERROR ? stderr : stdout;
+}
+
+static size_t format_line(char *out, size_t cap, time_t sec, int l, const char *msg, size_t len) {
+    char ts[32];
+    if (timecache_format_sec(sec, ts, sizeof(ts)) == 0) ts[0] = '\0';
+    int n = snprintf(out, cap, "[%s] [%s] %.*s\n", ts, level_names[l], (int)len, msg);
+    if (n < 0) return 0;
+    if ((size_t)n >= cap) {
+        out[cap - 2] = '\n';
+        return cap - 1;
+    }
+    return (size_t)n;
+}
+
+static void ring_init(void) {
+    for (size_t i = 0; i < LOG_RING; i++) atomic_init(&ring[i].seq, i);
+    atomic_init(&enq_pos, 0);
+    deq_pos = 0;
+}
+
+static int ring_push(int l, const char *msg, size_t len) {
+    size_t pos = atomic_load_explicit(&enq_pos, memory_order_relaxed);
+    struct log_cell *cell;
+    for (;;) {
+        cell = &ring[pos & (LOG_RING - 1)];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enq_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&enq_pos, memory_order_relaxed);
+        }
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    cell->rec.sec = ts.tv_sec;
+    cell->rec.level = l;
+    cell->rec.len = (uint16_t)len;
+    memcpy(cell->rec.msg, msg, len);
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    return 0;
+}
+
+static int ring_pop(struct log_record *rec) {
+    struct log_cell *cell = &ring[deq_pos & (LOG_RING - 1)];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    if (seq != deq_pos + 1) return -1;
+    *rec = cell->rec;
+    atomic_store_explicit(&cell->seq, deq_pos + LOG_RING, memory_order_release);
+    deq_pos++;
+    return 0;
+}
+
+struct log_sink {
+    FILE *f;
+    size_t len;
+    char buf[32768];
+};
+
+static void sink_flush(struct log_sink *s) {
+    if (s->len == 0) return;
+    fwrite(s->buf, 1, s->len, s->f);
+    fflush(s->f);
+    s->len = 0;
+}
+
+static void sink_add(struct log_sink *s, time_t sec, int l, const char *msg, size_t len) {
+    if (sizeof(s->buf) - s->len < LOG_MSG_MAX + 64) sink_flush(s);
+    s->len += format_line(s->buf + s->len, sizeof(s->buf) - s->len, sec, l, msg, len);
+}
+
+static int drain(struct log_sink *out, struct log_sink *err, uint64_t *reported) {
+    struct log_record rec;
+    int n = 0;
+    while (n < LOG_BATCH && ring_pop(&rec) == 0) {
+        sink_add(rec.level >= LOG_ERROR ? err : out, rec.sec, rec.level, rec.msg, rec.len);
+        n++;
+    }
+    uint64_t d = log_dropped();
+    if (d != *reported) {
+        char msg[64];
+        int len = snprintf(msg, sizeof(msg), "dropped %" PRIu64 " log records", d - *reported);
+        sink_add(err, time(NULL), LOG_ERROR, msg, (size_t)len);
+        *reported = d;
+    }
+    sink_flush(out);
+    sink_flush(err);
+    return n;
+}
+
+static void *log_thread(void *arg) {
+    (void)arg;
+    struct log_sink out;
+    struct log_sink err;
+    out.f = stdout;
+    out.len = 0;
+    err.f = stderr;
+    err.len = 0;
+    uint64_t reported = log_dropped();
+    for (;;) {
+        if (drain(&out, &err, &reported) > 0) continue;
+        if (atomic_load_explicit(&stopping, memory_order_acquire)) {
+            if (drain(&out, &err, &reported) == 0) break;
+            continue;
+        }
+        pthread_mutex_lock(&wake_lock);
+        atomic_store(&sleeping, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        struct log_cell *cell = &ring[deq_pos & (LOG_RING - 1)];
+        if (atomic_load_explicit(&cell->seq, memory_order_acquire) != deq_pos + 1 && !atomic_load(&stopping)) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += LOG_IDLE_NS;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&wake_cond, &wake_lock, &ts);
+        }
+        atomic_store(&sleeping, 0);
+        pthread_mutex_unlock(&wake_lock);
+    }
+    return NULL;
+}
+
+static void wake_consumer(void) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load(&sleeping)) return;
+    pthread_mutex_lock(&wake_lock);
+    pthread_cond_signal(&wake_cond);
+    pthread_mutex_unlock(&wake_lock);
+}
+
+int log_start(void) {
+    pthread_once(&ring_once, ring_init);
+    pthread_mutex_lock(&life_lock);
+    int rc = 0;
+    if (users++ == 0) {
+        atomic_store(&stopping, 0);
+        int err = pthread_create(&thread, NULL, log_thread, NULL);
+        if (err != 0) {
+            users--;
+            rc = -1;
+        } else {
+            atomic_store_explicit(&running, 1, memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(&life_lock);
+    return rc;
+}
+
+void log_stop(void) {
+    pthread_mutex_lock(&life_lock);
+    if (users > 0 && --users == 0) {
+        atomic_store_explicit(&running, 0, memory_order_release);
+        atomic_store_explicit(&stopping, 1, memory_order_release);
+        pthread_mutex_lock(&wake_lock);
+        pthread_cond_signal(&wake_cond);
+        pthread_mutex_unlock(&wake_lock);
+        pthread_join(thread, NULL);
+    }
+    pthread_mutex_unlock(&life_lock);
+}
+
+static void log_write(int l, const char *fmt, va_list ap) {
+    if (!log_enabled(l)) return;
+    char msg[LOG_MSG_MAX];
+    int n = vsnprintf(msg, sizeof(msg), fmt, ap);
+    if (n < 0) return;
+    size_t len = (size_t)n < sizeof(msg) ? (size_t)n : sizeof(msg) - 1;
+    if (atomic_load_explicit(&running, memory_order_acquire)) {
+        if (ring_push(l, msg, len) == 0) {
+            wake_consumer();
+        } else {
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        }
+        return;
+    }
+    char line[LOG_MSG_MAX + 64];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    size_t total = format_line(line, sizeof(line), ts.tv_sec, l, msg, len);
+    FILE *f = level_stream(l);
+    fwrite(line, 1, total, f);
+    fflush(f);
+}
+
+void log_debug(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    log_write(LOG_DEBUG, fmt, ap);
+    va_end(ap);
+}
+
+void log_info(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    log_write(LOG_INFO, fmt, ap);
+    va_end(ap);
+}
+
+void log_error(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    log_write(LOG_ERROR, fmt, ap);
+    va_end(ap);
+}
@@ -0,0 +1,26 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+enum log_level {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_ERROR,
+};
+
+void log_set_level(int level);
+int log_get_level(void);
+int log_enabled(int level);
+int log_level_parse(const char *name, int *level);
+const char *log_level_name(int level);
+uint64_t log_dropped(void);
+
+int log_start(void);
+void log_stop(void);
+
+void log_debug(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void log_info(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void log_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
@@ -0,0 +1,247 @@
+#define _GNU_SOURCE
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define METRICS_HTTP_BODY (256 * 1024)
+
+static const char *const transport_names[METRICS_TRANSPORTS] = {"tcp", "udp", "unix"};
+static const char *const rate_scope_names[METRICS_RATE_SCOPES] = {"conn", "ip"};
+static const double quantiles[] = {0.5, 0.99, 0.999};
+
+struct render_buf {
+    char *out;
+    size_t cap;
+    size_t len;
+    int overflow;
+};
+
+__attribute__((format(printf, 2, 3))) static void put(struct render_buf *b, const char *fmt, ...) {
+    if (b->overflow) return;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(b->out + b->len, b->cap - b->len, fmt, ap);
+    va_end(ap);
+    if (n < 0 || (size_t)n >= b->cap - b->len) {
+        b->overflow = 1;
+        return;
+    }
+    b->len += (size_t)n;
+}
+
+static void put_summary(struct render_buf *b, const char *name, const char *label, const char *value, const struct hist_snapshot *s, double scale) {
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+        put(b, "%s{%s=\"%s\",quantile=\"%g\"} %.9g\n", name, label, value, quantiles[i], (double)hist_quantile(s, quantiles[i]) * scale);
+    }
+    put(b, "%s_sum{%s=\"%s\"} %.9g\n", name, label, value, (double)s->sum * scale);
+    put(b, "%s_count{%s=\"%s\"} %" PRIu64 "\n", name, label, value, s->count);
+}
+
+int metrics_render(char *out, size_t cap, struct worker_metrics **workers, int count, const struct server_stats *stats) {
+    struct render_buf b = {out, cap, 0, 0};
+    struct hist_snapshot *snap = malloc(sizeof(*snap));
+    if (!snap || cap == 0) {
+        free(snap);
+        return -1;
+    }
+    put(&b, "# TYPE server_command_latency_seconds summary\n");
+    for (int id = 0; id < COMMAND_ID_COUNT; id++) {
+        const char *name = command_name(id);
+        if (!name) continue;
+        memset(snap, 0, sizeof(*snap));
+        for (int w = 0; w < count; w++) hist_snapshot_add(snap, &workers[w]->commands[id]);
+        if (snap->count == 0) continue;
+        put_summary(&b, "server_command_latency_seconds", "command", name, snap, 1e-9);
+    }
+    put(&b, "# TYPE server_transport_latency_seconds summary\n");
+    for (int t = 0; t < METRICS_TRANSPORTS; t++) {
+        memset(snap, 0, sizeof(*snap));
+        for (int w = 0; w < count; w++) hist_snapshot_add(snap, &workers[w]->transport[t]);
+        put_summary(&b, "server_transport_latency_seconds", "transport", transport_names[t], snap, 1e-9);
+    }
+    put(&b, "# TYPE server_loop_batch_events summary\n");
+    memset(snap, 0, sizeof(*snap));
+    for (int w = 0; w < count; w++) hist_snapshot_add(snap, &workers[w]->loop_batch);
+    put_summary(&b, "server_loop_batch_events", "loop", "all", snap, 1.0);
+    free(snap);
+    uint64_t in[METRICS_TRANSPORTS] = {0};
+    uint64_t outb[METRICS_TRANSPORTS] = {0};
+    uint64_t eagain = 0;
+    uint64_t wakeups = 0;
+    uint64_t yields = 0;
+    uint64_t ps[4] = {0};
+    uint64_t throttled[METRICS_RATE_SCOPES] = {0};
+    uint64_t rate_dropped = 0;
+    for (int w = 0; w < count; w++) {
+        for (int t = 0; t < METRICS_TRANSPORTS; t++) {
+            in[t] += atomic_load_explicit(&workers[w]->bytes_in[t], memory_order_relaxed);
+            outb[t] += atomic_load_explicit(&workers[w]->bytes_out[t], memory_order_relaxed);
+        }
+        eagain += atomic_load_explicit(&workers[w]->send_eagain, memory_order_relaxed);
+        wakeups += atomic_load_explicit(&workers[w]->loop_wakeups, memory_order_relaxed);
+        yields += atomic_load_explicit(&workers[w]->read_yields, memory_order_relaxed);
+        ps[0] += atomic_load_explicit(&workers[w]->pubsub_messages, memory_order_relaxed);
+        ps[1] += atomic_load_explicit(&workers[w]->pubsub_deliveries, memory_order_relaxed);
+        ps[2] += atomic_load_explicit(&workers[w]->pubsub_dropped, memory_order_relaxed);
+        ps[3] += atomic_load_explicit(&workers[w]->pubsub_yields, memory_order_relaxed);
+        for (int s = 0; s < METRICS_RATE_SCOPES; s++) throttled[s] += atomic_load_explicit(&workers[w]->rate_throttled[s], memory_order_relaxed);
+        rate_dropped += atomic_load_explicit(&workers[w]->rate_dropped, memory_order_relaxed);
+    }
+    put(&b, "# TYPE server_bytes_in_total counter\n");
+    for (int t = 0; t < METRICS_TRANSPORTS; t++) put(&b, "server_bytes_in_total{transport=\"%s\"} %" PRIu64 "\n", transport_names[t], in[t]);
+    put(&b, "# TYPE server_bytes_out_total counter\n");
+    for (int t = 0; t < METRICS_TRANSPORTS; t++) put(&b, "server_bytes_out_total{transport=\"%s\"} %" PRIu64 "\n", transport_names[t], outb[t]);
+    put(&b, "# TYPE server_send_eagain_total counter\nserver_send_eagain_total %" PRIu64 "\n", eagain);
+    put(&b, "# TYPE server_loop_wakeups_total counter\nserver_loop_wakeups_total %" PRIu64 "\n", wakeups);
+    put(&b, "# TYPE server_read_yields_total counter\nserver_read_yields_total %" PRIu64 "\n", yields);
+    put(&b, "# TYPE server_pubsub_messages_total counter\nserver_pubsub_messages_total %" PRIu64 "\n", ps[0]);
+    put(&b, "# TYPE server_pubsub_deliveries_total counter\nserver_pubsub_deliveries_total %" PRIu64 "\n", ps[1]);
+    put(&b, "# TYPE server_pubsub_dropped_total counter\nserver_pubsub_dropped_total %" PRIu64 "\n", ps[2]);
+    put(&b, "# TYPE server_pubsub_yields_total counter\nserver_pubsub_yields_total %" PRIu64 "\n", ps[3]);
+    put(&b, "# TYPE server_rate_throttled_total counter\n");
+    for (int s = 0; s < METRICS_RATE_SCOPES; s++) put(&b, "server_rate_throttled_total{scope=\"%s\"} %" PRIu64 "\n", rate_scope_names[s], throttled[s]);
+    put(&b, "# TYPE server_rate_dropped_total counter\nserver_rate_dropped_total %" PRIu64 "\n", rate_dropped);
+    put(&b, "# TYPE server_tcp_clients_total counter\nserver_tcp_clients_total %" PRIu64 "\n", stats->total_tcp_clients);
+    put(&b, "# TYPE server_tcp_clients gauge\nserver_tcp_clients %" PRIu64 "\n", stats->current_tcp_clients);
+    put(&b, "# TYPE server_udp_messages_total counter\nserver_udp_messages_total %" PRIu64 "\n", stats->total_udp_messages);
+    put(&b, "# TYPE server_unix_clients_total counter\nserver_unix_clients_total %" PRIu64 "\n", stats->total_unix_clients);
+    put(&b, "# TYPE server_unix_clients gauge\nserver_unix_clients %" PRIu64 "\n", stats->current_unix_clients);
+    put(&b, "# TYPE server_unix_messages_total counter\nserver_unix_messages_total %" PRIu64 "\n", stats->total_unix_messages);
+    put(&b, "# TYPE server_pool_hits_total counter\n");
+    put(&b, "server_pool_hits_total{pool=\"client\"} %" PRIu64 "\n", stats->client_pool_hits);
+    put(&b, "server_pool_hits_total{pool=\"buf\"} %" PRIu64 "\n", stats->buf_pool_hits);
+    put(&b, "# TYPE server_pool_misses_total counter\n");
+    put(&b, "server_pool_misses_total{pool=\"client\"} %" PRIu64 "\n", stats->client_pool_misses);
+    put(&b, "server_pool_misses_total{pool=\"buf\"} %" PRIu64 "\n", stats->buf_pool_misses);
+    put(&b, "# TYPE server_log_dropped_total counter\nserver_log_dropped_total %" PRIu64 "\n", stats->log_dropped);
+    put(&b, "# TYPE server_client_timeouts_total counter\nserver_client_timeouts_total %" PRIu64 "\n", stats->client_timeouts);
+    put(&b, "# TYPE server_rejected_clients_total counter\nserver_rejected_clients_total %" PRIu64 "\n", stats->rejected_clients);
+    put(&b, "# TYPE server_accept_pauses_total counter\nserver_accept_pauses_total %" PRIu64 "\n", stats->accept_pauses);
+    put(&b, "# TYPE server_udp_drops_total counter\nserver_udp_drops_total %" PRIu64 "\n", stats->udp_drops);
+    put(&b, "# TYPE server_udp_tx_drops_total counter\nserver_udp_tx_drops_total %" PRIu64 "\n", stats->udp_tx_drops);
+    put(&b, "# TYPE server_kv_keys gauge\nserver_kv_keys %" PRIu64 "\n", stats->kv_keys);
+    put(&b, "# TYPE server_kv_bytes gauge\nserver_kv_bytes %" PRIu64 "\n", stats->kv_bytes);
+    if (b.overflow) return -1;
+    return (int)b.len;
+}
+
+static void http_send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return;
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+static void http_serve(struct metrics_http *h, int fd, char *body) {
+    struct timeval tv = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    char req[2048];
+    size_t len = 0;
+    while (len < sizeof(req) - 1) {
+        ssize_t n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) break;
+        len += (size_t)n;
+        req[len] = '\0';
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) break;
+    }
+    int blen = h->render(h->arg, body, METRICS_HTTP_BODY);
+    char head[256];
+    int hlen;
+    if (blen < 0) {
+        hlen = snprintf(head, sizeof(head), "HTTP/1.0 500 Internal Server Error\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        blen = 0;
+    } else {
+        hlen = snprintf(head,
+                        sizeof(head),
+                        "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",
+                        blen);
+    }
+    http_send_all(fd, head, (size_t)hlen);
+    http_send_all(fd, body, (size_t)blen);
+    shutdown(fd, SHUT_WR);
+}
+
+static void *http_thread(void *arg) {
+    struct metrics_http *h = arg;
+    char *body = malloc(METRICS_HTTP_BODY);
+    if (!body) return NULL;
+    while (!atomic_load(&h->stop)) {
+        struct pollfd pfd = {h->fd, POLLIN, 0};
+        int r = poll(&pfd, 1, 200);
+        if (r <= 0) continue;
+        int cfd = accept4(h->fd, NULL, NULL, SOCK_CLOEXEC);
+        if (cfd == -1) continue;
+        http_serve(h, cfd, body);
+        close(cfd);
+    }
+    free(body);
+    return NULL;
+}
+
+int metrics_http_listen(const char *bind_addr, int port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, bind_addr ? bind_addr : "127.0.0.1", &addr.sin_addr) != 1) {
+        log_error("invalid metrics bind address: %s", bind_addr);
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        perror("socket metrics");
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, 16) == -1) {
+        perror("bind metrics");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int metrics_http_start(struct metrics_http *h, int fd, int (*render)(void *arg, char *out, size_t cap), void *arg) {
+    memset(h, 0, sizeof(*h));
+    h->fd = -1;
+    h->render = render;
+    h->arg = arg;
+    atomic_init(&h->stop, 0);
+    if (fd == -1) return -1;
+    h->fd = fd;
+    int err = pthread_create(&h->thread, NULL, http_thread, h);
+    if (err != 0) {
+        log_error("failed to start metrics thread: %s", strerror(err));
+        close(fd);
+        h->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void metrics_http_stop(struct metrics_http *h) {
+    if (h->fd == -1) return;
+    atomic_store(&h->stop, 1);
+    pthread_join(h->thread, NULL);
+    close(h->fd);
+    h->fd = -1;
+}
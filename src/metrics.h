@@ -0,0 +1,63 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "commands.h"
+#include "hist.h"
+
+enum metrics_transport {
+    METRICS_TCP,
+    METRICS_UDP,
+    METRICS_UNIX,
+    METRICS_TRANSPORTS,
+};
+
+enum metrics_rate_scope {
+    METRICS_RATE_CONN,
+    METRICS_RATE_IP,
+    METRICS_RATE_SCOPES,
+};
+
+struct worker_metrics {
+    struct hist commands[COMMAND_ID_COUNT];
+    struct hist transport[METRICS_TRANSPORTS];
+    struct hist loop_batch;
+    _Atomic uint64_t bytes_in[METRICS_TRANSPORTS];
+    _Atomic uint64_t bytes_out[METRICS_TRANSPORTS];
+    _Atomic uint64_t send_eagain;
+    _Atomic uint64_t loop_wakeups;
+    _Atomic uint64_t read_yields;
+    _Atomic uint64_t pubsub_messages;
+    _Atomic uint64_t pubsub_deliveries;
+    _Atomic uint64_t pubsub_dropped;
+    _Atomic uint64_t pubsub_yields;
+    _Atomic uint64_t rate_throttled[METRICS_RATE_SCOPES];
+    _Atomic uint64_t rate_dropped;
+};
+
+struct metrics_http {
+    int fd;
+    pthread_t thread;
+    atomic_int stop;
+    int (*render)(void *arg, char *out, size_t cap);
+    void *arg;
+};
+
+static inline uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+int metrics_render(char *out, size_t cap, struct worker_metrics **workers, int count, const struct server_stats *stats);
+
+int metrics_http_listen(const char *bind_addr, int port);
+int metrics_http_start(struct metrics_http *h, int fd, int (*render)(void *arg, char *out, size_t cap), void *arg);
+void metrics_http_stop(struct metrics_http *h);
+
+#endif
@@ -0,0 +1,154 @@
+#include "outq.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define OUTQ_CHUNK 4096
+#define OUTQ_MAX_IOV 64
+
+struct obuf *obuf_new(size_t cap) {
+    struct obuf *b = malloc(sizeof(*b) + cap);
+    if (!b) return NULL;
+    atomic_init(&b->refs, 1);
+    b->len = 0;
+    b->cap = cap;
+    return b;
+}
+
+void obuf_ref(struct obuf *b) {
+    atomic_fetch_add_explicit(&b->refs, 1, memory_order_relaxed);
+}
+
+void obuf_unref(struct obuf *b) {
+    if (atomic_fetch_sub_explicit(&b->refs, 1, memory_order_acq_rel) == 1) free(b);
+}
+
+void outq_init(struct outq *q) {
+    q->head = NULL;
+    q->tail = NULL;
+    q->bytes = 0;
+}
+
+static void seg_free(struct oseg *s) {
+    obuf_unref(s->buf);
+    free(s);
+}
+
+void outq_clear(struct outq *q) {
+    struct oseg *s = q->head;
+    while (s) {
+        struct oseg *next = s->next;
+        seg_free(s);
+        s = next;
+    }
+    outq_init(q);
+}
+
+static int tail_writable(const struct outq *q) {
+    const struct oseg *t = q->tail;
+    return t && atomic_load_explicit(&t->buf->refs, memory_order_relaxed) == 1 && t->off + t->len == t->buf->len;
+}
+
+int outq_append(struct outq *q, const void *data, size_t len) {
+    const char *p = data;
+    if (len == 0) return 0;
+    if (tail_writable(q)) {
+        struct oseg *t = q->tail;
+        size_t room = t->buf->cap - t->buf->len;
+        size_t n = len < room ? len : room;
+        memcpy(t->buf->data + t->buf->len, p, n);
+        t->buf->len += n;
+        t->len += n;
+        q->bytes += n;
+        p += n;
+        len -= n;
+        if (len == 0) return 0;
+    }
+    struct oseg *s = malloc(sizeof(*s));
+    if (!s) return -1;
+    s->buf = obuf_new(len > OUTQ_CHUNK ? len : OUTQ_CHUNK);
+    if (!s->buf) {
+        free(s);
+        return -1;
+    }
+    memcpy(s->buf->data, p, len);
+    s->buf->len = len;
+    s->off = 0;
+    s->len = len;
+    s->next = NULL;
+    if (q->tail) {
+        q->tail->next = s;
+    } else {
+        q->head = s;
+    }
+    q->tail = s;
+    q->bytes += len;
+    return 0;
+}
+
+int outq_append_ref(struct outq *q, struct obuf *buf, size_t off, size_t len) {
+    if (len == 0) return 0;
+    struct oseg *s = malloc(sizeof(*s));
+    if (!s) return -1;
+    obuf_ref(buf);
+    s->buf = buf;
+    s->off = off;
+    s->len = len;
+    s->next = NULL;
+    if (q->tail) {
+        q->tail->next = s;
+    } else {
+        q->head = s;
+    }
+    q->tail = s;
+    q->bytes += len;
+    return 0;
+}
+
+void outq_consume(struct outq *q, size_t n) {
+    q->bytes -= n;
+    while (n > 0) {
+        struct oseg *s = q->head;
+        if (n < s->len) {
+            s->off += n;
+            s->len -= n;
+            return;
+        }
+        n -= s->len;
+        q->head = s->next;
+        if (!q->head) q->tail = NULL;
+        seg_free(s);
+    }
+}
+
+ssize_t outq_flush(struct outq *q, int fd) {
+    size_t total = 0;
+    while (q->head) {
+        struct iovec iov[OUTQ_MAX_IOV];
+        int cnt = 0;
+        size_t want = 0;
+        for (struct oseg *s = q->head; s && cnt < OUTQ_MAX_IOV; s = s->next) {
+            iov[cnt].iov_base = s->buf->data + s->off;
+            iov[cnt].iov_len = s->len;
+            want += s->len;
+            cnt++;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t)cnt;
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        outq_consume(q, (size_t)n);
+        total += (size_t)n;
+        if ((size_t)n < want) break;
+    }
+    return (ssize_t)total;
+}
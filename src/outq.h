@@ -0,0 +1,43 @@
+#ifndef OUTQ_H
+#define OUTQ_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+struct obuf {
+    atomic_uint refs;
+    size_t len;
+    size_t cap;
+    char data[];
+};
+
+struct oseg {
+    struct oseg *next;
+    struct obuf *buf;
+    size_t off;
+    size_t len;
+};
+
+struct outq {
+    struct oseg *head;
+    struct oseg *tail;
+    size_t bytes;
+};
+
+struct obuf *obuf_new(size_t cap);
+void obuf_ref(struct obuf *b);
+void obuf_unref(struct obuf *b);
+
+void outq_init(struct outq *q);
+void outq_clear(struct outq *q);
+int outq_append(struct outq *q, const void *data, size_t len);
+int outq_append_ref(struct outq *q, struct obuf *buf, size_t off, size_t len);
+void outq_consume(struct outq *q, size_t n);
+ssize_t outq_flush(struct outq *q, int fd);
+
+static inline int outq_empty(const struct outq *q) {
+    return q->head == NULL;
+}
+
+#endif
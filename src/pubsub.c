@@ -0,0 +1,603 @@
+#define _GNU_SOURCE
+#include "pubsub.h"
+#include "binproto.h"
+#include "metrics.h"
+#include "server_internal.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PS_TABLE_MIN 16
+#define PS_HUB_MASK_WORKERS 64
+#define PS_PREFIX "message "
+#define PS_PREFIX_LEN (sizeof(PS_PREFIX) - 1)
+
+struct ps_key {
+    uint32_t hash;
+    uint32_t len;
+    char name[PUBSUB_TOPIC_MAX];
+};
+
+struct ps_table {
+    struct ps_key **slots;
+    uint32_t mask;
+    uint32_t count;
+};
+
+struct ps_tcp_sub {
+    struct client *client;
+    uint32_t link;
+};
+
+struct ps_udp_sub {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+};
+
+struct ps_topic {
+    struct ps_key key;
+    struct ps_tcp_sub *tcp;
+    uint32_t tcp_count;
+    uint32_t tcp_cap;
+    uint32_t tcp_cursor;
+    struct ps_udp_sub *udp;
+    uint32_t udp_count;
+    uint32_t udp_cap;
+    uint32_t udp_cursor;
+    int busy;
+};
+
+struct ps_link {
+    struct ps_topic *topic;
+    uint32_t idx;
+};
+
+struct ps_hub_topic {
+    struct ps_key key;
+    uint64_t subs;
+    uint64_t mask;
+    uint32_t workers;
+};
+
+struct ps_msg {
+    struct ps_msg *next;
+    struct obuf *buf;
+    uint32_t hash;
+    uint32_t topic_len;
+    int started;
+};
+
+struct pubsub_worker {
+    struct ps_table topics;
+    struct ps_msg *head;
+    struct ps_msg *tail;
+    uint32_t udp_peers;
+    pthread_mutex_t lock;
+    struct ps_msg *in_head;
+    struct ps_msg *in_tail;
+    atomic_int in_pending;
+};
+
+struct pubsub_hub {
+    pthread_mutex_t lock;
+    struct ps_table topics;
+    struct pubsub_worker *workers;
+    int workers_count;
+    int fanout_slice;
+    int slow_policy;
+};
+
+static uint32_t topic_hash(const char *name, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) h = (h ^ (uint8_t)name[i]) * 16777619u;
+    return h ^ (uint32_t)len;
+}
+
+static int key_eq(const struct ps_key *k, const char *name, size_t len, uint32_t hash) {
+    return k->hash == hash && k->len == len && memcmp(k->name, name, len) == 0;
+}
+
+static struct ps_key *table_find(const struct ps_table *t, const char *name, size_t len, uint32_t hash) {
+    if (!t->slots) return NULL;
+    for (uint32_t i = hash & t->mask;; i = (i + 1) & t->mask) {
+        struct ps_key *k = t->slots[i];
+        if (!k) return NULL;
+        if (key_eq(k, name, len, hash)) return k;
+    }
+}
+
+static void table_place(struct ps_key **slots, uint32_t mask, struct ps_key *k) {
+    uint32_t i = k->hash & mask;
+    while (slots[i]) i = (i + 1) & mask;
+    slots[i] = k;
+}
+
+static int table_insert(struct ps_table *t, struct ps_key *k) {
+    if (!t->slots || (t->count + 1) * 4 > (t->mask + 1) * 3) {
+        uint32_t cap = t->slots ? (t->mask + 1) * 2 : PS_TABLE_MIN;
+        struct ps_key **slots = calloc(cap, sizeof(*slots));
+        if (!slots) return -1;
+        for (uint32_t i = 0; t->slots && i <= t->mask; i++) {
+            if (t->slots[i]) table_place(slots, cap - 1, t->slots[i]);
+        }
+        free(t->slots);
+        t->slots = slots;
+        t->mask = cap - 1;
+    }
+    table_place(t->slots, t->mask, k);
+    t->count++;
+    return 0;
+}
+
+static void table_remove(struct ps_table *t, const struct ps_key *k) {
+    uint32_t i = k->hash & t->mask;
+    while (t->slots[i] != k) i = (i + 1) & t->mask;
+    for (uint32_t j = (i + 1) & t->mask; t->slots[j]; j = (j + 1) & t->mask) {
+        uint32_t home = t->slots[j]->hash & t->mask;
+        if (((j - home) & t->mask) >= ((j - i) & t->mask)) {
+            t->slots[i] = t->slots[j];
+            i = j;
+        }
+    }
+    t->slots[i] = NULL;
+    t->count--;
+}
+
+static void key_init(struct ps_key *k, const char *name, size_t len, uint32_t hash) {
+    k->hash = hash;
+    k->len = (uint32_t)len;
+    memcpy(k->name, name, len);
+}
+
+static void hub_update(struct pubsub_hub *hub, const struct ps_key *key, int worker, int subs_delta, int worker_delta) {
+    pthread_mutex_lock(&hub->lock);
+    struct ps_hub_topic *ht = (struct ps_hub_topic *)table_find(&hub->topics, key->name, key->len, key->hash);
+    if (!ht && worker_delta > 0) {
+        ht = calloc(1, sizeof(*ht));
+        if (ht) {
+            key_init(&ht->key, key->name, key->len, key->hash);
+            if (table_insert(&hub->topics, &ht->key) == -1) {
+                free(ht);
+                ht = NULL;
+            }
+        }
+        if (!ht) log_error("pubsub: failed to index topic %.*s", (int)key->len, key->name);
+    }
+    if (ht) {
+        ht->subs += (uint64_t)(int64_t)subs_delta;
+        if (worker_delta) {
+            ht->workers += (uint32_t)worker_delta;
+            if (worker < PS_HUB_MASK_WORKERS) {
+                uint64_t bit = (uint64_t)1 << worker;
+                ht->mask = worker_delta > 0 ? ht->mask | bit : ht->mask & ~bit;
+            }
+        }
+        if (ht->workers == 0) {
+            table_remove(&hub->topics, &ht->key);
+            free(ht);
+        }
+    }
+    pthread_mutex_unlock(&hub->lock);
+}
+
+static struct ps_topic *topic_get(struct server_state *st, const char *name, size_t len, uint32_t hash) {
+    struct ps_topic *t = (struct ps_topic *)table_find(&st->pubsub->topics, name, len, hash);
+    if (t) return t;
+    t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    key_init(&t->key, name, len, hash);
+    if (table_insert(&st->pubsub->topics, &t->key) == -1) {
+        free(t);
+        return NULL;
+    }
+    hub_update(st->shared->pubsub, &t->key, st->id, 0, 1);
+    return t;
+}
+
+static void topic_free(struct ps_topic *t) {
+    free(t->tcp);
+    free(t->udp);
+    free(t);
+}
+
+static void topic_release(struct server_state *st, struct ps_topic *t) {
+    if (t->busy || t->tcp_count + t->udp_count > 0) return;
+    table_remove(&st->pubsub->topics, &t->key);
+    hub_update(st->shared->pubsub, &t->key, st->id, 0, -1);
+    topic_free(t);
+}
+
+static void tcp_move(struct ps_topic *t, uint32_t from, uint32_t to) {
+    if (from == to) return;
+    t->tcp[to] = t->tcp[from];
+    t->tcp[to].client->ps_links[t->tcp[to].link].idx = to;
+}
+
+static void tcp_remove(struct ps_topic *t, uint32_t i) {
+    uint32_t last = t->tcp_count - 1;
+    if (i < t->tcp_cursor) {
+        t->tcp_cursor--;
+        tcp_move(t, t->tcp_cursor, i);
+        tcp_move(t, last, t->tcp_cursor);
+    } else {
+        tcp_move(t, last, i);
+    }
+    t->tcp_count--;
+}
+
+static void udp_remove(struct ps_topic *t, uint32_t i) {
+    uint32_t last = t->udp_count - 1;
+    if (i < t->udp_cursor) {
+        t->udp_cursor--;
+        t->udp[i] = t->udp[t->udp_cursor];
+        t->udp[t->udp_cursor] = t->udp[last];
+    } else {
+        t->udp[i] = t->udp[last];
+    }
+    t->udp_count--;
+}
+
+static void link_remove(struct client *c, uint32_t i) {
+    uint32_t last = --c->ps_count;
+    if (i == last) return;
+    c->ps_links[i] = c->ps_links[last];
+    struct ps_link *l = &c->ps_links[i];
+    l->topic->tcp[l->idx].link = i;
+}
+
+static void *grow(void *arr, uint32_t *cap, uint32_t need, size_t size) {
+    if (need <= *cap) return arr;
+    uint32_t n = *cap ? *cap * 2 : 4;
+    while (n < need) n *= 2;
+    void *p = realloc(arr, (size_t)n * size);
+    if (p) *cap = n;
+    return p;
+}
+
+static const char *sub_tcp(struct server_state *st, struct client *c, const char *name, size_t len, uint32_t hash) {
+    for (uint32_t i = 0; i < c->ps_count; i++) {
+        if (key_eq(&c->ps_links[i].topic->key, name, len, hash)) return NULL;
+    }
+    if (c->ps_count >= PUBSUB_CLIENT_TOPICS_MAX) return "too many subscriptions\n";
+    struct ps_link *links = grow(c->ps_links, &c->ps_cap, c->ps_count + 1, sizeof(*links));
+    if (!links) return "out of memory\n";
+    c->ps_links = links;
+    struct ps_topic *t = topic_get(st, name, len, hash);
+    if (!t) return "out of memory\n";
+    struct ps_tcp_sub *subs = grow(t->tcp, &t->tcp_cap, t->tcp_count + 1, sizeof(*subs));
+    if (!subs) {
+        topic_release(st, t);
+        return "out of memory\n";
+    }
+    t->tcp = subs;
+    t->tcp[t->tcp_count] = (struct ps_tcp_sub){c, c->ps_count};
+    c->ps_links[c->ps_count++] = (struct ps_link){t, t->tcp_count++};
+    hub_update(st->shared->pubsub, &t->key, st->id, 1, 0);
+    return NULL;
+}
+
+static void unsub_tcp(struct server_state *st, struct client *c, const char *name, size_t len, uint32_t hash) {
+    for (uint32_t i = 0; i < c->ps_count; i++) {
+        struct ps_topic *t = c->ps_links[i].topic;
+        if (!key_eq(&t->key, name, len, hash)) continue;
+        tcp_remove(t, c->ps_links[i].idx);
+        link_remove(c, i);
+        hub_update(st->shared->pubsub, &t->key, st->id, -1, 0);
+        topic_release(st, t);
+        return;
+    }
+}
+
+static int udp_find(const struct ps_topic *t, const struct sockaddr *addr, socklen_t addr_len) {
+    for (uint32_t i = 0; i < t->udp_count; i++) {
+        if (t->udp[i].addr_len == addr_len && memcmp(&t->udp[i].addr, addr, addr_len) == 0) return (int)i;
+    }
+    return -1;
+}
+
+static const char *sub_udp(struct server_state *st, const struct pubsub_peer *p, const char *name, size_t len, uint32_t hash) {
+    struct pubsub_worker *w = st->pubsub;
+    struct ps_topic *t = (struct ps_topic *)table_find(&w->topics, name, len, hash);
+    if (t && udp_find(t, p->addr, p->addr_len) >= 0) return NULL;
+    if (p->addr_len <= sizeof(sa_family_t)) return "invalid address\n";
+    if (w->udp_peers >= PUBSUB_UDP_PEERS_MAX || p->addr_len > sizeof(struct sockaddr_storage)) return "too many subscriptions\n";
+    if (!t) t = topic_get(st, name, len, hash);
+    if (!t) return "out of memory\n";
+    struct ps_udp_sub *peers = grow(t->udp, &t->udp_cap, t->udp_count + 1, sizeof(*peers));
+    if (!peers) {
+        topic_release(st, t);
+        return "out of memory\n";
+    }
+    t->udp = peers;
+    struct ps_udp_sub *s = &t->udp[t->udp_count++];
+    memcpy(&s->addr, p->addr, p->addr_len);
+    s->addr_len = p->addr_len;
+    w->udp_peers++;
+    hub_update(st->shared->pubsub, &t->key, st->id, 1, 0);
+    return NULL;
+}
+
+static void unsub_udp(struct server_state *st, const struct pubsub_peer *p, const char *name, size_t len, uint32_t hash) {
+    struct ps_topic *t = (struct ps_topic *)table_find(&st->pubsub->topics, name, len, hash);
+    if (!t) return;
+    int i = udp_find(t, p->addr, p->addr_len);
+    if (i < 0) return;
+    udp_remove(t, (uint32_t)i);
+    st->pubsub->udp_peers--;
+    hub_update(st->shared->pubsub, &t->key, st->id, -1, 0);
+    topic_release(st, t);
+}
+
+static void msg_free(struct ps_msg *m) {
+    obuf_unref(m->buf);
+    free(m);
+}
+
+static void inbox_push(struct server_shared *sh, int worker, struct ps_msg *m) {
+    struct pubsub_worker *w = &sh->pubsub->workers[worker];
+    pthread_mutex_lock(&w->lock);
+    int was_empty = w->in_head == NULL;
+    if (w->in_tail) {
+        w->in_tail->next = m;
+    } else {
+        w->in_head = m;
+    }
+    w->in_tail = m;
+    atomic_store_explicit(&w->in_pending, 1, memory_order_release);
+    pthread_mutex_unlock(&w->lock);
+    uint64_t one = 1;
+    int fd = sh->workers[worker].wake_fd;
+    if (was_empty && fd != -1 && write(fd, &one, sizeof(one)) == -1 && errno != EAGAIN) perror("write wake_fd");
+}
+
+static void local_push(struct pubsub_worker *w, struct ps_msg *m) {
+    if (w->tail) {
+        w->tail->next = m;
+    } else {
+        w->head = m;
+    }
+    w->tail = m;
+}
+
+static uint64_t publish(struct server_state *st, const char *name, size_t len, uint32_t hash, const char *msg, size_t msg_len) {
+    struct server_shared *sh = st->shared;
+    struct pubsub_hub *hub = sh->pubsub;
+    pthread_mutex_lock(&hub->lock);
+    struct ps_hub_topic *ht = (struct ps_hub_topic *)table_find(&hub->topics, name, len, hash);
+    uint64_t subs = ht ? ht->subs : 0;
+    uint64_t mask = ht ? ht->mask : 0;
+    pthread_mutex_unlock(&hub->lock);
+    if (subs == 0) return 0;
+    size_t text_len = PS_PREFIX_LEN + len + 1 + msg_len + 1;
+    struct obuf *buf = obuf_new(BIN_HEADER_LEN + text_len);
+    if (!buf) return 0;
+    struct bin_header h = {(uint32_t)text_len, BIN_OP_MESSAGE, BIN_OK, 0};
+    bin_header_encode(buf->data, &h);
+    char *p = buf->data + BIN_HEADER_LEN;
+    memcpy(p, PS_PREFIX, PS_PREFIX_LEN);
+    p += PS_PREFIX_LEN;
+    memcpy(p, name, len);
+    p += len;
+    *p++ = ' ';
+    memcpy(p, msg, msg_len);
+    p[msg_len] = '\n';
+    buf->len = BIN_HEADER_LEN + text_len;
+    for (int i = 0; i < hub->workers_count; i++) {
+        if (hub->workers_count <= PS_HUB_MASK_WORKERS && !(mask & ((uint64_t)1 << i))) continue;
+        struct ps_msg *m = calloc(1, sizeof(*m));
+        if (!m) break;
+        obuf_ref(buf);
+        m->buf = buf;
+        m->hash = hash;
+        m->topic_len = (uint32_t)len;
+        if (i == st->id) {
+            local_push(st->pubsub, m);
+        } else {
+            inbox_push(sh, i, m);
+        }
+    }
+    obuf_unref(buf);
+    metric_add(&st->metrics->pubsub_messages, 1);
+    return subs;
+}
+
+int pubsub_command(void *arg, int op, struct server_view topic, struct server_view msg, char *out, size_t cap) {
+    struct pubsub_peer *p = arg;
+    struct server_state *st = p->st;
+    if (topic.len == 0 || topic.len >= PUBSUB_TOPIC_MAX) {
+        int n = snprintf(out, cap, "invalid topic\n");
+        return n < 0 || (size_t)n >= cap ? -1 : n;
+    }
+    uint32_t hash = topic_hash(topic.data, topic.len);
+    const char *err = NULL;
+    int n = 0;
+    switch (op) {
+    case SERVER_PUBSUB_SUB:
+        err = p->client ? sub_tcp(st, p->client, topic.data, topic.len, hash) : sub_udp(st, p, topic.data, topic.len, hash);
+        if (!err) n = snprintf(out, cap, "subscribed %.*s\n", (int)topic.len, topic.data);
+        break;
+    case SERVER_PUBSUB_UNSUB:
+        if (p->client) {
+            unsub_tcp(st, p->client, topic.data, topic.len, hash);
+        } else {
+            unsub_udp(st, p, topic.data, topic.len, hash);
+        }
+        n = snprintf(out, cap, "unsubscribed %.*s\n", (int)topic.len, topic.data);
+        break;
+    case SERVER_PUBSUB_PUB:
+        n = snprintf(out, cap, "published %" PRIu64 "\n", publish(st, topic.data, topic.len, hash, msg.data, msg.len));
+        break;
+    default:
+        return -1;
+    }
+    if (err) n = snprintf(out, cap, "%s", err);
+    return n < 0 || (size_t)n >= cap ? -1 : n;
+}
+
+void pubsub_client_closed(struct server_state *st, struct client *c) {
+    while (c->ps_count > 0) {
+        struct ps_link *l = &c->ps_links[c->ps_count - 1];
+        struct ps_topic *t = l->topic;
+        tcp_remove(t, l->idx);
+        c->ps_count--;
+        hub_update(st->shared->pubsub, &t->key, st->id, -1, 0);
+        topic_release(st, t);
+    }
+    free(c->ps_links);
+    c->ps_links = NULL;
+    c->ps_cap = 0;
+}
+
+static void deliver_tcp(struct server_state *st, struct client *c, struct obuf *buf) {
+    if (!c->alive) return;
+    if (c->out.bytes > st->output_hwm) {
+        metric_add(&st->metrics->pubsub_dropped, 1);
+        if (st->shared->pubsub->slow_policy == SERVER_SLOW_DISCONNECT) {
+            log_info("tcp client fd=%d too slow for pubsub, disconnecting", c->src.fd);
+            close_client(st, c);
+        }
+        return;
+    }
+    size_t off = c->binary ? 0 : BIN_HEADER_LEN;
+    if (outq_append_ref(&c->out, buf, off, buf->len - off) == -1) {
+        metric_add(&st->metrics->pubsub_dropped, 1);
+        close_client(st, c);
+        return;
+    }
+    metric_add(&st->metrics->pubsub_deliveries, 1);
+    client_output_ready(st, c);
+}
+
+static void deliver_udp(struct server_state *st, const struct ps_udp_sub *s, const struct obuf *buf) {
+    size_t len = buf->len - BIN_HEADER_LEN;
+    int fd = s->addr.ss_family == AF_UNIX ? st->unix_dgram_fd : st->udp_fd;
+    ssize_t n;
+    do {
+        n = sendto(fd, buf->data + BIN_HEADER_LEN, len, MSG_DONTWAIT | MSG_NOSIGNAL, (const struct sockaddr *)&s->addr, s->addr_len);
+    } while (n == -1 && errno == EINTR);
+    if (n == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) metric_add(&st->metrics->send_eagain, 1);
+        metric_add(&st->metrics->pubsub_dropped, 1);
+        return;
+    }
+    metric_add(&st->metrics->bytes_out[s->addr.ss_family == AF_UNIX ? METRICS_UNIX : METRICS_UDP], (uint64_t)n);
+    metric_add(&st->metrics->pubsub_deliveries, 1);
+}
+
+static int fanout(struct server_state *st, struct ps_msg *m, int *budget) {
+    const char *name = m->buf->data + BIN_HEADER_LEN + PS_PREFIX_LEN;
+    struct ps_topic *t = (struct ps_topic *)table_find(&st->pubsub->topics, name, m->topic_len, m->hash);
+    if (!t) return 1;
+    if (!m->started) {
+        t->tcp_cursor = 0;
+        t->udp_cursor = 0;
+        m->started = 1;
+    }
+    t->busy = 1;
+    while (*budget > 0 && t->tcp_cursor < t->tcp_count) {
+        struct client *c = t->tcp[t->tcp_cursor++].client;
+        deliver_tcp(st, c, m->buf);
+        (*budget)--;
+    }
+    while (*budget > 0 && t->udp_cursor < t->udp_count) {
+        deliver_udp(st, &t->udp[t->udp_cursor++], m->buf);
+        (*budget)--;
+    }
+    t->busy = 0;
+    int done = t->tcp_cursor >= t->tcp_count && t->udp_cursor >= t->udp_count;
+    topic_release(st, t);
+    return done;
+}
+
+void pubsub_run(struct server_state *st) {
+    struct pubsub_worker *w = st->pubsub;
+    if (atomic_load_explicit(&w->in_pending, memory_order_acquire)) {
+        pthread_mutex_lock(&w->lock);
+        struct ps_msg *head = w->in_head;
+        struct ps_msg *tail = w->in_tail;
+        w->in_head = w->in_tail = NULL;
+        atomic_store_explicit(&w->in_pending, 0, memory_order_relaxed);
+        pthread_mutex_unlock(&w->lock);
+        if (head) {
+            if (w->tail) {
+                w->tail->next = head;
+            } else {
+                w->head = head;
+            }
+            w->tail = tail;
+        }
+    }
+    int budget = st->shared->pubsub->fanout_slice;
+    while (w->head && budget > 0) {
+        struct ps_msg *m = w->head;
+        if (!fanout(st, m, &budget)) {
+            metric_add(&st->metrics->pubsub_yields, 1);
+            break;
+        }
+        w->head = m->next;
+        if (!w->head) w->tail = NULL;
+        msg_free(m);
+    }
+}
+
+int pubsub_pending(struct server_state *st) {
+    struct pubsub_worker *w = st->pubsub;
+    return w->head != NULL || atomic_load_explicit(&w->in_pending, memory_order_relaxed);
+}
+
+int pubsub_init(struct server_shared *sh, int fanout_slice, int slow_policy) {
+    struct pubsub_hub *hub = calloc(1, sizeof(*hub));
+    if (!hub) return -1;
+    hub->workers = calloc((size_t)sh->workers_count, sizeof(*hub->workers));
+    if (!hub->workers) {
+        free(hub);
+        return -1;
+    }
+    pthread_mutex_init(&hub->lock, NULL);
+    hub->workers_count = sh->workers_count;
+    hub->fanout_slice = fanout_slice > 0 ? fanout_slice : 1024;
+    hub->slow_policy = slow_policy;
+    for (int i = 0; i < sh->workers_count; i++) {
+        pthread_mutex_init(&hub->workers[i].lock, NULL);
+        atomic_init(&hub->workers[i].in_pending, 0);
+        sh->workers[i].pubsub = &hub->workers[i];
+    }
+    sh->pubsub = hub;
+    return 0;
+}
+
+static void msgs_free(struct ps_msg *m) {
+    while (m) {
+        struct ps_msg *next = m->next;
+        msg_free(m);
+        m = next;
+    }
+}
+
+void pubsub_destroy(struct server_shared *sh) {
+    struct pubsub_hub *hub = sh->pubsub;
+    if (!hub) return;
+    for (int i = 0; i < hub->workers_count; i++) {
+        struct pubsub_worker *w = &hub->workers[i];
+        for (uint32_t j = 0; w->topics.slots && j <= w->topics.mask; j++) {
+            if (w->topics.slots[j]) topic_free((struct ps_topic *)w->topics.slots[j]);
+        }
+        free(w->topics.slots);
+        msgs_free(w->head);
+        msgs_free(w->in_head);
+        pthread_mutex_destroy(&w->lock);
+        sh->workers[i].pubsub = NULL;
+    }
+    for (uint32_t j = 0; hub->topics.slots && j <= hub->topics.mask; j++) free(hub->topics.slots[j]);
+    free(hub->topics.slots);
+    pthread_mutex_destroy(&hub->lock);
+    free(hub->workers);
+    free(hub);
+    sh->pubsub = NULL;
+}
@@ -0,0 +1,32 @@
+#ifndef PUBSUB_H
+#define PUBSUB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "server.h"
+
+#define PUBSUB_TOPIC_MAX 64
+#define PUBSUB_CLIENT_TOPICS_MAX 64
+#define PUBSUB_UDP_PEERS_MAX 4096
+
+struct client;
+struct server_state;
+struct server_shared;
+
+struct pubsub_peer {
+    struct server_state *st;
+    struct client *client;
+    const struct sockaddr *addr;
+    socklen_t addr_len;
+};
+
+int pubsub_init(struct server_shared *sh, int fanout_slice, int slow_policy);
+void pubsub_destroy(struct server_shared *sh);
+int pubsub_command(void *arg, int op, struct server_view topic, struct server_view msg, char *out, size_t cap);
+void pubsub_client_closed(struct server_state *st, struct client *c);
+void pubsub_run(struct server_state *st);
+int pubsub_pending(struct server_state *st);
+
+#endif
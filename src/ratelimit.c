@@ -0,0 +1,211 @@
+#include "ratelimit.h"
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RATE_NIL UINT32_MAX
+
+struct rate_ip_entry {
+    uint8_t key[RATE_IP_KEY];
+    struct rate_bucket msgs;
+    struct rate_bucket bytes;
+    uint32_t prev;
+    uint32_t next;
+};
+
+struct rate_ip_shard {
+    _Alignas(64) pthread_mutex_t lock;
+    struct rate_ip_entry *entries;
+    uint32_t *index;
+    uint32_t mask;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t head;
+    uint32_t tail;
+};
+
+struct rate_ip_table {
+    struct rate_ip_shard shards[RATE_IP_SHARDS];
+    uint64_t msgs_rate;
+    uint64_t bytes_rate;
+};
+
+void rate_ip_key(const struct sockaddr *sa, socklen_t len, uint8_t key[RATE_IP_KEY]) {
+    memset(key, 0, RATE_IP_KEY);
+    if (sa && sa->sa_family == AF_INET && len >= sizeof(struct sockaddr_in)) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)(const void *)sa;
+        key[10] = 0xff;
+        key[11] = 0xff;
+        memcpy(key + 12, &in->sin_addr, 4);
+    } else if (sa && sa->sa_family == AF_INET6 && len >= sizeof(struct sockaddr_in6)) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)(const void *)sa;
+        memcpy(key, &in6->sin6_addr, RATE_IP_KEY);
+    }
+}
+
+static uint32_t key_hash(const uint8_t key[RATE_IP_KEY]) {
+    uint64_t a, b;
+    memcpy(&a, key, 8);
+    memcpy(&b, key + 8, 8);
+    uint64_t h = (a ^ 0x9E3779B97F4A7C15ull) * 0xff51afd7ed558ccdull;
+    h = (h ^ (h >> 32) ^ b) * 0xc4ceb9fe1a85ec53ull;
+    return (uint32_t)(h ^ (h >> 29));
+}
+
+static void lru_unlink(struct rate_ip_shard *s, uint32_t i) {
+    struct rate_ip_entry *e = &s->entries[i];
+    if (e->prev != RATE_NIL) {
+        s->entries[e->prev].next = e->next;
+    } else {
+        s->head = e->next;
+    }
+    if (e->next != RATE_NIL) {
+        s->entries[e->next].prev = e->prev;
+    } else {
+        s->tail = e->prev;
+    }
+}
+
+static void lru_push(struct rate_ip_shard *s, uint32_t i) {
+    struct rate_ip_entry *e = &s->entries[i];
+    e->prev = RATE_NIL;
+    e->next = s->head;
+    if (s->head != RATE_NIL) s->entries[s->head].prev = i;
+    s->head = i;
+    if (s->tail == RATE_NIL) s->tail = i;
+}
+
+static uint32_t index_find(const struct rate_ip_shard *s, const uint8_t key[RATE_IP_KEY], uint32_t *pos) {
+    uint32_t p = key_hash(key) & s->mask;
+    for (;;) {
+        uint32_t i = s->index[p];
+        if (i == RATE_NIL || memcmp(s->entries[i].key, key, RATE_IP_KEY) == 0) {
+            *pos = p;
+            return i;
+        }
+        p = (p + 1) & s->mask;
+    }
+}
+
+static void index_remove(struct rate_ip_shard *s, uint32_t pos) {
+    uint32_t hole = pos;
+    uint32_t p = (pos + 1) & s->mask;
+    while (s->index[p] != RATE_NIL) {
+        uint32_t home = key_hash(s->entries[s->index[p]].key) & s->mask;
+        if (((p - home) & s->mask) >= ((p - hole) & s->mask)) {
+            s->index[hole] = s->index[p];
+            hole = p;
+        }
+        p = (p + 1) & s->mask;
+    }
+    s->index[hole] = RATE_NIL;
+}
+
+static uint32_t shard_lookup(struct rate_ip_table *t, struct rate_ip_shard *s, const uint8_t key[RATE_IP_KEY], uint64_t now_ms) {
+    uint32_t pos;
+    uint32_t i = index_find(s, key, &pos);
+    if (i != RATE_NIL) {
+        if (s->head != i) {
+            lru_unlink(s, i);
+            lru_push(s, i);
+        }
+        return i;
+    }
+    if (s->count < s->cap) {
+        i = s->count++;
+    } else {
+        i = s->tail;
+        uint32_t old;
+        index_find(s, s->entries[i].key, &old);
+        index_remove(s, old);
+        lru_unlink(s, i);
+        index_find(s, key, &pos);
+    }
+    struct rate_ip_entry *e = &s->entries[i];
+    memcpy(e->key, key, RATE_IP_KEY);
+    rate_bucket_init(&e->msgs, t->msgs_rate, now_ms);
+    rate_bucket_init(&e->bytes, t->bytes_rate, now_ms);
+    s->index[pos] = i;
+    lru_push(s, i);
+    return i;
+}
+
+uint64_t rate_ip_charge(struct rate_ip_table *t, const uint8_t key[RATE_IP_KEY], uint64_t msgs, uint64_t bytes, uint64_t now_ms, int debt) {
+    struct rate_ip_shard *s = &t->shards[key_hash(key) >> 28 & (RATE_IP_SHARDS - 1)];
+    uint64_t wait = 0;
+    pthread_mutex_lock(&s->lock);
+    struct rate_ip_entry *e = &s->entries[shard_lookup(t, s, key, now_ms)];
+    int64_t need_msgs = (int64_t)(msgs * 1000);
+    int64_t need_bytes = (int64_t)(bytes * 1000);
+    if (t->msgs_rate) {
+        rate_refill(&e->msgs, t->msgs_rate, now_ms);
+        wait = rate_wait_ms(&e->msgs, t->msgs_rate, need_msgs);
+    }
+    if (t->bytes_rate) {
+        rate_refill(&e->bytes, t->bytes_rate, now_ms);
+        uint64_t w = rate_wait_ms(&e->bytes, t->bytes_rate, need_bytes);
+        if (w > wait) wait = w;
+    }
+    if (debt || wait == 0) {
+        if (t->msgs_rate) e->msgs.level -= need_msgs;
+        if (t->bytes_rate) e->bytes.level -= need_bytes;
+        if (debt) {
+            wait = t->msgs_rate ? rate_wait_ms(&e->msgs, t->msgs_rate, 0) : 0;
+            uint64_t w = t->bytes_rate ? rate_wait_ms(&e->bytes, t->bytes_rate, 0) : 0;
+            if (w > wait) wait = w;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return wait;
+}
+
+size_t rate_ip_count(struct rate_ip_table *t) {
+    size_t n = 0;
+    for (int i = 0; i < RATE_IP_SHARDS; i++) {
+        pthread_mutex_lock(&t->shards[i].lock);
+        n += t->shards[i].count;
+        pthread_mutex_unlock(&t->shards[i].lock);
+    }
+    return n;
+}
+
+struct rate_ip_table *rate_ip_new(size_t entries, uint64_t msgs_rate, uint64_t bytes_rate) {
+    struct rate_ip_table *t = aligned_alloc(64, sizeof(*t));
+    if (!t) return NULL;
+    memset(t, 0, sizeof(*t));
+    t->msgs_rate = msgs_rate;
+    t->bytes_rate = bytes_rate;
+    uint32_t cap = (uint32_t)((entries + RATE_IP_SHARDS - 1) / RATE_IP_SHARDS);
+    if (cap == 0) cap = 1;
+    uint32_t slots = 2;
+    while (slots < cap * 2) slots <<= 1;
+    int ok = 1;
+    for (int i = 0; i < RATE_IP_SHARDS; i++) {
+        struct rate_ip_shard *s = &t->shards[i];
+        pthread_mutex_init(&s->lock, NULL);
+        s->cap = cap;
+        s->mask = slots - 1;
+        s->head = s->tail = RATE_NIL;
+        s->entries = malloc((size_t)cap * sizeof(*s->entries));
+        s->index = malloc((size_t)slots * sizeof(*s->index));
+        if (!s->entries || !s->index) ok = 0;
+        if (s->index) memset(s->index, 0xff, (size_t)slots * sizeof(*s->index));
+    }
+    if (!ok) {
+        rate_ip_free(t);
+        return NULL;
+    }
+    return t;
+}
+
+void rate_ip_free(struct rate_ip_table *t) {
+    if (!t) return;
+    for (int i = 0; i < RATE_IP_SHARDS; i++) {
+        free(t->shards[i].entries);
+        free(t->shards[i].index);
+        pthread_mutex_destroy(&t->shards[i].lock);
+    }
+    free(t);
+}
@@ -0,0 +1,42 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#define RATE_IP_KEY 16
+#define RATE_IP_SHARDS 16
+
+struct rate_bucket {
+    int64_t level;
+    uint64_t stamp_ms;
+};
+
+struct rate_ip_table;
+
+static inline void rate_bucket_init(struct rate_bucket *b, uint64_t rate, uint64_t now_ms) {
+    b->level = (int64_t)(rate * 1000);
+    b->stamp_ms = now_ms;
+}
+
+static inline void rate_refill(struct rate_bucket *b, uint64_t rate, uint64_t now_ms) {
+    if (now_ms <= b->stamp_ms) return;
+    uint64_t elapsed = now_ms - b->stamp_ms;
+    uint64_t missing = (uint64_t)((int64_t)(rate * 1000) - b->level);
+    b->stamp_ms = now_ms;
+    b->level = elapsed > missing / rate ? (int64_t)(rate * 1000) : b->level + (int64_t)(elapsed * rate);
+}
+
+static inline uint64_t rate_wait_ms(const struct rate_bucket *b, uint64_t rate, int64_t need) {
+    if (b->level >= need) return 0;
+    return ((uint64_t)(need - b->level) + rate - 1) / rate;
+}
+
+void rate_ip_key(const struct sockaddr *sa, socklen_t len, uint8_t key[RATE_IP_KEY]);
+struct rate_ip_table *rate_ip_new(size_t entries, uint64_t msgs_rate, uint64_t bytes_rate);
+void rate_ip_free(struct rate_ip_table *t);
+uint64_t rate_ip_charge(struct rate_ip_table *t, const uint8_t key[RATE_IP_KEY], uint64_t msgs, uint64_t bytes, uint64_t now_ms, int debt);
+size_t rate_ip_count(struct rate_ip_table *t);
+
+#endif
@@ -1,91 +1,216 @@
 #define _GNU_SOURCE
 #include "server.h"
+#include "server_internal.h"
+#include "binproto.h"
+#include "commands.h"
+#include "handoff.h"
+#include "kv.h"
+#include "linescan.h"
+#include "metrics.h"
+#include "pubsub.h"
+#include "ratelimit.h"
+#include "timecache.h"
 
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <netinet/in.h>
-#include <stdarg.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
-#include <time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 
-struct client {
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+#define UDP_RX_BUF 2048
+#define UDP_GRO_RX_BUF 65535
+#define UDP_REPLY_MAX 4096
+#define UDP_GSO_MAX_BYTES 65000
+#define UDP_GSO_MAX_SEGS 64
+
+struct udp_batch {
     int fd;
-    char *buf;
-    size_t len;
-    size_t cap;
-    int alive;
+    unsigned size;
+    size_t rx_buf_size;
+    int gro;
+    int gso;
+    struct mmsghdr *rx;
+    struct iovec *rx_iov;
+    struct sockaddr_storage *rx_addr;
+    char *rx_bufs;
+    char *rx_ctrl;
+    struct mmsghdr *tx;
+    struct iovec *tx_iov;
+    struct sockaddr_storage *tx_addr;
+    socklen_t *tx_addrlen;
+    char *tx_ctrl;
+    size_t *tx_seg;
+    unsigned *tx_nsegs;
+    unsigned tx_count;
+    char *arena;
+    size_t arena_cap;
+    size_t arena_len;
 };
 
-struct server_state {
-    int epfd;
-    int tcp_listen_fd;
-    int udp_fd;
-    struct client *clients;
-    size_t clients_count;
-    size_t clients_cap;
-    struct server_stats stats;
-    int shutdown_requested;
-    size_t client_buf_size;
-    int max_clients;
+#define UDP_RX_CTRL (CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(uint32_t)))
+#define UDP_TX_CTRL CMSG_SPACE(sizeof(uint16_t))
+
+#define REPLY_MAX 16384
+#define REPLY_BATCH_IOV 64
+#define FRAME_SCAN_MAX 256
+#define BIN_ECHO_COPY_MAX 512
+
+struct reply_batch {
+    struct iovec iov[REPLY_BATCH_IOV];
+    int iovcnt;
+    size_t out_len;
+    char out[4 * REPLY_MAX];
 };
 
-static void log_ts(char *buf, size_t cap) {
-    time_t now = time(NULL);
-    struct tm tm_now;
-    localtime_r(&now, &tm_now);
-    strftime(buf, cap, "%Y-%m-%d %H:%M:%S", &tm_now);
-}
-
-static void log_info(const char *fmt, ...) {
-    char ts[32];
-    log_ts(ts, sizeof(ts));
-    fprintf(stdout, "[%s] [INFO] ", ts);
-    va_list ap;
-    va_start(ap, fmt);
-    vfprintf(stdout, fmt, ap);
-    va_end(ap);
-    fputc('\n', stdout);
-    fflush(stdout);
-}
-
-static void log_error(const char *fmt, ...) {
-    char ts[32];
-    log_ts(ts, sizeof(ts));
-    fprintf(stderr, "[%s] [ERROR] ", ts);
-    va_list ap;
-    va_start(ap, fmt);
-    vfprintf(stderr, fmt, ap);
-    va_end(ap);
-    fputc('\n', stderr);
-    fflush(stderr);
-}
-
-static int make_nonblocking(int fd) {
-    int flags = fcntl(fd, F_GETFL, 0);
-    if (flags == -1) return -1;
-    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) return -1;
-    return 0;
+static void client_rate_resume(struct server_state *st, struct client *c);
+
+static void collect_counters(void *arg, struct server_stats *out) {
+    struct server_shared *sh = arg;
+    out->total_tcp_clients = out->current_tcp_clients = out->total_udp_messages = 0;
+    out->client_pool_hits = out->client_pool_misses = out->buf_pool_hits = out->buf_pool_misses = 0;
+    out->client_timeouts = out->rejected_clients = out->accept_pauses = out->udp_drops = 0;
+    out->kv_keys = out->kv_bytes = 0;
+    out->total_unix_clients = out->current_unix_clients = out->total_unix_messages = out->udp_tx_drops = 0;
+    for (int i = 0; i < sh->workers_count; i++) {
+        struct worker_counters *wc = &sh->workers[i].counters;
+        out->total_tcp_clients += counter_get(&wc->total_tcp_clients);
+        out->current_tcp_clients += counter_get(&wc->current_tcp_clients);
+        out->total_udp_messages += counter_get(&wc->total_udp_messages);
+        out->client_pool_hits += counter_get(&wc->client_pool_hits);
+        out->client_pool_misses += counter_get(&wc->client_pool_misses);
+        out->buf_pool_hits += counter_get(&wc->buf_pool_hits);
+        out->buf_pool_misses += counter_get(&wc->buf_pool_misses);
+        out->client_timeouts += counter_get(&wc->client_timeouts);
+        out->rejected_clients += counter_get(&wc->rejected_clients);
+        out->accept_pauses += counter_get(&wc->accept_pauses);
+        out->udp_drops += counter_get(&wc->udp_drops);
+        out->total_unix_clients += counter_get(&wc->total_unix_clients);
+        out->current_unix_clients += counter_get(&wc->current_unix_clients);
+        out->total_unix_messages += counter_get(&wc->total_unix_messages);
+        out->udp_tx_drops += counter_get(&wc->udp_tx_drops);
+    }
+    out->log_dropped = log_dropped();
+    if (sh->kv) kv_usage(sh->kv, &out->kv_keys, &out->kv_bytes);
+}
+
+static uint64_t stats_version(void *arg) {
+    struct server_shared *sh = arg;
+    uint64_t v = log_dropped();
+    for (int i = 0; i < sh->workers_count; i++) v += counter_get(&sh->workers[i].counters.version);
+    if (sh->kv) v += kv_version(sh->kv);
+    return v;
 }
 
-static int add_fd_epoll(int epfd, int fd, uint32_t events) {
+static void collect_stats(struct server_shared *sh, struct server_stats *out) {
+    memset(out, 0, sizeof(*out));
+    collect_counters(sh, out);
+}
+
+static void wake_workers(struct server_shared *sh) {
+    for (int i = 0; i < sh->workers_count; i++) {
+        uint64_t one = 1;
+        if (sh->workers[i].wake_fd != -1 && write(sh->workers[i].wake_fd, &one, sizeof(one)) == -1) {
+            perror("write wake_fd");
+        }
+    }
+}
+
+int request_shutdown(struct server_shared *sh) {
+    if (atomic_exchange(&sh->shutdown_requested, 1)) return 0;
+    wake_workers(sh);
+    return 1;
+}
+
+static void request_drain(void *arg) {
+    struct server_shared *sh = arg;
+    metrics_http_stop(sh->http);
+    atomic_store(&sh->drain_requested, 1);
+    wake_workers(sh);
+}
+
+static int add_fd_epoll(int epfd, int fd, uint32_t events, void *ptr) {
     struct epoll_event ev;
     memset(&ev, 0, sizeof(ev));
     ev.events = events;
-    ev.data.fd = fd;
+    ev.data.ptr = ptr;
     if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) return -1;
     return 0;
 }
 
-static int setup_tcp_listener(int port, int backlog) {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
+static void set_int_opt(int fd, int level, int name, int value, const char *what) {
+    if (setsockopt(fd, level, name, &value, sizeof(value)) == -1) log_error("setsockopt %s=%d: %s", what, value, strerror(errno));
+}
+
+static int get_int_opt(int fd, int level, int name) {
+    int v = -1;
+    socklen_t len = sizeof(v);
+    if (getsockopt(fd, level, name, &v, &len) == -1) return -1;
+    return v;
+}
+
+static void apply_common_opts(int fd, const struct server_sockopts *so, int rcvbuf, int sndbuf, int cpu) {
+    if (rcvbuf > 0) set_int_opt(fd, SOL_SOCKET, SO_RCVBUF, rcvbuf, "SO_RCVBUF");
+    if (sndbuf > 0) set_int_opt(fd, SOL_SOCKET, SO_SNDBUF, sndbuf, "SO_SNDBUF");
+    if (so->busy_poll_us > 0) set_int_opt(fd, SOL_SOCKET, SO_BUSY_POLL, so->busy_poll_us, "SO_BUSY_POLL");
+    if (so->tos > 0) set_int_opt(fd, IPPROTO_IP, IP_TOS, so->tos, "IP_TOS");
+    if (so->incoming_cpu && cpu >= 0) set_int_opt(fd, SOL_SOCKET, SO_INCOMING_CPU, cpu, "SO_INCOMING_CPU");
+}
+
+static void log_socket_opts(const char *what, int fd, int tcp) {
+    char nodelay[24] = "";
+    if (tcp) snprintf(nodelay, sizeof(nodelay), " nodelay=%d", get_int_opt(fd, IPPROTO_TCP, TCP_NODELAY));
+    log_info("%s: rcvbuf=%d sndbuf=%d%s busy_poll=%d tos=%#x incoming_cpu=%d",
+             what,
+             get_int_opt(fd, SOL_SOCKET, SO_RCVBUF),
+             get_int_opt(fd, SOL_SOCKET, SO_SNDBUF),
+             nodelay,
+             get_int_opt(fd, SOL_SOCKET, SO_BUSY_POLL),
+             (unsigned)get_int_opt(fd, IPPROTO_IP, IP_TOS),
+             get_int_opt(fd, SOL_SOCKET, SO_INCOMING_CPU));
+}
+
+static int worker_cpu(int id) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        perror("sched_getaffinity");
+        return -1;
+    }
+    int ncpu = CPU_COUNT(&allowed);
+    if (ncpu <= 0) return -1;
+    int want = id % ncpu;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        if (want-- == 0) return cpu;
+    }
+    return -1;
+}
+
+static int setup_tcp_listener(const struct server_config *cfg, int backlog, int reuseport, int cpu) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (fd == -1) {
         perror("socket tcp");
         return -1;
@@ -96,31 +221,41 @@ static int setup_tcp_listener(int port, int backlog) {
         close(fd);
         return -1;
     }
+    if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+        perror("setsockopt SO_REUSEPORT");
+        close(fd);
+        return -1;
+    }
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons((uint16_t)port);
+    addr.sin_port = htons((uint16_t)cfg->port);
     if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
         perror("bind tcp");
         close(fd);
         return -1;
     }
+    apply_common_opts(fd, &cfg->sock, cfg->sock.rcvbuf, cfg->sock.sndbuf, cpu);
+    if (cfg->sock.nodelay) set_int_opt(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    if (cfg->defer_accept_s > 0 &&
+        setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &cfg->defer_accept_s, sizeof(cfg->defer_accept_s)) == -1) {
+        perror("setsockopt TCP_DEFER_ACCEPT");
+    }
+    if (cfg->fastopen_qlen > 0 &&
+        setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &cfg->fastopen_qlen, sizeof(cfg->fastopen_qlen)) == -1) {
+        perror("setsockopt TCP_FASTOPEN");
+    }
     if (listen(fd, backlog) == -1) {
         perror("listen");
         close(fd);
         return -1;
     }
-    if (make_nonblocking(fd) == -1) {
-        perror("nonblock tcp listen");
-        close(fd);
-        return -1;
-    }
     return fd;
 }
 
-static int setup_udp_socket(int port) {
-    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+static int setup_udp_socket(const struct server_config *cfg, int reuseport, int cpu) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (fd == -1) {
         perror("socket udp");
         return -1;
@@ -131,205 +266,870 @@ static int setup_udp_socket(int port) {
         close(fd);
         return -1;
     }
+    if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+        perror("setsockopt SO_REUSEPORT");
+        close(fd);
+        return -1;
+    }
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons((uint16_t)port);
+    addr.sin_port = htons((uint16_t)cfg->port);
     if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
         perror("bind udp");
         close(fd);
         return -1;
     }
-    if (make_nonblocking(fd) == -1) {
-        perror("nonblock udp");
-        close(fd);
-        return -1;
-    }
+    apply_common_opts(fd, &cfg->sock, cfg->sock.udp_rcvbuf, cfg->sock.udp_sndbuf, cpu);
+    set_int_opt(fd, SOL_SOCKET, SO_RXQ_OVFL, 1, "SO_RXQ_OVFL");
     return fd;
 }
 
-static struct client *find_client(struct server_state *st, int fd) {
-    for (size_t i = 0; i < st->clients_count; i++) {
-        if (st->clients[i].fd == fd && st->clients[i].alive) return &st->clients[i];
+static int unix_sockaddr(const char *path, struct sockaddr_un *addr, socklen_t *alen) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    size_t len = strlen(path);
+    if (len < 2 || len >= sizeof(addr->sun_path)) {
+        log_error("unix socket path is too short or too long: %s", path);
+        return -1;
     }
-    return NULL;
+    memcpy(addr->sun_path, path, len);
+    if (path[0] == '@') addr->sun_path[0] = '\0';
+    *alen = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len);
+    return 0;
 }
 
-static int add_client(struct server_state *st, int fd) {
-    if (st->max_clients > 0 && (int)st->stats.current_tcp_clients >= st->max_clients) {
-        log_error("max clients reached, closing fd=%d", fd);
-        close(fd);
+static int unix_socket_live(const struct sockaddr_un *addr, socklen_t alen, int type) {
+    int fd = socket(AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) return 1;
+    int live = connect(fd, (const struct sockaddr *)addr, alen) == 0 || errno != ECONNREFUSED;
+    close(fd);
+    return live;
+}
+
+static int setup_unix_socket(const struct server_config *cfg, const char *path, int type, int backlog) {
+    struct sockaddr_un addr;
+    socklen_t alen;
+    if (unix_sockaddr(path, &addr, &alen) == -1) return -1;
+    int fd = socket(AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket unix");
         return -1;
     }
-    if (st->clients_count == st->clients_cap) {
-        size_t new_cap = st->clients_cap ? st->clients_cap * 2 : 16;
-        struct client *nc = realloc(st->clients, new_cap * sizeof(struct client));
-        if (!nc) {
+    struct stat sb;
+    if (path[0] != '@' && lstat(path, &sb) == 0 && S_ISSOCK(sb.st_mode)) {
+        if (unix_socket_live(&addr, alen, type)) {
+            log_error("bind %s: %s", path, strerror(EADDRINUSE));
             close(fd);
+            errno = EADDRINUSE;
             return -1;
         }
-        st->clients = nc;
-        st->clients_cap = new_cap;
+        unlink(path);
+    }
+    if (bind(fd, (struct sockaddr *)&addr, alen) == -1) {
+        log_error("bind %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
     }
-    struct client c;
-    c.fd = fd;
-    c.buf = malloc(st->client_buf_size);
-    if (!c.buf) {
+    int rcvbuf = type == SOCK_STREAM ? cfg->sock.rcvbuf : cfg->sock.udp_rcvbuf;
+    int sndbuf = type == SOCK_STREAM ? cfg->sock.sndbuf : cfg->sock.udp_sndbuf;
+    if (rcvbuf > 0) set_int_opt(fd, SOL_SOCKET, SO_RCVBUF, rcvbuf, "SO_RCVBUF");
+    if (sndbuf > 0) set_int_opt(fd, SOL_SOCKET, SO_SNDBUF, sndbuf, "SO_SNDBUF");
+    if (type == SOCK_STREAM && listen(fd, backlog) == -1) {
+        perror("listen unix");
         close(fd);
         return -1;
     }
-    c.len = 0;
-    c.cap = st->client_buf_size;
-    c.alive = 1;
-    st->clients[st->clients_count++] = c;
-    st->stats.total_tcp_clients++;
-    st->stats.current_tcp_clients++;
+    return fd;
+}
+
+static int client_slot_reserve(struct server_shared *sh) {
+    int live = atomic_load(&sh->live_clients);
+    do {
+        if (sh->max_clients > 0 && live >= sh->max_clients) return -1;
+    } while (!atomic_compare_exchange_weak(&sh->live_clients, &live, live + 1));
     return 0;
 }
 
-static void close_client(struct server_state *st, struct client *c) {
+static void wake_peers(struct server_state *st, int paused) {
+    struct server_shared *sh = st->shared;
+    for (int i = 0; i < sh->workers_count; i++) {
+        struct server_state *w = &sh->workers[i];
+        uint64_t one = 1;
+        if (w == st || atomic_load(&w->accept_paused) != paused || w->wake_fd == -1) continue;
+        if (write(w->wake_fd, &one, sizeof(one)) == -1) perror("write wake_fd");
+    }
+}
+
+static void client_slot_release(struct server_state *st) {
+    if (atomic_fetch_sub(&st->shared->live_clients, 1) == st->shared->max_clients) wake_peers(st, 1);
+}
+
+struct client *add_client(struct server_state *st, int fd, int local) {
+    if (client_slot_reserve(st->shared) == -1) {
+        stat_add(st, &st->counters.rejected_clients, 1);
+        close(fd);
+        return NULL;
+    }
+    int reused = st->clients.free_head != CLIENT_SLOT_NONE;
+    struct client *c = client_table_alloc(&st->clients);
+    if (!c) {
+        atomic_fetch_sub(&st->shared->live_clients, 1);
+        close(fd);
+        return NULL;
+    }
+    if (st->ring && client_limit_reached(st)) wake_peers(st, 0);
+    stat_add(st, reused ? &st->counters.client_pool_hits : &st->counters.client_pool_misses, 1);
+    if (st->quickack && !local) set_int_opt(fd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+    c->src.fd = fd;
+    c->local = local;
+    c->events = EPOLLIN;
+    outq_init(&c->out);
+    c->alive = 1;
+    c->active_ms = st->now_ms;
+    rate_bucket_init(&c->rate_msgs, st->shared->rate.conn_msgs, st->now_ms);
+    rate_bucket_init(&c->rate_bytes, st->shared->rate.conn_bytes, st->now_ms);
+    if (st->shared->rate_ips && !local) {
+        struct sockaddr_storage addr;
+        socklen_t alen = sizeof(addr);
+        if (getpeername(fd, (struct sockaddr *)&addr, &alen) == 0) rate_ip_key((struct sockaddr *)&addr, alen, c->peer_key);
+    }
+    if (local) {
+        stat_add(st, &st->counters.total_unix_clients, 1);
+        stat_add(st, &st->counters.current_unix_clients, 1);
+    } else {
+        stat_add(st, &st->counters.total_tcp_clients, 1);
+        stat_add(st, &st->counters.current_tcp_clients, 1);
+    }
+    client_timer_update(st, c);
+    return c;
+}
+
+static void client_ready_remove(struct server_state *st, struct client *c) {
+    if (!c->ready_pprev) return;
+    *c->ready_pprev = c->ready_next;
+    if (c->ready_next) {
+        c->ready_next->ready_pprev = c->ready_pprev;
+    } else {
+        st->ready_tail = c->ready_pprev;
+    }
+    c->ready_next = NULL;
+    c->ready_pprev = NULL;
+    st->ready_count--;
+}
+
+static void client_ready_push(struct server_state *st, struct client *c) {
+    if (c->ready_pprev) return;
+    c->ready_next = NULL;
+    c->ready_pprev = st->ready_tail;
+    *st->ready_tail = c;
+    st->ready_tail = &c->ready_next;
+    st->ready_count++;
+}
+
+static struct client *client_ready_pop(struct server_state *st) {
+    struct client *c = st->ready_head;
+    if (c) client_ready_remove(st, c);
+    return c;
+}
+
+void close_client(struct server_state *st, struct client *c) {
     if (!c->alive) return;
-    epoll_ctl(st->epfd, EPOLL_CTL_DEL, c->fd, NULL);
-    close(c->fd);
-    c->alive = 0;
-    if (c->buf) {
-        free(c->buf);
-        c->buf = NULL;
+    timer_cancel(&st->timers, &c->timer);
+    client_ready_remove(st, c);
+    stat_sub(st, c->local ? &st->counters.current_unix_clients : &st->counters.current_tcp_clients, 1);
+    client_slot_release(st);
+    pubsub_client_closed(st, c);
+    if (st->ring) {
+        uring_client_closed(st, c);
+        return;
+    }
+    epoll_ctl(st->epfd, EPOLL_CTL_DEL, c->src.fd, NULL);
+    close(c->src.fd);
+    client_buffer_release(st, c);
+    outq_clear(&c->out);
+    client_table_release(&st->clients, c);
+}
+
+static uint64_t client_deadline(const struct server_state *st, const struct client *c, const char **reason) {
+    uint64_t deadline = UINT64_MAX;
+    *reason = NULL;
+    if (st->idle_timeout_ms) {
+        deadline = c->active_ms + st->idle_timeout_ms;
+        *reason = "idle";
+    }
+    if (st->read_timeout_ms && c->line_since_ms && c->line_since_ms + st->read_timeout_ms < deadline) {
+        deadline = c->line_since_ms + st->read_timeout_ms;
+        *reason = "read";
+    }
+    if (st->write_timeout_ms && c->out_since_ms && c->out_since_ms + st->write_timeout_ms < deadline) {
+        deadline = c->out_since_ms + st->write_timeout_ms;
+        *reason = "write";
+    }
+    if ((c->paused & CLIENT_PAUSE_RATE) && c->resume_ms < deadline) {
+        deadline = c->resume_ms;
+        *reason = "rate";
+    }
+    return deadline;
+}
+
+void client_timer_update(struct server_state *st, struct client *c) {
+    if (!c->alive) return;
+    if (c->len > 0 || c->discarding || c->bin_skip) {
+        if (!c->line_since_ms) c->line_since_ms = st->now_ms;
+    } else {
+        c->line_since_ms = 0;
     }
-    if (st->stats.current_tcp_clients > 0) st->stats.current_tcp_clients--;
+    if (!outq_empty(&c->out)) {
+        if (!c->out_since_ms) c->out_since_ms = st->now_ms;
+    } else {
+        c->out_since_ms = 0;
+    }
+    const char *reason;
+    uint64_t deadline = client_deadline(st, c, &reason);
+    if (deadline == UINT64_MAX) {
+        timer_cancel(&st->timers, &c->timer);
+        return;
+    }
+    if (timer_pending(&c->timer) && c->timer.expires <= deadline) return;
+    timer_arm(&st->timers, &c->timer, deadline);
 }
 
-static void trim_line(char *line, size_t *len) {
-    while (*len > 0 && (line[*len - 1] == '\n' || line[*len - 1] == '\r' || line[*len - 1] == ' ' || line[*len - 1] == '\t')) {
-        line[*len - 1] = '\0';
-        (*len)--;
+static void client_timer_fired(struct timer_node *n, void *arg) {
+    struct server_state *st = arg;
+    struct client *c = (struct client *)((char *)n - offsetof(struct client, timer));
+    if (!c->alive) return;
+    const char *reason;
+    uint64_t deadline = client_deadline(st, c, &reason);
+    if (deadline == UINT64_MAX) return;
+    if (deadline > st->now_ms) {
+        timer_arm(&st->timers, &c->timer, deadline);
+        return;
     }
-    size_t start = 0;
-    while (start < *len && (line[start] == ' ' || line[start] == '\t')) start++;
-    if (start > 0 && start < *len) {
-        memmove(line, line + start, *len - start);
-        *len -= start;
-        line[*len] = '\0';
-    } else if (start >= *len) {
-        *len = 0;
-        line[0] = '\0';
+    if ((c->paused & CLIENT_PAUSE_RATE) && c->resume_ms <= st->now_ms) {
+        client_rate_resume(st, c);
+        return;
     }
+    stat_add(st, &st->counters.client_timeouts, 1);
+    log_info("tcp client fd=%d %s timeout", c->src.fd, reason);
+    close_client(st, c);
 }
 
-int server_process_line(const char *line,
+int worker_timer_timeout(struct server_state *st) {
+    st->now_ms = timer_now_ms();
+    int timeout = timer_wheel_timeout(&st->timers, st->now_ms);
+    if (st->draining && st->drain_deadline_ms) {
+        uint64_t left = st->drain_deadline_ms > st->now_ms ? st->drain_deadline_ms - st->now_ms : 0;
+        if (timeout < 0 || (uint64_t)timeout > left) timeout = (int)left;
+    }
+    if (st->shared->kv && kv_expiring(st->shared->kv)) {
+        uint64_t left = st->kv_sweep_ms > st->now_ms ? st->kv_sweep_ms - st->now_ms : 0;
+        if (timeout < 0 || (uint64_t)timeout > left) timeout = (int)left;
+    }
+    return timeout;
+}
+
+void worker_timers_expire(struct server_state *st) {
+    st->now_ms = timer_now_ms();
+    timer_wheel_advance(&st->timers, st->now_ms, client_timer_fired, st);
+    if (st->shared->kv && st->now_ms >= st->kv_sweep_ms) {
+        kv_sweep(st->shared->kv, st->now_ms, KV_SWEEP_SLOTS);
+        st->kv_sweep_ms = st->now_ms + KV_SWEEP_INTERVAL_MS;
+    }
+}
+
+static int render_metrics(void *arg, char *out, size_t cap) {
+    struct server_shared *sh = arg;
+    struct server_stats stats;
+    collect_stats(sh, &stats);
+    struct worker_metrics **wm = malloc((size_t)sh->workers_count * sizeof(*wm));
+    if (!wm) return -1;
+    for (int i = 0; i < sh->workers_count; i++) wm[i] = sh->workers[i].metrics;
+    int n = metrics_render(out, cap, wm, sh->workers_count, &stats);
+    free(wm);
+    return n;
+}
+
+static int process_line(struct server_state *st,
+                        struct pubsub_peer *peer,
+                        const char *line,
                         size_t len,
-                        const struct server_stats *stats,
-                        int *shutdown_requested,
+                        int *shutdown_flag,
                         char *out,
-                        size_t out_cap) {
-    if (!line || !stats || !shutdown_requested || !out || out_cap == 0) return -1;
-    if (len == 0) return 0;
-    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' ' || line[len - 1] == '\t')) len--;
-    size_t start = 0;
-    while (start < len && (line[start] == ' ' || line[start] == '\t')) start++;
-    if (start >= len) return 0;
-    const char *p = line + start;
-    size_t plen = len - start;
-    if (p[0] != '/') {
-        if (plen + 2 > out_cap) return -1;
-        memcpy(out, p, plen);
-        out[plen] = '\n';
-        out[plen + 1] = '\0';
-        return (int)(plen + 1);
-    }
-    char cmd[64];
-    size_t clen = plen < sizeof(cmd) - 1 ? plen : sizeof(cmd) - 1;
-    memcpy(cmd, p, clen);
-    cmd[clen] = '\0';
-    char *sp = strchr(cmd, ' ');
-    if (sp) *sp = '\0';
-    if (strcmp(cmd, "/time") == 0) {
-        time_t now = time(NULL);
-        struct tm tm_now;
-        if (!localtime_r(&now, &tm_now)) return -1;
-        if (out_cap < 32) return -1;
-        size_t n = strftime(out, out_cap, "%Y-%m-%d %H:%M:%S", &tm_now);
-        if (n == 0 || n + 2 > out_cap) return -1;
-        out[n] = '\n';
-        out[n + 1] = '\0';
-        return (int)(n + 1);
-    } else if (strcmp(cmd, "/stats") == 0) {
-        int n = snprintf(out,
-                         out_cap,
-                         "total_tcp_clients=%" PRIu64 " current_tcp_clients=%" PRIu64 " total_udp_messages=%" PRIu64 "\n",
-                         stats->total_tcp_clients,
-                         stats->current_tcp_clients,
-                         stats->total_udp_messages);
-        if (n < 0 || (size_t)n >= out_cap) return -1;
-        return n;
-    } else if (strcmp(cmd, "/help") == 0) {
-        const char *help =
-            "Available commands:\n"
-            "/time\n"
-            "/stats\n"
-            "/shutdown\n"
-            "/help\n";
-        size_t hlen = strlen(help);
-        if (hlen + 1 > out_cap) return -1;
-        memcpy(out, help, hlen + 1);
-        return (int)hlen;
-    } else if (strcmp(cmd, "/shutdown") == 0) {
-        *shutdown_requested = 1;
-        const char *m = "shutting down\n";
-        size_t mlen = strlen(m);
-        if (mlen + 1 > out_cap) return -1;
-        memcpy(out, m, mlen + 1);
-        return (int)mlen;
+                        size_t out_cap,
+                        int *cmd_id,
+                        const char **reply) {
+    static const struct server_stats empty;
+    struct server_command_ctx ctx;
+    ctx.stats = &empty;
+    ctx.shutdown_requested = shutdown_flag;
+    ctx.out = out;
+    ctx.out_cap = out_cap;
+    ctx.refresh = collect_counters;
+    ctx.refresh_arg = st->shared;
+    ctx.stats_version = stats_version;
+    ctx.metrics = render_metrics;
+    ctx.metrics_arg = st->shared;
+    ctx.pubsub = pubsub_command;
+    ctx.pubsub_arg = peer;
+    ctx.kv = st->shared->kv;
+    ctx.now_ms = st->now_ms;
+    ctx.binary = peer->client ? &peer->client->binary : NULL;
+    ctx.admin = st->shared->admin_commands;
+    *shutdown_flag = 0;
+    int out_len = commands_dispatch(line, len, &ctx, cmd_id);
+    *reply = ctx.reply;
+    if (*shutdown_flag) *shutdown_flag = request_shutdown(st->shared);
+    return out_len;
+}
+
+void worker_drain_begin(struct server_state *st) {
+    st->draining = 1;
+    st->now_ms = timer_now_ms();
+    st->drain_deadline_ms = st->shared->drain_timeout_ms ? st->now_ms + st->shared->drain_timeout_ms : 0;
+    log_info("worker %d draining %zu clients", st->id, st->clients.live);
+}
+
+int worker_drained(struct server_state *st) {
+    if (!st->draining) return 0;
+    if (st->clients.live == 0) return 1;
+    if (!st->drain_deadline_ms || st->now_ms < st->drain_deadline_ms) return 0;
+    log_info("worker %d drain timeout, closing %zu clients", st->id, st->clients.live);
+    return 1;
+}
+
+static int listener_watch(struct server_state *st, int on) {
+    if (st->listening == on) return 0;
+    if (on) {
+        if (add_fd_epoll(st->epfd, st->tcp_listen_fd, EPOLLIN, &st->tcp_listen_src) == -1) {
+            perror("epoll add tcp listen");
+            return -1;
+        }
+        if (st->unix_listen_fd != -1 && add_fd_epoll(st->epfd, st->unix_listen_fd, EPOLLIN | EPOLLEXCLUSIVE, &st->unix_listen_src) == -1) {
+            perror("epoll add unix listen");
+            epoll_ctl(st->epfd, EPOLL_CTL_DEL, st->tcp_listen_fd, NULL);
+            return -1;
+        }
     } else {
-        const char *u = "unknown command\n";
-        size_t ulen = strlen(u);
-        if (ulen + 1 > out_cap) return -1;
-        memcpy(out, u, ulen + 1);
-        return (int)ulen;
+        if (epoll_ctl(st->epfd, EPOLL_CTL_DEL, st->tcp_listen_fd, NULL) == -1) {
+            perror("epoll del tcp listen");
+            return -1;
+        }
+        if (st->unix_listen_fd != -1 && epoll_ctl(st->epfd, EPOLL_CTL_DEL, st->unix_listen_fd, NULL) == -1) perror("epoll del unix listen");
     }
+    st->listening = on;
+    return 0;
 }
 
-static void handle_tcp_accept(struct server_state *st) {
-    for (;;) {
+static void epoll_drain_begin(struct server_state *st) {
+    worker_drain_begin(st);
+    listener_watch(st, 0);
+    if (epoll_ctl(st->epfd, EPOLL_CTL_DEL, st->udp_fd, NULL) == -1) perror("epoll del udp");
+    if (st->unix_dgram_fd != -1 && epoll_ctl(st->epfd, EPOLL_CTL_DEL, st->unix_dgram_fd, NULL) == -1) perror("epoll del unix dgram");
+}
+
+static void pause_accept(struct server_state *st) {
+    listener_watch(st, 0);
+    st->accept_paused = 1;
+    stat_add(st, &st->counters.accept_pauses, 1);
+    log_info("max clients reached (%zu), pausing accept", st->clients.live);
+}
+
+static void resume_accept(struct server_state *st) {
+    listener_watch(st, 1);
+    st->accept_paused = 0;
+    log_info("accept resumed, clients=%zu", st->clients.live);
+}
+
+static void handle_accept(struct server_state *st, int listen_fd, int local) {
+    for (int accepted = 0; st->accept_batch <= 0 || accepted < st->accept_batch; accepted++) {
+        if (client_limit_reached(st)) {
+            pause_accept(st);
+            break;
+        }
         struct sockaddr_in addr;
         socklen_t alen = sizeof(addr);
-        int cfd = accept(st->tcp_listen_fd, (struct sockaddr *)&addr, &alen);
+        int cfd = accept4(listen_fd, local ? NULL : (struct sockaddr *)&addr, local ? NULL : &alen, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (cfd == -1) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR || errno == ECONNABORTED) continue;
             perror("accept");
             break;
         }
-        if (make_nonblocking(cfd) == -1) {
-            perror("nonblock client");
-            close(cfd);
+        struct client *c = add_client(st, cfd, local);
+        if (!c) {
+            log_error("failed to add client fd=%d", cfd);
             continue;
         }
-        if (add_fd_epoll(st->epfd, cfd, EPOLLIN) == -1) {
+        if (st->edge_triggered) c->events |= EPOLLET;
+        if (add_fd_epoll(st->epfd, cfd, c->events, c) == -1) {
             perror("epoll add client");
-            close(cfd);
+            close_client(st, c);
             continue;
         }
-        if (add_client(st, cfd) == -1) {
-            log_error("failed to add client fd=%d", cfd);
-            continue;
+        if (!log_enabled(LOG_INFO)) continue;
+        if (local) {
+            log_info("unix client fd=%d", cfd);
+        } else {
+            char ip[64];
+            inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+            log_info("tcp client fd=%d from %s:%d", cfd, ip, ntohs(addr.sin_port));
         }
-        char ip[64];
-        inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
-        log_info("tcp client fd=%d from %s:%d", cfd, ip, ntohs(addr.sin_port));
     }
 }
 
-static void handle_tcp_client(struct server_state *st, int fd) {
-    struct client *c = find_client(st, fd);
-    if (!c) {
-        epoll_ctl(st->epfd, EPOLL_CTL_DEL, fd, NULL);
-        close(fd);
+static int update_client_events(struct server_state *st, struct client *c) {
+    uint32_t want = 0;
+    if (!c->paused && !c->read_closed) want |= EPOLLIN;
+    if (!outq_empty(&c->out)) want |= EPOLLOUT;
+    if (st->edge_triggered) want |= EPOLLET;
+    if (want == c->events) return 0;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = want;
+    ev.data.ptr = c;
+    if (epoll_ctl(st->epfd, EPOLL_CTL_MOD, c->src.fd, &ev) == -1) {
+        perror("epoll mod client");
+        return -1;
+    }
+    c->events = want;
+    return 0;
+}
+
+static void settle_client(struct server_state *st, struct client *c) {
+    if (!c->alive) return;
+    if (c->read_closed && !c->paused && outq_empty(&c->out)) {
+        close_client(st, c);
         return;
     }
-    for (;;) {
-        char tmp[1024];
-        ssize_t n = recv(fd, tmp, sizeof(tmp), 0);
+    if (update_client_events(st, c) == -1) {
+        close_client(st, c);
+        return;
+    }
+    client_timer_update(st, c);
+}
+
+static int client_sendv(struct server_state *st, struct client *c, struct iovec *iov, int iovcnt) {
+    if (st->ring) {
+        for (int i = 0; i < iovcnt; i++) {
+            if (outq_append(&c->out, iov[i].iov_base, iov[i].iov_len) == -1) return -1;
+        }
+        uring_client_output(st, c);
+        return 0;
+    }
+    int first = 0;
+    if (outq_empty(&c->out)) {
+        while (first < iovcnt) {
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov + first;
+            msg.msg_iovlen = (size_t)(iovcnt - first);
+            ssize_t s = sendmsg(c->src.fd, &msg, MSG_NOSIGNAL);
+            if (s == -1) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    metric_add(&st->metrics->send_eagain, 1);
+                    break;
+                }
+                perror("send");
+                return -1;
+            }
+            metric_add(&st->metrics->bytes_out[c->local ? METRICS_UNIX : METRICS_TCP], (uint64_t)s);
+            size_t sent = (size_t)s;
+            while (first < iovcnt && sent >= iov[first].iov_len) {
+                sent -= iov[first].iov_len;
+                first++;
+            }
+            if (first < iovcnt) {
+                iov[first].iov_base = (char *)iov[first].iov_base + sent;
+                iov[first].iov_len -= sent;
+            }
+        }
+    }
+    for (; first < iovcnt; first++) {
+        if (outq_append(&c->out, iov[first].iov_base, iov[first].iov_len) == -1) return -1;
+    }
+    return 0;
+}
+
+static int batch_flush(struct server_state *st, struct client *c, struct reply_batch *b) {
+    if (b->iovcnt == 0) return 0;
+    int rc = client_sendv(st, c, b->iov, b->iovcnt);
+    b->iovcnt = 0;
+    b->out_len = 0;
+    if (c->out.bytes > st->output_hwm) c->paused |= CLIENT_PAUSE_OUTPUT;
+    return rc;
+}
+
+static int batch_add(struct server_state *st, struct client *c, struct reply_batch *b, const char *data, size_t len) {
+    if (b->iovcnt > 0) {
+        struct iovec *last = &b->iov[b->iovcnt - 1];
+        if ((const char *)last->iov_base + last->iov_len == data) {
+            last->iov_len += len;
+            return 0;
+        }
+    }
+    if (b->iovcnt == REPLY_BATCH_IOV && batch_flush(st, c, b) == -1) return -1;
+    b->iov[b->iovcnt].iov_base = (void *)data;
+    b->iov[b->iovcnt].iov_len = len;
+    b->iovcnt++;
+    return 0;
+}
+
+static void client_throttle(struct server_state *st, struct client *c, uint64_t wait_ms, int scope) {
+    uint64_t until = st->now_ms + wait_ms;
+    if (!(c->paused & CLIENT_PAUSE_RATE) || until > c->resume_ms) c->resume_ms = until;
+    c->paused |= CLIENT_PAUSE_RATE;
+    metric_add(&st->metrics->rate_throttled[scope], 1);
+}
+
+static int client_over_rate(struct server_state *st, struct client *c, size_t bytes) {
+    const struct server_rate_limits *r = &st->shared->rate;
+    if (!r->conn_msgs && !r->conn_bytes) return 0;
+    uint64_t wait = 0;
+    if (r->conn_msgs) {
+        rate_refill(&c->rate_msgs, r->conn_msgs, st->now_ms);
+        wait = rate_wait_ms(&c->rate_msgs, r->conn_msgs, 1000);
+    }
+    if (r->conn_bytes) {
+        rate_refill(&c->rate_bytes, r->conn_bytes, st->now_ms);
+        uint64_t w = rate_wait_ms(&c->rate_bytes, r->conn_bytes, 1);
+        if (w > wait) wait = w;
+    }
+    if (wait) {
+        client_throttle(st, c, wait, METRICS_RATE_CONN);
+        return 1;
+    }
+    if (r->conn_msgs) c->rate_msgs.level -= 1000;
+    if (r->conn_bytes) c->rate_bytes.level -= (int64_t)bytes * 1000;
+    return 0;
+}
+
+static void client_charge_ip(struct server_state *st, struct client *c, uint64_t msgs, uint64_t bytes) {
+    if (!st->shared->rate_ips || c->local || msgs == 0 || !c->alive) return;
+    uint64_t wait = rate_ip_charge(st->shared->rate_ips, c->peer_key, msgs, bytes, st->now_ms, 1);
+    if (wait) client_throttle(st, c, wait, METRICS_RATE_IP);
+}
+
+static int batch_line(struct server_state *st, struct client *c, struct reply_batch *b, const char *line, size_t len, int *cmd_id) {
+    trim_view(&line, &len);
+    *cmd_id = COMMAND_ID_NONE;
+    if (len == 0) return 0;
+    if (line[0] != '/') {
+        *cmd_id = COMMAND_ID_ECHO;
+        if (line[len] == '\n') return batch_add(st, c, b, line, len + 1);
+        if (batch_add(st, c, b, line, len) == -1) return -1;
+        return batch_add(st, c, b, "\n", 1);
+    }
+    if (sizeof(b->out) - b->out_len < REPLY_MAX && batch_flush(st, c, b) == -1) return -1;
+    char *out = b->out + b->out_len;
+    int shutdown_flag;
+    const char *reply;
+    struct pubsub_peer peer = {st, c, NULL, 0};
+    int out_len = process_line(st, &peer, line, len, &shutdown_flag, out, REPLY_MAX, cmd_id, &reply);
+    if (shutdown_flag) log_info("shutdown requested by %s fd=%d", c->local ? "unix" : "tcp", c->src.fd);
+    if (out_len <= 0) return 0;
+    if (reply == out) b->out_len += (size_t)out_len;
+    return batch_add(st, c, b, reply, (size_t)out_len);
+}
+
+static struct reply_batch *reply_batch_get(struct server_state *st) {
+    if (!st->reply && !(st->reply = malloc(sizeof(*st->reply)))) return NULL;
+    st->reply->iovcnt = 0;
+    st->reply->out_len = 0;
+    return st->reply;
+}
+
+static int frame_lines(struct server_state *st, struct client *c, const char *data, size_t len, size_t *consumed) {
+    static const char too_long[] = "line too long\n";
+    struct reply_batch *b = reply_batch_get(st);
+    if (!b) {
+        close_client(st, c);
+        return -1;
+    }
+    uint32_t offs[FRAME_SCAN_MAX];
+    size_t pos = 0;
+    uint64_t msgs = 0;
+    int rc = 0;
+    uint64_t start = metrics_now_ns();
+    uint64_t t = start;
+    size_t skip = c->scanned <= len ? c->scanned : 0;
+    c->scanned = 0;
+    while (pos < len && !c->paused && !c->binary && rc == 0) {
+        size_t base = pos + skip;
+        skip = 0;
+        size_t n = linescan(data + base, len - base, offs, FRAME_SCAN_MAX);
+        if (n == 0) {
+            if (!c->discarding && len - pos > st->max_line) {
+                rc = batch_add(st, c, b, too_long, sizeof(too_long) - 1);
+                c->discarding = 1;
+            }
+            if (c->discarding) {
+                pos = len;
+            } else {
+                c->scanned = len - pos;
+            }
+            break;
+        }
+        for (size_t i = 0; i < n && !c->paused && !c->binary; i++) {
+            size_t end = base + offs[i] + 1;
+            size_t line_len = end - pos;
+            if (c->discarding) {
+                c->discarding = 0;
+            } else if (line_len - 1 > st->max_line) {
+                rc = batch_add(st, c, b, too_long, sizeof(too_long) - 1);
+            } else if (client_over_rate(st, c, line_len)) {
+                break;
+            } else {
+                int cmd_id;
+                msgs++;
+                rc = batch_line(st, c, b, data + pos, line_len, &cmd_id);
+                if (cmd_id != COMMAND_ID_NONE) {
+                    uint64_t now = metrics_now_ns();
+                    hist_record(&st->metrics->commands[cmd_id], now - t);
+                    t = now;
+                }
+            }
+            if (rc == -1) break;
+            pos = end;
+        }
+    }
+    if (rc == 0) rc = batch_flush(st, c, b);
+    if (rc == -1) {
+        close_client(st, c);
+        return -1;
+    }
+    client_charge_ip(st, c, msgs, pos);
+    hist_record(&st->metrics->transport[c->local ? METRICS_UNIX : METRICS_TCP], metrics_now_ns() - start);
+    *consumed = pos;
+    return 0;
+}
+
+static size_t bin_stats(struct server_state *st, char *out) {
+    struct server_stats s;
+    collect_stats(st->shared, &s);
+    const uint64_t fields[BIN_STATS_FIELDS] = {
+        s.total_tcp_clients, s.current_tcp_clients, s.total_udp_messages, s.client_pool_hits,
+        s.client_pool_misses, s.buf_pool_hits, s.buf_pool_misses, s.log_dropped,
+        s.client_timeouts, s.rejected_clients, s.accept_pauses, s.udp_drops,
+        s.kv_keys, s.kv_bytes, s.total_unix_clients, s.current_unix_clients,
+        s.total_unix_messages, s.udp_tx_drops,
+    };
+    for (int i = 0; i < BIN_STATS_FIELDS; i++) bin_put64(out + 8 * i, fields[i]);
+    return 8 * BIN_STATS_FIELDS;
+}
+
+static int batch_frame(struct server_state *st, struct client *c, struct reply_batch *b, const struct bin_header *h, const char *payload, int *cmd_id) {
+    if (sizeof(b->out) - b->out_len < BIN_HEADER_LEN + REPLY_MAX && batch_flush(st, c, b) == -1) return -1;
+    char *hdr = b->out + b->out_len;
+    char *out = hdr + BIN_HEADER_LEN;
+    const char *body = out;
+    size_t body_len = 0;
+    struct bin_header r = {0, h->op, BIN_OK, h->id};
+    switch (h->op) {
+    case BIN_OP_ECHO:
+        *cmd_id = COMMAND_ID_ECHO;
+        body_len = h->len;
+        if (body_len <= BIN_ECHO_COPY_MAX) {
+            memcpy(out, payload, body_len);
+        } else {
+            body = payload;
+        }
+        break;
+    case BIN_OP_TIME:
+        *cmd_id = command_lookup("/time", 5);
+        bin_put64(out, timecache_now_us());
+        body_len = 8;
+        break;
+    case BIN_OP_STATS:
+        *cmd_id = command_lookup("/stats", 6);
+        body_len = bin_stats(st, out);
+        break;
+    case BIN_OP_COMMAND: {
+        int shutdown_flag;
+        struct pubsub_peer peer = {st, c, NULL, 0};
+        int out_len = process_line(st, &peer, payload, h->len, &shutdown_flag, out, REPLY_MAX, cmd_id, &body);
+        if (shutdown_flag) log_info("shutdown requested by %s fd=%d", c->local ? "unix" : "tcp", c->src.fd);
+        if (out_len < 0) {
+            r.status = BIN_EFAIL;
+            body = out;
+        } else {
+            body_len = (size_t)out_len;
+        }
+        break;
+    }
+    default:
+        *cmd_id = COMMAND_ID_UNKNOWN;
+        r.status = BIN_EUNKNOWN;
+        break;
+    }
+    r.len = (uint32_t)body_len;
+    bin_header_encode(hdr, &r);
+    if (body == out) {
+        b->out_len += BIN_HEADER_LEN + body_len;
+        return batch_add(st, c, b, hdr, BIN_HEADER_LEN + body_len);
+    }
+    b->out_len += BIN_HEADER_LEN;
+    if (batch_add(st, c, b, hdr, BIN_HEADER_LEN) == -1) return -1;
+    return body_len ? batch_add(st, c, b, body, body_len) : 0;
+}
+
+static int frame_binary(struct server_state *st, struct client *c, const char *data, size_t len, size_t *consumed) {
+    struct reply_batch *b = reply_batch_get(st);
+    if (!b) {
+        close_client(st, c);
+        return -1;
+    }
+    size_t pos = 0;
+    uint64_t msgs = 0;
+    int rc = 0;
+    uint64_t start = metrics_now_ns();
+    uint64_t t = start;
+    while (!c->paused && rc == 0) {
+        if (c->bin_skip) {
+            size_t k = len - pos < c->bin_skip ? len - pos : c->bin_skip;
+            pos += k;
+            c->bin_skip -= k;
+            if (c->bin_skip) break;
+        }
+        if (len - pos < BIN_HEADER_LEN) break;
+        struct bin_header h;
+        bin_header_decode(data + pos, &h);
+        if (h.len > st->max_line) {
+            struct bin_header r = {0, h.op, BIN_ETOOBIG, h.id};
+            if (sizeof(b->out) - b->out_len < BIN_HEADER_LEN && batch_flush(st, c, b) == -1) {
+                rc = -1;
+                break;
+            }
+            bin_header_encode(b->out + b->out_len, &r);
+            rc = batch_add(st, c, b, b->out + b->out_len, BIN_HEADER_LEN);
+            b->out_len += BIN_HEADER_LEN;
+            pos += BIN_HEADER_LEN;
+            c->bin_skip = h.len;
+            continue;
+        }
+        if (len - pos - BIN_HEADER_LEN < h.len) break;
+        if (client_over_rate(st, c, BIN_HEADER_LEN + h.len)) break;
+        msgs++;
+        int cmd_id = COMMAND_ID_NONE;
+        rc = batch_frame(st, c, b, &h, data + pos + BIN_HEADER_LEN, &cmd_id);
+        if (cmd_id != COMMAND_ID_NONE) {
+            uint64_t now = metrics_now_ns();
+            hist_record(&st->metrics->commands[cmd_id], now - t);
+            t = now;
+        }
+        pos += BIN_HEADER_LEN + h.len;
+    }
+    if (rc == 0) rc = batch_flush(st, c, b);
+    if (rc == -1) {
+        close_client(st, c);
+        return -1;
+    }
+    client_charge_ip(st, c, msgs, pos);
+    hist_record(&st->metrics->transport[c->local ? METRICS_UNIX : METRICS_TCP], metrics_now_ns() - start);
+    *consumed = pos;
+    return 0;
+}
+
+static int frame_input(struct server_state *st, struct client *c, const char *data, size_t len, size_t *consumed) {
+    size_t pos = 0;
+    if (!c->binary) {
+        if (frame_lines(st, c, data, len, &pos) == -1) return -1;
+        if (!c->binary || c->paused || pos == len) {
+            *consumed = pos;
+            return 0;
+        }
+    }
+    size_t n;
+    if (frame_binary(st, c, data + pos, len - pos, &n) == -1) return -1;
+    *consumed = pos + n;
+    return 0;
+}
+
+int process_client_input(struct server_state *st, struct client *c) {
+    size_t pos;
+    if (frame_input(st, c, c->buf, c->len, &pos) == -1) return -1;
+    if (pos > 0) {
+        if (pos < c->len) memmove(c->buf, c->buf + pos, c->len - pos);
+        c->len -= pos;
+    }
+    if (c->len == 0) client_buffer_release(st, c);
+    return 0;
+}
+
+int client_input(struct server_state *st, struct client *c, const char *data, size_t n) {
+    if (c->len > 0) {
+        if (client_buffer_append(st, c, data, n) == -1) {
+            close_client(st, c);
+            return -1;
+        }
+        return process_client_input(st, c);
+    }
+    size_t pos;
+    if (frame_input(st, c, data, n, &pos) == -1) return -1;
+    if (pos < n && client_buffer_append(st, c, data + pos, n - pos) == -1) {
+        close_client(st, c);
+        return -1;
+    }
+    return 0;
+}
+
+int client_buffer_reserve(struct server_state *st, struct client *c, size_t n) {
+    if (!c->buf) {
+        int hit;
+        c->buf = bufpool_get(&st->bufs, &hit);
+        if (!c->buf) return -1;
+        stat_add(st, hit ? &st->counters.buf_pool_hits : &st->counters.buf_pool_misses, 1);
+        c->cap = st->bufs.chunk_size;
+        c->len = 0;
+    }
+    if (c->len + n > c->cap) {
+        size_t new_cap = c->cap * 2;
+        while (new_cap < c->len + n) new_cap *= 2;
+        char *nb = realloc(c->buf, new_cap);
+        if (!nb) return -1;
+        c->buf = nb;
+        c->cap = new_cap;
+    }
+    return 0;
+}
+
+int client_buffer_append(struct server_state *st, struct client *c, const char *data, size_t n) {
+    if (client_buffer_reserve(st, c, n) == -1) return -1;
+    memcpy(c->buf + c->len, data, n);
+    c->len += n;
+    return 0;
+}
+
+void client_buffer_release(struct server_state *st, struct client *c) {
+    bufpool_put(&st->bufs, c->buf, c->cap);
+    c->buf = NULL;
+    c->len = 0;
+    c->cap = 0;
+    c->scanned = 0;
+}
+
+static void handle_tcp_client(struct server_state *st, struct client *c) {
+    int fd = c->src.fd;
+    size_t got = 0;
+    while (!c->paused) {
+        if (st->read_budget && got >= st->read_budget) {
+            metric_add(&st->metrics->read_yields, 1);
+            if (st->edge_triggered) client_ready_push(st, c);
+            break;
+        }
+        char *dst = st->rx_buf;
+        size_t room = st->client_buf_size;
+        if (c->len > 0) {
+            if (client_buffer_reserve(st, c, st->client_buf_size / 4 + 1) == -1) {
+                close_client(st, c);
+                return;
+            }
+            dst = c->buf + c->len;
+            room = c->cap - c->len;
+        }
+        ssize_t n = recv(fd, dst, room, 0);
         if (n == -1) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) break;
             perror("recv");
@@ -337,190 +1137,755 @@ static void handle_tcp_client(struct server_state *st, int fd) {
             return;
         }
         if (n == 0) {
-            close_client(st, c);
-            return;
+            c->read_closed = 1;
+            break;
         }
-        if (c->len + (size_t)n > c->cap) {
-            size_t new_cap = c->cap * 2;
-            while (new_cap < c->len + (size_t)n) new_cap *= 2;
-            char *nb = realloc(c->buf, new_cap);
-            if (!nb) {
-                close_client(st, c);
-                return;
-            }
-            c->buf = nb;
-            c->cap = new_cap;
-        }
-        memcpy(c->buf + c->len, tmp, (size_t)n);
-        c->len += (size_t)n;
-        size_t pos = 0;
-        while (pos < c->len) {
-            char *nl = memchr(c->buf + pos, '\n', c->len - pos);
-            if (!nl) break;
-            size_t line_len = (size_t)(nl - (c->buf + pos) + 1);
-            char line[2048];
-            size_t copy_len = line_len < sizeof(line) - 1 ? line_len : sizeof(line) - 1;
-            memcpy(line, c->buf + pos, copy_len);
-            line[copy_len] = '\0';
-            size_t logical_len = copy_len;
-            trim_line(line, &logical_len);
-            char out[4096];
-            int shutdown_flag = st->shutdown_requested;
-            int out_len = server_process_line(line, logical_len, &st->stats, &shutdown_flag, out, sizeof(out));
-            if (!st->shutdown_requested && shutdown_flag) {
-                st->shutdown_requested = 1;
-                log_info("shutdown requested by tcp fd=%d", fd);
-            }
-            if (out_len > 0) {
-                size_t sent = 0;
-                while (sent < (size_t)out_len) {
-                    ssize_t s = send(fd, out + sent, (size_t)out_len - sent, 0);
-                    if (s == -1) {
-                        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
-                        perror("send");
-                        close_client(st, c);
-                        return;
-                    }
-                    if (s == 0) break;
-                    sent += (size_t)s;
-                }
+        metric_add(&st->metrics->bytes_in[c->local ? METRICS_UNIX : METRICS_TCP], (uint64_t)n);
+        c->active_ms = st->now_ms;
+        got += (size_t)n;
+        if (dst == st->rx_buf) {
+            if (client_input(st, c, dst, (size_t)n) == -1) return;
+        } else {
+            c->len += (size_t)n;
+            if (process_client_input(st, c) == -1) return;
+        }
+    }
+    settle_client(st, c);
+}
+
+static int client_flush(struct server_state *st, struct client *c) {
+    ssize_t sent = outq_flush(&c->out, c->src.fd);
+    if (sent == -1) {
+        perror("send");
+        close_client(st, c);
+        return -1;
+    }
+    metric_add(&st->metrics->bytes_out[c->local ? METRICS_UNIX : METRICS_TCP], (uint64_t)sent);
+    if (sent > 0) c->active_ms = c->out_since_ms = st->now_ms;
+    return 0;
+}
+
+static void handle_tcp_writable(struct server_state *st, struct client *c) {
+    if (client_flush(st, c) == -1) return;
+    if ((c->paused & CLIENT_PAUSE_OUTPUT) && c->out.bytes <= st->output_hwm / 2) {
+        c->paused &= ~CLIENT_PAUSE_OUTPUT;
+        if (process_client_input(st, c) == -1) return;
+    }
+    settle_client(st, c);
+}
+
+static void client_rate_resume(struct server_state *st, struct client *c) {
+    c->paused &= ~CLIENT_PAUSE_RATE;
+    if (process_client_input(st, c) == -1) return;
+    if (st->ring) {
+        uring_client_resume(st, c);
+        uring_client_settle(st, c);
+        return;
+    }
+    settle_client(st, c);
+}
+
+void client_output_ready(struct server_state *st, struct client *c) {
+    if (st->ring) {
+        uring_client_output(st, c);
+        client_timer_update(st, c);
+        return;
+    }
+    if (c->events & EPOLLOUT) return;
+    if (client_flush(st, c) == -1) return;
+    settle_client(st, c);
+}
+
+int process_datagram(struct server_state *st, const char *data, size_t len, const struct sockaddr *from, socklen_t fromlen, char *out, size_t out_cap) {
+    int unnamed = fromlen <= sizeof(sa_family_t);
+    int local = unnamed || from->sa_family == AF_UNIX;
+    stat_add(st, local ? &st->counters.total_unix_messages : &st->counters.total_udp_messages, 1);
+    metric_add(&st->metrics->bytes_in[local ? METRICS_UNIX : METRICS_UDP], len);
+    if (st->shared->rate_ips && !local) {
+        uint8_t key[RATE_IP_KEY];
+        rate_ip_key(from, fromlen, key);
+        if (rate_ip_charge(st->shared->rate_ips, key, 1, len, st->now_ms, 0)) {
+            metric_add(&st->metrics->rate_dropped, 1);
+            return 0;
+        }
+    }
+    int shutdown_flag;
+    int cmd_id;
+    const char *reply;
+    uint64_t t = metrics_now_ns();
+    struct pubsub_peer peer = {st, NULL, from, fromlen};
+    int out_len = process_line(st, &peer, data, len, &shutdown_flag, out, out_cap, &cmd_id, &reply);
+    if (out_len > 0 && reply != out) {
+        if ((size_t)out_len > out_cap) {
+            out_len = -1;
+        } else {
+            memcpy(out, reply, (size_t)out_len);
+        }
+    }
+    if (cmd_id != COMMAND_ID_NONE) hist_record(&st->metrics->commands[cmd_id], metrics_now_ns() - t);
+    if (shutdown_flag) log_info("shutdown requested by %s", local ? "unix dgram" : "udp");
+    return unnamed ? 0 : out_len;
+}
+
+static void udp_batch_free(struct udp_batch *b) {
+    if (!b) return;
+    free(b->rx);
+    free(b->rx_iov);
+    free(b->rx_addr);
+    free(b->rx_bufs);
+    free(b->rx_ctrl);
+    free(b->tx);
+    free(b->tx_iov);
+    free(b->tx_addr);
+    free(b->tx_addrlen);
+    free(b->tx_ctrl);
+    free(b->tx_seg);
+    free(b->tx_nsegs);
+    free(b->arena);
+    free(b);
+}
+
+static struct udp_batch *udp_batch_new(int fd, int size, int want_gso) {
+    struct udp_batch *b = calloc(1, sizeof(*b));
+    if (!b) return NULL;
+    b->fd = fd;
+    b->size = size > 0 ? (unsigned)size : 32;
+    if (b->size > 1024) b->size = 1024;
+    if (want_gso) {
+        int on = 1;
+        if (setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0) {
+            b->gro = 1;
+        } else {
+            log_error("UDP_GRO not supported: %s", strerror(errno));
+        }
+        int probe = 0;
+        if (setsockopt(fd, SOL_UDP, UDP_SEGMENT, &probe, sizeof(probe)) == 0) {
+            b->gso = 1;
+        } else {
+            log_error("UDP_SEGMENT not supported: %s", strerror(errno));
+        }
+    }
+    b->rx_buf_size = b->gro ? UDP_GRO_RX_BUF : UDP_RX_BUF;
+    b->arena_cap = (size_t)b->size * UDP_REPLY_MAX;
+    b->rx = calloc(b->size, sizeof(*b->rx));
+    b->rx_iov = calloc(b->size, sizeof(*b->rx_iov));
+    b->rx_addr = calloc(b->size, sizeof(*b->rx_addr));
+    b->rx_bufs = malloc((size_t)b->size * b->rx_buf_size);
+    b->rx_ctrl = calloc(b->size, UDP_RX_CTRL);
+    b->tx = calloc(b->size, sizeof(*b->tx));
+    b->tx_iov = calloc(b->size, sizeof(*b->tx_iov));
+    b->tx_addr = calloc(b->size, sizeof(*b->tx_addr));
+    b->tx_addrlen = calloc(b->size, sizeof(*b->tx_addrlen));
+    b->tx_ctrl = calloc(b->size, UDP_TX_CTRL);
+    b->tx_seg = calloc(b->size, sizeof(*b->tx_seg));
+    b->tx_nsegs = calloc(b->size, sizeof(*b->tx_nsegs));
+    b->arena = malloc(b->arena_cap);
+    if (!b->rx || !b->rx_iov || !b->rx_addr || !b->rx_bufs || !b->rx_ctrl || !b->tx || !b->tx_iov || !b->tx_addr ||
+        !b->tx_addrlen || !b->tx_ctrl || !b->tx_seg || !b->tx_nsegs || !b->arena) {
+        udp_batch_free(b);
+        return NULL;
+    }
+    return b;
+}
+
+static void udp_flush(struct server_state *st, struct udp_batch *b) {
+    for (unsigned j = 0; j < b->tx_count; j++) {
+        struct msghdr *h = &b->tx[j].msg_hdr;
+        memset(h, 0, sizeof(*h));
+        h->msg_name = &b->tx_addr[j];
+        h->msg_namelen = b->tx_addrlen[j];
+        h->msg_iov = &b->tx_iov[j];
+        h->msg_iovlen = 1;
+        if (b->tx_nsegs[j] > 1) {
+            char *ctrl = b->tx_ctrl + (size_t)j * UDP_TX_CTRL;
+            memset(ctrl, 0, UDP_TX_CTRL);
+            h->msg_control = ctrl;
+            h->msg_controllen = UDP_TX_CTRL;
+            struct cmsghdr *cm = CMSG_FIRSTHDR(h);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t seg = (uint16_t)b->tx_seg[j];
+            memcpy(CMSG_DATA(cm), &seg, sizeof(seg));
+        }
+    }
+    unsigned sent = 0;
+    while (sent < b->tx_count) {
+        int r = sendmmsg(b->fd, b->tx + sent, b->tx_count - sent, 0);
+        if (r == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                metric_add(&st->metrics->send_eagain, 1);
+                stat_add(st, &st->counters.udp_tx_drops, b->tx_count - sent);
+                break;
             }
-            pos += line_len;
+            stat_add(st, &st->counters.udp_tx_drops, 1);
+            sent++;
+            continue;
         }
-        if (pos > 0) {
-            if (pos < c->len) memmove(c->buf, c->buf + pos, c->len - pos);
-            c->len -= pos;
+        for (int i = 0; i < r; i++) metric_add(&st->metrics->bytes_out[b->fd == st->unix_dgram_fd ? METRICS_UNIX : METRICS_UDP], b->tx[sent + (unsigned)i].msg_len);
+        sent += (unsigned)r;
+    }
+    b->tx_count = 0;
+    b->arena_len = 0;
+}
+
+static void udp_reply(struct server_state *st, struct udp_batch *b, const char *data, size_t len, const struct sockaddr_storage *addr, socklen_t alen) {
+    if (b->tx_count == b->size || b->arena_cap - b->arena_len < UDP_REPLY_MAX) udp_flush(st, b);
+    char *out = b->arena + b->arena_len;
+    int out_len = process_datagram(st, data, len, (const struct sockaddr *)addr, alen, out, UDP_REPLY_MAX);
+    if (out_len <= 0) return;
+    size_t olen = (size_t)out_len;
+    if (b->gso && b->tx_count > 0) {
+        unsigned j = b->tx_count - 1;
+        struct iovec *iov = &b->tx_iov[j];
+        if ((char *)iov->iov_base + iov->iov_len == out && b->tx_addrlen[j] == alen && memcmp(&b->tx_addr[j], addr, alen) == 0 &&
+            iov->iov_len % b->tx_seg[j] == 0 && olen <= b->tx_seg[j] && iov->iov_len + olen <= UDP_GSO_MAX_BYTES &&
+            b->tx_nsegs[j] < UDP_GSO_MAX_SEGS) {
+            iov->iov_len += olen;
+            b->tx_nsegs[j]++;
+            b->arena_len += olen;
+            return;
         }
     }
+    unsigned j = b->tx_count++;
+    b->tx_iov[j].iov_base = out;
+    b->tx_iov[j].iov_len = olen;
+    memcpy(&b->tx_addr[j], addr, alen);
+    b->tx_addrlen[j] = alen;
+    b->tx_seg[j] = olen;
+    b->tx_nsegs[j] = 1;
+    b->arena_len += olen;
 }
 
-static void handle_udp(struct server_state *st) {
+void udp_rx_cmsgs(struct server_state *st, struct msghdr *h, size_t *gro_seg) {
+    if (!h->msg_control) return;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(h); cm; cm = CMSG_NXTHDR(h, cm)) {
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+            int seg;
+            memcpy(&seg, CMSG_DATA(cm), sizeof(seg));
+            if (seg > 0) *gro_seg = (size_t)seg;
+        } else if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t drops;
+            memcpy(&drops, CMSG_DATA(cm), sizeof(drops));
+            stat_set(st, &st->counters.udp_drops, drops);
+        }
+    }
+}
+
+static void handle_udp(struct server_state *st, struct udp_batch *b) {
+    size_t got = 0;
     for (;;) {
-        char buf[2048];
-        struct sockaddr_in addr;
-        socklen_t alen = sizeof(addr);
-        ssize_t n = recvfrom(st->udp_fd, buf, sizeof(buf), 0, (struct sockaddr *)&addr, &alen);
+        if (st->read_budget && got >= st->read_budget) {
+            metric_add(&st->metrics->read_yields, 1);
+            break;
+        }
+        for (unsigned i = 0; i < b->size; i++) {
+            struct msghdr *h = &b->rx[i].msg_hdr;
+            b->rx_iov[i].iov_base = b->rx_bufs + (size_t)i * b->rx_buf_size;
+            b->rx_iov[i].iov_len = b->rx_buf_size;
+            h->msg_name = &b->rx_addr[i];
+            h->msg_namelen = sizeof(b->rx_addr[i]);
+            h->msg_iov = &b->rx_iov[i];
+            h->msg_iovlen = 1;
+            h->msg_control = b->rx_ctrl + (size_t)i * UDP_RX_CTRL;
+            h->msg_controllen = UDP_RX_CTRL;
+            h->msg_flags = 0;
+        }
+        int n = recvmmsg(b->fd, b->rx, b->size, 0, NULL);
         if (n == -1) {
+            if (errno == EINTR) continue;
             if (errno == EAGAIN || errno == EWOULDBLOCK) break;
-            perror("recvfrom");
+            perror("recvmmsg");
             break;
         }
-        if (n == 0) break;
-        st->stats.total_udp_messages++;
-        char line[2048];
-        size_t copy_len = (size_t)n < sizeof(line) - 1 ? (size_t)n : sizeof(line) - 1;
-        memcpy(line, buf, copy_len);
-        line[copy_len] = '\0';
-        size_t logical_len = copy_len;
-        trim_line(line, &logical_len);
-        char out[4096];
-        int shutdown_flag = st->shutdown_requested;
-        int out_len = server_process_line(line, logical_len, &st->stats, &shutdown_flag, out, sizeof(out));
-        if (!st->shutdown_requested && shutdown_flag) {
-            st->shutdown_requested = 1;
-            log_info("shutdown requested by udp");
+        uint64_t start = metrics_now_ns();
+        for (int i = 0; i < n; i++) {
+            struct msghdr *h = &b->rx[i].msg_hdr;
+            const char *data = b->rx_iov[i].iov_base;
+            size_t len = b->rx[i].msg_len;
+            if (len == 0) continue;
+            got += len;
+            size_t seg = len;
+            udp_rx_cmsgs(st, h, &seg);
+            for (size_t off = 0; off < len; off += seg) {
+                size_t part = len - off < seg ? len - off : seg;
+                udp_reply(st, b, data + off, part, &b->rx_addr[i], h->msg_namelen);
+            }
         }
-        if (out_len > 0) {
-            sendto(st->udp_fd, out, (size_t)out_len, 0, (struct sockaddr *)&addr, alen);
+        udp_flush(st, b);
+        hist_record(&st->metrics->transport[b->fd == st->unix_dgram_fd ? METRICS_UNIX : METRICS_UDP], metrics_now_ns() - start);
+        if ((unsigned)n < b->size) break;
+    }
+}
+
+static int open_unix_listeners(struct server_shared *sh, const struct server_config *cfg) {
+    int backlog = cfg->listen_backlog > 0 ? cfg->listen_backlog : 128;
+    if (cfg->unix_path && sh->unix_fd == -1) {
+        sh->unix_fd = setup_unix_socket(cfg, cfg->unix_path, SOCK_STREAM, backlog);
+        if (sh->unix_fd == -1) return -1;
+        sh->unix_path = cfg->unix_path;
+        log_info("unix stream listener %s", cfg->unix_path);
+    }
+    if (cfg->unix_dgram_path && sh->unix_dgram_fd == -1) {
+        sh->unix_dgram_fd = setup_unix_socket(cfg, cfg->unix_dgram_path, SOCK_DGRAM, backlog);
+        if (sh->unix_dgram_fd == -1) return -1;
+        sh->unix_dgram_path = cfg->unix_dgram_path;
+        log_info("unix datagram socket %s", cfg->unix_dgram_path);
+    }
+    return 0;
+}
+
+static int open_listeners(struct server_shared *sh, const struct server_config *cfg) {
+    int pairs = sh->workers_count;
+    sh->listen_fds = malloc((size_t)pairs * 2 * sizeof(int));
+    if (!sh->listen_fds) return -1;
+    int backlog = cfg->listen_backlog > 0 ? cfg->listen_backlog : 128;
+    for (int i = 0; i < pairs; i++) {
+        int cpu = cfg->sock.incoming_cpu ? worker_cpu(i) : -1;
+        int tcp = setup_tcp_listener(cfg, backlog, pairs > 1, cpu);
+        if (tcp == -1) return -1;
+        int udp = setup_udp_socket(cfg, pairs > 1, cpu);
+        if (udp == -1) {
+            close(tcp);
+            return -1;
         }
+        sh->listen_fds[2 * i] = tcp;
+        sh->listen_fds[2 * i + 1] = udp;
+        sh->listen_pairs++;
+    }
+    log_socket_opts("tcp listener", sh->listen_fds[0], 1);
+    log_socket_opts("udp socket", sh->listen_fds[1], 0);
+    if (cfg->metrics_port > 0) {
+        sh->metrics_fd = metrics_http_listen(cfg->metrics_bind, cfg->metrics_port);
+        if (sh->metrics_fd == -1) return -1;
     }
+    return open_unix_listeners(sh, cfg);
 }
 
-int server_run(const struct server_config *cfg) {
-    if (!cfg) return -1;
-    struct server_state st;
-    memset(&st, 0, sizeof(st));
-    st.client_buf_size = cfg->client_buffer_size ? cfg->client_buffer_size : 4096;
-    st.max_clients = cfg->max_clients;
-    st.epfd = epoll_create1(0);
-    if (st.epfd == -1) {
-        perror("epoll_create1");
+static int adopt_listeners(struct server_shared *sh, const struct server_config *cfg, const int *fds, int n) {
+    int tcp[HANDOFF_MAX_FDS];
+    int udp[HANDOFF_MAX_FDS];
+    int ntcp = 0, nudp = 0;
+    for (int i = 0; i < n; i++) {
+        int fd = fds[i];
+        int type = get_int_opt(fd, SOL_SOCKET, SO_TYPE);
+        int port = -1;
+        struct sockaddr_storage addr;
+        socklen_t alen = sizeof(addr);
+        if (getsockname(fd, (struct sockaddr *)&addr, &alen) == -1) addr.ss_family = AF_UNSPEC;
+        if (addr.ss_family == AF_INET) port = ntohs(((const struct sockaddr_in *)(const void *)&addr)->sin_port);
+        int flags = fcntl(fd, F_GETFL);
+        if (flags != -1 && !(flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) perror("fcntl O_NONBLOCK");
+        if (type == SOCK_STREAM && port == cfg->metrics_port && sh->metrics_fd == -1) {
+            sh->metrics_fd = fd;
+        } else if (type == SOCK_STREAM && port == cfg->port) {
+            tcp[ntcp++] = fd;
+        } else if (type == SOCK_DGRAM && port == cfg->port) {
+            udp[nudp++] = fd;
+        } else if (addr.ss_family == AF_UNIX && type == SOCK_STREAM && cfg->unix_path && sh->unix_fd == -1) {
+            sh->unix_fd = fd;
+            sh->unix_path = cfg->unix_path;
+        } else if (addr.ss_family == AF_UNIX && type == SOCK_DGRAM && cfg->unix_dgram_path && sh->unix_dgram_fd == -1) {
+            sh->unix_dgram_fd = fd;
+            sh->unix_dgram_path = cfg->unix_dgram_path;
+        } else {
+            log_error("ignoring inherited fd=%d type=%d port=%d", fd, type, port);
+            close(fd);
+        }
+    }
+    if (ntcp > 0 && ntcp == nudp && ntcp <= sh->workers_count) sh->listen_fds = malloc((size_t)ntcp * 2 * sizeof(int));
+    if (!sh->listen_fds) {
+        log_error("inherited %d tcp and %d udp sockets on port %d, need matching pairs for %d workers",
+                  ntcp,
+                  nudp,
+                  cfg->port,
+                  sh->workers_count);
+        for (int i = 0; i < ntcp; i++) close(tcp[i]);
+        for (int i = 0; i < nudp; i++) close(udp[i]);
         return -1;
     }
-    int backlog = cfg->listen_backlog > 0 ? cfg->listen_backlog : 128;
-    st.tcp_listen_fd = setup_tcp_listener(cfg->port, backlog);
-    if (st.tcp_listen_fd == -1) {
-        close(st.epfd);
+    for (int i = 0; i < ntcp; i++) {
+        sh->listen_fds[2 * i] = tcp[i];
+        sh->listen_fds[2 * i + 1] = udp[i];
+        set_int_opt(udp[i], SOL_SOCKET, SO_RXQ_OVFL, 1, "SO_RXQ_OVFL");
+    }
+    sh->listen_pairs = ntcp;
+    log_info("inherited %d listener pairs on port %d", ntcp, cfg->port);
+    log_socket_opts("tcp listener", tcp[0], 1);
+    log_socket_opts("udp socket", udp[0], 0);
+    return open_unix_listeners(sh, cfg);
+}
+
+static int acquire_listeners(struct server_shared *sh, const struct server_config *cfg, int *peer) {
+    int fds[HANDOFF_MAX_FDS];
+    int n = handoff_inherited(fds, HANDOFF_MAX_FDS);
+    if (n == 0 && cfg->upgrade_socket) n = handoff_receive(cfg->upgrade_socket, fds, HANDOFF_MAX_FDS, peer);
+    if (n < 0) return -1;
+    if (n == 0) return open_listeners(sh, cfg);
+    return adopt_listeners(sh, cfg, fds, n);
+}
+
+static void close_unix_socket(int fd, const char *path, int remove) {
+    if (fd == -1) return;
+    close(fd);
+    if (remove && path && path[0] != '@') unlink(path);
+}
+
+static void close_listeners(struct server_shared *sh, int remove) {
+    for (int i = 0; i < 2 * sh->listen_pairs; i++) close(sh->listen_fds[i]);
+    free(sh->listen_fds);
+    sh->listen_fds = NULL;
+    sh->listen_pairs = 0;
+    close_unix_socket(sh->unix_fd, sh->unix_path, remove);
+    close_unix_socket(sh->unix_dgram_fd, sh->unix_dgram_path, remove);
+    sh->unix_fd = sh->unix_dgram_fd = -1;
+}
+
+static void worker_close(struct server_state *st) {
+    if (st->wake_fd != -1) close(st->wake_fd);
+    if (st->epfd != -1) close(st->epfd);
+    st->udp_fd = st->tcp_listen_fd = st->wake_fd = st->epfd = -1;
+    st->unix_listen_fd = st->unix_dgram_fd = -1;
+    st->listening = 0;
+    udp_batch_free(st->udp);
+    udp_batch_free(st->unix_udp);
+    st->udp = st->unix_udp = NULL;
+}
+
+static int worker_open(struct server_state *st, const struct server_config *cfg) {
+    struct server_shared *sh = st->shared;
+    st->wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (st->wake_fd == -1) {
+        perror("eventfd");
+        worker_close(st);
         return -1;
     }
-    st.udp_fd = setup_udp_socket(cfg->port);
-    if (st.udp_fd == -1) {
-        close(st.tcp_listen_fd);
-        close(st.epfd);
+    int pair = st->id % sh->listen_pairs;
+    st->tcp_listen_fd = sh->listen_fds[2 * pair];
+    st->udp_fd = sh->listen_fds[2 * pair + 1];
+    st->wake_src.kind = EV_WAKE;
+    st->wake_src.fd = st->wake_fd;
+    st->tcp_listen_src.kind = EV_TCP_LISTEN;
+    st->tcp_listen_src.fd = st->tcp_listen_fd;
+    st->udp_src.kind = EV_UDP;
+    st->udp_src.fd = st->udp_fd;
+    st->unix_listen_fd = sh->unix_fd;
+    st->unix_dgram_fd = sh->unix_dgram_fd;
+    st->unix_listen_src.kind = EV_UNIX_LISTEN;
+    st->unix_listen_src.fd = st->unix_listen_fd;
+    st->unix_dgram_src.kind = EV_UNIX_DGRAM;
+    st->unix_dgram_src.fd = st->unix_dgram_fd;
+    if (sh->backend != SERVER_BACKEND_EPOLL) return 0;
+    st->udp = udp_batch_new(st->udp_fd, cfg->udp_batch, cfg->udp_gso);
+    if (st->udp && st->unix_dgram_fd != -1) st->unix_udp = udp_batch_new(st->unix_dgram_fd, cfg->udp_batch, 0);
+    if (!st->udp || (st->unix_dgram_fd != -1 && !st->unix_udp)) {
+        log_error("failed to allocate udp batch");
+        worker_close(st);
         return -1;
     }
-    if (add_fd_epoll(st.epfd, st.tcp_listen_fd, EPOLLIN) == -1) {
-        perror("epoll add tcp listen");
-        close(st.udp_fd);
-        close(st.tcp_listen_fd);
-        close(st.epfd);
+    if (st->id == 0) {
+        log_info("udp batch=%u gro=%d gso=%d", st->udp->size, st->udp->gro, st->udp->gso);
+    }
+    st->epfd = epoll_create1(0);
+    if (st->epfd == -1) {
+        perror("epoll_create1");
+        worker_close(st);
         return -1;
     }
-    if (add_fd_epoll(st.epfd, st.udp_fd, EPOLLIN) == -1) {
+    if (add_fd_epoll(st->epfd, st->wake_fd, EPOLLIN, &st->wake_src) == -1) {
+        perror("epoll add wake");
+        worker_close(st);
+        return -1;
+    }
+    if (listener_watch(st, 1) == -1) {
+        worker_close(st);
+        return -1;
+    }
+    if (add_fd_epoll(st->epfd, st->udp_fd, EPOLLIN, &st->udp_src) == -1) {
         perror("epoll add udp");
-        close(st.udp_fd);
-        close(st.tcp_listen_fd);
-        close(st.epfd);
+        worker_close(st);
         return -1;
     }
-    int max_events = cfg->max_events > 0 ? cfg->max_events : 64;
-    struct epoll_event *events = calloc((size_t)max_events, sizeof(struct epoll_event));
-    if (!events) {
-        close(st.udp_fd);
-        close(st.tcp_listen_fd);
-        close(st.epfd);
+    if (st->unix_dgram_fd != -1 && add_fd_epoll(st->epfd, st->unix_dgram_fd, EPOLLIN | EPOLLEXCLUSIVE, &st->unix_dgram_src) == -1) {
+        perror("epoll add unix dgram");
+        worker_close(st);
         return -1;
     }
-    log_info("server started on port %d", cfg->port);
-    int rc = 0;
-    while (!st.shutdown_requested) {
-        int n = epoll_wait(st.epfd, events, max_events, -1);
+    return 0;
+}
+
+static void pin_worker(struct server_state *st) {
+    int cpu = worker_cpu(st->id);
+    if (cpu < 0) return;
+    cpu_set_t one;
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+    if (err != 0) {
+        log_error("worker %d: failed to pin to cpu %d: %s", st->id, cpu, strerror(err));
+    } else {
+        log_info("worker %d pinned to cpu %d", st->id, cpu);
+    }
+}
+
+static void epoll_worker_loop(struct server_state *st) {
+    struct epoll_event *events = calloc((size_t)st->max_events, sizeof(struct epoll_event));
+    st->rx_buf = malloc(st->client_buf_size);
+    if (!events || !st->rx_buf) {
+        free(events);
+        free(st->rx_buf);
+        st->rx_buf = NULL;
+        st->rc = -1;
+        request_shutdown(st->shared);
+        return;
+    }
+    while (!shutting_down(st)) {
+        int timeout = worker_timer_timeout(st);
+        if (st->ready_head || pubsub_pending(st)) timeout = 0;
+        int n = epoll_wait(st->epfd, events, st->max_events, timeout);
         if (n == -1) {
             if (errno == EINTR) continue;
             perror("epoll_wait");
-            rc = -1;
+            st->rc = -1;
+            request_shutdown(st->shared);
             break;
         }
+        st->now_ms = timer_now_ms();
+        metric_add(&st->metrics->loop_wakeups, 1);
+        hist_record(&st->metrics->loop_batch, (uint64_t)n);
         for (int i = 0; i < n; i++) {
-            int fd = events[i].data.fd;
+            struct ev_source *src = events[i].data.ptr;
             uint32_t ev = events[i].events;
-            if (ev & (EPOLLERR | EPOLLHUP)) {
-                if (fd == st.tcp_listen_fd || fd == st.udp_fd) {
-                    log_error("fatal error on fd=%d", fd);
-                    st.shutdown_requested = 1;
-                    rc = -1;
-                    break;
-                } else {
-                    struct client *c = find_client(&st, fd);
-                    if (c) close_client(&st, c);
+            if (src->kind == EV_TCP_CLIENT) {
+                struct client *c = (struct client *)src;
+                if (!c->alive) continue;
+                if (ev & (EPOLLERR | EPOLLHUP)) {
+                    close_client(st, c);
                     continue;
                 }
+                if (ev & EPOLLOUT) handle_tcp_writable(st, c);
+                if ((ev & EPOLLIN) && c->alive) handle_tcp_client(st, c);
+            } else if (src->kind == EV_WAKE) {
+                uint64_t v;
+                if (read(st->wake_fd, &v, sizeof(v)) == -1 && errno != EAGAIN) perror("read wake_fd");
+            } else if (ev & (EPOLLERR | EPOLLHUP)) {
+                log_error("fatal error on fd=%d", src->fd);
+                st->rc = -1;
+                request_shutdown(st->shared);
+                break;
+            } else if (src->kind == EV_TCP_LISTEN) {
+                handle_accept(st, st->tcp_listen_fd, 0);
+            } else if (src->kind == EV_UNIX_LISTEN) {
+                handle_accept(st, st->unix_listen_fd, 1);
+            } else if (src->kind == EV_UNIX_DGRAM) {
+                handle_udp(st, st->unix_udp);
+            } else {
+                handle_udp(st, st->udp);
             }
-            if (fd == st.tcp_listen_fd) {
-                handle_tcp_accept(&st);
-            } else if (fd == st.udp_fd) {
-                handle_udp(&st);
+            if (shutting_down(st)) break;
+        }
+        for (size_t pending = st->ready_count; pending > 0 && !shutting_down(st); pending--) {
+            struct client *c = client_ready_pop(st);
+            if (!c) break;
+            handle_tcp_client(st, c);
+        }
+        pubsub_run(st);
+        worker_timers_expire(st);
+        client_table_reclaim(&st->clients);
+        commands_flushed();
+        if (st->accept_paused && !client_limit_reached(st) && !shutting_down(st) && !st->draining) resume_accept(st);
+        if (!st->draining && drain_requested(st)) epoll_drain_begin(st);
+        if (worker_drained(st)) break;
+    }
+    free(events);
+    free(st->rx_buf);
+    st->rx_buf = NULL;
+}
+
+static void worker_loop(struct server_state *st) {
+    if (st->shared->pin_cpus) pin_worker(st);
+    if (st->shared->backend == SERVER_BACKEND_IO_URING) {
+        if (uring_worker_loop(st) == -1) {
+            st->rc = -1;
+            request_shutdown(st->shared);
+        }
+    } else {
+        epoll_worker_loop(st);
+    }
+    for (uint32_t i = 0; i < st->clients.slots; i++) {
+        struct client *c = client_table_get(&st->clients, i);
+        if (c->alive) {
+            if (st->epfd != -1) epoll_ctl(st->epfd, EPOLL_CTL_DEL, c->src.fd, NULL);
+            close(c->src.fd);
+        }
+        free(c->buf);
+        free(c->ps_links);
+        outq_clear(&c->out);
+    }
+    client_table_destroy(&st->clients);
+    bufpool_destroy(&st->bufs);
+}
+
+static void *worker_thread(void *arg) {
+    worker_loop(arg);
+    return NULL;
+}
+
+int server_backend_available(int backend) {
+    if (backend == SERVER_BACKEND_EPOLL) return 1;
+    if (backend == SERVER_BACKEND_IO_URING) return uring_supported();
+    return 0;
+}
+
+int server_run(const struct server_config *cfg) {
+    if (!cfg) return -1;
+    int workers = cfg->workers > 0 ? cfg->workers : 1;
+    struct server_shared sh;
+    memset(&sh, 0, sizeof(sh));
+    atomic_init(&sh.shutdown_requested, 0);
+    atomic_init(&sh.drain_requested, 0);
+    sh.workers_count = workers;
+    sh.metrics_fd = -1;
+    sh.unix_fd = sh.unix_dgram_fd = -1;
+    sh.drain_timeout_ms = cfg->drain_timeout_ms;
+    sh.admin_commands = cfg->admin_commands;
+    sh.pin_cpus = cfg->pin_cpus;
+    sh.backend = cfg->backend;
+    sh.rate = cfg->rate;
+    if (!server_backend_available(sh.backend)) {
+        log_error("backend %d is not available", sh.backend);
+        return -1;
+    }
+    sh.workers = calloc((size_t)workers, sizeof(struct server_state));
+    if (!sh.workers) return -1;
+    commands_hold();
+    if (log_start() == -1) log_error("failed to start log thread, logging synchronously");
+    sh.max_clients = cfg->max_clients;
+    int rc = 0;
+    int ran = 0;
+    for (int i = 0; i < workers; i++) {
+        struct server_state *st = &sh.workers[i];
+        st->shared = &sh;
+        st->id = i;
+        st->epfd = st->wake_fd = st->tcp_listen_fd = st->udp_fd = -1;
+        st->unix_listen_fd = st->unix_dgram_fd = -1;
+        st->client_buf_size = cfg->client_buffer_size ? cfg->client_buffer_size : 4096;
+        st->max_line = cfg->max_line_length ? cfg->max_line_length : 64 * 1024;
+        st->output_hwm = cfg->client_output_hwm ? cfg->client_output_hwm : 256 * 1024;
+        st->accept_batch = cfg->accept_batch;
+        st->quickack = cfg->sock.quickack;
+        st->max_events = cfg->max_events > 0 ? cfg->max_events : 64;
+        st->idle_timeout_ms = cfg->idle_timeout_ms;
+        st->read_timeout_ms = cfg->read_timeout_ms;
+        st->write_timeout_ms = cfg->write_timeout_ms;
+        st->edge_triggered = cfg->edge_triggered;
+        st->read_budget = cfg->read_budget;
+        st->ready_tail = &st->ready_head;
+        st->now_ms = timer_now_ms();
+        timer_wheel_init(&st->timers, st->now_ms);
+        client_table_init(&st->clients);
+        size_t share = cfg->max_clients > 0 ? (size_t)(cfg->max_clients / workers + (i < cfg->max_clients % workers)) : 1024;
+        bufpool_init(&st->bufs, st->client_buf_size, share > 0 ? share : 1);
+        st->metrics = calloc(1, sizeof(*st->metrics));
+        if (!st->metrics) rc = -1;
+    }
+    if (rc == 0 && !(sh.kv = kv_new())) rc = -1;
+    if (rc == 0 && (sh.rate.ip_msgs || sh.rate.ip_bytes) &&
+        !(sh.rate_ips = rate_ip_new(sh.rate.ip_table ? sh.rate.ip_table : 65536, sh.rate.ip_msgs, sh.rate.ip_bytes))) {
+        rc = -1;
+    }
+    if (rc == 0 && pubsub_init(&sh, cfg->fanout_slice, cfg->slow_subscriber) == -1) rc = -1;
+    int peer = -1;
+    if (rc == 0 && acquire_listeners(&sh, cfg, &peer) == -1) rc = -1;
+    for (int i = 0; rc == 0 && i < workers; i++) {
+        if (worker_open(&sh.workers[i], cfg) == -1) {
+            rc = -1;
+            break;
+        }
+    }
+    struct metrics_http http;
+    http.fd = -1;
+    sh.http = &http;
+    int metrics_owned = sh.metrics_fd != -1;
+    if (rc == 0 && cfg->metrics_port > 0) {
+        metrics_owned = 0;
+        if (sh.metrics_fd == -1) sh.metrics_fd = metrics_http_listen(cfg->metrics_bind, cfg->metrics_port);
+        if (metrics_http_start(&http, sh.metrics_fd, render_metrics, &sh) == -1) {
+            rc = -1;
+        } else {
+            log_info("metrics listening on %s:%d", cfg->metrics_bind ? cfg->metrics_bind : "127.0.0.1", cfg->metrics_port);
+        }
+    }
+    if (peer != -1 && rc != 0) {
+        close(peer);
+    } else if (peer != -1 && handoff_confirm(peer) == 0) {
+        log_info("took over %d listener pairs from the previous process", sh.listen_pairs);
+    }
+    struct handoff upgrade;
+    upgrade.fd = -1;
+    upgrade.handed_off = 0;
+    if (rc == 0 && cfg->upgrade_socket) {
+        int fds[HANDOFF_MAX_FDS];
+        int count = 2 * sh.listen_pairs + (sh.metrics_fd != -1) + (sh.unix_fd != -1) + (sh.unix_dgram_fd != -1);
+        if (count > HANDOFF_MAX_FDS) {
+            log_error("too many sockets to hand off: %d", count);
+            rc = -1;
+        } else {
+            int n = 2 * sh.listen_pairs;
+            memcpy(fds, sh.listen_fds, (size_t)n * sizeof(int));
+            if (sh.metrics_fd != -1) fds[n++] = sh.metrics_fd;
+            if (sh.unix_fd != -1) fds[n++] = sh.unix_fd;
+            if (sh.unix_dgram_fd != -1) fds[n++] = sh.unix_dgram_fd;
+            if (handoff_start(&upgrade, cfg->upgrade_socket, fds, count, request_drain, &sh) == -1) {
+                rc = -1;
             } else {
-                if (ev & EPOLLIN) handle_tcp_client(&st, fd);
+                log_info("upgrade socket %s", cfg->upgrade_socket);
             }
-            if (st.shutdown_requested) break;
         }
     }
-    for (size_t i = 0; i < st.clients_count; i++) {
-        if (st.clients[i].alive) {
-            epoll_ctl(st.epfd, EPOLL_CTL_DEL, st.clients[i].fd, NULL);
-            close(st.clients[i].fd);
+    if (rc == 0) {
+        handoff_notify_ready();
+        log_info("server started on port %d workers=%d backend=%s", cfg->port, workers, sh.backend == SERVER_BACKEND_IO_URING ? "io_uring" : "epoll");
+        int started = 1;
+        for (; started < workers; started++) {
+            int err = pthread_create(&sh.workers[started].thread, NULL, worker_thread, &sh.workers[started]);
+            if (err != 0) {
+                log_error("failed to start worker %d: %s", started, strerror(err));
+                rc = -1;
+                request_shutdown(&sh);
+                break;
+            }
+        }
+        worker_loop(&sh.workers[0]);
+        ran = 1;
+        for (int i = 1; i < started; i++) pthread_join(sh.workers[i].thread, NULL);
+        for (int i = 0; i < workers; i++) {
+            if (sh.workers[i].rc != 0) rc = -1;
         }
-        free(st.clients[i].buf);
     }
-    free(st.clients);
-    free(events);
-    close(st.udp_fd);
-    close(st.tcp_listen_fd);
-    close(st.epfd);
-    log_info("server stopped total_tcp_clients=%" PRIu64 " current_tcp_clients=%" PRIu64 " total_udp_messages=%" PRIu64,
-             st.stats.total_tcp_clients,
-             st.stats.current_tcp_clients,
-             st.stats.total_udp_messages);
+    handoff_stop(&upgrade);
+    metrics_http_stop(&http);
+    if (metrics_owned) close(sh.metrics_fd);
+    struct server_stats total;
+    collect_stats(&sh, &total);
+    for (int i = 0; i < workers; i++) {
+        worker_close(&sh.workers[i]);
+        free(sh.workers[i].metrics);
+        free(sh.workers[i].reply);
+    }
+    close_listeners(&sh, !upgrade.handed_off);
+    pubsub_destroy(&sh);
+    kv_free(sh.kv);
+    rate_ip_free(sh.rate_ips);
+    free(sh.workers);
+    if (ran) {
+        log_info("server stopped total_tcp_clients=%" PRIu64 " current_tcp_clients=%" PRIu64 " total_udp_messages=%" PRIu64,
+                 total.total_tcp_clients,
+                 total.current_tcp_clients,
+                 total.total_udp_messages);
+    }
+    commands_release();
+    log_stop();
     return rc;
 }
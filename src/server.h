@@ -4,21 +4,128 @@
 #include <stddef.h>
 #include <stdint.h>
 
+enum server_backend {
+    SERVER_BACKEND_EPOLL,
+    SERVER_BACKEND_IO_URING,
+};
+
+enum server_slow_policy {
+    SERVER_SLOW_DROP,
+    SERVER_SLOW_DISCONNECT,
+};
+
+enum server_pubsub_op {
+    SERVER_PUBSUB_SUB,
+    SERVER_PUBSUB_UNSUB,
+    SERVER_PUBSUB_PUB,
+};
+
+struct server_sockopts {
+    int rcvbuf;
+    int sndbuf;
+    int udp_rcvbuf;
+    int udp_sndbuf;
+    int nodelay;
+    int quickack;
+    int busy_poll_us;
+    int incoming_cpu;
+    int tos;
+};
+
+struct server_rate_limits {
+    uint64_t conn_msgs;
+    uint64_t conn_bytes;
+    uint64_t ip_msgs;
+    uint64_t ip_bytes;
+    size_t ip_table;
+};
+
 struct server_config {
     int port;
     int max_events;
     int listen_backlog;
     int max_clients;
     size_t client_buffer_size;
+    size_t client_output_hwm;
+    size_t max_line_length;
+    int workers;
+    int pin_cpus;
+    int backend;
+    int udp_batch;
+    int udp_gso;
+    int metrics_port;
+    const char *metrics_bind;
+    unsigned idle_timeout_ms;
+    unsigned read_timeout_ms;
+    unsigned write_timeout_ms;
+    int edge_triggered;
+    size_t read_budget;
+    int accept_batch;
+    int defer_accept_s;
+    int fastopen_qlen;
+    struct server_sockopts sock;
+    const char *upgrade_socket;
+    const char *unix_path;
+    const char *unix_dgram_path;
+    unsigned drain_timeout_ms;
+    int fanout_slice;
+    int slow_subscriber;
+    int admin_commands;
+    struct server_rate_limits rate;
+};
+
+struct kv;
+
+struct server_view {
+    const char *data;
+    size_t len;
 };
 
 struct server_stats {
     uint64_t total_tcp_clients;
     uint64_t current_tcp_clients;
     uint64_t total_udp_messages;
+    uint64_t client_pool_hits;
+    uint64_t client_pool_misses;
+    uint64_t buf_pool_hits;
+    uint64_t buf_pool_misses;
+    uint64_t log_dropped;
+    uint64_t client_timeouts;
+    uint64_t rejected_clients;
+    uint64_t accept_pauses;
+    uint64_t udp_drops;
+    uint64_t kv_keys;
+    uint64_t kv_bytes;
+    uint64_t total_unix_clients;
+    uint64_t current_unix_clients;
+    uint64_t total_unix_messages;
+    uint64_t udp_tx_drops;
+};
+
+struct server_command_ctx {
+    struct server_view args;
+    const struct server_stats *stats;
+    int *shutdown_requested;
+    char *out;
+    size_t out_cap;
+    const char *reply;
+    void (*refresh)(void *arg, struct server_stats *stats);
+    void *refresh_arg;
+    uint64_t (*stats_version)(void *arg);
+    int (*metrics)(void *arg, char *out, size_t cap);
+    void *metrics_arg;
+    int (*pubsub)(void *arg, int op, struct server_view topic, struct server_view msg, char *out, size_t cap);
+    void *pubsub_arg;
+    struct kv *kv;
+    uint64_t now_ms;
+    int *binary;
+    int admin;
 };
 
+typedef int (*server_command_fn)(struct server_command_ctx *ctx);
+
 int server_run(const struct server_config *cfg);
+int server_backend_available(int backend);
 
 int server_process_line(const char *line,
                         size_t len,
@@ -26,5 +133,6 @@ int server_process_line(const char *line,
                         int *shutdown_requested,
                         char *out,
                         size_t out_cap);
+int server_register_command(const char *name, const char *help, server_command_fn fn);
 
 #endif
@@ -0,0 +1,202 @@
+#ifndef SERVER_INTERNAL_H
+#define SERVER_INTERNAL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "bufpool.h"
+#include "client_table.h"
+#include "log.h"
+#include "server.h"
+#include "timerwheel.h"
+
+struct worker_counters {
+    _Atomic uint64_t total_tcp_clients;
+    _Atomic uint64_t current_tcp_clients;
+    _Atomic uint64_t total_udp_messages;
+    _Atomic uint64_t client_pool_hits;
+    _Atomic uint64_t client_pool_misses;
+    _Atomic uint64_t buf_pool_hits;
+    _Atomic uint64_t buf_pool_misses;
+    _Atomic uint64_t client_timeouts;
+    _Atomic uint64_t rejected_clients;
+    _Atomic uint64_t accept_pauses;
+    _Atomic uint64_t udp_drops;
+    _Atomic uint64_t total_unix_clients;
+    _Atomic uint64_t current_unix_clients;
+    _Atomic uint64_t total_unix_messages;
+    _Atomic uint64_t udp_tx_drops;
+    _Atomic uint64_t version;
+};
+
+struct kv;
+struct metrics_http;
+struct msghdr;
+struct pubsub_hub;
+struct pubsub_worker;
+struct rate_ip_table;
+struct reply_batch;
+struct server_shared;
+struct uring;
+struct udp_batch;
+struct worker_metrics;
+
+struct server_state {
+    struct server_shared *shared;
+    int id;
+    int epfd;
+    int wake_fd;
+    int tcp_listen_fd;
+    int udp_fd;
+    int unix_listen_fd;
+    int unix_dgram_fd;
+    struct ev_source wake_src;
+    struct ev_source tcp_listen_src;
+    struct ev_source udp_src;
+    struct ev_source unix_listen_src;
+    struct ev_source unix_dgram_src;
+    struct client_table clients;
+    struct bufpool bufs;
+    char *rx_buf;
+    size_t client_buf_size;
+    size_t max_line;
+    size_t output_hwm;
+    struct timer_wheel timers;
+    uint64_t now_ms;
+    uint64_t idle_timeout_ms;
+    uint64_t read_timeout_ms;
+    uint64_t write_timeout_ms;
+    int edge_triggered;
+    size_t read_budget;
+    struct client *ready_head;
+    struct client **ready_tail;
+    size_t ready_count;
+    int accept_batch;
+    atomic_int accept_paused;
+    int listening;
+    int draining;
+    uint64_t drain_deadline_ms;
+    int quickack;
+    int max_events;
+    int rc;
+    pthread_t thread;
+    struct uring *ring;
+    struct udp_batch *udp;
+    struct udp_batch *unix_udp;
+    struct reply_batch *reply;
+    struct worker_metrics *metrics;
+    struct pubsub_worker *pubsub;
+    uint64_t kv_sweep_ms;
+    _Alignas(64) struct worker_counters counters;
+};
+
+struct server_shared {
+    struct server_state *workers;
+    int workers_count;
+    int pin_cpus;
+    int backend;
+    int *listen_fds;
+    int listen_pairs;
+    int unix_fd;
+    int unix_dgram_fd;
+    const char *unix_path;
+    const char *unix_dgram_path;
+    int metrics_fd;
+    uint64_t drain_timeout_ms;
+    int admin_commands;
+    struct metrics_http *http;
+    struct pubsub_hub *pubsub;
+    struct kv *kv;
+    struct server_rate_limits rate;
+    struct rate_ip_table *rate_ips;
+    int max_clients;
+    atomic_int live_clients;
+    atomic_int shutdown_requested;
+    atomic_int drain_requested;
+};
+
+static inline void counter_add(_Atomic uint64_t *c, uint64_t v) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+static inline void counter_sub(_Atomic uint64_t *c, uint64_t v) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) - v, memory_order_relaxed);
+}
+
+static inline void counter_set(_Atomic uint64_t *c, uint64_t v) {
+    atomic_store_explicit(c, v, memory_order_relaxed);
+}
+
+static inline uint64_t counter_get(_Atomic uint64_t *c) {
+    return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+static inline void stat_add(struct server_state *st, _Atomic uint64_t *c, uint64_t v) {
+    counter_add(c, v);
+    counter_add(&st->counters.version, 1);
+}
+
+static inline void stat_sub(struct server_state *st, _Atomic uint64_t *c, uint64_t v) {
+    counter_sub(c, v);
+    counter_add(&st->counters.version, 1);
+}
+
+static inline void stat_set(struct server_state *st, _Atomic uint64_t *c, uint64_t v) {
+    if (counter_get(c) == v) return;
+    counter_set(c, v);
+    counter_add(&st->counters.version, 1);
+}
+
+static inline void trim_view(const char **line, size_t *len) {
+    const char *p = *line;
+    size_t n = *len;
+    while (n > 0 && (p[n - 1] == '\n' || p[n - 1] == '\r' || p[n - 1] == ' ' || p[n - 1] == '\t')) n--;
+    while (n > 0 && (p[0] == ' ' || p[0] == '\t')) {
+        p++;
+        n--;
+    }
+    *line = p;
+    *len = n;
+}
+
+static inline int client_limit_reached(const struct server_state *st) {
+    const struct server_shared *sh = st->shared;
+    return sh->max_clients > 0 && atomic_load(&sh->live_clients) >= sh->max_clients;
+}
+
+static inline int shutting_down(const struct server_state *st) {
+    return atomic_load_explicit(&st->shared->shutdown_requested, memory_order_relaxed);
+}
+
+static inline int drain_requested(const struct server_state *st) {
+    return atomic_load_explicit(&st->shared->drain_requested, memory_order_relaxed);
+}
+
+int request_shutdown(struct server_shared *sh);
+void worker_drain_begin(struct server_state *st);
+int worker_drained(struct server_state *st);
+struct client *add_client(struct server_state *st, int fd, int local);
+void close_client(struct server_state *st, struct client *c);
+void client_output_ready(struct server_state *st, struct client *c);
+int client_buffer_reserve(struct server_state *st, struct client *c, size_t n);
+int client_buffer_append(struct server_state *st, struct client *c, const char *data, size_t n);
+void client_buffer_release(struct server_state *st, struct client *c);
+void udp_rx_cmsgs(struct server_state *st, struct msghdr *h, size_t *gro_seg);
+int process_client_input(struct server_state *st, struct client *c);
+int client_input(struct server_state *st, struct client *c, const char *data, size_t n);
+void client_timer_update(struct server_state *st, struct client *c);
+int worker_timer_timeout(struct server_state *st);
+void worker_timers_expire(struct server_state *st);
+int process_datagram(struct server_state *st, const char *data, size_t len, const struct sockaddr *from, socklen_t fromlen, char *out, size_t out_cap);
+
+int uring_supported(void);
+int uring_worker_loop(struct server_state *st);
+void uring_client_closed(struct server_state *st, struct client *c);
+void uring_client_output(struct server_state *st, struct client *c);
+void uring_client_resume(struct server_state *st, struct client *c);
+void uring_client_settle(struct server_state *st, struct client *c);
+
+#endif
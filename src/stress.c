@@ -1,99 +1,874 @@
+#define _GNU_SOURCE
+#include "hist.h"
+
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
-struct worker_args {
+#define STRESS_EVENTS 256
+#define STRESS_RX 65536
+#define STRESS_UDP_WINDOW 4096
+#define STRESS_UDP_PAYLOAD_MAX 1400
+#define STRESS_UDP_TIMEOUT_NS 1000000000ull
+#define STRESS_SWEEP_NS 100000000ull
+#define STRESS_UDP_INDEX UINT32_MAX
+
+enum req_kind {
+    REQ_ECHO,
+    REQ_TIME,
+    REQ_STATS,
+    REQ_HELP,
+    REQ_KINDS,
+};
+
+static const char *const req_names[REQ_KINDS] = {"echo", "time", "stats", "help"};
+static const char *const req_lines[REQ_KINDS] = {NULL, "/time\n", "/stats\n", "/help\n"};
+
+struct options {
     const char *host;
     int port;
-    int messages;
+    int threads;
+    int connections;
+    double rate;
+    double duration;
+    double drain;
+    int pipeline;
+    double udp_ratio;
+    size_t size_min;
+    size_t size_max;
+    unsigned mix[REQ_KINDS];
+    unsigned mix_total;
+    unsigned help_lines;
+    const char *json;
+};
+
+struct inflight {
+    uint64_t intended;
+    uint64_t sent;
+    enum req_kind kind;
+    unsigned lines;
+};
+
+struct conn {
+    int fd;
+    int dead;
+    struct inflight *q;
+    unsigned head;
+    unsigned count;
+    char *wbuf;
+    size_t wlen;
+    size_t wcap;
+    int want_out;
+};
+
+struct udp_slot {
+    uint64_t seq;
+    uint64_t intended;
+    uint64_t sent;
+    int used;
+};
+
+struct loader {
+    const struct options *o;
+    pthread_t thread;
+    pthread_barrier_t *barrier;
     int id;
+    int ep;
+    struct conn *conns;
+    int nconns;
+    unsigned rr;
+    unsigned avail;
+    int udp_fd;
+    struct udp_slot *udp;
+    uint64_t udp_seq;
+    unsigned udp_inflight;
+    uint64_t rng;
+    char *payload;
+    uint64_t start;
+    uint64_t end;
+    uint64_t interval;
+    uint64_t next_intended;
+    uint64_t last_done;
+    int choice_set;
+    int choice_udp;
+    struct hist latency;
+    struct hist service;
+    uint64_t sent[REQ_KINDS];
+    uint64_t done[REQ_KINDS];
+    uint64_t udp_sent;
+    uint64_t udp_done;
+    uint64_t udp_lost;
+    uint64_t tcp_lost;
+    uint64_t errors;
+    uint64_t unsent;
+    uint64_t backlog_max;
+    uint64_t bytes_out;
+    uint64_t bytes_in;
 };
 
-static void *worker_thread(void *arg) {
-    struct worker_args *wa = (struct worker_args *)arg;
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd == -1) pthread_exit(NULL);
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t rng_next(uint64_t *s) {
+    uint64_t x = *s;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *s = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+static double rng_unit(uint64_t *s) {
+    return (double)(rng_next(s) >> 11) / (double)(1ull << 53);
+}
+
+static size_t pick_size(struct loader *l) {
+    const struct options *o = l->o;
+    if (o->size_max == o->size_min) return o->size_min;
+    return o->size_min + (size_t)(rng_next(&l->rng) % (o->size_max - o->size_min + 1));
+}
+
+static enum req_kind pick_kind(struct loader *l) {
+    unsigned r = (unsigned)(rng_next(&l->rng) % l->o->mix_total);
+    for (int k = 0; k < REQ_KINDS; k++) {
+        if (r < l->o->mix[k]) return (enum req_kind)k;
+        r -= l->o->mix[k];
+    }
+    return REQ_ECHO;
+}
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static int make_addr(const struct options *o, struct sockaddr_in *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons((uint16_t)o->port);
+    return inet_pton(AF_INET, o->host, &addr->sin_addr) == 1 ? 0 : -1;
+}
+
+static int connect_to(const struct options *o, int type) {
     struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons((uint16_t)wa->port);
-    if (inet_pton(AF_INET, wa->host, &addr.sin_addr) != 1) {
+    if (make_addr(o, &addr) == -1) return -1;
+    int fd = socket(AF_INET, type | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
         close(fd);
-        pthread_exit(NULL);
+        return -1;
     }
-    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    if (type == SOCK_STREAM) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+static int probe_help_lines(const struct options *o, unsigned *lines) {
+    int fd = connect_to(o, SOCK_STREAM);
+    if (fd == -1) return -1;
+    static const char probe[] = "/help\n#probe-end\n";
+    if (send(fd, probe, sizeof(probe) - 1, MSG_NOSIGNAL) != (ssize_t)(sizeof(probe) - 1)) {
         close(fd);
-        pthread_exit(NULL);
-    }
-    char buf[1024];
-    for (int i = 0; i < wa->messages; i++) {
-        int type = i % 4;
-        if (type == 0) {
-            snprintf(buf, sizeof(buf), "hello-%d-%d\n", wa->id, i);
-        } else if (type == 1) {
-            snprintf(buf, sizeof(buf), "/time\n");
-        } else if (type == 2) {
-            snprintf(buf, sizeof(buf), "/stats\n");
-        } else {
-            snprintf(buf, sizeof(buf), "/help\n");
-        }
-        size_t len = strlen(buf);
-        size_t sent = 0;
-        while (sent < len) {
-            ssize_t n = send(fd, buf + sent, len - sent, 0);
-            if (n == -1) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) continue;
+        return -1;
+    }
+    char buf[4096];
+    size_t len = 0;
+    unsigned count = 0;
+    for (;;) {
+        ssize_t n = recv(fd, buf + len, sizeof(buf) - len, 0);
+        if (n <= 0) break;
+        len += (size_t)n;
+        char *p = buf;
+        char *nl;
+        while ((nl = memchr(p, '\n', len - (size_t)(p - buf)))) {
+            if ((size_t)(nl - p) == 10 && memcmp(p, "#probe-end", 10) == 0) {
                 close(fd);
-                pthread_exit(NULL);
+                *lines = count;
+                return count > 0 ? 0 : -1;
             }
-            sent += (size_t)n;
+            count++;
+            p = nl + 1;
         }
-        ssize_t r = recv(fd, buf, sizeof(buf) - 1, 0);
-        if (r <= 0) break;
-        buf[r] = '\0';
+        len -= (size_t)(p - buf);
+        memmove(buf, p, len);
+        if (len == sizeof(buf)) break;
     }
     close(fd);
-    pthread_exit(NULL);
+    return -1;
+}
+
+static void conn_arm(struct loader *l, uint32_t idx, int want_out) {
+    struct conn *c = &l->conns[idx];
+    if (c->want_out == want_out) return;
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (want_out ? EPOLLOUT : 0);
+    ev.data.u32 = idx;
+    epoll_ctl(l->ep, EPOLL_CTL_MOD, c->fd, &ev);
+    c->want_out = want_out;
+}
+
+static void conn_kill(struct loader *l, uint32_t idx) {
+    struct conn *c = &l->conns[idx];
+    if (c->dead) return;
+    if (c->count < (unsigned)l->o->pipeline) l->avail--;
+    c->dead = 1;
+    l->errors++;
+    l->tcp_lost += c->count;
+    c->count = 0;
+    epoll_ctl(l->ep, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+}
+
+static void conn_flush(struct loader *l, uint32_t idx) {
+    struct conn *c = &l->conns[idx];
+    size_t off = 0;
+    while (off < c->wlen) {
+        ssize_t n = send(c->fd, c->wbuf + off, c->wlen - off, MSG_NOSIGNAL);
+        if (n > 0) {
+            off += (size_t)n;
+            l->bytes_out += (uint64_t)n;
+            continue;
+        }
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        conn_kill(l, idx);
+        return;
+    }
+    c->wlen -= off;
+    if (c->wlen) memmove(c->wbuf, c->wbuf + off, c->wlen);
+    conn_arm(l, idx, c->wlen > 0);
+}
+
+static int conn_append(struct conn *c, const char *data, size_t len) {
+    if (c->wlen + len > c->wcap) {
+        size_t cap = c->wcap ? c->wcap : 4096;
+        while (cap < c->wlen + len) cap *= 2;
+        char *nb = realloc(c->wbuf, cap);
+        if (!nb) return -1;
+        c->wbuf = nb;
+        c->wcap = cap;
+    }
+    memcpy(c->wbuf + c->wlen, data, len);
+    c->wlen += len;
+    return 0;
+}
+
+static int send_tcp(struct loader *l, uint64_t intended, uint64_t now) {
+    if (l->avail == 0) return 0;
+    unsigned pipeline = (unsigned)l->o->pipeline;
+    uint32_t idx = 0;
+    struct conn *c = NULL;
+    for (int i = 0; i < l->nconns; i++) {
+        idx = (uint32_t)((l->rr + (unsigned)i) % (unsigned)l->nconns);
+        if (!l->conns[idx].dead && l->conns[idx].count < pipeline) {
+            c = &l->conns[idx];
+            break;
+        }
+    }
+    if (!c) return 0;
+    l->rr = idx + 1;
+    enum req_kind kind = pick_kind(l);
+    int rc;
+    if (kind == REQ_ECHO) {
+        size_t n = pick_size(l);
+        char saved = l->payload[n];
+        l->payload[n] = '\n';
+        rc = conn_append(c, l->payload, n + 1);
+        l->payload[n] = saved;
+    } else {
+        rc = conn_append(c, req_lines[kind], strlen(req_lines[kind]));
+    }
+    if (rc == -1) {
+        conn_kill(l, idx);
+        return 1;
+    }
+    struct inflight *f = &c->q[(c->head + c->count) % pipeline];
+    f->intended = intended;
+    f->sent = now;
+    f->kind = kind;
+    f->lines = kind == REQ_HELP ? l->o->help_lines : 1;
+    if (++c->count == pipeline) l->avail--;
+    l->sent[kind]++;
+    conn_flush(l, idx);
+    return 1;
+}
+
+static int send_udp(struct loader *l, uint64_t intended, uint64_t now) {
+    struct udp_slot *s = &l->udp[l->udp_seq % STRESS_UDP_WINDOW];
+    if (s->used) return 0;
+    char buf[STRESS_UDP_PAYLOAD_MAX + 32];
+    size_t n = pick_size(l);
+    if (n > STRESS_UDP_PAYLOAD_MAX) n = STRESS_UDP_PAYLOAD_MAX;
+    int h = snprintf(buf, sizeof(buf), "#%llu ", (unsigned long long)l->udp_seq);
+    memcpy(buf + h, l->payload, n);
+    ssize_t w = send(l->udp_fd, buf, (size_t)h + n, 0);
+    if (w == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) return 0;
+        l->errors++;
+        return 1;
+    }
+    s->seq = l->udp_seq++;
+    s->intended = intended;
+    s->sent = now;
+    s->used = 1;
+    l->udp_inflight++;
+    l->udp_sent++;
+    l->sent[REQ_ECHO]++;
+    l->bytes_out += (uint64_t)w;
+    return 1;
+}
+
+static void complete(struct loader *l, enum req_kind kind, uint64_t intended, uint64_t sent, uint64_t now) {
+    hist_record(&l->latency, now - intended);
+    hist_record(&l->service, now - sent);
+    l->done[kind]++;
+    l->last_done = now;
+}
+
+static void on_tcp_read(struct loader *l, uint32_t idx, char *buf) {
+    struct conn *c = &l->conns[idx];
+    unsigned pipeline = (unsigned)l->o->pipeline;
+    for (;;) {
+        ssize_t n = recv(c->fd, buf, STRESS_RX, 0);
+        if (n == 0) {
+            conn_kill(l, idx);
+            return;
+        }
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) conn_kill(l, idx);
+            return;
+        }
+        l->bytes_in += (uint64_t)n;
+        uint64_t now = now_ns();
+        char *p = buf;
+        char *e = buf + n;
+        char *nl;
+        while ((nl = memchr(p, '\n', (size_t)(e - p)))) {
+            p = nl + 1;
+            if (c->count == 0) {
+                l->errors++;
+                continue;
+            }
+            struct inflight *f = &c->q[c->head];
+            if (--f->lines > 0) continue;
+            complete(l, f->kind, f->intended, f->sent, now);
+            c->head = (c->head + 1) % pipeline;
+            if (c->count-- == pipeline) l->avail++;
+        }
+        if (n < STRESS_RX) return;
+    }
+}
+
+static void on_udp_read(struct loader *l, char *buf) {
+    for (;;) {
+        ssize_t n = recv(l->udp_fd, buf, STRESS_RX, 0);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        l->bytes_in += (uint64_t)n;
+        if (n < 2 || buf[0] != '#') {
+            l->errors++;
+            continue;
+        }
+        buf[n - 1] = '\0';
+        unsigned long long seq = strtoull(buf + 1, NULL, 10);
+        struct udp_slot *s = &l->udp[seq % STRESS_UDP_WINDOW];
+        if (!s->used || s->seq != seq) continue;
+        s->used = 0;
+        l->udp_inflight--;
+        l->udp_done++;
+        complete(l, REQ_ECHO, s->intended, s->sent, now_ns());
+    }
+}
+
+static void udp_sweep(struct loader *l, uint64_t now) {
+    if (!l->udp || l->udp_inflight == 0) return;
+    for (unsigned i = 0; i < STRESS_UDP_WINDOW; i++) {
+        struct udp_slot *s = &l->udp[i];
+        if (s->used && now - s->sent > STRESS_UDP_TIMEOUT_NS) {
+            s->used = 0;
+            l->udp_inflight--;
+            l->udp_lost++;
+        }
+    }
+}
+
+static void dispatch(struct loader *l, uint64_t now) {
+    const struct options *o = l->o;
+    for (;;) {
+        uint64_t intended;
+        if (o->rate > 0) {
+            if (l->next_intended >= l->end || l->next_intended > now) break;
+            intended = l->next_intended;
+        } else {
+            if (now >= l->end) break;
+            intended = now;
+        }
+        if (!l->choice_set) {
+            l->choice_udp = l->udp_fd != -1 && rng_unit(&l->rng) < o->udp_ratio;
+            l->choice_set = 1;
+        }
+        int ok = l->choice_udp ? send_udp(l, intended, now) : send_tcp(l, intended, now);
+        if (!ok) break;
+        l->choice_set = 0;
+        if (o->rate > 0) l->next_intended += l->interval;
+    }
+    if (o->rate > 0 && l->next_intended <= now && l->next_intended < l->end) {
+        uint64_t last = now < l->end ? now : l->end - 1;
+        uint64_t backlog = (last - l->next_intended) / l->interval + 1;
+        if (backlog > l->backlog_max) l->backlog_max = backlog;
+    }
+}
+
+static unsigned outstanding(const struct loader *l) {
+    unsigned total = l->udp_inflight;
+    for (int i = 0; i < l->nconns; i++) total += l->conns[i].count;
+    return total;
+}
+
+static int loader_setup(struct loader *l) {
+    const struct options *o = l->o;
+    l->ep = epoll_create1(EPOLL_CLOEXEC);
+    if (l->ep == -1) return -1;
+    l->udp_fd = -1;
+    l->payload = malloc(o->size_max + 1);
+    if (!l->payload) return -1;
+    for (size_t i = 0; i <= o->size_max; i++) l->payload[i] = (char)('a' + rng_next(&l->rng) % 26);
+    if (l->nconns > 0) {
+        l->conns = calloc((size_t)l->nconns, sizeof(*l->conns));
+        if (!l->conns) return -1;
+    }
+    for (int i = 0; i < l->nconns; i++) {
+        struct conn *c = &l->conns[i];
+        c->fd = -1;
+        c->q = calloc((size_t)o->pipeline, sizeof(*c->q));
+        if (!c->q) return -1;
+        c->fd = connect_to(o, SOCK_STREAM);
+        if (c->fd == -1 || set_nonblocking(c->fd) == -1) {
+            fprintf(stderr, "stress: connect failed: %s\n", strerror(errno));
+            return -1;
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = (uint32_t)i;
+        if (epoll_ctl(l->ep, EPOLL_CTL_ADD, c->fd, &ev) == -1) return -1;
+        l->avail++;
+    }
+    if (o->udp_ratio > 0) {
+        l->udp = calloc(STRESS_UDP_WINDOW, sizeof(*l->udp));
+        if (!l->udp) return -1;
+        l->udp_fd = connect_to(o, SOCK_DGRAM);
+        if (l->udp_fd == -1 || set_nonblocking(l->udp_fd) == -1) return -1;
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = STRESS_UDP_INDEX;
+        if (epoll_ctl(l->ep, EPOLL_CTL_ADD, l->udp_fd, &ev) == -1) return -1;
+    }
+    return 0;
+}
+
+static void loader_cleanup(struct loader *l) {
+    for (int i = 0; l->conns && i < l->nconns; i++) {
+        if (l->conns[i].fd != -1) close(l->conns[i].fd);
+        free(l->conns[i].q);
+        free(l->conns[i].wbuf);
+    }
+    free(l->conns);
+    free(l->udp);
+    free(l->payload);
+    if (l->udp_fd != -1) close(l->udp_fd);
+    if (l->ep != -1) close(l->ep);
+}
+
+static void *loader_thread(void *arg) {
+    struct loader *l = arg;
+    const struct options *o = l->o;
+    int ok = loader_setup(l) == 0;
+    if (!ok) l->errors++;
+    pthread_barrier_wait(l->barrier);
+    if (!ok) return NULL;
+    char *buf = malloc(STRESS_RX);
+    if (!buf) {
+        l->errors++;
+        return NULL;
+    }
+    l->start = now_ns();
+    l->end = l->start + (uint64_t)(o->duration * 1e9);
+    l->next_intended = l->start;
+    l->last_done = l->start;
+    uint64_t drain_end = l->end + (uint64_t)(o->drain * 1e9);
+    uint64_t next_sweep = l->start + STRESS_SWEEP_NS;
+    struct epoll_event events[STRESS_EVENTS];
+    for (;;) {
+        uint64_t now = now_ns();
+        dispatch(l, now);
+        if (now >= next_sweep) {
+            udp_sweep(l, now);
+            next_sweep = now + STRESS_SWEEP_NS;
+        }
+        if (now >= l->end && (outstanding(l) == 0 || now >= drain_end)) break;
+        uint64_t wait = STRESS_SWEEP_NS;
+        if (now < l->end && l->end - now < wait) wait = l->end - now;
+        if (o->rate > 0 && l->next_intended < l->end && l->next_intended > now && l->next_intended - now < wait) {
+            wait = l->next_intended - now;
+        }
+        int timeout = (int)((wait + 999999) / 1000000);
+        int n = epoll_wait(l->ep, events, STRESS_EVENTS, timeout);
+        for (int i = 0; i < n; i++) {
+            uint32_t idx = events[i].data.u32;
+            if (idx == STRESS_UDP_INDEX) {
+                on_udp_read(l, buf);
+                continue;
+            }
+            if (l->conns[idx].dead) continue;
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) on_tcp_read(l, idx, buf);
+            if (!l->conns[idx].dead && (events[i].events & EPOLLOUT)) conn_flush(l, idx);
+        }
+    }
+    if (o->rate > 0 && l->next_intended < l->end) l->unsent = (l->end - l->next_intended + l->interval - 1) / l->interval;
+    for (int i = 0; i < l->nconns; i++) l->tcp_lost += l->conns[i].count;
+    l->udp_lost += l->udp_inflight;
+    free(buf);
+    return NULL;
+}
+
+static int parse_size(const char *s, struct options *o) {
+    char *end;
+    long a = strtol(s, &end, 10);
+    long b = a;
+    if (*end == ':') b = strtol(end + 1, &end, 10);
+    if (*end || a <= 0 || b < a || b > 1 << 20) return -1;
+    o->size_min = (size_t)a;
+    o->size_max = (size_t)b;
+    return 0;
+}
+
+static int parse_mix(const char *s, struct options *o) {
+    memset(o->mix, 0, sizeof(o->mix));
+    char *copy = strdup(s);
+    if (!copy) return -1;
+    int rc = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '=');
+        long w = 1;
+        if (eq) {
+            *eq = '\0';
+            char *end;
+            w = strtol(eq + 1, &end, 10);
+            if (*end || w < 0 || w > 1000000) rc = -1;
+        }
+        int k;
+        for (k = 0; k < REQ_KINDS; k++) {
+            if (strcmp(tok, req_names[k]) == 0) break;
+        }
+        if (k == REQ_KINDS) rc = -1;
+        else o->mix[k] = (unsigned)w;
+    }
+    free(copy);
+    o->mix_total = 0;
+    for (int k = 0; k < REQ_KINDS; k++) o->mix_total += o->mix[k];
+    return rc == 0 && o->mix_total > 0 ? 0 : -1;
+}
+
+static void print_latency(FILE *f, const char *name, const struct hist_snapshot *s, int json) {
+    static const double qs[] = {0.5, 0.9, 0.99, 0.999, 0.9999, 1.0};
+    static const char *const qn[] = {"p50", "p90", "p99", "p999", "p9999", "max"};
+    double mean = s->count ? (double)s->sum / (double)s->count / 1000.0 : 0.0;
+    if (json) {
+        fprintf(f, "  \"%s\": {\"count\": %llu, \"mean\": %.1f", name, (unsigned long long)s->count, mean);
+        for (size_t i = 0; i < sizeof(qs) / sizeof(qs[0]); i++) {
+            fprintf(f, ", \"%s\": %.1f", qn[i], (double)hist_quantile(s, qs[i]) / 1000.0);
+        }
+        fprintf(f, "}");
+        return;
+    }
+    fprintf(f, "%-8s mean %.1fus", name, mean);
+    for (size_t i = 0; i < sizeof(qs) / sizeof(qs[0]); i++) {
+        fprintf(f, "  %s %.1fus", qn[i], (double)hist_quantile(s, qs[i]) / 1000.0);
+    }
+    fprintf(f, "\n");
+}
+
+struct totals {
+    uint64_t sent[REQ_KINDS];
+    uint64_t done[REQ_KINDS];
+    uint64_t sent_all;
+    uint64_t done_all;
+    uint64_t udp_sent;
+    uint64_t udp_done;
+    uint64_t udp_lost;
+    uint64_t tcp_lost;
+    uint64_t errors;
+    uint64_t unsent;
+    uint64_t backlog_max;
+    uint64_t bytes_out;
+    uint64_t bytes_in;
+    double elapsed;
+    struct hist_snapshot latency;
+    struct hist_snapshot service;
+};
+
+static void report(FILE *f, const struct options *o, const struct totals *t, int json) {
+    double rps = t->elapsed > 0 ? (double)t->done_all / t->elapsed : 0.0;
+    if (!json) {
+        fprintf(f, "target %.0f req/s, %d threads, %d connections, pipeline %d, udp %.0f%%\n",
+                o->rate, o->threads, o->connections, o->pipeline, o->udp_ratio * 100.0);
+        fprintf(f, "sent %llu, completed %llu in %.2fs: %.0f req/s, %.2f MB/s out, %.2f MB/s in\n",
+                (unsigned long long)t->sent_all, (unsigned long long)t->done_all, t->elapsed, rps,
+                (double)t->bytes_out / t->elapsed / 1e6, (double)t->bytes_in / t->elapsed / 1e6);
+        fprintf(f, "udp sent %llu, completed %llu, lost %llu; tcp lost %llu; unsent %llu; max backlog %llu; errors %llu\n",
+                (unsigned long long)t->udp_sent, (unsigned long long)t->udp_done, (unsigned long long)t->udp_lost,
+                (unsigned long long)t->tcp_lost, (unsigned long long)t->unsent, (unsigned long long)t->backlog_max,
+                (unsigned long long)t->errors);
+        print_latency(f, "latency", &t->latency, 0);
+        print_latency(f, "service", &t->service, 0);
+        return;
+    }
+    fprintf(f, "{\n");
+    fprintf(f, "  \"config\": {\"host\": \"%s\", \"port\": %d, \"threads\": %d, \"connections\": %d, \"rate\": %.1f, "
+               "\"duration\": %.3f, \"pipeline\": %d, \"udp_ratio\": %.3f, \"size_min\": %zu, \"size_max\": %zu, \"mix\": {",
+            o->host, o->port, o->threads, o->connections, o->rate, o->duration, o->pipeline, o->udp_ratio, o->size_min,
+            o->size_max);
+    for (int k = 0; k < REQ_KINDS; k++) fprintf(f, "%s\"%s\": %u", k ? ", " : "", req_names[k], o->mix[k]);
+    fprintf(f, "}},\n");
+    fprintf(f, "  \"elapsed_s\": %.3f,\n  \"sent\": %llu,\n  \"completed\": %llu,\n  \"throughput_rps\": %.1f,\n", t->elapsed,
+            (unsigned long long)t->sent_all, (unsigned long long)t->done_all, rps);
+    fprintf(f, "  \"bytes_out\": %llu,\n  \"bytes_in\": %llu,\n", (unsigned long long)t->bytes_out,
+            (unsigned long long)t->bytes_in);
+    fprintf(f, "  \"udp_sent\": %llu,\n  \"udp_completed\": %llu,\n  \"udp_lost\": %llu,\n  \"tcp_lost\": %llu,\n",
+            (unsigned long long)t->udp_sent, (unsigned long long)t->udp_done, (unsigned long long)t->udp_lost,
+            (unsigned long long)t->tcp_lost);
+    fprintf(f, "  \"unsent\": %llu,\n  \"backlog_max\": %llu,\n  \"errors\": %llu,\n", (unsigned long long)t->unsent,
+            (unsigned long long)t->backlog_max, (unsigned long long)t->errors);
+    fprintf(f, "  \"requests\": {");
+    for (int k = 0; k < REQ_KINDS; k++) {
+        fprintf(f, "%s\"%s\": {\"sent\": %llu, \"completed\": %llu}", k ? ", " : "", req_names[k],
+                (unsigned long long)t->sent[k], (unsigned long long)t->done[k]);
+    }
+    fprintf(f, "},\n");
+    print_latency(f, "latency_us", &t->latency, 1);
+    fprintf(f, ",\n");
+    print_latency(f, "service_us", &t->service, 1);
+    fprintf(f, "\n}\n");
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--threads N] [--connections N] [--rate REQ_PER_SEC] [--duration SEC]\n"
+                    "       [--pipeline N] [--udp-ratio F] [--size N|MIN:MAX] [--mix echo=W,time=W,stats=W,help=W]\n"
+                    "       [--drain SEC] [--json FILE|-] host port\n", prog);
 }
 
 int main(int argc, char **argv) {
-    if (argc < 5) {
-        fprintf(stderr, "usage: %s host port threads messages_per_thread\n", argv[0]);
+    struct options o;
+    memset(&o, 0, sizeof(o));
+    o.threads = 1;
+    o.connections = 16;
+    o.rate = 10000;
+    o.duration = 5;
+    o.drain = 2;
+    o.pipeline = 1;
+    o.size_min = o.size_max = 16;
+    o.mix[REQ_ECHO] = 1;
+    o.mix_total = 1;
+    static const struct option opts[] = {
+        {"threads", required_argument, NULL, 't'},
+        {"connections", required_argument, NULL, 'c'},
+        {"rate", required_argument, NULL, 'r'},
+        {"duration", required_argument, NULL, 'd'},
+        {"pipeline", required_argument, NULL, 'p'},
+        {"udp-ratio", required_argument, NULL, 'u'},
+        {"size", required_argument, NULL, 's'},
+        {"mix", required_argument, NULL, 'm'},
+        {"drain", required_argument, NULL, 'D'},
+        {"json", required_argument, NULL, 'j'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:c:r:d:p:u:s:m:D:j:h", opts, NULL)) != -1) {
+        switch (opt) {
+        case 't':
+            o.threads = atoi(optarg);
+            if (o.threads <= 0 || o.threads > 1024) {
+                fprintf(stderr, "invalid threads: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'c':
+            o.connections = atoi(optarg);
+            if (o.connections < 0 || o.connections > 1000000) {
+                fprintf(stderr, "invalid connections: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'r':
+            o.rate = atof(optarg);
+            if (o.rate < 0) {
+                fprintf(stderr, "invalid rate: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'd':
+            o.duration = atof(optarg);
+            if (o.duration <= 0) {
+                fprintf(stderr, "invalid duration: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'p':
+            o.pipeline = atoi(optarg);
+            if (o.pipeline <= 0 || o.pipeline > 65536) {
+                fprintf(stderr, "invalid pipeline: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'u':
+            o.udp_ratio = atof(optarg);
+            if (o.udp_ratio < 0 || o.udp_ratio > 1) {
+                fprintf(stderr, "invalid udp-ratio: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 's':
+            if (parse_size(optarg, &o) == -1) {
+                fprintf(stderr, "invalid size: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'm':
+            if (parse_mix(optarg, &o) == -1) {
+                fprintf(stderr, "invalid mix: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'D':
+            o.drain = atof(optarg);
+            if (o.drain < 0) {
+                fprintf(stderr, "invalid drain: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'j':
+            o.json = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    o.host = argv[optind];
+    o.port = atoi(argv[optind + 1]);
+    struct sockaddr_in probe_addr;
+    if (o.port <= 0 || o.port > 65535 || make_addr(&o, &probe_addr) == -1) {
+        fprintf(stderr, "invalid address: %s %s\n", argv[optind], argv[optind + 1]);
         return 1;
     }
-    const char *host = argv[1];
-    int port = atoi(argv[2]);
-    int threads = atoi(argv[3]);
-    int messages = atoi(argv[4]);
-    if (port <= 0 || port > 65535 || threads <= 0 || messages <= 0) {
-        fprintf(stderr, "invalid arguments\n");
+    if (o.udp_ratio < 1 && o.connections == 0) {
+        fprintf(stderr, "tcp requests need --connections > 0\n");
         return 1;
     }
-    pthread_t *t = malloc((size_t)threads * sizeof(pthread_t));
-    struct worker_args *args = malloc((size_t)threads * sizeof(struct worker_args));
-    if (!t || !args) {
-        free(t);
-        free(args);
+    if (o.connections < o.threads && o.udp_ratio < 1) o.threads = o.connections;
+    o.help_lines = 1;
+    if (o.mix[REQ_HELP] && probe_help_lines(&o, &o.help_lines) == -1) {
+        fprintf(stderr, "failed to probe /help\n");
         return 1;
     }
-    for (int i = 0; i < threads; i++) {
-        args[i].host = host;
-        args[i].port = port;
-        args[i].messages = messages;
-        args[i].id = i;
-        pthread_create(&t[i], NULL, worker_thread, &args[i]);
+    struct loader *loaders = calloc((size_t)o.threads, sizeof(*loaders));
+    if (!loaders) return 1;
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, (unsigned)o.threads);
+    double rate_per_thread = o.rate / o.threads;
+    for (int i = 0; i < o.threads; i++) {
+        struct loader *l = &loaders[i];
+        l->o = &o;
+        l->id = i;
+        l->ep = -1;
+        l->udp_fd = -1;
+        l->barrier = &barrier;
+        l->nconns = o.connections / o.threads + (i < o.connections % o.threads ? 1 : 0);
+        l->rng = 0x9E3779B97F4A7C15ull * (uint64_t)(i + 1) ^ now_ns();
+        l->interval = o.rate > 0 ? (uint64_t)(1e9 / rate_per_thread) : 0;
+        if (o.rate > 0 && l->interval == 0) l->interval = 1;
     }
-    for (int i = 0; i < threads; i++) {
-        pthread_join(t[i], NULL);
+    int started = 0;
+    for (; started < o.threads; started++) {
+        if (pthread_create(&loaders[started].thread, NULL, loader_thread, &loaders[started]) != 0) break;
     }
-    free(t);
-    free(args);
-    return 0;
+    if (started != o.threads) {
+        fprintf(stderr, "failed to start threads\n");
+        return 1;
+    }
+    struct totals t;
+    memset(&t, 0, sizeof(t));
+    uint64_t start = UINT64_MAX;
+    uint64_t last = 0;
+    for (int i = 0; i < o.threads; i++) {
+        struct loader *l = &loaders[i];
+        pthread_join(l->thread, NULL);
+        for (int k = 0; k < REQ_KINDS; k++) {
+            t.sent[k] += l->sent[k];
+            t.done[k] += l->done[k];
+            t.sent_all += l->sent[k];
+            t.done_all += l->done[k];
+        }
+        t.udp_sent += l->udp_sent;
+        t.udp_done += l->udp_done;
+        t.udp_lost += l->udp_lost;
+        t.tcp_lost += l->tcp_lost;
+        t.errors += l->errors;
+        t.unsent += l->unsent;
+        if (l->backlog_max > t.backlog_max) t.backlog_max = l->backlog_max;
+        t.bytes_out += l->bytes_out;
+        t.bytes_in += l->bytes_in;
+        hist_snapshot_add(&t.latency, &l->latency);
+        hist_snapshot_add(&t.service, &l->service);
+        if (l->start && l->start < start) start = l->start;
+        if (l->last_done > last) last = l->last_done;
+        loader_cleanup(l);
+    }
+    pthread_barrier_destroy(&barrier);
+    free(loaders);
+    t.elapsed = o.duration;
+    if (last > start && (double)(last - start) / 1e9 > t.elapsed) t.elapsed = (double)(last - start) / 1e9;
+    if (o.json && strcmp(o.json, "-") == 0) {
+        report(stdout, &o, &t, 1);
+    } else {
+        report(stdout, &o, &t, 0);
+        if (o.json) {
+            FILE *f = fopen(o.json, "w");
+            if (!f) {
+                fprintf(stderr, "cannot write %s: %s\n", o.json, strerror(errno));
+                return 1;
+            }
+            report(f, &o, &t, 1);
+            fclose(f);
+        }
+    }
+    return t.errors == 0 && t.tcp_lost == 0 ? 0 : 2;
 }
@@ -1,9 +1,36 @@
+#define _GNU_SOURCE
 #include "server.h"
+#include "binproto.h"
+#include "bufpool.h"
+#include "client_table.h"
+#include "commands.h"
+#include "config.h"
+#include "kv.h"
+#include "linescan.h"
+#include "log.h"
+#include "metrics.h"
+#include "ratelimit.h"
+#include "timecache.h"
+#include "timerwheel.h"
 
+#include <arpa/inet.h>
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
 
 static void test_echo_simple(void) {
     struct server_stats stats;
@@ -61,27 +88,109 @@ static void test_time_format(void) {
     assert(out[16] == ':');
 }
 
+static void test_timecache(void) {
+    char cached[32];
+    char fresh[32];
+    int same = 0;
+    for (int i = 0; i < 3 && !same; i++) {
+        size_t n = timecache_format(cached, sizeof(cached));
+        size_t m = timecache_format_uncached(fresh, sizeof(fresh));
+        assert(n == TIMECACHE_LEN && m == TIMECACHE_LEN);
+        same = strcmp(cached, fresh) == 0;
+    }
+    assert(same);
+    assert(timecache_format(cached, TIMECACHE_LEN) == 0);
+}
+
 static void test_stats_output(void) {
     struct server_stats stats;
     memset(&stats, 0, sizeof(stats));
     stats.total_tcp_clients = 10;
     stats.current_tcp_clients = 3;
     stats.total_udp_messages = 5;
+    stats.buf_pool_hits = 7;
     int shutdown = 0;
-    char out[256];
+    char out[512];
     int n = server_process_line("/stats", strlen("/stats"), &stats, &shutdown, out, sizeof(out));
     assert(n > 0);
     out[n] = '\0';
     assert(strstr(out, "total_tcp_clients=10") != NULL);
     assert(strstr(out, "current_tcp_clients=3") != NULL);
     assert(strstr(out, "total_udp_messages=5") != NULL);
+    assert(strstr(out, "buf_pool_hits=7") != NULL);
+}
+
+static int refresh_calls;
+
+static void refresh_counters(void *arg, struct server_stats *stats) {
+    (void)arg;
+    refresh_calls++;
+    stats->total_tcp_clients = 40 + (uint64_t)refresh_calls;
+}
+
+static uint64_t stats_version_value;
+
+static uint64_t stats_version_fn(void *arg) {
+    (void)arg;
+    return stats_version_value;
+}
+
+static void test_stats_cache(void) {
+    struct server_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.udp_drops = 9;
+    int shutdown = 0;
+    char first[512];
+    char out[1024];
+    int n = server_process_line("/stats", 6, &stats, &shutdown, first, sizeof(first));
+    assert(n > 0 && strstr(first, " udp_drops=9 ") != NULL);
+    int m = server_process_line("/stats", 6, &stats, &shutdown, out, sizeof(out));
+    assert(m == n && memcmp(first, out, (size_t)n + 1) == 0);
+    stats.udp_drops = 10;
+    n = server_process_line("/stats", 6, &stats, &shutdown, out, sizeof(out));
+    assert(n > 0 && strstr(out, " udp_drops=10 ") != NULL);
+    struct server_command_ctx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.stats = &stats;
+    ctx.shutdown_requested = &shutdown;
+    ctx.out = out;
+    ctx.out_cap = sizeof(out);
+    ctx.refresh = refresh_counters;
+    refresh_calls = 0;
+    n = commands_process(&ctx, "/stats", 6);
+    assert(n > 0 && refresh_calls == 1 && strstr(out, "total_tcp_clients=41 ") != NULL);
+    n = commands_process(&ctx, "/stats", 6);
+    assert(n > 0 && refresh_calls == 2 && strstr(out, "total_tcp_clients=42 ") != NULL);
+    assert(stats.total_tcp_clients == 0 && ctx.stats == &stats);
+    n = commands_process(&ctx, "/time", 5);
+    assert(n > 0 && refresh_calls == 2);
+    n = commands_process(&ctx, "/help", 5);
+    assert(n > 0 && refresh_calls == 2);
+    assert(server_process_line("/help", 5, &stats, &shutdown, out, 16) == -1);
+    ctx.stats_version = stats_version_fn;
+    stats_version_value = 1;
+    refresh_calls = 0;
+    int cmd_id;
+    n = commands_dispatch("/stats", 6, &ctx, &cmd_id);
+    const char *cached = ctx.reply;
+    assert(n > 0 && refresh_calls == 1 && cached != out && strstr(cached, "total_tcp_clients=41 ") != NULL);
+    n = commands_dispatch("/stats", 6, &ctx, &cmd_id);
+    assert(n > 0 && refresh_calls == 1 && ctx.reply == cached);
+    stats_version_value = 2;
+    n = commands_dispatch("/stats", 6, &ctx, &cmd_id);
+    assert(n > 0 && refresh_calls == 2 && ctx.reply == out && strstr(out, "total_tcp_clients=42 ") != NULL);
+    assert(strstr(cached, "total_tcp_clients=41 ") != NULL);
+    commands_flushed();
+    n = commands_dispatch("/stats", 6, &ctx, &cmd_id);
+    assert(n > 0 && refresh_calls == 3 && ctx.reply == cached && strstr(cached, "total_tcp_clients=43 ") != NULL);
+    commands_flushed();
 }
 
 static void test_help_output(void) {
     struct server_stats stats;
     memset(&stats, 0, sizeof(stats));
     int shutdown = 0;
-    char out[256];
+    char out[1024];
     int n = server_process_line("/help", strlen("/help"), &stats, &shutdown, out, sizeof(out));
     assert(n > 0);
     out[n] = '\0';
@@ -89,6 +198,200 @@ static void test_help_output(void) {
     assert(strstr(out, "/stats") != NULL);
     assert(strstr(out, "/shutdown") != NULL);
     assert(strstr(out, "/help") != NULL);
+    assert(strstr(out, "/pub") != NULL);
+    assert(strstr(out, "/binary - ") != NULL);
+    assert(command_lookup("/binary", 7) != COMMAND_ID_UNKNOWN);
+    char again[1024];
+    assert(server_process_line("/help", 5, &stats, &shutdown, again, sizeof(again)) == n);
+    assert(memcmp(out, again, (size_t)n) == 0);
+}
+
+static void test_pubsub_unavailable(void) {
+    struct server_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    int shutdown = 0;
+    char out[64];
+    int n = server_process_line("/sub news", strlen("/sub news"), &stats, &shutdown, out, sizeof(out));
+    assert(n > 0);
+    out[n] = '\0';
+    assert(strcmp(out, "pubsub unavailable\n") == 0);
+    n = server_process_line("/binary", 7, &stats, &shutdown, out, sizeof(out));
+    assert(n > 0 && strcmp(out, "binary unavailable\n") == 0);
+}
+
+static int kv_line(struct server_command_ctx *ctx, const char *line, char *out, size_t cap) {
+    ctx->out = out;
+    ctx->out_cap = cap;
+    int n = commands_process(ctx, line, strlen(line));
+    assert(n > 0);
+    out[n] = '\0';
+    return n;
+}
+
+static void test_kv_commands(void) {
+    struct server_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    int shutdown = 0;
+    struct server_command_ctx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.stats = &stats;
+    ctx.shutdown_requested = &shutdown;
+    char out[512];
+    kv_line(&ctx, "/get a", out, sizeof(out));
+    assert(strcmp(out, "kv unavailable\n") == 0);
+
+    ctx.kv = kv_new();
+    assert(ctx.kv != NULL);
+    ctx.now_ms = 1000;
+    kv_line(&ctx, "/set a hello", out, sizeof(out));
+    assert(strcmp(out, "stored\n") == 0);
+    kv_line(&ctx, "/get a", out, sizeof(out));
+    assert(strcmp(out, "hello\n") == 0);
+    kv_line(&ctx, "/set a a-much-longer-value-that-needs-a-bigger-slab-block", out, sizeof(out));
+    kv_line(&ctx, "/get a", out, sizeof(out));
+    assert(strcmp(out, "a-much-longer-value-that-needs-a-bigger-slab-block\n") == 0);
+    kv_line(&ctx, "/get missing", out, sizeof(out));
+    assert(strcmp(out, "not found\n") == 0);
+    kv_line(&ctx, "/set a", out, sizeof(out));
+    assert(strcmp(out, "invalid arguments\n") == 0);
+    kv_line(&ctx, "/set a hello \t world", out, sizeof(out));
+    assert(strcmp(out, "stored\n") == 0);
+    kv_line(&ctx, "/get a", out, sizeof(out));
+    assert(strcmp(out, "hello \t world\n") == 0);
+    kv_line(&ctx, "/setex a 500", out, sizeof(out));
+    assert(strcmp(out, "invalid arguments\n") == 0);
+    kv_line(&ctx, "/setex a soon b", out, sizeof(out));
+    assert(strcmp(out, "invalid ttl\n") == 0);
+    kv_line(&ctx, "/setex a 0 b", out, sizeof(out));
+    assert(strcmp(out, "invalid ttl\n") == 0);
+    assert(kv_set(ctx.kv, "a", 1, "b", 1, UINT64_MAX, 1) == KV_OVERFLOW);
+
+    kv_line(&ctx, "/incr n", out, sizeof(out));
+    assert(strcmp(out, "1\n") == 0);
+    kv_line(&ctx, "/incr n 41", out, sizeof(out));
+    assert(strcmp(out, "42\n") == 0);
+    kv_line(&ctx, "/incr n -50", out, sizeof(out));
+    assert(strcmp(out, "-8\n") == 0);
+    kv_line(&ctx, "/incr a", out, sizeof(out));
+    assert(strcmp(out, "not an integer\n") == 0);
+    kv_line(&ctx, "/set big 9223372036854775807", out, sizeof(out));
+    kv_line(&ctx, "/incr big", out, sizeof(out));
+    assert(strcmp(out, "overflow\n") == 0);
+
+    kv_line(&ctx, "/setex t 500 1", out, sizeof(out));
+    kv_line(&ctx, "/incr t 2", out, sizeof(out));
+    assert(strcmp(out, "3\n") == 0);
+    ctx.now_ms = 1499;
+    kv_line(&ctx, "/get t", out, sizeof(out));
+    assert(strcmp(out, "3\n") == 0);
+    ctx.now_ms = 1500;
+    kv_line(&ctx, "/get t", out, sizeof(out));
+    assert(strcmp(out, "not found\n") == 0);
+
+    kv_line(&ctx, "/del a", out, sizeof(out));
+    assert(strcmp(out, "deleted\n") == 0);
+    kv_line(&ctx, "/del a", out, sizeof(out));
+    assert(strcmp(out, "not found\n") == 0);
+
+    char line[400];
+    memset(line, 'k', sizeof(line));
+    memcpy(line, "/get ", 5);
+    line[5 + KV_KEY_MAX + 1] = '\0';
+    kv_line(&ctx, line, out, sizeof(out));
+    assert(strcmp(out, "invalid key\n") == 0);
+
+    kv_usage(ctx.kv, &stats.kv_keys, &stats.kv_bytes);
+    assert(stats.kv_keys == 2);
+    kv_line(&ctx, "/stats", out, sizeof(out));
+    assert(strstr(out, " kv_keys=2 kv_bytes=") != NULL);
+    kv_free(ctx.kv);
+}
+
+static void test_kv_table(void) {
+    struct kv *kv = kv_new();
+    assert(kv != NULL);
+    enum { N = 200000 };
+    char key[32], val[64];
+    size_t vlen;
+    for (int i = 0; i < N; i++) {
+        int kl = snprintf(key, sizeof(key), "key:%d", i);
+        int vl = snprintf(val, sizeof(val), "value-%d", i * 7);
+        assert(kv_set(kv, key, (size_t)kl, val, (size_t)vl, i % 2 ? 100 : 0, 0) == KV_OK);
+    }
+    uint64_t keys, bytes;
+    kv_usage(kv, &keys, &bytes);
+    assert(keys == N);
+    assert(bytes > (uint64_t)N * 32);
+    for (int i = 0; i < N; i += 3) {
+        int kl = snprintf(key, sizeof(key), "key:%d", i);
+        assert(kv_del(kv, key, (size_t)kl, 0) == KV_OK);
+    }
+    for (int i = 0; i < N; i++) {
+        int kl = snprintf(key, sizeof(key), "key:%d", i);
+        int rc = kv_get(kv, key, (size_t)kl, 50, val, sizeof(val), &vlen);
+        if (i % 3 == 0) {
+            assert(rc == KV_NOT_FOUND);
+            continue;
+        }
+        assert(rc == KV_OK);
+        char want[64];
+        int wl = snprintf(want, sizeof(want), "value-%d", i * 7);
+        assert(vlen == (size_t)wl && memcmp(val, want, vlen) == 0);
+    }
+    for (int i = 0; i < N; i += 3) {
+        int kl = snprintf(key, sizeof(key), "key:%d", i);
+        assert(kv_set(kv, key, (size_t)kl, "x", 1, 0, 0) == KV_OK);
+    }
+    kv_usage(kv, &keys, &bytes);
+    assert(keys == N);
+    assert(kv_get(kv, "key:0", 5, 50, val, 0, &vlen) == KV_TOO_BIG && vlen == 1);
+    for (int i = 0; i < 64 * 16384 / KV_SWEEP_SLOTS; i++) kv_sweep(kv, 200, KV_SWEEP_SLOTS);
+    kv_usage(kv, &keys, &bytes);
+    uint64_t live = 0;
+    for (int i = 0; i < N; i++) live += i % 3 == 0 || i % 2 == 0;
+    assert(keys == live);
+    kv_free(kv);
+}
+
+static void test_rate_limiter(void) {
+    struct rate_bucket b;
+    rate_bucket_init(&b, 10, 1000);
+    assert(b.level == 10000 && rate_wait_ms(&b, 10, 1000) == 0);
+    b.level -= 15000;
+    assert(rate_wait_ms(&b, 10, 0) == 500);
+    rate_refill(&b, 10, 1200);
+    assert(b.level == -3000);
+    rate_refill(&b, 10, 1000000);
+    assert(b.level == 10000);
+
+    uint8_t cold[RATE_IP_KEY], hot[RATE_IP_KEY], key[RATE_IP_KEY];
+    struct sockaddr_in a;
+    memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = htonl(0x01020304);
+    rate_ip_key((struct sockaddr *)&a, sizeof(a), cold);
+    assert(cold[10] == 0xff && cold[11] == 0xff && cold[12] == 1 && cold[15] == 4);
+    a.sin_addr.s_addr = htonl(0x05060708);
+    rate_ip_key((struct sockaddr *)&a, sizeof(a), hot);
+
+    struct rate_ip_table *t = rate_ip_new(32, 10, 0);
+    assert(t != NULL);
+    assert(rate_ip_charge(t, cold, 10, 0, 0, 1) == 0);
+    assert(rate_ip_charge(t, hot, 10, 0, 0, 1) == 0);
+    assert(rate_ip_charge(t, hot, 1, 0, 0, 0) == 100);
+    assert(rate_ip_charge(t, hot, 1, 0, 0, 1) == 100);
+    for (uint32_t i = 0; i < 1000; i++) {
+        a.sin_addr.s_addr = htonl(0x0a000000 + i);
+        rate_ip_key((struct sockaddr *)&a, sizeof(a), key);
+        rate_ip_charge(t, key, 1, 0, 0, 1);
+        rate_ip_charge(t, hot, 0, 0, 0, 1);
+    }
+    assert(rate_ip_count(t) == 32);
+    assert(rate_ip_charge(t, cold, 1, 0, 0, 0) == 0);
+    assert(rate_ip_charge(t, hot, 0, 0, 50, 0) == 50);
+    assert(rate_ip_charge(t, hot, 1, 0, 100, 0) == 100);
+    assert(rate_ip_charge(t, hot, 1, 0, 200, 0) == 0);
+    rate_ip_free(t);
 }
 
 static void test_shutdown_flag(void) {
@@ -115,6 +418,114 @@ static void test_unknown_command(void) {
     assert(shutdown == 0);
 }
 
+static int cmd_args(struct server_command_ctx *ctx) {
+    if (ctx->args.len + 2 > ctx->out_cap) return -1;
+    memcpy(ctx->out, ctx->args.data, ctx->args.len);
+    ctx->out[ctx->args.len] = '\n';
+    ctx->out[ctx->args.len + 1] = '\0';
+    return (int)ctx->args.len + 1;
+}
+
+static void test_register_command(void) {
+    assert(server_register_command("/args", "echo arguments", cmd_args) == 0);
+    assert(server_register_command("/args", NULL, cmd_args) == -1);
+    assert(server_register_command("/time", NULL, cmd_args) == -1);
+    assert(server_register_command("args", NULL, cmd_args) == -1);
+    assert(server_register_command("/a b", NULL, cmd_args) == -1);
+    struct server_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    int shutdown = 0;
+    char out[1024];
+    const char *line = "  /args \t foo  bar \r\n";
+    int n = server_process_line(line, strlen(line), &stats, &shutdown, out, sizeof(out));
+    assert(n > 0);
+    assert(strcmp(out, "foo  bar\n") == 0);
+    n = server_process_line("/args", 5, &stats, &shutdown, out, sizeof(out));
+    assert(n == 1 && strcmp(out, "\n") == 0);
+    n = server_process_line("/argsx", 6, &stats, &shutdown, out, sizeof(out));
+    assert(n > 0 && strcmp(out, "unknown command\n") == 0);
+    n = server_process_line("/help", 5, &stats, &shutdown, out, sizeof(out));
+    assert(n > 0 && strstr(out, "/args - echo arguments\n") != NULL);
+    assert(shutdown == 0);
+    struct server_command_ctx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.stats = &stats;
+    ctx.shutdown_requested = &shutdown;
+    ctx.out = out;
+    ctx.out_cap = sizeof(out);
+    ctx.refresh = refresh_counters;
+    refresh_calls = 0;
+    n = commands_process(&ctx, "/args x", 7);
+    assert(n == 2 && refresh_calls == 0);
+}
+
+static void test_loglevel_command(void) {
+    int level = -1;
+    assert(log_level_parse("debug", &level) == 0 && level == LOG_DEBUG);
+    assert(log_level_parse("ERROR", &level) == 0 && level == LOG_ERROR);
+    assert(log_level_parse("loud", &level) == -1);
+    struct server_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    int shutdown = 0;
+    char out[64];
+    int n = server_process_line("/loglevel error", strlen("/loglevel error"), &stats, &shutdown, out, sizeof(out));
+    assert(n > 0 && strcmp(out, "loglevel=ERROR\n") == 0);
+    assert(!log_enabled(LOG_INFO) && log_enabled(LOG_ERROR));
+    n = server_process_line("/loglevel nope", strlen("/loglevel nope"), &stats, &shutdown, out, sizeof(out));
+    assert(n > 0 && strcmp(out, "invalid log level\n") == 0);
+    n = server_process_line("/loglevel info", strlen("/loglevel info"), &stats, &shutdown, out, sizeof(out));
+    assert(n > 0 && strcmp(out, "loglevel=INFO\n") == 0);
+    assert(log_get_level() == LOG_INFO);
+}
+
+static int write_config(const char *path, const char *text) {
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    fputs(text, f);
+    return fclose(f);
+}
+
+static void test_config_file(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/server-test-%d.conf", (int)getpid());
+    struct server_config cfg;
+    config_defaults(&cfg);
+    assert(write_config(path, "# comment\n  workers = 3  \nnodelay\nquickack = off\nmetrics-bind = 127.0.0.2 # local\nread-budget=8192") == 0);
+    assert(config_load(path, &cfg) == 0);
+    assert(cfg.workers == 3 && cfg.read_budget == 8192);
+    assert(cfg.sock.nodelay == 1 && cfg.sock.quickack == 0);
+    assert(cfg.metrics_bind && strcmp(cfg.metrics_bind, "127.0.0.2") == 0);
+    free((char *)cfg.metrics_bind);
+
+    config_defaults(&cfg);
+    assert(write_config(path, "workers = 2\nbogus = 1\n") == 0);
+    assert(config_load(path, &cfg) == -1);
+    assert(write_config(path, "workers\n") == 0);
+    assert(config_load(path, &cfg) == -1);
+    assert(write_config(path, "nodelay = maybe\n") == 0);
+    assert(config_load(path, &cfg) == -1);
+
+    char long_line[1024];
+    int n = snprintf(long_line, sizeof(long_line), "upgrade-socket = /tmp/");
+    memset(long_line + n, 'a', 600);
+    strcpy(long_line + n + 600, "\nworkers = 4\n");
+    config_defaults(&cfg);
+    assert(write_config(path, long_line) == 0);
+    assert(config_load(path, &cfg) == -1);
+    assert(cfg.upgrade_socket == NULL && cfg.workers == 1);
+    unlink(path);
+    assert(config_load(path, &cfg) == -1);
+
+    char *argv1[] = {"server", "-C/etc/a.conf", NULL};
+    assert(strcmp(config_path(2, argv1), "/etc/a.conf") == 0);
+    char *argv2[] = {"server", "-p", "-C", "/etc/b.conf", "8000", NULL};
+    assert(strcmp(config_path(5, argv2), "/etc/b.conf") == 0);
+    char *argv3[] = {"server", "--config=/etc/c.conf", "-pC/etc/d.conf", NULL};
+    assert(strcmp(config_path(3, argv3), "/etc/d.conf") == 0);
+    char *argv4[] = {"server", "--workers", "2", "--", "-C/etc/e.conf", NULL};
+    assert(config_path(5, argv4) == NULL);
+}
+
 static void test_small_buffer_failure(void) {
     struct server_stats stats;
     memset(&stats, 0, sizeof(stats));
@@ -127,16 +538,1258 @@ static void test_small_buffer_failure(void) {
     assert(n == -1);
 }
 
+static void test_client_table_reuse(void) {
+    struct client_table t;
+    client_table_init(&t);
+    struct client *cs[CLIENT_CHUNK_SIZE + 8];
+    for (uint32_t i = 0; i < CLIENT_CHUNK_SIZE + 8; i++) {
+        cs[i] = client_table_alloc(&t);
+        assert(cs[i] != NULL);
+        assert(cs[i]->slot == i);
+        assert(client_table_get(&t, i) == cs[i]);
+    }
+    assert(t.live == CLIENT_CHUNK_SIZE + 8);
+    client_table_release(&t, cs[3]);
+    client_table_release(&t, cs[CLIENT_CHUNK_SIZE + 1]);
+    assert(t.live == CLIENT_CHUNK_SIZE + 6);
+    struct client *c = client_table_alloc(&t);
+    assert(c->slot == CLIENT_CHUNK_SIZE + 8);
+    client_table_reclaim(&t);
+    struct client *a = client_table_alloc(&t);
+    struct client *b = client_table_alloc(&t);
+    assert((a->slot == 3 && b->slot == CLIENT_CHUNK_SIZE + 1) || (a->slot == CLIENT_CHUNK_SIZE + 1 && b->slot == 3));
+    assert(t.slots == CLIENT_CHUNK_SIZE + 9);
+    client_table_destroy(&t);
+}
+
+static void test_bufpool_reuse(void) {
+    struct bufpool p;
+    bufpool_init(&p, 64, 1);
+    int hit = -1;
+    char *a = bufpool_get(&p, &hit);
+    assert(a != NULL && hit == 0);
+    char *b = bufpool_get(&p, &hit);
+    assert(b != NULL && hit == 0);
+    bufpool_put(&p, a, 64);
+    bufpool_put(&p, b, 64);
+    assert(p.free_count == 1);
+    char *c = bufpool_get(&p, &hit);
+    assert(c == a && hit == 1);
+    char *big = realloc(c, 128);
+    assert(big != NULL);
+    bufpool_put(&p, big, 128);
+    assert(p.free_count == 0);
+    bufpool_destroy(&p);
+}
+
+static void test_linescan(void) {
+    static char data[4099];
+    unsigned seed = 12345;
+    for (size_t i = 0; i < sizeof(data); i++) {
+        seed = seed * 1103515245u + 12345u;
+        data[i] = (seed >> 16) % 7 == 0 ? '\n' : 'x';
+    }
+    uint32_t ref[4096];
+    uint32_t got[4096];
+    size_t lens[] = {0, 1, 15, 16, 17, 31, 32, 33, 100, sizeof(data)};
+    for (size_t k = 0; k < sizeof(lens) / sizeof(lens[0]); k++) {
+        for (size_t max = 1; max <= 4096; max *= 8) {
+            size_t n = linescan_scalar(data, lens[k], ref, max);
+            size_t m = linescan_sse2(data, lens[k], got, max);
+            assert(m == n && memcmp(ref, got, n * sizeof(ref[0])) == 0);
+            if (strcmp(linescan_impl_name(), "avx2") == 0) {
+                m = linescan_avx2(data, lens[k], got, max);
+                assert(m == n && memcmp(ref, got, n * sizeof(ref[0])) == 0);
+            }
+            m = linescan(data, lens[k], got, max);
+            assert(m == n && memcmp(ref, got, n * sizeof(ref[0])) == 0);
+        }
+    }
+    assert(linescan("ab\ncd\n", 6, ref, 8) == 2 && ref[0] == 2 && ref[1] == 5);
+}
+
+static void test_hist(void) {
+    unsigned prev = 0;
+    for (uint64_t v = 0; v < 5000000; v += v / 7 + 1) {
+        unsigned idx = hist_index(v);
+        assert(idx >= prev && idx < HIST_BUCKETS);
+        prev = idx;
+        uint64_t mid = hist_value(idx);
+        uint64_t diff = mid > v ? mid - v : v - mid;
+        assert(diff * HIST_SUB <= v + HIST_SUB);
+    }
+    assert(hist_index(UINT64_MAX) == HIST_BUCKETS - 1);
+    static struct hist h;
+    memset(&h, 0, sizeof(h));
+    for (uint64_t v = 1; v <= 1000; v++) hist_record(&h, v * 1000);
+    static struct hist_snapshot snap;
+    memset(&snap, 0, sizeof(snap));
+    hist_snapshot_add(&snap, &h);
+    assert(snap.count == 1000);
+    assert(snap.sum == 500500u * 1000u);
+    uint64_t p50 = hist_quantile(&snap, 0.5);
+    uint64_t p99 = hist_quantile(&snap, 0.99);
+    assert(p50 > 500000 * 7 / 8 && p50 < 500000 * 9 / 8);
+    assert(p99 > 990000 * 7 / 8 && p99 < 990000 * 9 / 8);
+}
+
+struct wheel_entry {
+    struct timer_node node;
+    uint64_t expires;
+    uint64_t fired_at;
+};
+
+static uint64_t wheel_clock;
+
+static void wheel_fire(struct timer_node *n, void *arg) {
+    (void)arg;
+    struct wheel_entry *e = (struct wheel_entry *)n;
+    assert(e->fired_at == 0);
+    e->fired_at = wheel_clock;
+}
+
+static void test_timer_wheel(void) {
+    static struct timer_wheel w;
+    static struct wheel_entry entries[20000];
+    uint64_t start = 1000;
+    timer_wheel_init(&w, start);
+    assert(timer_wheel_timeout(&w, start) == -1);
+    unsigned seed = 4242;
+    size_t count = sizeof(entries) / sizeof(entries[0]);
+    for (size_t i = 0; i < count; i++) {
+        seed = seed * 1103515245u + 12345u;
+        uint64_t delta = i % 100 == 0 ? (1ull << 25) + seed % 1000 : (seed >> 8) % (i % 2 ? 300000 : 5000);
+        entries[i].expires = start + delta;
+        timer_arm(&w, &entries[i].node, entries[i].expires);
+    }
+    for (size_t i = 0; i < count; i += 7) {
+        if (i % 2) {
+            timer_cancel(&w, &entries[i].node);
+            entries[i].expires = 0;
+        } else {
+            entries[i].expires += 1234;
+            timer_arm(&w, &entries[i].node, entries[i].expires);
+        }
+    }
+    int t = timer_wheel_timeout(&w, start);
+    assert(t >= 0);
+    wheel_clock = start;
+    uint64_t end = start + (1ull << 25) + 5000;
+    while (wheel_clock < end) {
+        int timeout = timer_wheel_timeout(&w, wheel_clock);
+        if (timeout == -1) break;
+        wheel_clock += timeout > 0 ? (uint64_t)timeout : 1;
+        timer_wheel_advance(&w, wheel_clock, wheel_fire, NULL);
+    }
+    assert(w.count == 0);
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].expires == 0) {
+            assert(entries[i].fired_at == 0);
+            continue;
+        }
+        assert(entries[i].fired_at == entries[i].expires);
+    }
+    timer_wheel_init(&w, 0);
+    struct wheel_entry one;
+    memset(&one, 0, sizeof(one));
+    one.expires = 100;
+    timer_arm(&w, &one.node, 100);
+    t = timer_wheel_timeout(&w, 0);
+    assert(t > 0 && t <= 100);
+    wheel_clock = 99;
+    timer_wheel_advance(&w, 99, wheel_fire, NULL);
+    assert(one.fired_at == 0 && timer_pending(&one.node));
+    wheel_clock = 250;
+    timer_wheel_advance(&w, 250, wheel_fire, NULL);
+    assert(one.fired_at == 250 && !timer_pending(&one.node));
+}
+
+struct server_thread {
+    struct server_config cfg;
+    int rc;
+};
+
+static void *server_thread_main(void *arg) {
+    struct server_thread *t = arg;
+    t->rc = server_run(&t->cfg);
+    return NULL;
+}
+
+static int connect_tcp(int port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int attempt = 0; attempt < 200; attempt++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        assert(fd != -1);
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            struct timeval tv = {5, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            return fd;
+        }
+        close(fd);
+        struct timespec ts = {0, 10 * 1000 * 1000};
+        nanosleep(&ts, NULL);
+    }
+    return -1;
+}
+
+static size_t read_lines(int fd, char *buf, size_t cap, size_t lines) {
+    size_t len = 0;
+    size_t seen = 0;
+    while (seen < lines && len < cap - 1) {
+        ssize_t n = recv(fd, buf + len, cap - 1 - len, 0);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) break;
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[len + (size_t)i] == '\n') seen++;
+        }
+        len += (size_t)n;
+    }
+    buf[len] = '\0';
+    return seen;
+}
+
+static ssize_t recv_dgram(int fd, char *buf, size_t cap) {
+    ssize_t n;
+    do {
+        n = recv(fd, buf, cap, 0);
+    } while (n == -1 && errno == EINTR);
+    return n;
+}
+
+static void send_all(int fd, const char *data, size_t len) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t n = send(fd, data + sent, len - sent, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR) continue;
+        assert(n > 0);
+        sent += (size_t)n;
+    }
+}
+
+static void test_backend_roundtrip(int backend, int edge) {
+    if (!server_backend_available(backend)) {
+        printf("skipping backend %d: not available\n", backend);
+        return;
+    }
+    struct server_thread t;
+    memset(&t, 0, sizeof(t));
+    t.cfg.port = 20000 + (int)(getpid() % 500) + backend + 2 * edge;
+    t.cfg.max_events = 64;
+    t.cfg.listen_backlog = 128;
+    t.cfg.max_clients = 64;
+    t.cfg.client_buffer_size = 4096;
+    t.cfg.client_output_hwm = 4096;
+    t.cfg.workers = 2;
+    t.cfg.backend = backend;
+    t.cfg.max_line_length = 16384;
+    t.cfg.udp_batch = 4;
+    t.cfg.udp_gso = 1;
+    t.cfg.metrics_port = t.cfg.port + 500;
+    t.cfg.edge_triggered = edge;
+    t.cfg.read_budget = edge ? 4096 : 0;
+    t.cfg.sock.nodelay = 1;
+    t.cfg.sock.quickack = 1;
+    t.cfg.sock.udp_rcvbuf = 1 << 20;
+    t.cfg.sock.tos = 0x10;
+    pthread_t th;
+    assert(pthread_create(&th, NULL, server_thread_main, &t) == 0);
+    int fd = connect_tcp(t.cfg.port);
+    assert(fd != -1);
+    assert(server_register_command("/late", NULL, cmd_args) == -1);
+
+    static char buf[1 << 20];
+    send_all(fd, "  hello  \n/stats\n", strlen("  hello  \n/stats\n"));
+    assert(read_lines(fd, buf, sizeof(buf), 2) == 2);
+    assert(strncmp(buf, "hello\n", 6) == 0);
+    assert(strstr(buf, "current_tcp_clients=1") != NULL);
+    assert(strstr(buf, "client_pool_misses=1") != NULL);
+    assert(strstr(buf, " udp_drops=0 kv_keys=0 kv_bytes=") != NULL);
+
+    send_all(fd, "/set greeting hi\n/incr hits 5\n/get greeting\n", strlen("/set greeting hi\n/incr hits 5\n/get greeting\n"));
+    assert(read_lines(fd, buf, sizeof(buf), 3) == 3);
+    assert(strcmp(buf, "stored\n5\nhi\n") == 0);
+    send_all(fd, "/loglevel debug\n/loglevel\n", strlen("/loglevel debug\n/loglevel\n"));
+    assert(read_lines(fd, buf, sizeof(buf), 2) == 2);
+    assert(strcmp(buf, "not permitted\nloglevel=INFO\n") == 0);
+
+    static char req[2000 * 8];
+    size_t rlen = 0;
+    for (int i = 0; i < 2000; i++) rlen += (size_t)snprintf(req + rlen, sizeof(req) - rlen, "%05d\n", i);
+    send_all(fd, req, rlen);
+    assert(read_lines(fd, buf, sizeof(buf), 2000) == 2000);
+    assert(memcmp(buf, req, rlen) == 0);
+
+    static char big[20002];
+    memset(big, 'a', 10000);
+    big[10000] = '\n';
+    send_all(fd, big, 6000);
+    usleep(10000);
+    send_all(fd, big + 6000, 4001);
+    assert(read_lines(fd, buf, sizeof(buf), 1) == 1);
+    assert(strlen(buf) == 10001 && memcmp(buf, big, 10001) == 0);
+    for (int i = 0; i < 12; i++) {
+        send_all(fd, big + i * 800, 800);
+        usleep(2000);
+    }
+    send_all(fd, "\nx\n", 3);
+    assert(read_lines(fd, buf, sizeof(buf), 2) == 2);
+    assert(strlen(buf) == 9603 && memcmp(buf, big, 9600) == 0 && strcmp(buf + 9600, "\nx\n") == 0);
+    memset(big, 'b', 20000);
+    big[20000] = '\n';
+    send_all(fd, big, 20001);
+    send_all(fd, "ok\n", 3);
+    assert(read_lines(fd, buf, sizeof(buf), 2) == 2);
+    assert(strcmp(buf, "line too long\nok\n") == 0);
+
+    int mfd = connect_tcp(t.cfg.metrics_port);
+    assert(mfd != -1);
+    send_all(mfd, "GET /metrics HTTP/1.0\r\n\r\n", strlen("GET /metrics HTTP/1.0\r\n\r\n"));
+    read_lines(mfd, buf, sizeof(buf), 1 << 20);
+    close(mfd);
+    assert(strncmp(buf, "HTTP/1.0 200 OK\r\n", 17) == 0);
+    assert(strstr(buf, "server_command_latency_seconds{command=\"echo\",quantile=\"0.99\"}") != NULL);
+    assert(strstr(buf, "server_command_latency_seconds_count{command=\"/stats\"} 1\n") != NULL);
+    assert(strstr(buf, "server_tcp_clients 1\n") != NULL);
+    assert((strstr(buf, "server_read_yields_total 0\n") == NULL) == (edge != 0));
+
+    int ufd = socket(AF_INET, SOCK_DGRAM, 0);
+    assert(ufd != -1);
+    struct timeval tv = {5, 0};
+    setsockopt(ufd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)t.cfg.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(sendto(ufd, "/time\n", 6, 0, (struct sockaddr *)&addr, sizeof(addr)) == 6);
+    ssize_t n = recv_dgram(ufd, buf, sizeof(buf) - 1);
+    assert(n >= 20);
+    assert(buf[4] == '-' && buf[10] == ' ' && buf[13] == ':');
+    assert(sendto(ufd, "/metrics\n", 9, 0, (struct sockaddr *)&addr, sizeof(addr)) == 9);
+    n = recv_dgram(ufd, buf, sizeof(buf) - 1);
+    assert(n == 45 && memcmp(buf, "metrics too large, use TCP or --metrics-port\n", 45) == 0);
+    for (int i = 0; i < 16; i++) {
+        char msg[16];
+        int mlen = snprintf(msg, sizeof(msg), " u%02d \n", i);
+        assert(sendto(ufd, msg, (size_t)mlen, 0, (struct sockaddr *)&addr, sizeof(addr)) == mlen);
+    }
+    for (int i = 0; i < 16; i++) {
+        char expect[16];
+        snprintf(expect, sizeof(expect), "u%02d\n", i);
+        n = recv_dgram(ufd, buf, sizeof(buf) - 1);
+        assert(n == 4 && memcmp(buf, expect, 4) == 0);
+    }
+    close(ufd);
+
+    send_all(fd, "/shutdown\n", strlen("/shutdown\n"));
+    assert(read_lines(fd, buf, sizeof(buf), 1) == 1);
+    assert(strcmp(buf, "shutting down\n") == 0);
+    close(fd);
+    pthread_join(th, NULL);
+    assert(t.rc == 0);
+}
+
+static void wait_closed(int fd) {
+    char buf[64];
+    ssize_t n;
+    do {
+        n = recv(fd, buf, sizeof(buf), 0);
+    } while (n > 0 || (n == -1 && errno == EINTR));
+    assert(n == 0);
+    close(fd);
+}
+
+struct rt_client {
+    int port;
+    int id;
+};
+
+static void *rt_client_main(void *arg) {
+    struct rt_client *rc = arg;
+    char req[2048];
+    char want[2048];
+    char buf[4096];
+    for (int conn = 0; conn < 4; conn++) {
+        int fd = connect_tcp(rc->port);
+        assert(fd != -1);
+        size_t len = 0;
+        for (int i = 0; i < 100; i++) len += (size_t)snprintf(req + len, sizeof(req) - len, "c%d-%d-%d\n", rc->id, conn, i);
+        memcpy(want, req, len + 1);
+        send_all(fd, req, len);
+        assert(read_lines(fd, buf, sizeof(buf), 100) == 100);
+        assert(strcmp(buf, want) == 0);
+        close(fd);
+    }
+    return NULL;
+}
+
+static void test_workers_roundtrip(int backend) {
+    if (!server_backend_available(backend)) return;
+    struct server_thread t;
+    memset(&t, 0, sizeof(t));
+    t.cfg.port = 29000 + (int)(getpid() % 500) + backend;
+    t.cfg.max_events = 64;
+    t.cfg.listen_backlog = 128;
+    t.cfg.max_clients = 64;
+    t.cfg.workers = 4;
+    t.cfg.backend = backend;
+    t.cfg.udp_batch = 8;
+    pthread_t th;
+    assert(pthread_create(&th, NULL, server_thread_main, &t) == 0);
+    pthread_t clients[4];
+    struct rt_client args[4];
+    for (int i = 0; i < 4; i++) {
+        args[i].port = t.cfg.port;
+        args[i].id = i;
+        assert(pthread_create(&clients[i], NULL, rt_client_main, &args[i]) == 0);
+    }
+    for (int i = 0; i < 4; i++) pthread_join(clients[i], NULL);
+
+    int ufd = socket(AF_INET, SOCK_DGRAM, 0);
+    assert(ufd != -1);
+    struct timeval tv = {5, 0};
+    setsockopt(ufd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)t.cfg.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    char buf[4096];
+    for (int i = 0; i < 8; i++) {
+        char msg[32];
+        int n = snprintf(msg, sizeof(msg), "udp-%d\n", i);
+        assert(sendto(ufd, msg, (size_t)n, 0, (struct sockaddr *)&addr, sizeof(addr)) == n);
+        assert(recv_dgram(ufd, buf, sizeof(buf)) == n && memcmp(buf, msg, (size_t)n) == 0);
+    }
+    close(ufd);
+
+    int fd = connect_tcp(t.cfg.port);
+    assert(fd != -1);
+    send_all(fd, "/stats\n", 7);
+    assert(read_lines(fd, buf, sizeof(buf), 1) == 1);
+    assert(strstr(buf, "total_tcp_clients=17 ") != NULL);
+    assert(strstr(buf, " total_udp_messages=8 ") != NULL);
+    send_all(fd, "/shutdown\n", 10);
+    assert(read_lines(fd, buf, sizeof(buf), 1) == 1);
+    close(fd);
+    pthread_join(th, NULL);
+    assert(t.rc == 0);
+}
+
+struct slow_writer {
+    int fd;
+    const char *data;
+    size_t len;
+    atomic_int done;
+};
+
+static void *slow_writer_main(void *arg) {
+    struct slow_writer *w = arg;
+    send_all(w->fd, w->data, w->len);
+    atomic_store(&w->done, 1);
+    return NULL;
+}
+
+static void test_slow_reader(int backend, int edge) {
+    if (!server_backend_available(backend)) return;
+    struct server_thread t;
+    memset(&t, 0, sizeof(t));
+    t.cfg.port = 30000 + (int)(getpid() % 500) + backend + 2 * edge;
+    t.cfg.max_events = 64;
+    t.cfg.listen_backlog = 128;
+    t.cfg.max_clients = 8;
+    t.cfg.workers = 1;
+    t.cfg.backend = backend;
+    t.cfg.edge_triggered = edge;
+    t.cfg.read_budget = edge ? 4096 : 0;
+    t.cfg.client_output_hwm = 16 * 1024;
+    t.cfg.sock.rcvbuf = 16384;
+    t.cfg.sock.sndbuf = 16384;
+    t.cfg.sock.nodelay = 1;
+    pthread_t th;
+    assert(pthread_create(&th, NULL, server_thread_main, &t) == 0);
+    static char req[1 << 20];
+    static char buf[(1 << 20) + 1];
+    size_t len = 0;
+    size_t lines = 0;
+    while (len + 64 <= sizeof(req)) {
+        int n = snprintf(req + len, sizeof(req) - len, "%08zu-", lines);
+        memset(req + len + n, 'a' + (char)(lines % 26), (size_t)(63 - n));
+        req[len + 63] = '\n';
+        len += 64;
+        lines++;
+    }
+    int fd = connect_tcp(t.cfg.port);
+    assert(fd != -1);
+    int small = 16384;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    struct slow_writer w = {fd, req, len, 0};
+    atomic_init(&w.done, 0);
+    pthread_t writer;
+    assert(pthread_create(&writer, NULL, slow_writer_main, &w) == 0);
+    usleep(300000);
+    assert(atomic_load(&w.done) == 0);
+    int large = 1 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &large, sizeof(large));
+    assert(read_lines(fd, buf, sizeof(buf), lines) == lines);
+    assert(memcmp(buf, req, len) == 0 && buf[len] == '\0');
+    pthread_join(writer, NULL);
+    assert(atomic_load(&w.done) == 1);
+    send_all(fd, "/stats\n", 7);
+    assert(read_lines(fd, buf, sizeof(buf), 1) == 1);
+    assert(strstr(buf, "current_tcp_clients=1 ") != NULL);
+    send_all(fd, "/shutdown\n", 10);
+    assert(read_lines(fd, buf, sizeof(buf), 1) == 1);
+    close(fd);
+    pthread_join(th, NULL);
+    assert(t.rc == 0);
+}
+
+static void test_client_timeouts(int backend) {
+    if (!server_backend_available(backend)) return;
+    struct server_thread t;
+    memset(&t, 0, sizeof(t));
+    t.cfg.port = 21000 + (int)(getpid() % 500) + backend;
+    t.cfg.max_events = 64;
+    t.cfg.listen_backlog = 128;
+    t.cfg.max_clients = 64;
+    t.cfg.workers = 1;
+    t.cfg.backend = backend;
+    t.cfg.idle_timeout_ms = 300;
+    t.cfg.read_timeout_ms = 100;
+    t.cfg.write_timeout_ms = 1000;
+    pthread_t th;
+    assert(pthread_create(&th, NULL, server_thread_main, &t) == 0);
+    int idle = connect_tcp(t.cfg.port);
+    assert(idle != -1);
+    char buf[512];
+    send_all(idle, "hi\n", 3);
+    assert(read_lines(idle, buf, sizeof(buf), 1) == 1);
+    int partial = connect_tcp(t.cfg.port);
+    assert(partial != -1);
+    send_all(partial, "no newline", 10);
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    wait_closed(partial);
+    wait_closed(idle);
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double elapsed = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+    assert(elapsed >= 0.1 && elapsed < 3.0);
+    int fd = connect_tcp(t.cfg.port);
+    assert(fd != -1);
+    send_all(fd, "/stats\n", 7);
+    assert(read_lines(fd, buf, sizeof(buf), 1) == 1);
+    assert(strstr(buf, "client_timeouts=2") != NULL);
+    assert(strstr(buf, "current_tcp_clients=1 ") != NULL);
+    send_all(fd, "/shutdown\n", 10);
+    assert(read_lines(fd, buf, sizeof(buf), 1) == 1);
+    close(fd);
+    pthread_join(th, NULL);
+    assert(t.rc == 0);
+}
+
+static void test_accept_pause(int backend) {
+    if (!server_backend_available(backend)) return;
+    struct server_thread t;
+    memset(&t, 0, sizeof(t));
+    t.cfg.port = 22000 + (int)(getpid() % 500) + backend;
+    t.cfg.max_events = 64;
+    t.cfg.listen_backlog = 128;
+    t.cfg.max_clients = 2;
+    t.cfg.workers = 1;
+    t.cfg.backend = backend;
+    t.cfg.accept_batch = 1;
+    pthread_t th;
+    assert(pthread_create(&th, NULL, server_thread_main, &t) == 0);
+    char buf[512];
+    int a = connect_tcp(t.cfg.port);
+    assert(a != -1);
+    send_all(a, "a\n", 2);
+    assert(read_lines(a, buf, sizeof(buf), 1) == 1);
+    int b = connect_tcp(t.cfg.port);
+    assert(b != -1);
+    send_all(b, "b\n", 2);
+    assert(read_lines(b, buf, sizeof(buf), 1) == 1);
+    int c = connect_tcp(t.cfg.port);
+    assert(c != -1);
+    send_all(c, "c\n", 2);
+    usleep(200000);
+    assert(recv(c, buf, sizeof(buf), MSG_DONTWAIT) == -1 && errno == EAGAIN);
+    close(a);
+    assert(read_lines(c, buf, sizeof(buf), 1) == 1);
+    assert(strcmp(buf, "c\n") == 0);
+    send_all(b, "/stats\n", 7);
+    assert(read_lines(b, buf, sizeof(buf), 1) == 1);
+    assert(strstr(buf, "current_tcp_clients=2 ") != NULL);
+    assert(strstr(buf, "rejected_clients=0 ") != NULL);
+    assert(strstr(buf, "accept_pauses=0\n") == NULL);
+    send_all(b, "/shutdown\n", 10);
+    assert(read_lines(b, buf, sizeof(buf), 1) == 1);
+    close(b);
+    close(c);
+    pthread_join(th, NULL);
+    assert(t.rc == 0);
+}
+
+static void test_shared_client_limit(int backend) {
+    if (!server_backend_available(backend)) return;
+    struct server_thread t;
+    memset(&t, 0, sizeof(t));
+    t.cfg.port = 31000 + (int)(getpid() % 500) + backend;
+    t.cfg.max_events = 64;
+    t.cfg.listen_backlog = 128;
+    t.cfg.max_clients = 3;
+    t.cfg.workers = 4;
+    t.cfg.backend = backend;
+    pthread_t th;
+    assert(pthread_create(&th, NULL, server_thread_main, &t) == 0);
+    char buf[512];
+    int fds[3];
+    for (int i = 0; i < 3; i++) {
+        fds[i] = connect_tcp(t.cfg.port);
+        assert(fds[i] != -1);
+        send_all(fds[i], "x\n", 2);
+        assert(read_lines(fds[i], buf, sizeof(buf), 1) == 1);
+    }
+    int extra[3];
+    for (int i = 0; i < 3; i++) {
+        extra[i] = connect_tcp(t.cfg.port);
+        assert(extra[i] != -1);
+        send_all(extra[i], "y\n", 2);
+    }
+    usleep(200000);
+    for (int i = 0; i < 3; i++) assert(recv(extra[i], buf, sizeof(buf), MSG_DONTWAIT) == -1 && errno == EAGAIN);
+    close(fds[0]);
+    close(fds[1]);
+    int served = 0;
+    for (int i = 0; i < 3; i++) {
+        struct pollfd p = {extra[i], POLLIN, 0};
+        if (poll(&p, 1, 500) == 1) {
+            assert(read_lines(extra[i], buf, sizeof(buf), 1) == 1);
+            assert(strcmp(buf, "y\n") == 0);
+            served++;
+        }
+    }
+    assert(served == 2);
+    send_all(fds[2], "/stats\n", 7);
+    assert(read_lines(fds[2], buf, sizeof(buf), 1) == 1);
+    assert(strstr(buf, "current_tcp_clients=3 ") != NULL);
+    assert(strstr(buf, "rejected_clients=0 ") != NULL);
+    send_all(fds[2], "/shutdown\n", 10);
+    assert(read_lines(fds[2], buf, sizeof(buf), 1) == 1);
+    close(fds[2]);
+    for (int i = 0; i < 3; i++) close(extra[i]);
+    pthread_join(th, NULL);
+    assert(t.rc == 0);
+}
+
+struct flooder {
+    int fd;
+    atomic_int stop;
+    atomic_size_t sent;
+};
+
+static void *flood_main(void *arg) {
+    struct flooder *f = arg;
+    static char chunk[64 * 1024];
+    memset(chunk, '\n', sizeof(chunk));
+    struct timeval tv = {0, 100000};
+    setsockopt(f->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    while (!atomic_load(&f->stop)) {
+        ssize_t n = send(f->fd, chunk, sizeof(chunk), MSG_NOSIGNAL);
+        if (n == -1 && (errno == EINTR || errno == EAGAIN)) continue;
+        if (n <= 0) break;
+        atomic_fetch_add(&f->sent, (size_t)n);
+    }
+    return NULL;
+}
+
+static double elapsed_since(const struct timespec *t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (double)(t1.tv_sec - t0->tv_sec) + (double)(t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static void test_read_fairness(void) {
+    struct server_thread t;
+    memset(&t, 0, sizeof(t));
+    t.cfg.port = 28000 + (int)(getpid() % 500);
+    t.cfg.max_events = 64;
+    t.cfg.listen_backlog = 128;
+    t.cfg.max_clients = 8;
+    t.cfg.workers = 1;
+    t.cfg.backend = SERVER_BACKEND_EPOLL;
+    t.cfg.edge_triggered = 1;
+    t.cfg.read_budget = 4096;
+    pthread_t th;
+    assert(pthread_create(&th, NULL, server_thread_main, &t) == 0);
+    struct flooder f;
+    memset(&f, 0, sizeof(f));
+    atomic_init(&f.stop, 0);
+    atomic_init(&f.sent, 0);
+    f.fd = connect_tcp(t.cfg.port);
+    assert(f.fd != -1);
+    int quiet = connect_tcp(t.cfg.port);
+    assert(quiet != -1);
+    char buf[512];
+    send_all(quiet, "ready\n", 6);
+    assert(read_lines(quiet, buf, sizeof(buf), 1) == 1);
+    pthread_t flood;
+    assert(pthread_create(&flood, NULL, flood_main, &f) == 0);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (atomic_load(&f.sent) < 4 * 1024 * 1024 && elapsed_since(&start) < 5.0) usleep(1000);
+    size_t before = atomic_load(&f.sent);
+    assert(before >= 4 * 1024 * 1024);
+    double worst = 0;
+    for (int i = 0; i < 20; i++) {
+        struct timespec t0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        send_all(quiet, "ping\n", 5);
+        assert(read_lines(quiet, buf, sizeof(buf), 1) == 1);
+        assert(strcmp(buf, "ping\n") == 0);
+        double rtt = elapsed_since(&t0);
+        if (rtt > worst) worst = rtt;
+        usleep(10000);
+    }
+    assert(atomic_load(&f.sent) > before);
+    assert(worst < 0.5);
+    atomic_store(&f.stop, 1);
+    pthread_join(flood, NULL);
+    close(f.fd);
+    send_all(quiet, "/shutdown\n", 10);
+    assert(read_lines(quiet, buf, sizeof(buf), 1) == 1);
+    close(quiet);
+    pthread_join(th, NULL);
+    assert(t.rc == 0);
+}
+
+static void test_binproto_header(void) {
+    struct bin_header h = {0x01020304u, BIN_OP_COMMAND, BIN_ETOOBIG, 0xdeadbeefu};
+    char buf[BIN_HEADER_LEN];
+    bin_header_encode(buf, &h);
+    assert(memcmp(buf, "\x01\x02\x03\x04\x00\x04\x00\x02\xde\xad\xbe\xef", BIN_HEADER_LEN) == 0);
+    struct bin_header d;
+    bin_header_decode(buf, &d);
+    assert(d.len == h.len && d.op == h.op && d.status == h.status && d.id == h.id);
+    char v[8];
+    bin_put64(v, 0x0102030405060708ull);
+    assert(bin_get64(v) == 0x0102030405060708ull && v[0] == 1 && v[7] == 8);
+}
+
+static size_t put_frame(char *out, uint16_t op, uint32_t id, const void *payload, size_t len) {
+    struct bin_header h = {(uint32_t)len, op, 0, id};
+    bin_header_encode(out, &h);
+    if (len) memcpy(out + BIN_HEADER_LEN, payload, len);
+    return BIN_HEADER_LEN + len;
+}
+
+static void read_exact(int fd, char *buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = recv(fd, buf + got, len - got, 0);
+        if (n == -1 && errno == EINTR) continue;
+        assert(n > 0);
+        got += (size_t)n;
+    }
+}
+
+static void read_frame(int fd, struct bin_header *h, char *payload, size_t cap) {
+    char hdr[BIN_HEADER_LEN];
+    read_exact(fd, hdr, sizeof(hdr));
+    bin_header_decode(hdr, h);
+    assert(h->len <= cap);
+    read_exact(fd, payload, h->len);
+}
+
+static void test_binary_protocol(int backend) {
+    if (!server_backend_available(backend)) return;
+    struct server_thread t;
+    memset(&t, 0, sizeof(t));
+    t.cfg.port = 23000 + (int)(getpid() % 500) + backend;
+    t.cfg.max_events = 64;
+    t.cfg.listen_backlog = 128;
+    t.cfg.max_clients = 64;
+    t.cfg.workers = 1;
+    t.cfg.backend = backend;
+    t.cfg.max_line_length = 1024;
+    pthread_t th;
+    assert(pthread_create(&th, NULL, server_thread_main, &t) == 0);
+    int fd = connect_tcp(t.cfg.port);
+    assert(fd != -1);
+
+    static char req[8192];
+    static const char blob[] = "a\nb\0c\r\n";
+    static char big[2000];
+    memset(big, 'z', sizeof(big));
+    size_t len = 0;
+    memcpy(req, "hi\n/binary\n", 11);
+    len += 11;
+    len += put_frame(req + len, BIN_OP_ECHO, 7, blob, sizeof(blob));
+    len += put_frame(req + len, BIN_OP_TIME, 8, NULL, 0);
+    len += put_frame(req + len, BIN_OP_STATS, 9, NULL, 0);
+    len += put_frame(req + len, BIN_OP_COMMAND, 10, "/help", 5);
+    len += put_frame(req + len, 99, 11, "x", 1);
+    len += put_frame(req + len, BIN_OP_ECHO, 12, big, sizeof(big));
+    len += put_frame(req + len, BIN_OP_ECHO, 13, "", 0);
+    send_all(fd, req, 20);
+    usleep(10000);
+    send_all(fd, req + 20, len - 20);
+
+    char buf[4096];
+    read_exact(fd, buf, 10);
+    assert(memcmp(buf, "hi\nbinary\n", 10) == 0);
+    struct bin_header h;
+    read_frame(fd, &h, buf, sizeof(buf));
+    assert(h.id == 7 && h.op == BIN_OP_ECHO && h.status == BIN_OK);
+    assert(h.len == sizeof(blob) && memcmp(buf, blob, sizeof(blob)) == 0);
+    read_frame(fd, &h, buf, sizeof(buf));
+    assert(h.id == 8 && h.status == BIN_OK && h.len == 8);
+    uint64_t us = bin_get64(buf);
+    assert(us / 1000000 + 5 >= (uint64_t)time(NULL) && us / 1000000 <= (uint64_t)time(NULL));
+    read_frame(fd, &h, buf, sizeof(buf));
+    assert(h.id == 9 && h.status == BIN_OK && h.len == 8 * BIN_STATS_FIELDS);
+    assert(bin_get64(buf) == 1 && bin_get64(buf + 8) == 1);
+    read_frame(fd, &h, buf, sizeof(buf) - 1);
+    assert(h.id == 10 && h.status == BIN_OK);
+    buf[h.len] = '\0';
+    assert(strncmp(buf, "Available commands:\n", 20) == 0);
+    read_frame(fd, &h, buf, sizeof(buf));
+    assert(h.id == 11 && h.op == 99 && h.status == BIN_EUNKNOWN && h.len == 0);
+    read_frame(fd, &h, buf, sizeof(buf));
+    assert(h.id == 12 && h.status == BIN_ETOOBIG && h.len == 0);
+    read_frame(fd, &h, buf, sizeof(buf));
+    assert(h.id == 13 && h.status == BIN_OK && h.len == 0);
+
+    len = put_frame(req, BIN_OP_COMMAND, 14, "/shutdown", 9);
+    send_all(fd, req, len);
+    read_frame(fd, &h, buf, sizeof(buf));
+    assert(h.id == 14 && h.len == 14 && memcmp(buf, "shutting down\n", 14) == 0);
+    close(fd);
+    pthread_join(th, NULL);
+    assert(t.rc == 0);
+}
+
+static void test_listener_handoff(int backend) {
+    if (!server_backend_available(backend)) return;
+    struct server_thread a;
+    memset(&a, 0, sizeof(a));
+    a.cfg.port = 24000 + (int)(getpid() % 500) + backend;
+    a.cfg.max_events = 64;
+    a.cfg.listen_backlog = 128;
+    a.cfg.max_clients = 64;
+    a.cfg.workers = 2;
+    a.cfg.backend = backend;
+    a.cfg.udp_batch = 4;
+    a.cfg.drain_timeout_ms = 5000;
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/server-tests-%d-%d.sock", (int)getpid(), backend);
+    a.cfg.upgrade_socket = path;
+    struct server_thread b = a;
+    pthread_t tha, thb;
+    assert(pthread_create(&tha, NULL, server_thread_main, &a) == 0);
+    char buf[512];
+    int held = connect_tcp(a.cfg.port);
+    assert(held != -1);
+    send_all(held, "before\n", 7);
+    assert(read_lines(held, buf, sizeof(buf), 1) == 1);
+    struct stat sb;
+    assert(stat(path, &sb) == 0 && S_ISSOCK(sb.st_mode) && (sb.st_mode & 0777) == 0600);
+
+    assert(pthread_create(&thb, NULL, server_thread_main, &b) == 0);
+    int fd = -1;
+    for (int attempt = 0; attempt < 200 && fd == -1; attempt++) {
+        fd = connect_tcp(a.cfg.port);
+        assert(fd != -1);
+        send_all(fd, "/stats\n", 7);
+        assert(read_lines(fd, buf, sizeof(buf), 1) == 1);
+        if (strstr(buf, "total_tcp_clients=1 ") == NULL) {
+            close(fd);
+            fd = -1;
+            usleep(10000);
+        }
+    }
+    assert(fd != -1);
+    send_all(held, "after\n", 6);
+    assert(read_lines(held, buf, sizeof(buf), 1) == 1);
+    assert(strcmp(buf, "after\n") == 0);
+    close(held);
+    pthread_join(tha, NULL);
+    assert(a.rc == 0);
+
+    int ufd = socket(AF_INET, SOCK_DGRAM, 0);
+    assert(ufd != -1);
+    struct timeval tv = {5, 0};
+    setsockopt(ufd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)a.cfg.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(sendto(ufd, "udp\n", 4, 0, (struct sockaddr *)&addr, sizeof(addr)) == 4);
+    assert(recv_dgram(ufd, buf, sizeof(buf)) == 4);
+    close(ufd);
+
+    send_all(fd, "/shutdown\n", 10);
+    assert(read_lines(fd, buf, sizeof(buf), 1) == 1);
+    close(fd);
+    pthread_join(thb, NULL);
+    assert(b.rc == 0);
+    assert(access(path, F_OK) == -1);
+}
+
+static void test_pubsub(int backend) {
+    if (!server_backend_available(backend)) return;
+    struct server_thread t;
+    memset(&t, 0, sizeof(t));
+    t.cfg.port = 25000 + (int)(getpid() % 500) + backend;
+    t.cfg.max_events = 64;
+    t.cfg.listen_backlog = 128;
+    t.cfg.max_clients = 64;
+    t.cfg.workers = 2;
+    t.cfg.backend = backend;
+    t.cfg.udp_batch = 4;
+    t.cfg.fanout_slice = 2;
+    pthread_t th;
+    assert(pthread_create(&th, NULL, server_thread_main, &t) == 0);
+    char buf[4096];
+    int subs[6];
+    for (int i = 0; i < 6; i++) {
+        subs[i] = connect_tcp(t.cfg.port);
+        assert(subs[i] != -1);
+        send_all(subs[i], "/sub news\n/sub news\n", 20);
+        assert(read_lines(subs[i], buf, sizeof(buf), 2) == 2);
+        assert(strcmp(buf, "subscribed news\nsubscribed news\n") == 0);
+    }
+    int bin = connect_tcp(t.cfg.port);
+    assert(bin != -1);
+    char req[64];
+    memcpy(req, "/binary\n", 8);
+    size_t len = 8 + put_frame(req + 8, BIN_OP_COMMAND, 1, "/sub news", 9);
+    send_all(bin, req, len);
+    read_exact(bin, buf, 7);
+    struct bin_header h;
+    read_frame(bin, &h, buf, sizeof(buf));
+    assert(h.id == 1 && h.status == BIN_OK && h.len == 16 && memcmp(buf, "subscribed news\n", 16) == 0);
+
+    int ufd = socket(AF_INET, SOCK_DGRAM, 0);
+    assert(ufd != -1);
+    struct timeval tv = {5, 0};
+    setsockopt(ufd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)t.cfg.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(sendto(ufd, "/sub news\n", 10, 0, (struct sockaddr *)&addr, sizeof(addr)) == 10);
+    assert(recv_dgram(ufd, buf, sizeof(buf)) == 16 && memcmp(buf, "subscribed news\n", 16) == 0);
+
+    int pub = connect_tcp(t.cfg.port);
+    assert(pub != -1);
+    send_all(pub, "/pub news hello world\n/pub nobody x\n/sub a b\n", 45);
+    assert(read_lines(pub, buf, sizeof(buf), 3) == 3);
+    assert(strcmp(buf, "published 8\npublished 0\ninvalid topic\n") == 0);
+    for (int i = 0; i < 6; i++) {
+        assert(read_lines(subs[i], buf, sizeof(buf), 1) == 1);
+        assert(strcmp(buf, "message news hello world\n") == 0);
+    }
+    read_frame(bin, &h, buf, sizeof(buf));
+    assert(h.op == BIN_OP_MESSAGE && h.id == 0 && h.len == 25 && memcmp(buf, "message news hello world\n", 25) == 0);
+    assert(recv_dgram(ufd, buf, sizeof(buf)) == 25 && memcmp(buf, "message news hello world\n", 25) == 0);
+
+    send_all(subs[0], "/unsub news\n", 12);
+    assert(read_lines(subs[0], buf, sizeof(buf), 1) == 1);
+    assert(strcmp(buf, "unsubscribed news\n") == 0);
+    assert(sendto(ufd, "/unsub news\n", 12, 0, (struct sockaddr *)&addr, sizeof(addr)) == 12);
+    assert(recv_dgram(ufd, buf, sizeof(buf)) == 18);
+    close(subs[1]);
+    int published = 0;
+    for (int attempt = 0; attempt < 200 && published != 5; attempt++) {
+        send_all(pub, "/pub news again\n", 16);
+        assert(read_lines(pub, buf, sizeof(buf), 1) == 1);
+        assert(sscanf(buf, "published %d", &published) == 1);
+        if (published != 5) usleep(10000);
+    }
+    assert(published == 5);
+    send_all(subs[0], "ping\n", 5);
+    assert(read_lines(subs[0], buf, sizeof(buf), 1) == 1);
+    assert(strcmp(buf, "ping\n") == 0);
+
+    send_all(pub, "/shutdown\n", 10);
+    assert(read_lines(pub, buf, sizeof(buf), 1) == 1);
+    for (int i = 0; i < 6; i++) {
+        if (i != 1) close(subs[i]);
+    }
+    close(bin);
+    close(ufd);
+    close(pub);
+    pthread_join(th, NULL);
+    assert(t.rc == 0);
+}
+
+static uint64_t metric_value(const char *text, const char *name) {
+    const char *p = strstr(text, name);
+    if (!p) return UINT64_MAX;
+    return strtoull(p + strlen(name), NULL, 10);
+}
+
+static void test_rate_limit(int backend) {
+    if (!server_backend_available(backend)) return;
+    struct server_thread t;
+    memset(&t, 0, sizeof(t));
+    t.cfg.port = 26000 + (int)(getpid() % 500) + backend;
+    t.cfg.metrics_port = t.cfg.port + 500;
+    t.cfg.max_events = 64;
+    t.cfg.listen_backlog = 128;
+    t.cfg.max_clients = 64;
+    t.cfg.workers = 1;
+    t.cfg.backend = backend;
+    t.cfg.udp_batch = 8;
+    t.cfg.sock.udp_rcvbuf = 1 << 20;
+    t.cfg.rate.conn_msgs = 100;
+    t.cfg.rate.ip_msgs = 400;
+    t.cfg.rate.ip_table = 64;
+    pthread_t th;
+    assert(pthread_create(&th, NULL, server_thread_main, &t) == 0);
+    static char buf[1 << 16];
+    static char req[150 * 2];
+    for (int i = 0; i < 150; i++) memcpy(req + 2 * i, "x\n", 2);
+    int fd = connect_tcp(t.cfg.port);
+    assert(fd != -1);
+    struct timeval t0, t1;
+    gettimeofday(&t0, NULL);
+    send_all(fd, req, sizeof(req));
+    assert(read_lines(fd, buf, sizeof(buf), 150) == 150);
+    gettimeofday(&t1, NULL);
+    assert(memcmp(buf, req, sizeof(req)) == 0);
+    long elapsed = (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_usec - t0.tv_usec) / 1000;
+    assert(elapsed >= 400);
+
+    int ufd = socket(AF_INET, SOCK_DGRAM, 0);
+    assert(ufd != -1);
+    struct timeval tv = {0, 200000};
+    setsockopt(ufd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)t.cfg.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int replies = 0;
+    for (int i = 0; i < 600; i++) {
+        assert(sendto(ufd, "u\n", 2, 0, (struct sockaddr *)&addr, sizeof(addr)) == 2);
+        if (i % 8 == 7) {
+            while (recv(ufd, buf, sizeof(buf), MSG_DONTWAIT) > 0) replies++;
+        }
+    }
+    while (recv_dgram(ufd, buf, sizeof(buf)) > 0) replies++;
+    assert(replies > 0 && replies < 600);
+
+    int fd2 = connect_tcp(t.cfg.port);
+    assert(fd2 != -1);
+    send_all(fd2, req, sizeof(req));
+    assert(read_lines(fd2, buf, sizeof(buf), 150) == 150);
+
+    int mfd = connect_tcp(t.cfg.metrics_port);
+    assert(mfd != -1);
+    send_all(mfd, "GET /metrics HTTP/1.0\r\n\r\n", strlen("GET /metrics HTTP/1.0\r\n\r\n"));
+    static char metrics[1 << 20];
+    read_lines(mfd, metrics, sizeof(metrics), 1 << 20);
+    close(mfd);
+    uint64_t conn = metric_value(metrics, "server_rate_throttled_total{scope=\"conn\"} ");
+    uint64_t ip = metric_value(metrics, "server_rate_throttled_total{scope=\"ip\"} ");
+    uint64_t dropped = metric_value(metrics, "\nserver_rate_dropped_total ");
+    assert(conn > 0 && conn != UINT64_MAX);
+    assert(ip > 0 && ip != UINT64_MAX);
+    assert(dropped > 0 && dropped != UINT64_MAX);
+
+    send_all(fd, "/shutdown\n", 10);
+    assert(read_lines(fd, buf, sizeof(buf), 1) == 1);
+    close(fd);
+    close(fd2);
+    close(ufd);
+    pthread_join(th, NULL);
+    assert(t.rc == 0);
+}
+
+static socklen_t unix_addr(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    size_t len = strlen(path);
+    memcpy(addr->sun_path, path, len);
+    if (path[0] == '@') addr->sun_path[0] = '\0';
+    return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len);
+}
+
+static int connect_unix(const char *path) {
+    struct sockaddr_un addr;
+    socklen_t alen = unix_addr(path, &addr);
+    for (int attempt = 0; attempt < 200; attempt++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        assert(fd != -1);
+        if (connect(fd, (struct sockaddr *)&addr, alen) == 0) {
+            struct timeval tv = {5, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            return fd;
+        }
+        close(fd);
+        struct timespec ts = {0, 10 * 1000 * 1000};
+        nanosleep(&ts, NULL);
+    }
+    return -1;
+}
+
+static void test_unix_sockets(int backend) {
+    if (!server_backend_available(backend)) return;
+    char path[64];
+    char dgram_path[64];
+    snprintf(path, sizeof(path), "/tmp/server-test-%d-%d.sock", (int)getpid(), backend);
+    snprintf(dgram_path, sizeof(dgram_path), "@server-test-%d-%d", (int)getpid(), backend);
+    struct server_thread t;
+    memset(&t, 0, sizeof(t));
+    t.cfg.port = 27000 + (int)(getpid() % 500) + backend;
+    t.cfg.max_events = 64;
+    t.cfg.listen_backlog = 128;
+    t.cfg.max_clients = 64;
+    t.cfg.workers = 2;
+    t.cfg.backend = backend;
+    t.cfg.udp_batch = 8;
+    t.cfg.unix_path = path;
+    t.cfg.unix_dgram_path = dgram_path;
+    t.cfg.metrics_port = t.cfg.port + 500;
+    t.cfg.admin_commands = 1;
+    t.cfg.rate.ip_msgs = 1;
+    pthread_t th;
+    assert(pthread_create(&th, NULL, server_thread_main, &t) == 0);
+    char buf[4096];
+    struct stat sb;
+    int fd = connect_unix(path);
+    assert(fd != -1);
+    send_all(fd, "/loglevel info\n", 15);
+    assert(read_lines(fd, buf, sizeof(buf), 1) == 1);
+    assert(strcmp(buf, "loglevel=INFO\n") == 0);
+    send_all(fd, "hello\n/binary\n", 14);
+    assert(read_lines(fd, buf, sizeof(buf), 2) == 2);
+    assert(strcmp(buf, "hello\nbinary\n") == 0);
+    close(fd);
+    fd = connect_unix(path);
+    assert(fd != -1);
+
+    int dfd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    assert(dfd != -1);
+    struct sockaddr_un self;
+    memset(&self, 0, sizeof(self));
+    self.sun_family = AF_UNIX;
+    assert(bind(dfd, (struct sockaddr *)&self, sizeof(sa_family_t)) == 0);
+    struct timeval tv = {5, 0};
+    setsockopt(dfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    struct sockaddr_un srv;
+    socklen_t srv_len = unix_addr(dgram_path, &srv);
+    assert(sendto(dfd, "ping\n", 5, 0, (struct sockaddr *)&srv, srv_len) == 5);
+    assert(recv_dgram(dfd, buf, sizeof(buf)) == 5 && memcmp(buf, "ping\n", 5) == 0);
+    int anon = socket(AF_UNIX, SOCK_DGRAM, 0);
+    assert(anon != -1);
+    assert(sendto(anon, "/time\n", 6, 0, (struct sockaddr *)&srv, srv_len) == 6);
+    close(anon);
+    assert(sendto(dfd, "/sub local\n", 11, 0, (struct sockaddr *)&srv, srv_len) == 11);
+    assert(recv_dgram(dfd, buf, sizeof(buf)) == 17 && memcmp(buf, "subscribed local\n", 17) == 0);
+    send_all(fd, "/pub local hi\n", 14);
+    assert(read_lines(fd, buf, sizeof(buf), 1) == 1);
+    assert(strcmp(buf, "published 1\n") == 0);
+    assert(recv_dgram(dfd, buf, sizeof(buf)) == 17 && memcmp(buf, "message local hi\n", 17) == 0);
+
+    send_all(fd, "/stats\n", 7);
+    assert(read_lines(fd, buf, sizeof(buf), 1) == 1);
+    assert(strstr(buf, "total_tcp_clients=0 ") != NULL);
+    assert(strstr(buf, " total_udp_messages=0 ") != NULL);
+    assert(strstr(buf, " total_unix_clients=2 current_unix_clients=1 total_unix_messages=3 udp_tx_drops=0\n") != NULL);
+    int mfd = connect_tcp(t.cfg.metrics_port);
+    assert(mfd != -1);
+    send_all(mfd, "GET /metrics HTTP/1.0\r\n\r\n", strlen("GET /metrics HTTP/1.0\r\n\r\n"));
+    static char metrics[1 << 20];
+    read_lines(mfd, metrics, sizeof(metrics), 1 << 20);
+    close(mfd);
+    uint64_t unix_in = metric_value(metrics, "server_bytes_in_total{transport=\"unix\"} ");
+    assert(unix_in > 0 && unix_in != UINT64_MAX);
+    assert(metric_value(metrics, "server_bytes_in_total{transport=\"tcp\"} ") == 0);
+    assert(metric_value(metrics, "server_bytes_in_total{transport=\"udp\"} ") == 0);
+    uint64_t unix_calls = metric_value(metrics, "server_transport_latency_seconds_count{transport=\"unix\"} ");
+    assert(unix_calls > 0 && unix_calls != UINT64_MAX);
+    assert(metric_value(metrics, "server_transport_latency_seconds_count{transport=\"tcp\"} ") == 0);
+
+    struct server_thread second = t;
+    second.cfg.port = t.cfg.port + 100;
+    second.cfg.unix_dgram_path = NULL;
+    assert(server_run(&second.cfg) == -1);
+    assert(stat(path, &sb) == 0 && S_ISSOCK(sb.st_mode));
+    send_all(fd, "still\n", 6);
+    assert(read_lines(fd, buf, sizeof(buf), 1) == 1);
+    assert(strcmp(buf, "still\n") == 0);
+
+    send_all(fd, "/shutdown\n", 10);
+    assert(read_lines(fd, buf, sizeof(buf), 1) == 1);
+    close(fd);
+    close(dfd);
+    pthread_join(th, NULL);
+    assert(t.rc == 0);
+    assert(stat(path, &sb) == -1 && errno == ENOENT);
+}
+
 int main(void) {
     test_echo_simple();
     test_echo_trim_spaces();
     test_empty_line();
     test_time_format();
+    test_timecache();
     test_stats_output();
+    test_stats_cache();
     test_help_output();
+    test_pubsub_unavailable();
+    test_kv_commands();
+    test_kv_table();
+    test_rate_limiter();
     test_shutdown_flag();
     test_unknown_command();
     test_small_buffer_failure();
+    test_register_command();
+    test_loglevel_command();
+    test_config_file();
+    test_client_table_reuse();
+    test_bufpool_reuse();
+    test_linescan();
+    test_hist();
+    test_timer_wheel();
+    test_backend_roundtrip(SERVER_BACKEND_EPOLL, 0);
+    test_backend_roundtrip(SERVER_BACKEND_IO_URING, 0);
+    test_backend_roundtrip(SERVER_BACKEND_EPOLL, 1);
+    test_workers_roundtrip(SERVER_BACKEND_EPOLL);
+    test_workers_roundtrip(SERVER_BACKEND_IO_URING);
+    test_slow_reader(SERVER_BACKEND_EPOLL, 0);
+    test_slow_reader(SERVER_BACKEND_EPOLL, 1);
+    test_slow_reader(SERVER_BACKEND_IO_URING, 0);
+    test_client_timeouts(SERVER_BACKEND_EPOLL);
+    test_client_timeouts(SERVER_BACKEND_IO_URING);
+    test_accept_pause(SERVER_BACKEND_EPOLL);
+    test_accept_pause(SERVER_BACKEND_IO_URING);
+    test_shared_client_limit(SERVER_BACKEND_EPOLL);
+    test_shared_client_limit(SERVER_BACKEND_IO_URING);
+    test_read_fairness();
+    test_binproto_header();
+    test_binary_protocol(SERVER_BACKEND_EPOLL);
+    test_binary_protocol(SERVER_BACKEND_IO_URING);
+    test_listener_handoff(SERVER_BACKEND_EPOLL);
+    test_listener_handoff(SERVER_BACKEND_IO_URING);
+    test_pubsub(SERVER_BACKEND_EPOLL);
+    test_pubsub(SERVER_BACKEND_IO_URING);
+    test_rate_limit(SERVER_BACKEND_EPOLL);
+    test_rate_limit(SERVER_BACKEND_IO_URING);
+    test_unix_sockets(SERVER_BACKEND_EPOLL);
+    test_unix_sockets(SERVER_BACKEND_IO_URING);
     printf("all tests passed\n");
     return 0;
 }
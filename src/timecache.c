@@ -0,0 +1,45 @@
+#define _GNU_SOURCE
+#include "timecache.h"
+
+#include <string.h>
+#include <time.h>
+
+struct timecache {
+    time_t sec;
+    size_t len;
+    char buf[32];
+};
+
+static _Thread_local struct timecache tc = {(time_t)-1, 0, {0}};
+
+size_t timecache_format_uncached(char *out, size_t cap) {
+    time_t now = time(NULL);
+    struct tm tm_now;
+    if (!localtime_r(&now, &tm_now)) return 0;
+    return strftime(out, cap, "%Y-%m-%d %H:%M:%S", &tm_now);
+}
+
+size_t timecache_format_sec(time_t sec, char *out, size_t cap) {
+    if (sec != tc.sec) {
+        struct tm tm_now;
+        if (!localtime_r(&sec, &tm_now)) return 0;
+        tc.len = strftime(tc.buf, sizeof(tc.buf), "%Y-%m-%d %H:%M:%S", &tm_now);
+        if (tc.len == 0) return 0;
+        tc.sec = sec;
+    }
+    if (tc.len + 1 > cap) return 0;
+    memcpy(out, tc.buf, tc.len + 1);
+    return tc.len;
+}
+
+uint64_t timecache_now_us(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_REALTIME_COARSE, &ts) == -1) clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+size_t timecache_format(char *out, size_t cap) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_REALTIME_COARSE, &ts) == -1) return timecache_format_uncached(out, cap);
+    return timecache_format_sec(ts.tv_sec, out, cap);
+}
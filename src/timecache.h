@@ -0,0 +1,15 @@
+#ifndef TIMECACHE_H
+#define TIMECACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define TIMECACHE_LEN 19
+
+size_t timecache_format(char *out, size_t cap);
+size_t timecache_format_sec(time_t sec, char *out, size_t cap);
+size_t timecache_format_uncached(char *out, size_t cap);
+uint64_t timecache_now_us(void);
+
+#endif
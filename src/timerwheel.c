@@ -0,0 +1,142 @@
+#include "timerwheel.h"
+
+#include <limits.h>
+#include <string.h>
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_SPAN_BITS (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)
+#define TIMER_WHERE_OVERFLOW UINT16_MAX
+
+void timer_wheel_init(struct timer_wheel *w, uint64_t now) {
+    memset(w, 0, sizeof(*w));
+    w->now = now;
+}
+
+static void link_node(struct timer_node **head, struct timer_node *n) {
+    n->next = *head;
+    if (n->next) n->next->pprev = &n->next;
+    *head = n;
+    n->pprev = head;
+}
+
+static void place(struct timer_wheel *w, struct timer_node *n) {
+    uint64_t e = n->expires < w->now ? w->now : n->expires;
+    if ((e >> TIMER_WHEEL_SPAN_BITS) != (w->now >> TIMER_WHEEL_SPAN_BITS)) {
+        n->where = TIMER_WHERE_OVERFLOW;
+        link_node(&w->overflow, n);
+        return;
+    }
+    unsigned level = 0;
+    while ((e >> (TIMER_WHEEL_BITS * (level + 1))) != (w->now >> (TIMER_WHEEL_BITS * (level + 1)))) level++;
+    unsigned slot = (unsigned)(e >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    n->where = (uint16_t)(level * TIMER_WHEEL_SLOTS + slot);
+    link_node(&w->slots[level][slot], n);
+    w->occupied[level] |= 1ull << slot;
+}
+
+static void unlink_node(struct timer_wheel *w, struct timer_node *n) {
+    *n->pprev = n->next;
+    if (n->next) n->next->pprev = n->pprev;
+    if (n->where != TIMER_WHERE_OVERFLOW) {
+        unsigned level = n->where / TIMER_WHEEL_SLOTS;
+        unsigned slot = n->where % TIMER_WHEEL_SLOTS;
+        if (!w->slots[level][slot]) w->occupied[level] &= ~(1ull << slot);
+    }
+    n->next = NULL;
+    n->pprev = NULL;
+}
+
+void timer_arm(struct timer_wheel *w, struct timer_node *n, uint64_t expires) {
+    if (timer_pending(n)) {
+        unlink_node(w, n);
+    } else {
+        w->count++;
+    }
+    n->expires = expires;
+    place(w, n);
+}
+
+void timer_cancel(struct timer_wheel *w, struct timer_node *n) {
+    if (!timer_pending(n)) return;
+    unlink_node(w, n);
+    w->count--;
+}
+
+static void replace_list(struct timer_wheel *w, struct timer_node **head) {
+    struct timer_node *list = *head;
+    *head = NULL;
+    while (list) {
+        struct timer_node *n = list;
+        list = n->next;
+        place(w, n);
+    }
+}
+
+static void cascade(struct timer_wheel *w, uint64_t t) {
+    if ((t & ((1ull << TIMER_WHEEL_SPAN_BITS) - 1)) == 0 && w->overflow) replace_list(w, &w->overflow);
+    for (unsigned level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+        unsigned shift = TIMER_WHEEL_BITS * level;
+        if (t & ((1ull << shift) - 1)) continue;
+        unsigned slot = (unsigned)(t >> shift) & TIMER_WHEEL_MASK;
+        if (!(w->occupied[level] & (1ull << slot))) continue;
+        w->occupied[level] &= ~(1ull << slot);
+        replace_list(w, &w->slots[level][slot]);
+    }
+}
+
+static uint64_t next_event(const struct timer_wheel *w) {
+    uint64_t next = UINT64_MAX;
+    unsigned idx = (unsigned)w->now & TIMER_WHEEL_MASK;
+    uint64_t bits = w->occupied[0] & (~0ull << idx);
+    if (bits) next = (w->now & ~(uint64_t)TIMER_WHEEL_MASK) + (uint64_t)__builtin_ctzll(bits);
+    for (unsigned level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        if (!w->occupied[level]) continue;
+        unsigned shift = TIMER_WHEEL_BITS * level;
+        uint64_t base = (w->now >> (shift + TIMER_WHEEL_BITS)) << (shift + TIMER_WHEEL_BITS);
+        uint64_t at = base + ((uint64_t)__builtin_ctzll(w->occupied[level]) << shift);
+        if (at < next) next = at;
+    }
+    if (w->overflow) {
+        uint64_t at = ((w->now >> TIMER_WHEEL_SPAN_BITS) + 1) << TIMER_WHEEL_SPAN_BITS;
+        if (at < next) next = at;
+    }
+    return next;
+}
+
+int timer_wheel_timeout(const struct timer_wheel *w, uint64_t now) {
+    if (w->count == 0) return -1;
+    uint64_t next = next_event(w);
+    if (next <= now) return 0;
+    return next - now > INT_MAX ? INT_MAX : (int)(next - now);
+}
+
+void timer_wheel_advance(struct timer_wheel *w, uint64_t now, timer_fire_fn fire, void *arg) {
+    while (w->now <= now) {
+        if (w->count == 0) {
+            w->now = now + 1;
+            break;
+        }
+        uint64_t next = next_event(w);
+        if (next > now) {
+            w->now = now + 1;
+            break;
+        }
+        w->now = next;
+        if ((next & TIMER_WHEEL_MASK) == 0) cascade(w, next);
+        unsigned slot = (unsigned)next & TIMER_WHEEL_MASK;
+        struct timer_node *list = w->slots[0][slot];
+        w->slots[0][slot] = NULL;
+        w->occupied[0] &= ~(1ull << slot);
+        if (list) list->pprev = &list;
+        w->now = next + 1;
+        while (list) {
+            struct timer_node *n = list;
+            list = n->next;
+            if (list) list->pprev = &list;
+            n->next = NULL;
+            n->pprev = NULL;
+            w->count--;
+            fire(n, arg);
+        }
+    }
+}
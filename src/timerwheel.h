@@ -0,0 +1,45 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+struct timer_node {
+    struct timer_node *next;
+    struct timer_node **pprev;
+    uint64_t expires;
+    uint16_t where;
+};
+
+struct timer_wheel {
+    uint64_t now;
+    size_t count;
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    struct timer_node *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    struct timer_node *overflow;
+};
+
+typedef void (*timer_fire_fn)(struct timer_node *n, void *arg);
+
+void timer_wheel_init(struct timer_wheel *w, uint64_t now);
+void timer_arm(struct timer_wheel *w, struct timer_node *n, uint64_t expires);
+void timer_cancel(struct timer_wheel *w, struct timer_node *n);
+int timer_wheel_timeout(const struct timer_wheel *w, uint64_t now);
+void timer_wheel_advance(struct timer_wheel *w, uint64_t now, timer_fire_fn fire, void *arg);
+
+static inline int timer_pending(const struct timer_node *n) {
+    return n->pprev != NULL;
+}
+
+static inline uint64_t timer_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+#endif
@@ -0,0 +1,769 @@
+#define _GNU_SOURCE
+#include "server_internal.h"
+#include "commands.h"
+#include "metrics.h"
+#include "pubsub.h"
+
+#ifdef SERVER_IO_URING
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#define URING_ENTRIES 1024
+#define URING_CQ_ENTRIES 8192
+#define URING_BUFS 1024
+#define URING_BUF_SIZE 4096
+#define URING_BGID 0
+#define URING_UDP_SLOTS 32
+#define URING_UNIX_SLOTS 8
+
+enum uring_op {
+    UOP_ACCEPT = 1,
+    UOP_RECV,
+    UOP_SEND,
+    UOP_WAKE,
+    UOP_UDP_RECV,
+    UOP_UDP_SEND,
+    UOP_CANCEL,
+};
+
+#define UOP_MASK 7u
+
+struct udp_slot {
+    int fd;
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_storage addr;
+    char ctrl[CMSG_SPACE(sizeof(uint32_t))];
+    char buf[2048];
+    char out[4096];
+};
+
+struct uring {
+    int fd;
+    unsigned sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_sz;
+    void *cq_ring;
+    size_t cq_ring_sz;
+    size_t sqes_sz;
+    unsigned sq_local_tail;
+    unsigned pending;
+    struct io_uring_buf_ring *br;
+    size_t br_sz;
+    char *bufs;
+    unsigned br_tail;
+    struct udp_slot *udp;
+    uint64_t wake_val;
+    struct client *flush_head;
+    int accept_armed[2];
+    int *parked;
+    size_t parked_count;
+    size_t parked_cap;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_io_uring_register(int fd, unsigned op, void *arg, unsigned nr) {
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nr);
+}
+
+static inline uint64_t tag(void *ptr, enum uring_op op) {
+    return (uint64_t)(uintptr_t)ptr | (uint64_t)op;
+}
+
+static inline void *tag_ptr(uint64_t ud) {
+    return (void *)(uintptr_t)(ud & ~(uint64_t)UOP_MASK);
+}
+
+int uring_supported(void) {
+    struct utsname un;
+    if (uname(&un) == -1) return 0;
+    int major = 0, minor = 0;
+    if (sscanf(un.release, "%d.%d", &major, &minor) != 2) return 0;
+    if (major < 6) return 0;
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = sys_io_uring_setup(4, &p);
+    if (fd < 0) return 0;
+    close(fd);
+    return 1;
+}
+
+static void uring_close(struct uring *u) {
+    if (u->fd >= 0) close(u->fd);
+    if (u->sqes) munmap(u->sqes, u->sqes_sz);
+    if (u->cq_ring && u->cq_ring != u->sq_ring) munmap(u->cq_ring, u->cq_ring_sz);
+    if (u->sq_ring) munmap(u->sq_ring, u->sq_ring_sz);
+    if (u->br) munmap(u->br, u->br_sz);
+    free(u->bufs);
+    free(u->udp);
+    for (size_t i = 0; i < u->parked_count; i++) close(u->parked[i] >> 1);
+    free(u->parked);
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+}
+
+static void buf_ring_add(struct uring *u, unsigned bid) {
+    struct io_uring_buf *b = &u->br->bufs[u->br_tail & (URING_BUFS - 1)];
+    b->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)bid * URING_BUF_SIZE);
+    b->len = URING_BUF_SIZE;
+    b->bid = (uint16_t)bid;
+    u->br_tail++;
+}
+
+static void buf_ring_publish(struct uring *u) {
+    __atomic_store_n(&u->br->tail, (uint16_t)u->br_tail, __ATOMIC_RELEASE);
+}
+
+static int uring_open(struct uring *u) {
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    p.cq_entries = URING_CQ_ENTRIES;
+    u->fd = sys_io_uring_setup(URING_ENTRIES, &p);
+    if (u->fd < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = URING_CQ_ENTRIES;
+        u->fd = sys_io_uring_setup(URING_ENTRIES, &p);
+    }
+    if (u->fd < 0) {
+        perror("io_uring_setup");
+        return -1;
+    }
+    u->sq_entries = p.sq_entries;
+    u->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_ring_sz > u->sq_ring_sz) u->sq_ring_sz = u->cq_ring_sz;
+        u->cq_ring_sz = u->sq_ring_sz;
+    }
+    u->sq_ring = mmap(NULL, u->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED) {
+        u->sq_ring = NULL;
+        perror("mmap sq ring");
+        uring_close(u);
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_ring = u->sq_ring;
+    } else {
+        u->cq_ring = mmap(NULL, u->cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ring == MAP_FAILED) {
+            u->cq_ring = NULL;
+            perror("mmap cq ring");
+            uring_close(u);
+            return -1;
+        }
+    }
+    u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        u->sqes = NULL;
+        perror("mmap sqes");
+        uring_close(u);
+        return -1;
+    }
+    char *sq = u->sq_ring;
+    char *cq = u->cq_ring;
+    u->sq_head = (unsigned *)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + p.sq_off.array);
+    u->cq_head = (unsigned *)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    u->sq_local_tail = *u->sq_tail;
+
+    u->br_sz = URING_BUFS * sizeof(struct io_uring_buf);
+    u->br = mmap(NULL, u->br_sz, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (u->br == MAP_FAILED) {
+        u->br = NULL;
+        perror("mmap buf ring");
+        uring_close(u);
+        return -1;
+    }
+    u->bufs = malloc((size_t)URING_BUFS * URING_BUF_SIZE);
+    u->udp = calloc(URING_UDP_SLOTS + URING_UNIX_SLOTS, sizeof(struct udp_slot));
+    if (!u->bufs || !u->udp) {
+        uring_close(u);
+        return -1;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+    reg.ring_entries = URING_BUFS;
+    reg.bgid = URING_BGID;
+    if (sys_io_uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        perror("io_uring_register pbuf ring");
+        uring_close(u);
+        return -1;
+    }
+    for (unsigned i = 0; i < URING_BUFS; i++) buf_ring_add(u, i);
+    buf_ring_publish(u);
+    return 0;
+}
+
+static int uring_enter(struct uring *u, unsigned wait_nr, int timeout_ms) {
+    __atomic_store_n(u->sq_tail, u->sq_local_tail, __ATOMIC_RELEASE);
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    void *argp = NULL;
+    size_t argsz = 0;
+    if (wait_nr && timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        argp = &arg;
+        argsz = sizeof(arg);
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    for (;;) {
+        int r = sys_io_uring_enter(u->fd, u->pending, wait_nr, flags, argp, argsz);
+        if (r >= 0) {
+            u->pending -= (unsigned)r < u->pending ? (unsigned)r : u->pending;
+            return 0;
+        }
+        if (errno == EINTR || errno == ETIME) {
+            if (wait_nr) return 0;
+            continue;
+        }
+        if (errno == EAGAIN || errno == EBUSY) return 0;
+        return -1;
+    }
+}
+
+static int uring_submit(struct uring *u, unsigned wait_nr) {
+    return uring_enter(u, wait_nr, -1);
+}
+
+static struct io_uring_sqe *get_sqe(struct uring *u) {
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (u->sq_local_tail - head >= u->sq_entries) {
+        if (uring_submit(u, 0) == -1) return NULL;
+        head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+        if (u->sq_local_tail - head >= u->sq_entries) return NULL;
+    }
+    unsigned idx = u->sq_local_tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    u->sq_local_tail++;
+    u->pending++;
+    return sqe;
+}
+
+static int arm_accept(struct server_state *st, int local) {
+    struct io_uring_sqe *sqe = get_sqe(st->ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = local ? st->unix_listen_fd : st->tcp_listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = tag(local ? st : NULL, UOP_ACCEPT);
+    st->ring->accept_armed[local] = 1;
+    return 0;
+}
+
+static void cancel_accept(struct server_state *st, int local) {
+    if (!st->ring->accept_armed[local]) return;
+    struct io_uring_sqe *sqe = get_sqe(st->ring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = tag(local ? st : NULL, UOP_ACCEPT);
+    sqe->user_data = tag(NULL, UOP_CANCEL);
+}
+
+static void pause_accept(struct server_state *st) {
+    st->accept_paused = 1;
+    stat_add(st, &st->counters.accept_pauses, 1);
+    log_info("max clients reached (%zu), pausing accept", st->clients.live);
+    cancel_accept(st, 0);
+    cancel_accept(st, 1);
+}
+
+static int arm_wake(struct server_state *st) {
+    struct uring *u = st->ring;
+    struct io_uring_sqe *sqe = get_sqe(u);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = st->wake_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&u->wake_val;
+    sqe->len = sizeof(u->wake_val);
+    sqe->user_data = tag(NULL, UOP_WAKE);
+    return 0;
+}
+
+static int arm_recv(struct server_state *st, struct client *c) {
+    struct io_uring_sqe *sqe = get_sqe(st->ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->src.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = tag(c, UOP_RECV);
+    c->recv_armed = 1;
+    c->recv_cancel = 0;
+    c->uring_refs++;
+    return 0;
+}
+
+static void cancel_recv(struct server_state *st, struct client *c) {
+    if (!c->recv_armed || c->recv_cancel) return;
+    struct io_uring_sqe *sqe = get_sqe(st->ring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = tag(c, UOP_RECV);
+    sqe->user_data = tag(NULL, UOP_CANCEL);
+    c->recv_cancel = 1;
+}
+
+static void cancel_fd(struct server_state *st, int fd) {
+    struct io_uring_sqe *sqe = get_sqe(st->ring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = tag(NULL, UOP_CANCEL);
+}
+
+static int arm_send(struct server_state *st, struct client *c) {
+    struct oseg *seg = c->out.head;
+    struct io_uring_sqe *sqe = get_sqe(st->ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = c->src.fd;
+    sqe->addr = (uint64_t)(uintptr_t)(seg->buf->data + seg->off);
+    sqe->len = (uint32_t)(seg->len > UINT32_MAX ? UINT32_MAX : seg->len);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = tag(c, UOP_SEND);
+    c->send_inflight = 1;
+    c->uring_refs++;
+    return 0;
+}
+
+static int arm_udp_recv(struct server_state *st, struct udp_slot *slot) {
+    struct io_uring_sqe *sqe = get_sqe(st->ring);
+    if (!sqe) return -1;
+    memset(&slot->msg, 0, sizeof(slot->msg));
+    slot->iov.iov_base = slot->buf;
+    slot->iov.iov_len = sizeof(slot->buf);
+    slot->msg.msg_name = &slot->addr;
+    slot->msg.msg_namelen = sizeof(slot->addr);
+    slot->msg.msg_iov = &slot->iov;
+    slot->msg.msg_iovlen = 1;
+    slot->msg.msg_control = slot->ctrl;
+    slot->msg.msg_controllen = sizeof(slot->ctrl);
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = slot->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&slot->msg;
+    sqe->len = 1;
+    sqe->user_data = tag(slot, UOP_UDP_RECV);
+    return 0;
+}
+
+static int arm_udp_send(struct server_state *st, struct udp_slot *slot, size_t len) {
+    struct io_uring_sqe *sqe = get_sqe(st->ring);
+    if (!sqe) return -1;
+    slot->iov.iov_base = slot->out;
+    slot->iov.iov_len = len;
+    slot->msg.msg_control = NULL;
+    slot->msg.msg_controllen = 0;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = slot->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&slot->msg;
+    sqe->len = 1;
+    sqe->user_data = tag(slot, UOP_UDP_SEND);
+    return 0;
+}
+
+static void release_if_done(struct server_state *st, struct client *c) {
+    if (!c->alive && c->uring_refs == 0 && c->src.fd != -1) {
+        c->src.fd = -1;
+        outq_clear(&c->out);
+        client_table_release(&st->clients, c);
+    }
+}
+
+void uring_client_closed(struct server_state *st, struct client *c) {
+    c->alive = 0;
+    cancel_recv(st, c);
+    close(c->src.fd);
+    client_buffer_release(st, c);
+    if (!c->send_inflight) outq_clear(&c->out);
+    release_if_done(st, c);
+}
+
+void uring_client_output(struct server_state *st, struct client *c) {
+    if (c->flush_queued) return;
+    c->flush_queued = 1;
+    c->flush_next = st->ring->flush_head;
+    st->ring->flush_head = c;
+}
+
+void uring_client_resume(struct server_state *st, struct client *c) {
+    if (c->alive && !c->recv_armed && !c->paused && !c->read_closed && arm_recv(st, c) == -1) close_client(st, c);
+}
+
+void uring_client_settle(struct server_state *st, struct client *c) {
+    if (!c->alive) return;
+    if (c->read_closed && !c->paused && outq_empty(&c->out) && !c->send_inflight) {
+        close_client(st, c);
+        return;
+    }
+    if (c->paused) cancel_recv(st, c);
+    client_timer_update(st, c);
+}
+
+static void flush_pending(struct server_state *st) {
+    struct uring *u = st->ring;
+    struct client *c = u->flush_head;
+    u->flush_head = NULL;
+    while (c) {
+        struct client *next = c->flush_next;
+        c->flush_queued = 0;
+        c->flush_next = NULL;
+        if (c->alive && !c->send_inflight && !outq_empty(&c->out) && arm_send(st, c) == -1) close_client(st, c);
+        c = next;
+    }
+}
+
+static void log_peer(int fd, int local) {
+    if (!log_enabled(LOG_INFO)) return;
+    if (local) {
+        log_info("unix client fd=%d", fd);
+        return;
+    }
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof(addr);
+    char ip[64] = "?";
+    int port = 0;
+    if (getpeername(fd, (struct sockaddr *)&addr, &alen) == 0) {
+        inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+        port = ntohs(addr.sin_port);
+    }
+    log_info("tcp client fd=%d from %s:%d", fd, ip, port);
+}
+
+static void accept_client(struct server_state *st, int fd, int local) {
+    struct client *c = add_client(st, fd, local);
+    if (!c) {
+        if (!client_limit_reached(st)) log_error("failed to add client fd=%d", fd);
+    } else if (arm_recv(st, c) == -1) {
+        close_client(st, c);
+    } else {
+        log_peer(fd, local);
+    }
+}
+
+static void park_fd(struct server_state *st, int fd, int local) {
+    struct uring *u = st->ring;
+    if (u->parked_count == u->parked_cap) {
+        size_t cap = u->parked_cap ? u->parked_cap * 2 : 16;
+        int *p = realloc(u->parked, cap * sizeof(*p));
+        if (!p) {
+            stat_add(st, &st->counters.rejected_clients, 1);
+            close(fd);
+            return;
+        }
+        u->parked = p;
+        u->parked_cap = cap;
+    }
+    u->parked[u->parked_count++] = fd << 1 | local;
+}
+
+static void close_parked(struct server_state *st) {
+    struct uring *u = st->ring;
+    stat_add(st, &st->counters.rejected_clients, u->parked_count);
+    for (size_t i = 0; i < u->parked_count; i++) close(u->parked[i] >> 1);
+    u->parked_count = 0;
+}
+
+static void resume_accept(struct server_state *st) {
+    if (!st->accept_paused || client_limit_reached(st) || shutting_down(st) || st->draining) return;
+    struct uring *u = st->ring;
+    size_t done = 0;
+    while (done < u->parked_count && !client_limit_reached(st)) {
+        int v = u->parked[done++];
+        accept_client(st, v >> 1, v & 1);
+    }
+    memmove(u->parked, u->parked + done, (u->parked_count - done) * sizeof(*u->parked));
+    u->parked_count -= done;
+    if (client_limit_reached(st)) return;
+    st->accept_paused = 0;
+    log_info("accept resumed, clients=%zu", st->clients.live);
+    for (int local = 0; local < 2; local++) {
+        if (local && st->unix_listen_fd == -1) break;
+        if (!u->accept_armed[local] && arm_accept(st, local) == -1) {
+            log_error("failed to re-arm accept");
+            request_shutdown(st->shared);
+        }
+    }
+}
+
+static void on_accept(struct server_state *st, int local, const struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) st->ring->accept_armed[local] = 0;
+    if (cqe->res >= 0) {
+        if (client_limit_reached(st)) {
+            if (!st->accept_paused) pause_accept(st);
+            park_fd(st, cqe->res, local);
+        } else {
+            accept_client(st, cqe->res, local);
+            if (!st->accept_paused && client_limit_reached(st)) pause_accept(st);
+        }
+    } else if (cqe->res != -ECANCELED) {
+        errno = -cqe->res;
+        perror("accept");
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE) && !st->accept_paused && !shutting_down(st) && !st->draining && arm_accept(st, local) == -1) {
+        log_error("failed to re-arm accept");
+        request_shutdown(st->shared);
+    }
+}
+
+static void on_recv(struct server_state *st, struct client *c, const struct io_uring_cqe *cqe) {
+    struct uring *u = st->ring;
+    int more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    if (!more) {
+        c->recv_armed = 0;
+        c->recv_cancel = 0;
+        c->uring_refs--;
+    }
+    const char *data = NULL;
+    unsigned bid = 0;
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        data = u->bufs + (size_t)bid * URING_BUF_SIZE;
+    }
+    if (cqe->res > 0) {
+        metric_add(&st->metrics->bytes_in[c->local ? METRICS_UNIX : METRICS_TCP], (uint64_t)cqe->res);
+        c->active_ms = st->now_ms;
+    }
+    if (c->alive && cqe->res > 0 && data) client_input(st, c, data, (size_t)cqe->res);
+    if (data) {
+        buf_ring_add(u, bid);
+        buf_ring_publish(u);
+    }
+    if (c->alive) {
+        if (cqe->res == 0) {
+            c->read_closed = 1;
+        } else if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED && cqe->res != -EAGAIN) {
+            close_client(st, c);
+        }
+    }
+    if (c->alive && !more) uring_client_resume(st, c);
+    uring_client_settle(st, c);
+    release_if_done(st, c);
+}
+
+static void on_send(struct server_state *st, struct client *c, const struct io_uring_cqe *cqe) {
+    c->send_inflight = 0;
+    c->uring_refs--;
+    if (!c->alive) {
+        outq_clear(&c->out);
+        release_if_done(st, c);
+        return;
+    }
+    if (cqe->res < 0) {
+        if (cqe->res != -EAGAIN && cqe->res != -EINTR) {
+            errno = -cqe->res;
+            perror("send");
+            close_client(st, c);
+            release_if_done(st, c);
+            return;
+        }
+    } else {
+        metric_add(&st->metrics->bytes_out[c->local ? METRICS_UNIX : METRICS_TCP], (uint64_t)cqe->res);
+        outq_consume(&c->out, (size_t)cqe->res);
+        if (cqe->res > 0) c->active_ms = c->out_since_ms = st->now_ms;
+    }
+    if ((c->paused & CLIENT_PAUSE_OUTPUT) && c->out.bytes <= st->output_hwm / 2) {
+        c->paused &= ~CLIENT_PAUSE_OUTPUT;
+        if (process_client_input(st, c) == -1) {
+            release_if_done(st, c);
+            return;
+        }
+        uring_client_resume(st, c);
+    }
+    if (c->alive && !outq_empty(&c->out)) uring_client_output(st, c);
+    uring_client_settle(st, c);
+    release_if_done(st, c);
+}
+
+static void on_udp_recv(struct server_state *st, struct udp_slot *slot, const struct io_uring_cqe *cqe) {
+    if (shutting_down(st)) return;
+    if (cqe->res > 0) {
+        size_t seg = (size_t)cqe->res;
+        udp_rx_cmsgs(st, &slot->msg, &seg);
+        uint64_t start = metrics_now_ns();
+        int out_len = process_datagram(st, slot->buf, (size_t)cqe->res, (const struct sockaddr *)&slot->addr, slot->msg.msg_namelen, slot->out, sizeof(slot->out));
+        hist_record(&st->metrics->transport[slot->fd == st->unix_dgram_fd ? METRICS_UNIX : METRICS_UDP], metrics_now_ns() - start);
+        if (out_len > 0) {
+            if (arm_udp_send(st, slot, (size_t)out_len) == 0) return;
+        }
+    } else if (cqe->res < 0 && cqe->res != -ECANCELED && cqe->res != -EAGAIN) {
+        errno = -cqe->res;
+        perror("recvmsg");
+    }
+    if (st->draining) return;
+    if (arm_udp_recv(st, slot) == -1) log_error("failed to re-arm udp recv");
+}
+
+static void on_udp_send(struct server_state *st, struct udp_slot *slot, const struct io_uring_cqe *cqe) {
+    if (cqe->res > 0) metric_add(&st->metrics->bytes_out[slot->fd == st->unix_dgram_fd ? METRICS_UNIX : METRICS_UDP], (uint64_t)cqe->res);
+    if (cqe->res < 0 && cqe->res != -ECANCELED) stat_add(st, &st->counters.udp_tx_drops, 1);
+    if (shutting_down(st) || st->draining) return;
+    if (arm_udp_recv(st, slot) == -1) log_error("failed to re-arm udp recv");
+}
+
+static void dispatch(struct server_state *st, const struct io_uring_cqe *cqe) {
+    enum uring_op op = (enum uring_op)(cqe->user_data & UOP_MASK);
+    void *ptr = tag_ptr(cqe->user_data);
+    switch (op) {
+    case UOP_ACCEPT:
+        on_accept(st, ptr != NULL, cqe);
+        break;
+    case UOP_RECV:
+        on_recv(st, ptr, cqe);
+        break;
+    case UOP_SEND:
+        on_send(st, ptr, cqe);
+        break;
+    case UOP_WAKE:
+        if (!shutting_down(st) && arm_wake(st) == -1) log_error("failed to re-arm wake");
+        break;
+    case UOP_UDP_RECV:
+        on_udp_recv(st, ptr, cqe);
+        break;
+    case UOP_UDP_SEND:
+        on_udp_send(st, ptr, cqe);
+        break;
+    case UOP_CANCEL:
+        break;
+    }
+}
+
+int uring_worker_loop(struct server_state *st) {
+    struct uring u;
+    if (uring_open(&u) == -1) return -1;
+    st->ring = &u;
+    int rc = 0;
+    if (arm_wake(st) == -1 || arm_accept(st, 0) == -1) rc = -1;
+    if (rc == 0 && st->unix_listen_fd != -1 && arm_accept(st, 1) == -1) rc = -1;
+    for (int i = 0; rc == 0 && i < URING_UDP_SLOTS + URING_UNIX_SLOTS; i++) {
+        u.udp[i].fd = i < URING_UDP_SLOTS ? st->udp_fd : st->unix_dgram_fd;
+        if (u.udp[i].fd != -1 && arm_udp_recv(st, &u.udp[i]) == -1) rc = -1;
+    }
+    while (rc == 0 && !shutting_down(st)) {
+        flush_pending(st);
+        int timeout = worker_timer_timeout(st);
+        if (pubsub_pending(st)) timeout = 0;
+        if (uring_enter(&u, 1, timeout) == -1) {
+            perror("io_uring_enter");
+            rc = -1;
+            break;
+        }
+        st->now_ms = timer_now_ms();
+        unsigned head = *u.cq_head;
+        unsigned tail = __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE);
+        metric_add(&st->metrics->loop_wakeups, 1);
+        hist_record(&st->metrics->loop_batch, tail - head);
+        while (head != tail) {
+            struct io_uring_cqe cqe = u.cqes[head & *u.cq_mask];
+            head++;
+            __atomic_store_n(u.cq_head, head, __ATOMIC_RELEASE);
+            dispatch(st, &cqe);
+            if (head == tail) tail = __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE);
+        }
+        pubsub_run(st);
+        worker_timers_expire(st);
+        client_table_reclaim(&st->clients);
+        commands_flushed();
+        if (!st->accept_paused && client_limit_reached(st)) pause_accept(st);
+        else resume_accept(st);
+        if (!st->draining && drain_requested(st)) {
+            worker_drain_begin(st);
+            close_parked(st);
+            cancel_fd(st, st->tcp_listen_fd);
+            cancel_fd(st, st->udp_fd);
+            if (st->unix_listen_fd != -1) cancel_fd(st, st->unix_listen_fd);
+            if (st->unix_dgram_fd != -1) cancel_fd(st, st->unix_dgram_fd);
+        }
+        if (worker_drained(st)) break;
+    }
+    for (uint32_t i = 0; i < st->clients.slots; i++) {
+        struct client *c = client_table_get(&st->clients, i);
+        if (c->alive && !c->send_inflight && !outq_empty(&c->out)) outq_flush(&c->out, c->src.fd);
+    }
+    st->ring = NULL;
+    uring_close(&u);
+    return rc;
+}
+
+#else
+
+int uring_supported(void) {
+    return 0;
+}
+
+int uring_worker_loop(struct server_state *st) {
+    (void)st;
+    return -1;
+}
+
+void uring_client_closed(struct server_state *st, struct client *c) {
+    (void)st;
+    (void)c;
+}
+
+void uring_client_output(struct server_state *st, struct client *c) {
+    (void)st;
+    (void)c;
+}
+
+void uring_client_resume(struct server_state *st, struct client *c) {
+    (void)st;
+    (void)c;
+}
+
+void uring_client_settle(struct server_state *st, struct client *c) {
+    (void)st;
+    (void)c;
+}
+
+#endif